@@ -1,17 +1,35 @@
 local http = require("nibiru.http")
 local Route = require("nibiru.route")
+local Router = require("nibiru.router")
 local Config = require("nibiru.config")
+local markdown = require("nibiru.markdown")
 local TemplateLoader = require("nibiru.loader")
 local Template = require("nibiru.template")
 
 local not_found = http.not_found()
 local method_not_allowed = http.method_not_allowed()
 
+--- Iterate over a response's content as its only chunk.
+--- This stands in for ipairs({ response.content }) without the table.
+--- @param response Response
+--- @param index integer
+--- @return integer?
+--- @return string?
+local function content_chunks(response, index)
+    if index == 0 then
+        return 1, response.content
+    end
+end
+
 --- @class Application
 --- @field routes Route[]
 --- @field routes_by_name table<string, Route> Lookup table for routes by name
+--- @field router Router The routes compiled for dispatch
 --- @field config table Configuration loaded from config.lua
 --- @field app Application An alias for the application
+--- @field private request Request The request reused for every call
+--- @field private headers table The response headers reused for every call
+--- @field private template_watcher userdata|false? Watches templates when enabled, false once watching failed
 local Application = {}
 Application.__index = Application
 
@@ -24,6 +42,8 @@ local function _init(_, routes, config_path)
     local self = setmetatable({}, Application)
     self.routes = routes or {}
     self.routes_by_name = {}
+    self.request = http.Request()
+    self.headers = {}
 
     -- Process routes and build name lookup table
     for _, route in ipairs(self.routes) do
@@ -34,6 +54,7 @@ local function _init(_, routes, config_path)
             self.routes_by_name[route.name] = route
         end
     end
+    self.router = Router(self.routes)
 
     -- Determine config path if not provided
     if not config_path then
@@ -51,7 +72,36 @@ local function _init(_, routes, config_path)
     self.config = Config.load(config_path)
 
     -- Initialize template loader using configured directory
+    Template.set_cache_directory(self.config.templates.cache_directory)
+    if self.config.templates.fragment_cache_size then
+        Template.fragments:resize(self.config.templates.fragment_cache_size)
+    end
     TemplateLoader.from_directory(self.config.templates.directory)
+    if self.config.templates.watch then
+        -- Each worker makes its own watcher later, but an unsupported
+        -- platform or directory should stop the server now rather than fail
+        -- every request.
+        local ok, err = pcall(function()
+            TemplateLoader.watch():close()
+        end)
+        if not ok then
+            error("templates.watch is enabled but templates can't be watched: " .. tostring(err))
+        end
+    end
+
+    -- Parse the markdown documents into their cache before serving
+    local markdown_config = self.config.markdown
+    if markdown_config then
+        if markdown_config.cache_size then
+            markdown.cache:resize(markdown_config.cache_size)
+        end
+        if markdown_config.directory then
+            local _, err = markdown.warm(markdown_config.directory)
+            if err then
+                error("Failed to load markdown from '" .. markdown_config.directory .. "': " .. err)
+            end
+        end
+    end
 
     -- By keeping a reference to itself as `app`, a real project can simplify
     -- how it provides the nibiru server with the application instance.
@@ -65,16 +115,27 @@ end
 setmetatable(Application, { __call = _init })
 
 --- Handle requests from a server, according to the WSGI interface.
+---
+--- The request passed to responders and the headers passed to
+--- start_response are reset and reused by the next call, so anything kept
+--- past a request must be copied out of them. A streamed response keeps its
+--- request until the stream ends.
 --- @param self Application
 --- @param environ table The input request data
 --- @param start_response function The callable to invoke before returning data
 function Application.__call(self, environ, start_response)
-    local match, route = self:find_route(environ.REQUEST_METHOD, environ.PATH_INFO)
+    if self.config.templates.watch then
+        self:reload_templates()
+    end
+
+    local match, route, parameters =
+        self:find_route(environ.REQUEST_METHOD, environ.PATH_INFO)
 
     local response = not_found
+    local request
     if match == Route.MATCH and route then
-        local request = http.Request(environ.REQUEST_METHOD, environ.PATH_INFO)
-        response = route:run(request)
+        request = self.request:reset(environ.REQUEST_METHOD, environ.PATH_INFO)
+        response = route:run(request, parameters)
     elseif match == Route.NOT_ALLOWED then
         response = method_not_allowed
     end
@@ -82,26 +143,82 @@ function Application.__call(self, environ, start_response)
     -- TODO: handle an unknown status
     local status = http.statuses[response.status_code]
 
-    -- TODO: handle response headers
-    start_response(status, {})
-    return ipairs({ response.content })
+    local headers = self.headers
+    for name in pairs(headers) do
+        headers[name] = nil
+    end
+    for name, value in pairs(response.headers) do
+        headers[name] = value
+    end
+    if not headers["Content-Type"] then
+        headers["Content-Type"] = response.content_type
+    end
+    start_response(status, headers)
+    if response.stream then
+        -- The server may serve other requests while a stream waits for a
+        -- slow client, so the stream keeps its request to itself.
+        if request then
+            self.request = http.Request()
+        end
+        return response.stream
+    end
+    return content_chunks, response, 0
+end
+
+--- Recompile the templates that changed on disk since the last call.
+---
+--- The watcher is created on the first call rather than at startup so that
+--- each worker gets its own after the server forks. Files written before
+--- then aren't in its events, so that first call checks every file. If the
+--- watcher can't be created, the error is reported once and the worker
+--- stops watching.
+--- A template that fails to compile is reported and the previous version
+--- keeps rendering.
+--- @param self Application
+function Application.reload_templates(self)
+    local watcher = self.template_watcher
+    if watcher == false then
+        return
+    end
+    local first_check = false
+    if not watcher then
+        local ok, result = pcall(TemplateLoader.watch)
+        if not ok then
+            io.stderr:write("Template watching disabled: " .. tostring(result) .. "\n")
+            self.template_watcher = false
+            return
+        end
+        watcher = result
+        self.template_watcher = watcher
+        first_check = true
+    end
+
+    local changed, overflow = watcher:changes()
+    if overflow or first_check then
+        -- Some events were lost or happened before the watcher existed, so
+        -- check every file.
+        changed = nil
+    elseif not changed then
+        return
+    end
+    local ok, err = pcall(TemplateLoader.reload, changed)
+    if not ok then
+        io.stderr:write("Template reload failed: " .. tostring(err) .. "\n")
+    end
 end
 
 --- Find a matching route for the HTTP request.
+---
+--- Static path segments take priority over parameters. Otherwise, the route
+--- listed first wins.
 --- @param self Application
 --- @param method Method The request's HTTP method
 --- @param path any The request's path
 --- @return Match match Any matching route status from the set of routes
 --- @return Route? route A specific route if there is a match
+--- @return table? parameters The raw path parameters for a match
 function Application.find_route(self, method, path)
-    local match
-    for _, route in ipairs(self.routes) do
-        match = route:matches(method, path)
-        if match ~= Route.NO_MATCH then
-            return match, route
-        end
-    end
-    return Route.NO_MATCH, nil
+    return self.router:match(method, path)
 end
 
 --- Generate a URL by looking up a named route and delegating to its url_for method.
@@ -1,5 +1,12 @@
 -- nibiru/builtin_filters.lua
 
+local html = require("nibiru.html")
+
+-- The C versions of the string filters are used when the core library
+-- provides them.
+local has_core, core = pcall(require, "nibiru_core")
+local native = has_core and core.filters or {}
+
 -- String filters
 
 --- Convert a string to uppercase
@@ -189,14 +196,15 @@ end
 
 -- Return table mapping filter names to functions
 return {
-    uppercase = uppercase,
-    lowercase = lowercase,
-    capitalize = capitalize,
-    truncate = truncate,
+    uppercase = native.uppercase or uppercase,
+    lowercase = native.lowercase or lowercase,
+    capitalize = native.capitalize or capitalize,
+    truncate = native.truncate or truncate,
     length = length,
     first = first,
     last = last,
     reverse = reverse,
     default = default,
     format = format,
+    safe = html.safe,
 }
\ No newline at end of file
@@ -31,7 +31,7 @@ end
 -- @param config_path string: Path to the config file (for error messages)
 function Config.validate(config, config_path)
     -- Check for unknown top-level keys
-    local allowed_top_keys = { templates = true }
+    local allowed_top_keys = { templates = true, markdown = true }
     for key, _ in pairs(config) do
         if not allowed_top_keys[key] then
             error("Config file '" .. config_path .. "' contains unknown setting '" .. key .. "'")
@@ -44,7 +44,12 @@ function Config.validate(config, config_path)
     end
 
     -- Check for unknown keys in templates section
-    local allowed_template_keys = { directory = true }
+    local allowed_template_keys = {
+        directory = true,
+        cache_directory = true,
+        watch = true,
+        fragment_cache_size = true,
+    }
     for key, _ in pairs(config.templates) do
         if not allowed_template_keys[key] then
             error("Config file '" .. config_path .. "' contains unknown templates setting '" .. key .. "'")
@@ -55,6 +60,51 @@ function Config.validate(config, config_path)
     if not config.templates.directory or type(config.templates.directory) ~= "string" or config.templates.directory == "" then
         error("Config file '" .. config_path .. "' templates.directory must be a non-empty string")
     end
+
+    -- Validate the optional templates.cache_directory is a non-empty string
+    local cache_directory = config.templates.cache_directory
+    if cache_directory ~= nil and (type(cache_directory) ~= "string" or cache_directory == "") then
+        error("Config file '" .. config_path .. "' templates.cache_directory must be a non-empty string")
+    end
+
+    -- Validate the optional templates.watch is a boolean
+    local watch = config.templates.watch
+    if watch ~= nil and type(watch) ~= "boolean" then
+        error("Config file '" .. config_path .. "' templates.watch must be a boolean")
+    end
+
+    -- Validate the optional templates.fragment_cache_size is a positive integer
+    local fragment_cache_size = config.templates.fragment_cache_size
+    if fragment_cache_size ~= nil and (math.type(fragment_cache_size) ~= "integer" or fragment_cache_size <= 0) then
+        error("Config file '" .. config_path .. "' templates.fragment_cache_size must be a positive integer")
+    end
+
+    -- Validate the optional markdown section
+    if config.markdown == nil then
+        return
+    end
+    if type(config.markdown) ~= "table" then
+        error("Config file '" .. config_path .. "' markdown must be a table")
+    end
+
+    local allowed_markdown_keys = { directory = true, cache_size = true }
+    for key, _ in pairs(config.markdown) do
+        if not allowed_markdown_keys[key] then
+            error("Config file '" .. config_path .. "' contains unknown markdown setting '" .. key .. "'")
+        end
+    end
+
+    -- Validate the optional markdown.directory is a non-empty string
+    local directory = config.markdown.directory
+    if directory ~= nil and (type(directory) ~= "string" or directory == "") then
+        error("Config file '" .. config_path .. "' markdown.directory must be a non-empty string")
+    end
+
+    -- Validate the optional markdown.cache_size is a positive integer
+    local cache_size = config.markdown.cache_size
+    if cache_size ~= nil and (math.type(cache_size) ~= "integer" or cache_size <= 0) then
+        error("Config file '" .. config_path .. "' markdown.cache_size must be a positive integer")
+    end
 end
 
 --- Return the default configuration structure
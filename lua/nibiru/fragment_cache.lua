@@ -0,0 +1,132 @@
+--- @class FragmentEntry
+--- @field key string
+--- @field value any
+--- @field size integer Bytes charged to the cache for the entry
+--- @field expires number? When the entry expires, by the cache's clock
+--- @field newer FragmentEntry? The entry used next most recently
+--- @field older FragmentEntry? The entry used next least recently
+
+--- @class FragmentCache
+--- @field max_bytes integer Most bytes of keys and values to keep
+--- @field bytes integer Bytes of keys and values kept now
+--- @field clock fun(): number Current time in seconds
+--- @field private entries table<string, FragmentEntry>
+--- @field private newest FragmentEntry?
+--- @field private oldest FragmentEntry?
+local FragmentCache = {}
+FragmentCache.__index = FragmentCache
+
+--- A cache of rendered template output.
+---
+--- Entries expire after their time to live, and the least recently used
+--- entries are dropped once the keys and values held pass max_bytes.
+--- @param _ any
+--- @param max_bytes integer Most bytes of keys and values to keep
+--- @param clock (fun(): number)? Current time in seconds (default: os.time)
+--- @return FragmentCache
+local function _init(_, max_bytes, clock)
+    local self = setmetatable({}, FragmentCache)
+    self.max_bytes = max_bytes
+    self.clock = clock or os.time
+    self:clear()
+    return self
+end
+setmetatable(FragmentCache, { __call = _init })
+
+--- Unlink an entry from the recency list and the key table.
+--- @param entry FragmentEntry
+function FragmentCache:remove(entry)
+    if entry.newer then
+        entry.newer.older = entry.older
+    else
+        self.newest = entry.older
+    end
+    if entry.older then
+        entry.older.newer = entry.newer
+    else
+        self.oldest = entry.newer
+    end
+    entry.newer, entry.older = nil, nil
+    self.entries[entry.key] = nil
+    self.bytes = self.bytes - entry.size
+end
+
+--- Link an entry in as the most recently used.
+--- @param entry FragmentEntry
+function FragmentCache:push(entry)
+    entry.older = self.newest
+    if self.newest then
+        self.newest.newer = entry
+    else
+        self.oldest = entry
+    end
+    self.newest = entry
+    self.entries[entry.key] = entry
+    self.bytes = self.bytes + entry.size
+end
+
+--- Get a fragment that hasn't expired.
+--- @param key string
+--- @return any value
+function FragmentCache:get(key)
+    local entry = self.entries[key]
+    if not entry then
+        return nil
+    end
+    self:remove(entry)
+    if entry.expires and entry.expires <= self.clock() then
+        return nil
+    end
+    self:push(entry)
+    return entry.value
+end
+
+--- Store a fragment, dropping the least recently used ones to make room.
+---
+--- A fragment larger than the whole cache is not stored.
+--- @param key string
+--- @param value any
+--- @param ttl number? Seconds until the fragment expires, or nil to keep it
+--- until it is evicted
+--- @param size integer? Bytes to charge for a value that isn't a string
+function FragmentCache:set(key, value, ttl, size)
+    local existing = self.entries[key]
+    if existing then
+        self:remove(existing)
+    end
+    size = #key + (size or #value)
+    if size > self.max_bytes then
+        return
+    end
+    self:push({
+        key = key,
+        value = value,
+        size = size,
+        expires = ttl and self.clock() + ttl,
+    })
+    self:evict()
+end
+
+--- Drop the least recently used fragments until the cache fits in max_bytes.
+function FragmentCache:evict()
+    while self.bytes > self.max_bytes do
+        self:remove(self.oldest)
+    end
+end
+
+--- Change the most bytes to keep, dropping fragments if there are too many.
+--- @param max_bytes integer
+function FragmentCache:resize(max_bytes)
+    self.max_bytes = max_bytes
+    self:evict()
+end
+
+--- Drop every fragment.
+function FragmentCache:clear()
+    self.entries = {}
+    self.newest = nil
+    self.oldest = nil
+    self.bytes = 0
+end
+
+return FragmentCache
@@ -0,0 +1,60 @@
+-- nibiru/html.lua
+
+-- The C versions are used when the core library provides them.
+local has_core, core = pcall(require, "nibiru_core")
+local native = has_core and core.escape_html and core
+
+local html = {}
+
+--- Metatable for values marked as HTML by html.safe
+local SafeString = {
+    __tostring = function(self)
+        return self[1]
+    end,
+}
+
+-- Replacement for each character that has one
+local ESCAPES = {
+    ["&"] = "&amp;",
+    ["<"] = "&lt;",
+    [">"] = "&gt;",
+    ['"'] = "&quot;",
+    ["'"] = "&#39;",
+}
+
+--- Get the text of a value for HTML output.
+---
+--- nil and false are empty, values marked by html.safe are returned as they
+--- are, and everything else is converted with tostring and escaped.
+---@param value any
+---@return string
+local function escape(value)
+    if value == nil or value == false then
+        return ""
+    end
+    if getmetatable(value) == SafeString then
+        return value[1]
+    end
+    local text = tostring(value)
+    if not text:find("[&<>\"']") then
+        return text
+    end
+    return (text:gsub("[&<>\"']", ESCAPES))
+end
+
+--- Mark a value as HTML so that template output leaves it unescaped.
+---
+--- The value is converted with tostring, with nil and false as empty.
+---@param value any
+---@return table Safe string whose tostring is the HTML
+local function safe(value)
+    if getmetatable(value) == SafeString then
+        return value
+    end
+    return setmetatable({ value and tostring(value) or "" }, SafeString)
+end
+
+html.escape = native and native.escape_html or escape
+html.safe = native and native.safe or safe
+
+return html
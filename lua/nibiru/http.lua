@@ -24,6 +24,21 @@ end
 setmetatable(Request, { __call = _init })
 http.Request = Request
 
+--- Reset the request in place so it can be reused for another request.
+---
+--- Any fields added to the request since it was created are removed.
+--- @param method? Method
+--- @param path? string HTTP request path
+--- @return Request
+function Request:reset(method, path)
+    for key in pairs(self) do
+        self[key] = nil
+    end
+    self.method = method or "GET"
+    self.path = path or ""
+    return self
+end
+
 --- Create a GET request.
 --- @param path? string HTTP request path
 --- @return Request
@@ -34,6 +49,8 @@ end
 --- @class Response
 --- @field status_code integer The status code
 --- @field content string HTTP response body data
+--- @field stream function? An iterator over the body's chunks that is
+--- used instead of content, returning an index and a chunk like ipairs
 --- @field content_type string MIME type of response data
 --- @field headers table Storage for the response headers
 local Response = {}
@@ -1,8 +1,14 @@
+local core = require("nibiru_core")
 local path = require("nibiru.path")
 local Template = require("nibiru.template")
 
 local TemplateLoader = {}
 
+--- The directory loaded last, with its templates and dependency graph, kept so
+--- changed files can be reloaded
+---@type table|nil
+local loaded = nil
+
 --- Parse a template string to extract the extends statement.
 ---@param template_content string The raw template content
 ---@return string|nil The parent template name if extends is found, nil otherwise
@@ -116,6 +122,151 @@ function TemplateLoader.from_directory(directory_path)
     for _, template_name in ipairs(sorted_templates) do
         Template.register(template_name, templates[template_name])
     end
+
+    loaded = {
+        directory = directory_path,
+        templates = templates,
+        dependencies = dependencies,
+        dependents = dependents,
+    }
+end
+
+--- Reload changed template files and recompile the templates that extend them.
+---
+--- Only the changed templates and their dependents in the graph built by
+--- from_directory are recompiled, parents first, and they replace the
+--- registered templates together. Files that can't be read, like an editor's
+--- temporary files that are already gone, are skipped.
+---@param changed string[]? Paths relative to the loaded directory, or nil to check every file
+---@return string[] names The recompiled templates
+function TemplateLoader.reload(changed)
+    if not loaded then
+        error("No template directory has been loaded")
+    end
+    local directory_path = loaded.directory
+    if not changed then
+        changed = path.files_from(directory_path) or {}
+    end
+
+    -- Read the new content, skipping files that didn't really change
+    local contents = {}
+    local parents = {} -- template -> its new parent, or false for none
+    for _, relative_path in ipairs(changed) do
+        local file = io.open(directory_path .. "/" .. relative_path, "r")
+        if file then
+            local content = file:read("*a")
+            file:close()
+            if content and content ~= loaded.templates[relative_path] then
+                contents[relative_path] = content
+                parents[relative_path] = parse_extends(content) or false
+            end
+        end
+    end
+    if next(contents) == nil then
+        return {}
+    end
+
+    --- Get a template's parent with the changes applied.
+    ---@param template_name string
+    ---@return string|false
+    local function parent_of(template_name)
+        local parent = parents[template_name]
+        if parent == nil then
+            local current = loaded.dependencies[template_name]
+            parent = current and current[1] or false
+        end
+        return parent
+    end
+
+    -- Move changed templates to their new parents in a copy of the graph
+    local dependents = {}
+    for parent, children in pairs(loaded.dependents) do
+        dependents[parent] = {}
+        for _, child in ipairs(children) do
+            if parents[child] == nil or parents[child] == parent then
+                table.insert(dependents[parent], child)
+            end
+        end
+    end
+    for template_name, parent in pairs(parents) do
+        if parent then
+            local seen = { [template_name] = true }
+            local ancestor = parent
+            while ancestor do
+                if seen[ancestor] then
+                    error("Circular dependency detected in templates: " .. template_name)
+                end
+                seen[ancestor] = true
+                ancestor = parent_of(ancestor)
+            end
+
+            dependents[parent] = dependents[parent] or {}
+            local siblings = dependents[parent]
+            local listed = false
+            for _, sibling in ipairs(siblings) do
+                listed = listed or sibling == template_name
+            end
+            if not listed then
+                table.insert(siblings, template_name)
+            end
+        end
+    end
+
+    -- Collect the changed templates and everything below them
+    local depths = {}
+    local names = {}
+    local queue = {}
+    for template_name in pairs(contents) do
+        table.insert(queue, template_name)
+    end
+    while #queue > 0 do
+        local current = table.remove(queue)
+        if not depths[current] then
+            local depth = 0
+            local ancestor = parent_of(current)
+            while ancestor do
+                depth = depth + 1
+                ancestor = parent_of(ancestor)
+            end
+            depths[current] = depth
+            table.insert(names, current)
+            for _, dependent in ipairs(dependents[current] or {}) do
+                table.insert(queue, dependent)
+            end
+        end
+    end
+    table.sort(names, function(a, b)
+        if depths[a] ~= depths[b] then
+            return depths[a] < depths[b]
+        end
+        return a < b
+    end)
+
+    Template.replace(names, contents)
+
+    for template_name, content in pairs(contents) do
+        loaded.templates[template_name] = content
+        local parent = parents[template_name]
+        loaded.dependencies[template_name] = parent and { parent } or {}
+    end
+    loaded.dependents = dependents
+    return names
+end
+
+--- Watch the loaded directory for template files that are written.
+---
+--- Pass the watcher's changes to reload. Every process needs its own watcher,
+--- so workers create one after they fork.
+---@return userdata watcher A watcher whose changes method lists written files, or returns nil when there are none
+function TemplateLoader.watch()
+    if not loaded then
+        error("No template directory has been loaded")
+    end
+    local watcher, err = core.watch(loaded.directory)
+    if not watcher then
+        error("Failed to watch directory '" .. loaded.directory .. "': " .. err)
+    end
+    return watcher
 end
 
 return TemplateLoader
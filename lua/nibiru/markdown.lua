@@ -12,8 +12,13 @@
 --- - Footnotes ([^label] and [^label]: content)
 --- - YAML frontmatter parsing
 
+local FragmentCache = require("nibiru.fragment_cache")
+local html = require("nibiru.html")
 local yaml = require("nibiru.yaml")
 
+-- Cache keys and file times come from the core library when it's loaded.
+local has_core, core = pcall(require, "nibiru_core")
+
 --- @class markdown
 --- Markdown parser module with YAML frontmatter support
 local markdown = {}
@@ -105,6 +110,110 @@ function markdown.parse(input)
     }
 end
 
+--- Parsed documents kept by parse_cached and parse_file. Each entry is
+--- charged the size of its source and HTML, and the least recently used
+--- documents are dropped once the cache passes its size in bytes.
+markdown.cache = FragmentCache(16 * 1024 * 1024)
+
+--- Parse markdown content, reusing the result for content parsed before.
+---
+--- Documents are cached by a hash of their content. The result is shared
+--- with every caller that parses the same content, so it must not be
+--- modified.
+--- @param input string The markdown string to parse (may include YAML frontmatter)
+--- @return table|nil result Table with frontmatter, markdown, and html fields, or nil on error
+--- @return string|nil error Error message if parsing failed
+function markdown.parse_cached(input)
+    if type(input) ~= "string" then
+        return nil, "expected string"
+    end
+    local key = "=" .. (has_core and core.hash(input) or input)
+    local result = markdown.cache:get(key)
+    if result then
+        return result
+    end
+    local err
+    result, err = markdown.parse(input)
+    if not result then
+        return nil, err
+    end
+    markdown.cache:set(key, result, nil, #input + #result.html)
+    return result
+end
+
+--- Parse a markdown file, reusing the result until the file changes.
+---
+--- Documents are cached by path and checked against the file's modification
+--- time and size on every call. The result is shared with other callers, so
+--- it must not be modified.
+--- @param file_path string Path to the markdown file
+--- @return table|nil result Table with frontmatter, markdown, and html fields, or nil on error
+--- @return string|nil error Error message if the file can't be read or parsed
+function markdown.parse_file(file_path)
+    local mtime, size
+    if has_core then
+        mtime, size = core.modified(file_path)
+        if not mtime then
+            return nil, size
+        end
+        local document = markdown.cache:get("@" .. file_path)
+        if document and document.mtime == mtime and document.size == size then
+            return document.result
+        end
+    end
+
+    local file, open_err = io.open(file_path, "rb")
+    if not file then
+        return nil, open_err
+    end
+    local content = file:read("a")
+    file:close()
+    if not has_core then
+        return markdown.parse_cached(content)
+    end
+
+    local result, err = markdown.parse(content)
+    if not result then
+        return nil, err
+    end
+    -- A file written after it was checked is stored with the older time, so
+    -- the next call parses it again.
+    markdown.cache:set(
+        "@" .. file_path,
+        { mtime = mtime, size = size, result = result },
+        nil,
+        #content + #result.html
+    )
+    return result
+end
+
+--- Parse every markdown file in a directory into the cache.
+---
+--- Files ending in .md or .markdown are parsed with parse_file under
+--- directory .. "/" .. their relative path, so later calls must use the same
+--- paths to reuse them.
+--- @param directory string The directory to scan
+--- @return integer|nil count Number of documents parsed, or nil on error
+--- @return string|nil error Error message naming the file that failed
+function markdown.warm(directory)
+    local files, err = require("nibiru.path").files_from(directory)
+    if not files then
+        return nil, err
+    end
+    local count = 0
+    for _, relative_path in ipairs(files) do
+        if relative_path:match("%.md$") or relative_path:match("%.markdown$") then
+            local file_path = directory .. "/" .. relative_path
+            local result, parse_err = markdown.parse_file(file_path)
+            if not result then
+                return nil, file_path .. ": " .. parse_err
+            end
+            count = count + 1
+        end
+    end
+    return count
+end
+
 --- Parse markdown text into HTML using recursive descent parsing
 --- @param text string The markdown text to parse
 --- @return string html The rendered HTML string
@@ -838,12 +947,7 @@ end
 --- @param text string The text to escape
 --- @return string The text with HTML entities escaped
 function escape_html(text)
-    if not text then return "" end
-    return text:gsub("&", "&amp;")
-               :gsub("<", "&lt;")
-               :gsub(">", "&gt;")
-               :gsub('"', "&quot;")
-               :gsub("'", "&#39;")
+    return html.escape(text)
 end
 
 return markdown
\ No newline at end of file
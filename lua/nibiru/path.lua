@@ -10,4 +10,11 @@ local core = require("nibiru_core")
 --- @return string|nil error Error message if path is invalid
 M.files_from = core.files_from
 
+--- Get when a file was last modified and its size.
+---
+--- @param path string The file path
+--- @return number|nil mtime Modification time in seconds, with a fraction, or nil if the file can't be read
+--- @return integer|string size Size in bytes, or an error message
+M.modified = core.modified
+
 return M
\ No newline at end of file
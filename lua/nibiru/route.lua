@@ -18,21 +18,15 @@ local CONVERTER_PATTERNS = {
 }
 local CONVERTER_TRANSFORMS = { integer = math.tointeger }
 
---- Make a pattern that corresponds to path.
----
---- If the path includes parameters, then converters are returned in the table
---- which will be used later to construct arguments to the responder that is
---- associated with the Route.
---- @param path string The desired routing path
---- @return string pattern The string pattern used for matching
+--- Make the body of a pattern for a path or one of its segments.
+--- @param path string The path or segment text
+--- @return string pattern The pattern body without anchors
 --- @return table converters Converters for each parameter in the pattern
-local function make_path_matcher(path)
-    assert(path:sub(1, 1) == "/", "A route path must start with a slash `/`.")
-
+local function make_pattern(path)
     -- Capture which converters are used. There will be one converter for each parameter.
     local converters = {}
 
-    local pattern = "^"
+    local pattern = ""
     local index, path_length = 1, string.len(path)
     local parameter_start, parameter_end
     while index <= path_length do
@@ -58,13 +52,66 @@ local function make_path_matcher(path)
             break
         end
     end
-    return pattern .. "$", converters
+    return pattern, converters
+end
+
+--- Make a pattern that corresponds to path.
+---
+--- If the path includes parameters, then converters are returned in the table
+--- which will be used later to construct arguments to the responder that is
+--- associated with the Route.
+--- @param path string The desired routing path
+--- @return string pattern The string pattern used for matching
+--- @return table converters Converters for each parameter in the pattern
+local function make_path_matcher(path)
+    assert(path:sub(1, 1) == "/", "A route path must start with a slash `/`.")
+    local pattern, converters = make_pattern(path)
+    return "^" .. pattern .. "$", converters
+end
+
+--- @class Segment
+--- @field kind "static" | "parameter" | "pattern"
+--- @field text string The text of the segment from the path
+--- @field converter string? The converter of a segment that is one parameter
+--- @field pattern string? The anchored pattern of a mixed segment
+--- @field converters string[]? The converters of a mixed segment's parameters
+
+--- Split a path into the segments that the router matches one at a time.
+---
+--- A segment is static text, exactly one parameter, or a mix of the two
+--- that falls back to a pattern match.
+--- @param path string The routing path
+--- @return Segment[]
+local function make_segments(path)
+    local segments = {}
+    for text in string.gmatch(string.sub(path, 2) .. "/", "([^/]*)/") do
+        local segment
+        if not string.find(text, PARAMETER_PATTERN) then
+            segment = { kind = "static", text = text }
+        else
+            local _, converter = string.match(text, "^" .. PARAMETER_PATTERN .. "$")
+            if converter then
+                segment = { kind = "parameter", converter = string.sub(converter, 2) }
+            else
+                local pattern, converters = make_pattern(text)
+                segment = {
+                    kind = "pattern",
+                    text = text,
+                    pattern = "^" .. pattern .. "$",
+                    converters = converters,
+                }
+            end
+        end
+        table.insert(segments, segment)
+    end
+    return segments
 end
 
 --- @class Route
 --- @field path string The path to reach the route
 --- @field path_pattern string The string pattern corresponding to the path
 --- @field converters table Converters for parameters in the path
+--- @field segments Segment[] The path split up for the router
 --- @field responder function The responder that will handle the route
 --- @field name string? Optional unique name for the route
 --- @field methods Method[] The allowed HTTP methods
@@ -86,6 +133,7 @@ local function _init(_, path, responder, name, methods)
     local self = setmetatable({}, Route)
     self.path = path
     self.path_pattern, self.converters = make_path_matcher(path)
+    self.segments = make_segments(path)
     self.responder = responder
     self.name = name
 
@@ -123,12 +171,17 @@ end
 ---Run a route by preparing parameters and invoking the responder.
 ---@param self Route
 ---@param request Request
+---@param parameters table? Parameters already captured and converted by the router
 ---@return Response
-function Route.run(self, request)
+function Route.run(self, request, parameters)
+    if parameters then
+        return self.responder(request, table.unpack(parameters, 1, #self.converters))
+    end
+
     local raw_parameters = table.pack(string.match(request.path, self.path_pattern))
 
     local transformer
-    local parameters = {}
+    parameters = {}
     for i, converter_type in ipairs(self.converters) do
         transformer = CONVERTER_TRANSFORMS[converter_type]
         if transformer then
@@ -0,0 +1,248 @@
+local Route = require("nibiru.route")
+
+-- The C matcher is used when the core library provides one.
+local has_core, core = pcall(require, "nibiru_core")
+local router_new = has_core and core.router_new
+
+local NO_MATCH = Route.NO_MATCH
+local MATCH = Route.MATCH
+local NOT_ALLOWED = Route.NOT_ALLOWED
+
+--- @class RouteNode
+--- @field static table<string, RouteNode> Children keyed by segment text
+--- @field parameters table<string, RouteNode> Children keyed by converter
+--- @field patterns table[] Children for mixed segments as
+--- {pattern, text, converters, node}
+--- @field routes table<Method, Route>? The route for each allowed method
+--- @field first_route Route? The first route that ends at this node
+
+--- @return RouteNode
+local function make_node()
+    return { static = {}, parameters = {}, patterns = {} }
+end
+
+-- Parameter children are tried in this order after a static child.
+local CONVERTER_ORDER = { "integer", "string" }
+
+-- Every string converter segment must be non-empty and integers are digits.
+local CONVERTER_CHECKS = {
+    integer = "^%d+$",
+    string = "^.",
+}
+
+--- @class Router
+--- @field root RouteNode
+--- @field routes Route[] Every route added, in order
+--- @field private automaton userdata? The tree compiled by nibiru_core
+local Router = {}
+Router.__index = Router
+
+--- A router that dispatches requests through a tree of path segments.
+---
+--- Routes are compiled into the tree once so that matching a path walks it
+--- one segment at a time instead of trying every route's pattern in turn.
+--- Unless native is false, the finished tree is flattened into a C automaton
+--- that does the walk.
+--- @param _ any
+--- @param routes Route[]? Routes to add to the router
+--- @param native boolean? Whether to match in C when it is available
+--- @return Router
+local function _init(_, routes, native)
+    local self = setmetatable({}, Router)
+    self.root = make_node()
+    self.routes = {}
+    for _, route in ipairs(routes or {}) do
+        self:add(route)
+    end
+    if router_new and native ~= false then
+        self.automaton = router_new(self.root, self.routes)
+    end
+    return self
+end
+setmetatable(Router, { __call = _init })
+
+--- Add a route to the tree.
+---
+--- When routes overlap, the route added first keeps each method.
+--- Routes must be added before the router is created for C to match them.
+--- @param route Route
+function Router:add(route)
+    table.insert(self.routes, route)
+    local node = self.root
+    for _, segment in ipairs(route.segments) do
+        local child
+        if segment.kind == "static" then
+            child = node.static[segment.text]
+            if not child then
+                child = make_node()
+                node.static[segment.text] = child
+            end
+        elseif segment.kind == "parameter" then
+            child = node.parameters[segment.converter]
+            if not child then
+                child = make_node()
+                node.parameters[segment.converter] = child
+            end
+        else
+            for _, edge in ipairs(node.patterns) do
+                if edge.pattern == segment.pattern then
+                    child = edge.node
+                    break
+                end
+            end
+            if not child then
+                child = make_node()
+                table.insert(node.patterns, {
+                    pattern = segment.pattern,
+                    text = segment.text,
+                    converters = segment.converters,
+                    node = child,
+                })
+            end
+        end
+        node = child
+    end
+
+    node.routes = node.routes or {}
+    node.first_route = node.first_route or route
+    for method in pairs(route.methods) do
+        if not node.routes[method] then
+            node.routes[method] = route
+        end
+    end
+end
+
+-- Matching is not reentrant, so the captured parameters and the first route
+-- that refused the method are kept here rather than allocated per request.
+local captures = {}
+local refused
+
+--- Convert a captured parameter like Route.run does.
+--- @param converter string
+--- @param value string
+--- @return any
+local function convert(converter, value)
+    if converter == "integer" then
+        return math.tointeger(value)
+    end
+    return value
+end
+
+--- Store a segment's pattern captures after the ones already taken.
+--- @param converters string[] The converters of the segment's parameters
+--- @param count integer The number of parameters captured so far
+--- @return integer? count The new count, or nil if the pattern didn't match
+local function store(converters, count, first, ...)
+    if first == nil then
+        return nil
+    end
+    captures[count + 1] = convert(converters[1], first)
+    for i = 1, select("#", ...) do
+        captures[count + 1 + i] = convert(converters[i + 1], (select(i, ...)))
+    end
+    return count + 1 + select("#", ...)
+end
+
+--- Walk the tree for the rest of a path.
+---
+--- Static children are tried first, then parameters, then mixed segments,
+--- backtracking when a branch doesn't lead to a route for the method.
+--- @param node RouteNode
+--- @param method Method
+--- @param path string
+--- @param position integer? Where the next segment starts, nil at the end
+--- @param count integer The number of parameters captured so far
+--- @return Route? route
+--- @return integer? count
+local function search(node, method, path, position, count)
+    if not position then
+        local routes = node.routes
+        if not routes then
+            return nil
+        end
+        local route = routes[method]
+        if route then
+            return route, count
+        end
+        refused = refused or node.first_route
+        return nil
+    end
+
+    local segment, next_position
+    local slash = string.find(path, "/", position, true)
+    if slash then
+        segment = string.sub(path, position, slash - 1)
+        next_position = slash + 1
+    else
+        segment = string.sub(path, position)
+    end
+
+    local route, total
+    local child = node.static[segment]
+    if child then
+        route, total = search(child, method, path, next_position, count)
+        if route then
+            return route, total
+        end
+    end
+
+    for _, converter in ipairs(CONVERTER_ORDER) do
+        child = node.parameters[converter]
+        if child and string.find(segment, CONVERTER_CHECKS[converter]) then
+            captures[count + 1] = convert(converter, segment)
+            route, total = search(child, method, path, next_position, count + 1)
+            if route then
+                return route, total
+            end
+        end
+    end
+
+    for _, edge in ipairs(node.patterns) do
+        total = store(edge.converters, count, string.match(segment, edge.pattern))
+        if total then
+            route, total = search(edge.node, method, path, next_position, total)
+            if route then
+                return route, total
+            end
+        end
+    end
+
+    return nil
+end
+
+--- Find the route for a method and path.
+---
+--- The returned parameters are reused by the next call, so they must be
+--- consumed before matching another request.
+--- @param method Method The request's HTTP method
+--- @param path string The request's path
+--- @return Match match
+--- @return Route? route The matching route, or the first route that
+--- matched the path when the method is not allowed
+--- @return table? parameters The converted parameters captured from the path
+function Router:match(method, path)
+    if self.automaton then
+        local match, index = self.automaton:match(method, path, captures)
+        if match == NO_MATCH then
+            return NO_MATCH, nil
+        end
+        return match, self.routes[index], match == MATCH and captures or nil
+    end
+
+    if string.byte(path, 1) ~= 47 then -- "/"
+        return NO_MATCH, nil
+    end
+
+    refused = nil
+    local route = search(self.root, method, path, 2, 0)
+    if route then
+        return MATCH, route, captures
+    elseif refused then
+        local first_route = refused
+        refused = nil
+        return NOT_ALLOWED, first_route
+    end
+    return NO_MATCH, nil
+end
+
+return Router
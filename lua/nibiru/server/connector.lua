@@ -23,46 +23,216 @@ function connector.start_response(status, response_headers)
     connector.response_headers = response_headers
 end
 
+-- Responses up to this many bytes are buffered and framed with
+-- Content-Length. Larger ones switch to chunked transfer encoding and stream
+-- out as the application produces them.
+local STREAM_THRESHOLD = 16384
+
+-- Most body pieces handed to C in one call before they are joined in Lua.
+-- This stays under the server's writev limit with room for framing.
+local MAX_PIECES = 60
+
+-- Request bodies and lists of body pieces are reused across requests
+-- instead of allocating new ones for each. A response paused for a slow
+-- client holds on to its own while the worker serves other requests, so
+-- they are taken from and returned to these spares.
+local spare_inputs = {}
+local spare_pending = {}
+local NO_HEADERS = {}
+
+--- Empty a list in place, keeping its allocated array part.
+--- @param list table
+local function clear(list)
+    for i = #list, 1, -1 do
+        list[i] = nil
+    end
+end
+
+-- Header fields the server sets itself to frame the response
+local FRAMING_HEADERS = {
+    ["content-length"] = true,
+    ["transfer-encoding"] = true,
+    ["connection"] = true,
+}
+
+--- Serialize a response head in Lua.
+---
+--- This mirrors what the C server does for callers without it, minus the
+--- Date header so the output is deterministic.
+--- @param status string
+--- @param headers table Header names mapped to a value or a list of values
+--- @param content_length integer? The body length, or nil for chunked
+--- @param keep_alive boolean? Whether the server keeps the connection open
+--- @return string
+local function serialize_head(status, headers, content_length, keep_alive)
+    local names = {}
+    for name in pairs(headers) do
+        if not FRAMING_HEADERS[string.lower(name)] then
+            table.insert(names, name)
+        end
+    end
+    table.sort(names)
+
+    local head = { "HTTP/1.1 ", status, "\r\n" }
+    for _, name in ipairs(names) do
+        local values = headers[name]
+        if type(values) ~= "table" then
+            values = { values }
+        end
+        for _, value in ipairs(values) do
+            table.insert(head, name .. ": " .. value .. "\r\n")
+        end
+    end
+    if content_length then
+        table.insert(head, "Content-Length: " .. content_length .. "\r\n")
+    else
+        table.insert(head, "Transfer-Encoding: chunked\r\n")
+    end
+    if keep_alive == false then
+        table.insert(head, "Connection: close\r\n")
+    end
+    table.insert(head, "\r\n")
+    return table.concat(head)
+end
+
 --- Handle data received on the network connection.
 ---
+--- The server builds the environ in C and calls handle_environ instead.
+--- This entry point parses the headers in Lua for callers without C.
 --- @param application function The WSGI application callable
 --- @param method string The HTTP method
 --- @param target string The request target/path
 --- @param version string The HTTP version
 --- @param remaining_data string The remaining HTTP data after the request line
+--- @param keep_alive boolean? Whether the server keeps the connection open
 --- @return string response The outbound data to send on the connection
-function connector.handle_connection(application, method, target, version, remaining_data)
-    local environ, err = parser.parse(method, target, version, remaining_data)
+function connector.handle_connection(application, method, target, version, remaining_data, keep_alive)
+    local environ = parser.parse(method, target, version, remaining_data)
+    return connector.handle_environ(application, environ, nil, keep_alive)
+end
 
-    -- Note: Error handling for invalid request lines is now done in C
+--- Handle a request whose environ is already built.
+---
+--- The response goes out through two callables from the server.
+--- respond(status, headers, content_length, ...) serializes the head and
+--- sends it along with any body pieces; a nil content_length means chunked.
+--- write(...) sends more pieces. Both send their pieces together and
+--- return false once the connection fails. They wait for the client to read
+--- while too much output is queued, and fail if it stops reading. The
+--- server may run other requests while a response waits.
+--- Without them, the whole response is returned as a string instead.
+--- @param application function The WSGI application callable
+--- @param environ table The WSGI environ
+--- @param body string? The request body, when environ lacks wsgi.input
+--- @param keep_alive boolean? Whether the server keeps the connection open
+--- @param respond function? The server's respond callable
+--- @param write function? The server's write callable
+--- @return string? response The outbound data when there is no respond
+function connector.handle_environ(
+    application,
+    environ,
+    body,
+    keep_alive,
+    respond,
+    write
+)
+    local input
+    if body then
+        input = table.remove(spare_inputs) or parser.Input("")
+        environ["wsgi.input"] = input:reset(body)
+    end
 
-    -- TODO: The application callable returns an iterable. The spec says that
-    -- this data should not be buffered and should be sent immediately, but I'm
-    -- going to buffer it into a single value to start because it will keep the
-    -- exchange with the Lua code and C code easier to begin.
-    -- When I do get to this level, it appears that the way to handle the
-    -- Content-Length for iterables is to use `Transfer-Encoding: chunked`
-    -- which doesn't require a known content length.
+    local output
+    if not respond then
+        output = {}
+        write = function(...)
+            for i = 1, select("#", ...) do
+                table.insert(output, (select(i, ...)))
+            end
+            return true
+        end
+        respond = function(status, headers, content_length, ...)
+            local head = serialize_head(status, headers, content_length, keep_alive)
+            return write(head, ...)
+        end
+    end
 
+    connector.response_headers = NO_HEADERS
     -- This code is assuming that application is returning the elements
     -- that would come from a call to ipairs.
     local response_iterator, state, initial =
         application(environ, connector.start_response)
 
-    local response = { "HTTP/1.1 ", connector.status, "\r\n" }
+    -- HEAD responses are framed like GET but carry no body.
+    local send_body = environ.REQUEST_METHOD ~= "HEAD"
+    -- Chunks are passed to C as separate pieces so the body isn't copied
+    -- into one string first.
+    local pending = table.remove(spare_pending) or {}
+    local pending_size = 0
+    local streaming = false
+    for _, chunk in response_iterator, state, initial do
+        if #chunk > 0 then
+            if #pending == MAX_PIECES then
+                local joined = table.concat(pending)
+                clear(pending)
+                pending[1] = joined
+            end
+            table.insert(pending, chunk)
+            pending_size = pending_size + #chunk
+        end
 
-    -- TODO: handle response_headers serialization
-    table.insert(response, "\r\n")
+        if pending_size >= STREAM_THRESHOLD then
+            if send_body then
+                table.insert(pending, 1, string.format("%x\r\n", pending_size))
+                table.insert(pending, "\r\n")
+            else
+                clear(pending)
+            end
+            local ok = true
+            if not streaming then
+                streaming = true
+                ok = respond(
+                    connector.status,
+                    connector.response_headers,
+                    nil,
+                    table.unpack(pending)
+                )
+            elseif send_body then
+                ok = write(table.unpack(pending))
+            end
+            clear(pending)
+            pending_size = 0
+            if not ok then
+                break
+            end
+        end
+    end
 
-    -- TODO: if the application doesn't provide Content-Length, then special
-    -- code will be needed to tack on that header before appending the content
-    -- from the response iterator. This will be impossible to calculate
-    -- without buffering the response.
+    if not streaming then
+        -- Everything fit under the threshold so Content-Length frames it.
+        if not send_body then
+            clear(pending)
+        end
+        local headers = connector.response_headers
+        respond(connector.status, headers, pending_size, table.unpack(pending))
+    elseif send_body then
+        if pending_size > 0 then
+            table.insert(pending, 1, string.format("%x\r\n", pending_size))
+            table.insert(pending, "\r\n")
+        end
+        table.insert(pending, "0\r\n\r\n")
+        write(table.unpack(pending))
+    end
 
-    for _, chunk in response_iterator, state, initial do
-        table.insert(response, chunk)
+    -- Drop the body pieces so they can be collected between requests.
+    clear(pending)
+    table.insert(spare_pending, pending)
+    if input then
+        table.insert(spare_inputs, input:reset(""))
+    end
+    if output then
+        return table.concat(output)
     end
-    return table.concat(response)
 end
 
 return connector
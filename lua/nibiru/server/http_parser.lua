@@ -62,7 +62,73 @@ local SUPPORTED_METHODS = {
     ["PATCH"] = true,
 }
 
+--- @class Input
+--- @field private data string
+--- @field private position integer
+local Input = {}
+Input.__index = Input
+
+--- A wsgi.input stream over a buffered request body.
+--- @param data string The request body
+--- @return Input
+function parser.Input(data)
+    return setmetatable({ data = data, position = 1 }, Input)
+end
+
+--- Point the stream at a new body so one Input can serve many requests.
+--- @param data string The request body
+--- @return Input
+function Input:reset(data)
+    self.data = data
+    self.position = 1
+    return self
+end
+
+--- Read from the body.
+--- @param size integer? The most bytes to read, or everything left if nil
+--- @return string
+function Input:read(size)
+    local first = self.position
+    local last = #self.data
+    if size and size >= 0 then
+        last = math.min(last, first + size - 1)
+    end
+    self.position = last + 1
+    return string.sub(self.data, first, last)
+end
+
+--- Read a line from the body, including its newline.
+--- @return string
+function Input:readline()
+    local newline = string.find(self.data, "\n", self.position, true)
+    return self:read(newline and newline - self.position + 1 or nil)
+end
+
+-- Environ keys for the fields that don't get an HTTP_ prefix
+local CGI_HEADERS = {
+    CONTENT_TYPE = true,
+    CONTENT_LENGTH = true,
+}
+
+--- Get the environ key for a header field name.
+--- @param name string
+--- @return string?
+local function environ_key(name)
+    -- Underscores would let a client spoof a dashed header's key.
+    if string.find(name, "_", 1, true) then
+        return nil
+    end
+    local key = string.gsub(string.upper(name), "-", "_")
+    if CGI_HEADERS[key] then
+        return key
+    end
+    return "HTTP_" .. key
+end
+
 --- Parse the HTTP data into a WSGI environ table.
+---
+--- The server builds the environ in C, so this is the reference for what
+--- it must produce.
 --- @param method string The HTTP method (pre-parsed)
 --- @param target string The request target/path (pre-parsed)
 --- @param version string The HTTP version (pre-parsed)
@@ -71,29 +137,51 @@ local SUPPORTED_METHODS = {
 --- @return nil No errors are returned since validation is done in C
 function parser.parse(method, target, version, data)
     -- Note: Method and version validation is now done in C
+    local path, query = target, ""
+    local question = string.find(target, "?", 1, true)
+    if question then
+        path = string.sub(target, 1, question - 1)
+        query = string.sub(target, question + 1)
+    end
+
     local environ = {
         REQUEST_METHOD = method,
         -- This is ignored for now. The nibiru server assumes that it is mounted
         -- at the root of a server rather than some sub-path like /app.
         SCRIPT_NAME = "",
-        -- TODO: This version does not parse out the query string.
-        PATH_INFO = target,
-        -- QUERY_STRING
-        -- CONTENT_TYPE
-        -- CONTENT_LENGTH
+        PATH_INFO = path,
+        QUERY_STRING = query,
         SERVER_NAME = "localhost",
         SERVER_PORT = "8080",
         SERVER_PROTOCOL = version,
-        -- `HTTP_` Variables
         ["wsgi.version"] = { 1, 0 },
         ["wsgi.url_scheme"] = "http",
-        -- wsgi.input
         -- wsgi.errors
         ["wsgi.multithread"] = false,
         ["wsgi.multiprocess"] = true,
         ["wsgi.run_once"] = false,
         -- nibiru.example_variable
     }
+
+    -- `HTTP_` Variables, with repeated fields joined by commas
+    local position = 1
+    while true do
+        local line_end = string.find(data, "\r\n", position, true)
+        if not line_end or line_end == position then
+            position = line_end and line_end + 2 or #data + 1
+            break
+        end
+        local name, value = string.match(
+            string.sub(data, position, line_end - 1), "^([^:%s]+):[ \t]*(.-)[ \t]*$")
+        local key = name and environ_key(name)
+        if key then
+            local existing = environ[key]
+            environ[key] = existing and existing .. "," .. value or value
+        end
+        position = line_end + 2
+    end
+    environ["wsgi.input"] = parser.Input(string.sub(data, position))
+
     return environ, nil
 end
 
@@ -1,11 +1,13 @@
 -- nibiru/template.lua
 
 local builtin_filters = require("nibiru.builtin_filters")
+local FragmentCache = require("nibiru.fragment_cache")
+local html = require("nibiru.html")
 local http = require("nibiru.http")
 local Tokenizer = require("nibiru.tokenizer")
 
 --- @class Template
---- @field render fun(context: table): string Renders the template with the given context
+--- @field render fun(context: table, sink: fun(chunk: string)?): string Renders the template with the given context. With a sink, output is flushed to it in chunks and the rest is returned
 --- @field code string The compiled Lua code for debugging
 local Template = {}
 
@@ -17,6 +19,13 @@ local Template_mt = {
     __index = Template,
 }
 
+-- Output of {% cache %} tags is kept up to this many bytes unless configured.
+local FRAGMENT_CACHE_BYTES = 8 * 1024 * 1024
+
+--- Rendered {% cache %} fragments, shared by every compiled template
+---@type FragmentCache
+Template.fragments = FragmentCache(FRAGMENT_CACHE_BYTES)
+
 --- Component registry: maps component names to their template strings
 ---@type table<string, string>
 local component_registry = {}
@@ -41,14 +50,49 @@ local template_registry = {}
 ---@type table<string, Template>
 local compiled_registry = {}
 
---- Set of template names currently being processed (to detect cycles)
----@type table<string, boolean>
-local processing_templates = {}
+--- Parsed templates: maps template names to their blocks, shared by every
+--- template that extends them
+---@type table<string, table>
+local parsed_templates = {}
+
+--- The blocks above a root template, the starting point of every merge
+local EMPTY_BLOCKS = {}
 
 --- Application instance for route function
 ---@type table|nil
 local application_instance = nil
 
+--- The C core library, loaded once template caching is turned on
+local core = nil
+
+--- Directory for compiled template bytecode, or nil when caching is off
+---@type string|nil
+local cache_directory = nil
+
+--- Templates and components read by the compile in progress, when caching
+---@type table<string, table<string, boolean>>|nil
+local compile_dependencies = nil
+
+--- Look up a registered template's content while compiling.
+---@param name string
+---@return string|nil
+local function lookup_template(name)
+    if compile_dependencies then
+        compile_dependencies.template[name] = true
+    end
+    return template_registry[name]
+end
+
+--- Look up a component's template while compiling.
+---@param name string
+---@return string|nil
+local function lookup_component(name)
+    if compile_dependencies then
+        compile_dependencies.component[name] = true
+    end
+    return component_registry[name]
+end
+
 --- Register a reusable component template.
 ---@param name string Component name (should start with capital letter)
 ---@param template_string string The component's template content
@@ -80,9 +124,10 @@ function Template.register_filter(name, filter_func)
     filter_registry[name] = filter_func
 end
 
---- Clear all registered filters (for testing).
+--- Clear all registered filters (for testing). Preserves the safe filter,
+--- which templates need to output HTML unescaped.
 function Template.clear_filters()
-    filter_registry = {}
+    filter_registry = { safe = builtin_filters.safe }
 end
 
 --- Register a function.
@@ -147,6 +192,57 @@ function Template.render(template_name, context, content_type, status_code, head
     )
 end
 
+--- Iterate over a template's output as it renders.
+---
+--- The render runs in a coroutine that yields each chunk the template flushes,
+--- so only one buffer of output, about STREAM_BYTES, is held at a time. The
+--- server waits for a slow client to read before asking for more chunks. The iterator returns an
+--- index and a chunk, like ipairs, and can be returned to a WSGI server.
+---@param context table? Context variables for template rendering
+---@return function iterator
+function Template:chunks(context)
+    local render = self.render
+    local next_chunk = coroutine.wrap(function()
+        -- The last, partly filled buffer is returned rather than flushed
+        coroutine.yield(render(context or {}, coroutine.yield))
+    end)
+    local index = 0
+    return function()
+        local chunk = next_chunk()
+        if chunk ~= nil then
+            index = index + 1
+            return index, chunk
+        end
+    end
+end
+
+--- Render a registered template as an HTTP response that streams its body.
+---
+--- The template renders while the server sends the response, so a large page
+--- is never held in memory whole. Errors in the template happen after the
+--- status line has gone out and can only cut the response short.
+---@param template_name string Name of the registered template
+---@param context table? Context variables for template rendering
+---@param content_type string? MIME type (default: "text/html")
+---@param status_code integer? HTTP status code (default: 200)
+---@param headers table? Additional HTTP headers
+---@return Response HTTP Response object with a stream instead of content
+function Template.stream(template_name, context, content_type, status_code, headers)
+    local compiled = compiled_registry[template_name]
+    if not compiled then
+        error("Template '" .. template_name .. "' not found")
+    end
+
+    local response = http.Response(
+        status_code or 200,
+        "",
+        content_type or "text/html",
+        headers or {}
+    )
+    response.stream = compiled:chunks(context)
+    return response
+end
+
 --- Escape a string for safe inclusion in Lua double-quoted string literals.
 ---@param s string String to escape
 ---@return string Escaped string wrapped in quotes
@@ -156,27 +252,168 @@ local function escape_lua_string(s)
     return '"' .. s .. '"'
 end
 
+-- A streaming render passes its output on once this many bytes are buffered.
+local STREAM_BYTES = 16384
+
+-- A render reads each context variable, filter, and function it uses into a
+-- local once. Lua allows 200 locals per function, so any names past this many
+-- are looked up where they are used instead.
+local MAX_HOISTED = 120
+
+--- Create the state for generating a template's code.
+---@return table Scope with generated lines, pending text, lookups, open loops,
+--- and the time to live of each open cache tag
+local function new_scope()
+    return {
+        body = {},
+        text = {},
+        hoisted = {},
+        lookups = {},
+        loops = {},
+        caches = {},
+    }
+end
+
+--- Get a local that holds a registry entry for the whole render.
+---@param scope table Code generation scope
+---@param prefix string Prefix that keeps the local apart from other kinds of names
+---@param registry string Name of the table the entry is read from
+---@param name string Key of the entry
+---@return string Lua code that evaluates to the entry
+local function hoist(scope, prefix, registry, name)
+    local var = prefix .. name
+    if scope.hoisted[var] then
+        return var
+    end
+    if #scope.lookups >= MAX_HOISTED or not name:match("^[%a_][%w_]*$") then
+        return string.format("%s[%q]", registry, name)
+    end
+    scope.hoisted[var] = true
+    local lookup = string.format("local %s = %s[%q]", var, registry, name)
+    table.insert(scope.lookups, lookup)
+    return var
+end
+
+--- Get the Lua code that reads a template variable.
+---@param scope table Code generation scope
+---@param name string Variable name
+---@return string Lua code for the loop variable or context value
+local function variable_code(scope, name)
+    for i = #scope.loops, 1, -1 do
+        if scope.loops[i].variables[name] then
+            return "l_" .. name
+        end
+    end
+    return hoist(scope, "c_", "context", name)
+end
+
+--- Get the context to pass to a template function.
+--- Loops around the call then build a context that includes their variables.
+---@param scope table Code generation scope
+---@return string Lua code for the context
+local function context_code(scope)
+    for _, loop in ipairs(scope.loops) do
+        loop.needs_context = true
+    end
+    return "context"
+end
+
+--- Get the Lua code for a component attribute's value.
+---@param value string String literal, or Lua code marked with __CODE__
+---@return string Lua code for the value
+local function attribute_code(value)
+    if value:sub(1, 8) == "__CODE__" then
+        return "(" .. value:sub(9) .. ")"
+    end
+    return escape_lua_string(value)
+end
+
+--- Get the marked Lua code for a dotted attribute expression like user.name.
+---@param expression string Dotted path to the value
+---@param scope table Code generation scope
+---@return string Lua code marked with __CODE__
+local function attribute_expression_code(expression, scope)
+    local code = nil
+    for part in expression:gmatch("[^.]+") do
+        if code then
+            code = code .. string.format("[%q]", part)
+        else
+            code = variable_code(scope, part)
+        end
+    end
+    return "__CODE__" .. "tostring(" .. (code or "context") .. ' or "")'
+end
+
+--- Generate Lua code for a sequence of expression tokens.
+---@param tokens table Array of expression tokens
+---@param scope table Code generation scope
+---@param attributes table<string, string>? Component attributes by name
+---@return string Lua code for the expression
+local function expression_code(tokens, scope, attributes)
+    local parts = {}
+    local previous = nil
+    for _, token in ipairs(tokens) do
+        local is_dot = token.type == "PUNCTUATION" and token.value == "."
+        local after_dot = previous ~= nil
+            and previous.type == "PUNCTUATION"
+            and previous.value == "."
+        -- Add space between tokens unless this token is a dot or follows a dot
+        if #parts > 0 and not is_dot and not after_dot then
+            table.insert(parts, " ")
+        end
+
+        if token.type == "IDENTIFIER" then
+            if after_dot then
+                -- Property access
+                table.insert(parts, token.value)
+            elseif attributes and attributes[token.value] then
+                table.insert(parts, attribute_code(attributes[token.value]))
+            else
+                table.insert(parts, variable_code(scope, token.value))
+            end
+        elseif token.type == "LITERAL" then
+            if type(token.value) == "string" then
+                table.insert(parts, string.format("%q", token.value))
+            else
+                table.insert(parts, tostring(token.value))
+            end
+        else
+            table.insert(parts, token.value or "")
+        end
+        previous = token
+    end
+    return table.concat(parts)
+end
+
+--- Join two pieces of Lua code with a space.
+---@param left string
+---@param right string
+---@return string
+local function join_code(left, right)
+    if left == "" or right == "" then
+        return left .. right
+    end
+    return left .. " " .. right
+end
+
 --- Parse a filter pipeline expression and generate Lua code.
 ---@param expr_tokens table Array of expression tokens
----@param attributes table<string, any> Optional attributes table for component context
+---@param scope table Code generation scope
+---@param attributes table<string, string>? Component attributes by name
 ---@return string Lua code that evaluates the filter pipeline
-local function parse_filter_pipeline(expr_tokens, attributes)
-    -- Simple implementation for basic filter support
-    -- Look for |> operators and convert to function calls
-
-    local parts = {}
+local function filter_pipeline_code(expr_tokens, scope, attributes)
+    local value = ""
+    local pending = {}
     local i = 1
-    local current_expr = {}
 
     while i <= #expr_tokens do
         local token = expr_tokens[i]
 
         if token.type == "OPERATOR" and token.value == "|>" then
-            -- Found a filter pipeline operator
-            -- The current_expr contains the value to filter
-            -- The next tokens should be the filter name and arguments
-
-            if #current_expr == 0 then
+            -- The code so far is the value to filter
+            local pending_code = expression_code(pending, scope, attributes)
+            local input = join_code(value, pending_code)
+            if input == "" then
                 error("Expected expression before |> operator")
             end
 
@@ -186,135 +423,181 @@ local function parse_filter_pipeline(expr_tokens, attributes)
                 error("Expected filter name after |> operator")
             end
             local filter_name = expr_tokens[i].value
-
-            -- Check if filter exists
             if not filter_registry[filter_name] then
                 error("Unknown filter '" .. filter_name .. "'")
             end
 
             -- Parse optional arguments
-            local args = {}
+            local args = { input }
             i = i + 1
             if
                 i <= #expr_tokens
                 and expr_tokens[i].type == "PUNCTUATION"
                 and expr_tokens[i].value == "("
             then
-                -- Parse arguments until closing )
                 i = i + 1
                 local current_arg = {}
-                while
-                    i <= #expr_tokens
-                    and not (
-                        expr_tokens[i].type == "PUNCTUATION"
-                        and expr_tokens[i].value == ")"
-                    )
-                do
-                    if
-                        expr_tokens[i].type == "PUNCTUATION"
-                        and expr_tokens[i].value == ","
-                    then
-                        -- End of current argument
+                local depth = 0
+                while i <= #expr_tokens do
+                    local arg_token = expr_tokens[i]
+                    local punctuation = arg_token.type == "PUNCTUATION"
+                        and arg_token.value
+                    if punctuation == ")" and depth == 0 then
+                        break
+                    elseif punctuation == "," and depth == 0 then
                         if #current_arg > 0 then
-                            table.insert(args, table.concat(current_arg))
+                            local arg = expression_code(current_arg, scope, attributes)
+                            table.insert(args, arg)
                             current_arg = {}
                         end
                     else
-                        -- Add token to current argument
-                        if expr_tokens[i].type == "IDENTIFIER" then
-                            -- Check if this is an attribute (for component context)
-                            if attributes and attributes[expr_tokens[i].value] then
-                                -- Attributes may be strings or Lua code marked with __CODE__
-                                local attr_value = attributes[expr_tokens[i].value]
-                                if
-                                    type(attr_value) == "string"
-                                    and attr_value:sub(1, 8) == "__CODE__"
-                                then
-                                    -- This is Lua code, insert it directly
-                                    table.insert(
-                                        current_arg,
-                                        "(" .. attr_value:sub(9) .. ")"
-                                    )
-                                else
-                                    -- String literal
-                                    table.insert(
-                                        current_arg,
-                                        escape_lua_string(attr_value)
-                                    )
-                                end
-                            else
-                                table.insert(current_arg, "c." .. expr_tokens[i].value)
-                            end
-                        elseif expr_tokens[i].type == "LITERAL" then
-                            if type(expr_tokens[i].value) == "string" then
-                                table.insert(
-                                    current_arg,
-                                    string.format("%q", expr_tokens[i].value)
-                                )
-                            else
-                                table.insert(
-                                    current_arg,
-                                    tostring(expr_tokens[i].value)
-                                )
-                            end
-                        else
-                            table.insert(current_arg, expr_tokens[i].value or "")
+                        if punctuation == "(" then
+                            depth = depth + 1
+                        elseif punctuation == ")" then
+                            depth = depth - 1
                         end
+                        table.insert(current_arg, arg_token)
                     end
                     i = i + 1
                 end
-                -- Add the last argument if any
                 if #current_arg > 0 then
-                    table.insert(args, table.concat(current_arg))
+                    table.insert(args, expression_code(current_arg, scope, attributes))
                 end
-                if i > #expr_tokens or expr_tokens[i].value ~= ")" then
+                if i > #expr_tokens then
                     error("Expected closing ) after filter arguments")
                 end
                 i = i + 1
             end
 
-            -- Generate filter call
-            local value_expr = table.concat(current_expr)
-            local args_str = #args > 0 and ", " .. table.concat(args, ", ") or ""
-            local filter_call =
-                string.format("fr[%q](%s%s)", filter_name, value_expr, args_str)
+            value = string.format(
+                "%s(%s)",
+                hoist(scope, "f_", "filter_registry", filter_name),
+                table.concat(args, ", ")
+            )
+            pending = {}
+        else
+            table.insert(pending, token)
+            i = i + 1
+        end
+    end
+
+    return join_code(value, expression_code(pending, scope, attributes))
+end
+
+--- Generate Lua code for a call to a registered template function.
+---@param expr_tokens table Expression tokens starting with the name and (
+---@param scope table Code generation scope
+---@param attributes table<string, string>? Component attributes by name
+---@return string Lua code for the call
+local function function_call_code(expr_tokens, scope, attributes)
+    local func_name = expr_tokens[1].value
+    if not function_registry[func_name] then
+        error("Unknown function '" .. func_name .. "'")
+    end
 
-            -- Reset for next part of pipeline
-            current_expr = { filter_call }
+    -- Functions receive the context first, then the template's arguments
+    local args = { context_code(scope) }
+    local current_arg = {}
+    local depth = 1
+    local i = 3 -- Skip function name and opening paren
+    while i <= #expr_tokens do
+        local token = expr_tokens[i]
+        local punctuation = token.type == "PUNCTUATION" and token.value
+        if punctuation == "," and depth == 1 then
+            if #current_arg > 0 then
+                table.insert(args, expression_code(current_arg, scope, attributes))
+                current_arg = {}
+            end
         else
-            -- Regular token, add to current expression
-            if token.type == "IDENTIFIER" then
-                -- Check if this is an attribute (for component context)
-                if attributes and attributes[token.value] then
-                    -- Attributes may be strings or Lua code marked with __CODE__
-                    local attr_value = attributes[token.value]
-                    if
-                        type(attr_value) == "string"
-                        and attr_value:sub(1, 8) == "__CODE__"
-                    then
-                        -- This is Lua code, insert it directly
-                        table.insert(current_expr, "(" .. attr_value:sub(9) .. ")")
-                    else
-                        -- String literal
-                        table.insert(current_expr, escape_lua_string(attr_value))
-                    end
-                else
-                    table.insert(current_expr, "c." .. token.value)
-                end
-            elseif token.type == "LITERAL" then
-                if type(token.value) == "string" then
-                    table.insert(current_expr, string.format("%q", token.value))
-                else
-                    table.insert(current_expr, tostring(token.value))
+            if punctuation == "(" then
+                depth = depth + 1
+            elseif punctuation == ")" then
+                depth = depth - 1
+                if depth == 0 then
+                    break
                 end
-            else
-                table.insert(current_expr, token.value or "")
             end
-            i = i + 1
+            table.insert(current_arg, token)
+        end
+        i = i + 1
+    end
+    if #current_arg > 0 then
+        table.insert(args, expression_code(current_arg, scope, attributes))
+    end
+
+    return string.format(
+        "%s(%s)",
+        hoist(scope, "fn_", "function_registry", func_name),
+        table.concat(args, ", ")
+    )
+end
+
+--- Generate the output of a {{ }} expression.
+---@param expr_tokens table Array of expression tokens
+---@param scope table Code generation scope
+---@param attributes table<string, string>? Component attributes by name
+---@return table Chunk with either constant text or Lua code for a string
+local function output_chunk(expr_tokens, scope, attributes)
+    for _, token in ipairs(expr_tokens) do
+        if token.type == "OPERATOR" and token.value == "|>" then
+            local filter_code = filter_pipeline_code(expr_tokens, scope, attributes)
+            return { code = string.format("escape(%s)", filter_code) }
+        end
+    end
+
+    if
+        #expr_tokens >= 3
+        and expr_tokens[1].type == "IDENTIFIER"
+        and expr_tokens[2].type == "PUNCTUATION"
+        and expr_tokens[2].value == "("
+    then
+        local call = function_call_code(expr_tokens, scope, attributes)
+        return { code = string.format("escape(%s)", call) }
+    elseif #expr_tokens == 1 and expr_tokens[1].type == "IDENTIFIER" then
+        local var_name = expr_tokens[1].value
+        local attr_value = attributes and attributes[var_name]
+        if attr_value then
+            if attr_value:sub(1, 8) == "__CODE__" then
+                return { code = "escape(" .. attr_value:sub(9) .. ")" }
+            end
+            -- String attributes are constant text
+            return { text = attr_value }
+        end
+        local var = variable_code(scope, var_name)
+        return { code = string.format("escape(%s)", var) }
+    end
+
+    local expr = expression_code(expr_tokens, scope, attributes)
+    return { code = string.format("escape(%s)", expr) }
+end
+
+--- Add a line of generated code, after any text waiting to be output.
+---@param scope table Code generation scope
+---@param line string Lua code
+local function emit(scope, line)
+    if #scope.text > 0 then
+        local text = table.concat(scope.text)
+        scope.text = {}
+        if text ~= "" then
+            table.insert(scope.body, "n = n + 1")
+            table.insert(scope.body, "parts[n] = " .. escape_lua_string(text))
+            table.insert(scope.body, "size = size + " .. #text)
         end
     end
+    table.insert(scope.body, line)
+end
 
-    return table.concat(current_expr)
+--- Add template output. Runs of constant text are folded into one string.
+---@param scope table Code generation scope
+---@param chunk table Chunk from output_chunk or compile_component
+local function emit_output(scope, chunk)
+    if chunk.text then
+        table.insert(scope.text, chunk.text)
+    else
+        emit(scope, "n = n + 1")
+        table.insert(scope.body, "parts[n] = " .. chunk.code)
+        table.insert(scope.body, "size = size + #parts[n]")
+    end
 end
 
 --- Parse an identifier from expression tokens.
@@ -358,9 +641,10 @@ end
 
 --- Compile a component template with provided attributes.
 ---@param component_template string The component's template string
----@param attributes table<string, table> Attribute values to inject into the component (each value is {type="string"|"code", value=string})
----@return table Array of compiled chunks for the component
-local function compile_component(component_template, attributes)
+---@param attributes table<string, string> Attribute values to inject into the component (string literals, or Lua code marked with __CODE__)
+---@param scope table Code generation scope of the template using the component
+---@return table Array of output chunks for the component
+local function compile_component(component_template, attributes, scope)
     -- Compile component template with attributes as additional context
     local component_tokens = Tokenizer.tokenize(component_template)
     local component_parser = { tokens = component_tokens, pos = 1 }
@@ -369,7 +653,7 @@ local function compile_component(component_template, attributes)
     while component_parser.pos <= #component_tokens do
         local token = component_tokens[component_parser.pos]
         if token.type == "TEXT" then
-            table.insert(chunks, escape_lua_string(token.value))
+            table.insert(chunks, { text = token.value })
             component_parser.pos = component_parser.pos + 1
         elseif token.type == "EXPR_START" then
             component_parser.pos = component_parser.pos + 1
@@ -392,174 +676,7 @@ local function compile_component(component_template, attributes)
             end
             component_parser.pos = component_parser.pos + 1
 
-            -- Check if this expression contains filter pipelines
-            local has_filters = false
-            for _, token in ipairs(expr_tokens) do
-                if token.type == "OPERATOR" and token.value == "|>" then
-                    has_filters = true
-                    break
-                end
-            end
-
-            if has_filters then
-                -- Handle filter pipeline expressions
-                local filter_code = parse_filter_pipeline(expr_tokens, attributes)
-                table.insert(
-                    chunks,
-                    string.format(
-                        'tostring((function(c, fr) return %s end)(context, filter_registry) or "")',
-                        filter_code
-                    )
-                )
-            elseif
-                #expr_tokens >= 3
-                and expr_tokens[1].type == "IDENTIFIER"
-                and expr_tokens[2].type == "PUNCTUATION"
-                and expr_tokens[2].value == "("
-            then
-                -- Check if this is a function call
-                local func_name = expr_tokens[1].value
-                if function_registry[func_name] then
-                    -- Parse function arguments
-                    local args = {}
-                    local i = 3 -- Skip function name and opening paren
-                    local current_arg = {}
-                    local paren_depth = 1
-
-                    while i <= #expr_tokens and paren_depth > 0 do
-                        local token = expr_tokens[i]
-                        if token.type == "PUNCTUATION" and token.value == "(" then
-                            paren_depth = paren_depth + 1
-                            table.insert(current_arg, token.value)
-                        elseif token.type == "PUNCTUATION" and token.value == ")" then
-                            paren_depth = paren_depth - 1
-                            if paren_depth > 0 then
-                                table.insert(current_arg, token.value)
-                            end
-                        elseif
-                            token.type == "PUNCTUATION"
-                            and token.value == ","
-                            and paren_depth == 1
-                        then
-                            -- End of current argument
-                            if #current_arg > 0 then
-                                table.insert(args, table.concat(current_arg))
-                                current_arg = {}
-                            end
-                        else
-                            -- Add token to current argument
-                            if token.type == "IDENTIFIER" then
-                                -- Check if this is an attribute (for component context)
-                                if attributes and attributes[token.value] then
-                                    -- Attributes may be strings or Lua code marked with __CODE__
-                                    local attr_value = attributes[token.value]
-                                    if
-                                        type(attr_value) == "string"
-                                        and attr_value:sub(1, 8) == "__CODE__"
-                                    then
-                                        -- This is Lua code, insert it directly
-                                        table.insert(
-                                            current_arg,
-                                            "(" .. attr_value:sub(9) .. ")"
-                                        )
-                                    else
-                                        -- String literal
-                                        table.insert(
-                                            current_arg,
-                                            escape_lua_string(attr_value)
-                                        )
-                                    end
-                                else
-                                    table.insert(current_arg, "context." .. token.value)
-                                end
-                            elseif token.type == "LITERAL" then
-                                if type(token.value) == "string" then
-                                    table.insert(
-                                        current_arg,
-                                        string.format("%q", token.value)
-                                    )
-                                else
-                                    table.insert(current_arg, tostring(token.value))
-                                end
-                            else
-                                table.insert(current_arg, token.value or "")
-                            end
-                        end
-                        i = i + 1
-                    end
-
-                    -- Add the last argument if any
-                    if #current_arg > 0 then
-                        table.insert(args, table.concat(current_arg))
-                    end
-
-                    -- Generate function call code
-                    local args_str = #args > 0 and ", " .. table.concat(args, ", ")
-                        or ""
-                    local func_call = string.format(
-                        "function_registry[%q](context%s)",
-                        func_name,
-                        args_str
-                    )
-                    table.insert(chunks, string.format('tostring(%s or "")', func_call))
-                else
-                    -- Not a registered function, this is an error
-                    error("Unknown function '" .. func_name .. "'")
-                end
-            elseif #expr_tokens == 1 and expr_tokens[1].type == "IDENTIFIER" then
-                local var_name = expr_tokens[1].value
-                -- Check if this is an attribute, otherwise use normal context access
-                if attributes[var_name] then
-                    -- Attributes may be strings or Lua code marked with __CODE__
-                    local attr_value = attributes[var_name]
-                    if
-                        type(attr_value) == "string"
-                        and attr_value:sub(1, 8) == "__CODE__"
-                    then
-                        -- This is Lua code, insert it directly
-                        table.insert(chunks, attr_value:sub(9))
-                    else
-                        -- String literal, escape it
-                        table.insert(chunks, escape_lua_string(attr_value))
-                    end
-                else
-                    -- Generate Lua code for safe table access and tostring conversion
-                    table.insert(
-                        chunks,
-                        string.format('tostring(context[%q] or "")', var_name)
-                    )
-                end
-            else
-                -- Handle complex expressions by converting tokens back to Lua code
-                local expr_parts = {}
-                for _, token in ipairs(expr_tokens) do
-                    if token.type == "IDENTIFIER" then
-                        table.insert(expr_parts, "c." .. token.value)
-                    elseif token.type == "LITERAL" then
-                        if type(token.value) == "string" then
-                            table.insert(expr_parts, string.format("%q", token.value))
-                        else
-                            table.insert(expr_parts, tostring(token.value))
-                        end
-                    elseif token.type == "OPERATOR" then
-                        table.insert(expr_parts, token.value)
-                    elseif token.type == "KEYWORD" then
-                        table.insert(expr_parts, token.value)
-                    else
-                        table.insert(expr_parts, token.value or "")
-                    end
-                end
-                local expr_str = table.concat(expr_parts, " ")
-
-                -- Generate code to evaluate the expression safely
-                table.insert(
-                    chunks,
-                    string.format(
-                        'tostring((function(c) return %s end)(context) or "")',
-                        expr_str
-                    )
-                )
-            end
+            table.insert(chunks, output_chunk(expr_tokens, scope, attributes))
         elseif token.type == "COMPONENT_START" then
             -- Handle component usage within component template (composition)
             component_parser.pos = component_parser.pos + 1
@@ -573,7 +690,7 @@ local function compile_component(component_template, attributes)
             component_parser.pos = component_parser.pos + 1
 
             -- Check if sub-component is registered
-            local sub_component_template = component_registry[sub_component_name]
+            local sub_component_template = lookup_component(sub_component_name)
             if not sub_component_template then
                 error("Component '" .. sub_component_name .. "' is not registered")
             end
@@ -590,14 +707,8 @@ local function compile_component(component_template, attributes)
                         sub_attributes[attr_name] = attr_info.value
                     elseif attr_info.type == "expression" then
                         -- For sub-component attributes, evaluate in the current component's context
-                        local parts = {}
-                        for part in attr_info.value:gmatch("[^.]+") do
-                            table.insert(parts, string.format("[%q]", part))
-                        end
-                        sub_attributes[attr_name] = "__CODE__"
-                            .. "tostring(context"
-                            .. table.concat(parts)
-                            .. ' or "")'
+                        sub_attributes[attr_name] =
+                            attribute_expression_code(attr_info.value, scope)
                     end
                 end
                 component_parser.pos = component_parser.pos + 1
@@ -624,7 +735,7 @@ local function compile_component(component_template, attributes)
             if is_self_closing then
                 -- Inline the sub-component
                 local sub_component_chunks =
-                    compile_component(sub_component_template, sub_attributes)
+                    compile_component(sub_component_template, sub_attributes, scope)
                 for _, chunk in ipairs(sub_component_chunks) do
                     table.insert(chunks, chunk)
                 end
@@ -646,341 +757,175 @@ local function compile_component(component_template, attributes)
     return chunks
 end
 
---- Compile a template string into a renderable template object.
----@param template_str string Template string to compile
----@return table Template object with render function and code field
-local function process_child_tokens(child_tokens, child_blocks)
-    -- Process child tokens to expand blocks that are not overridden
-    local result = {}
+--- Split a template's tokens into its blocks.
+---
+--- Each block becomes a node holding its own tokens and nested blocks, so
+--- inheritance can swap whole blocks without looking at the source again.
+---@param tokens table[] The template's tokens
+---@return string|nil parent The template named by extends, if any
+---@return table[] body The tokens and block nodes outside of any block
+---@return table<string, table[]> blocks The contents of the top-level blocks
+local function parse_blocks(tokens)
+    local parent = nil
+    local body = {}
+    local blocks = {}
+    local stack = {}
+    local items = body
     local i = 1
-    while i <= #child_tokens do
-        local token = child_tokens[i]
+    while i <= #tokens do
+        local token = tokens[i]
+        local statement = token.type == "STMT_START" and tokens[i + 1]
         if
-            token.type == "BLOCK_START"
-            and i + 1 <= #child_tokens
-            and child_tokens[i + 1].type == "IDENTIFIER"
+            statement
+            and statement.type == "BLOCK_START"
+            and tokens[i + 2]
+            and tokens[i + 2].type == "IDENTIFIER"
         then
-            local block_name = child_tokens[i + 1].value
-            -- Skip BLOCK_START and IDENTIFIER
-            i = i + 2
-            -- Skip STMT_END if present
-            if i <= #child_tokens and child_tokens[i].type == "STMT_END" then
-                i = i + 1
-            end
-            -- Collect content until BLOCK_END
-            local block_content = {}
-            while i <= #child_tokens and child_tokens[i].type ~= "BLOCK_END" do
-                table.insert(block_content, child_tokens[i])
-                i = i + 1
-            end
-            -- Skip BLOCK_END
-            if i <= #child_tokens then
-                i = i + 1
-            end
-            -- Skip STMT_END if present
-            if i <= #child_tokens and child_tokens[i].type == "STMT_END" then
-                i = i + 1
-            end
-            -- If this block is not overridden, expand it
-            if not child_blocks[block_name] then
-                -- Recursively process the block content and add to result
-                local processed_content =
-                    process_child_tokens(block_content, child_blocks)
-                for _, t in ipairs(processed_content) do
-                    table.insert(result, t)
-                end
-            else
-                -- This shouldn't happen in child content, but keep the block
-                table.insert(result, { type = "BLOCK_START" })
-                table.insert(result, { type = "IDENTIFIER", value = block_name })
-                for _, t in ipairs(block_content) do
-                    table.insert(result, t)
-                end
-                table.insert(result, { type = "BLOCK_END" })
+            local block = { name = tokens[i + 2].value, items = {} }
+            items[#items + 1] = block
+            if #stack == 0 then
+                blocks[block.name] = block.items
             end
+            stack[#stack + 1] = items
+            items = block.items
+            i = i + 4
+        elseif statement and statement.type == "BLOCK_END" and #stack > 0 then
+            items = table.remove(stack)
+            i = i + 3
+        elseif statement and statement.type == "EXTENDS" and not parent then
+            parent = tokens[i + 2] and tokens[i + 2].value
+            i = i + 4
         else
-            table.insert(result, token)
+            items[#items + 1] = token
             i = i + 1
         end
     end
-    return result
-end
-
-local function insert_processed_child_token(tokens, token, child_blocks)
-    -- This function is not used anymore, replaced by process_child_tokens
+    return parent, body, blocks
 end
 
---- Resolve complete inheritance chain and return final template string
----@param template_name string Name of template to start resolution from
----@param current_template_str string Optional current template content with additional blocks
----@return string Final template string with all inheritance resolved
-local function resolve_inheritance_chain(template_name, current_template_str)
-    -- Build the complete inheritance chain (from root to leaf)
-    local chain = {}
-    local current = template_name
-
-    while current do
-        table.insert(chain, 1, current) -- Insert at beginning to get root-first
-        local template_str = template_registry[current]
-        if not template_str then
-            error("Template '" .. current .. "' not found")
-        end
-
-        -- Find extends statement
-        local extends_match = template_str:match('extends%s+"([^"]+)"')
-        current = extends_match
+--- Parse a registered template for inheritance, reusing an earlier parse
+--- while its content is unchanged.
+---@param name string
+---@param template_str string The template's registered content
+---@return table entry
+local function parsed_template(name, template_str)
+    local entry = parsed_templates[name]
+    if not entry or entry.source ~= template_str then
+        local parent, body, blocks = parse_blocks(Tokenizer.tokenize(template_str))
+        entry = {
+            source = template_str,
+            parent = parent,
+            body = body,
+            blocks = blocks,
+        }
+        parsed_templates[name] = entry
     end
+    return entry
+end
 
-    -- Collect all block definitions from the chain
-    local all_blocks = {} -- block_name -> {original = string, content = string}
-    local block_order = {} -- List of block names in processing order
-
-    for _, name in ipairs(chain) do
-        local template_str = template_registry[name]
-        -- Remove extends statement
-        local extends_end = template_str:find("%%}")
-        if extends_end and template_str:sub(1, extends_end + 1):find("extends") then
-            template_str = template_str:sub(extends_end + 2)
-        end
-
-        -- Parse blocks
-        local pos = 1
-        while pos <= #template_str do
-            local block_start = template_str:find("{% block ", pos, true)
-            if not block_start then
-                break
-            end
-
-            local name_start = block_start + #"{% block "
-            local name_end = template_str:find("%%}", name_start)
-            if not name_end then
-                break
-            end
-
-            local block_name =
-                template_str:sub(name_start, name_end - 1):gsub("%s*$", "")
-            local content_start = name_end + 2
-
-            -- Find matching endblock by counting block nesting
-            local search_pos = content_start
-            local depth = 0
-            local endblock_pos = nil
-            while search_pos <= #template_str do
-                local next_block_start =
-                    template_str:find("{% block ", search_pos, true)
-                local next_endblock =
-                    template_str:find("{% endblock %}", search_pos, true)
-
-                if
-                    next_block_start
-                    and (not next_endblock or next_block_start < next_endblock)
-                then
-                    depth = depth + 1
-                    search_pos = next_block_start + #"{% block "
-                elseif next_endblock then
-                    depth = depth - 1
-                    if depth < 0 then
-                        endblock_pos = next_endblock
-                        break
-                    end
-                    search_pos = next_endblock + #"{% endblock %}"
-                else
-                    break
-                end
-            end
-            if not endblock_pos then
-                break
-            end
-
-            local content = template_str:sub(content_start, endblock_pos - 1)
-            local original =
-                template_str:sub(block_start, endblock_pos + #"{% endblock %}" - 1)
-            if not all_blocks[block_name] then
-                all_blocks[block_name] = { original = original, content = content }
-            else
-                -- Later templates override
-                all_blocks[block_name].content = content
-            end
-            -- Track block order (add if not already present)
-            local already_in_order = false
-            for _, existing in ipairs(block_order) do
-                if existing == block_name then
-                    already_in_order = true
-                    break
-                end
+--- Append a template body's tokens, replacing each block with the contents
+--- of its most derived definition.
+---@param items table[] Tokens and block nodes
+---@param blocks table<string, table[]> Block contents by name
+---@param tokens table[] The tokens to append to
+---@param expanding table<string, boolean> Blocks being expanded, so a block
+--- nested in its own override keeps its default contents
+local function expand_blocks(items, blocks, tokens, expanding)
+    for _, item in ipairs(items) do
+        local name = item.name
+        if name then
+            local contents = blocks[name]
+            if not contents or expanding[name] then
+                contents = item.items
             end
-            if not already_in_order then
-                table.insert(block_order, block_name)
-            end
-
-            pos = endblock_pos + #"{% endblock %}"
+            expanding[name] = true
+            expand_blocks(contents, blocks, tokens, expanding)
+            expanding[name] = nil
+        else
+            tokens[#tokens + 1] = item
         end
     end
+end
 
-    -- Also process blocks from current template if provided
-    if current_template_str then
-        -- Remove extends statement
-        local current_str = current_template_str
-        local extends_end = current_str:find("%%}")
-        if extends_end and current_str:sub(1, extends_end + 1):find("extends") then
-            current_str = current_str:sub(extends_end + 2)
+--- Resolve a child template's inheritance chain into a single token list.
+---
+--- Every template in the chain is tokenized once and its blocks are merged
+--- with those of its ancestors once, so each child only adds its own blocks.
+---@param parent_name string The template the child extends
+---@param child_tokens table[] The child template's tokens
+---@return table[] tokens The root template's tokens with every block filled in
+local function resolve_inheritance(parent_name, child_tokens)
+    local chain = {}
+    local seen = {}
+    local name = parent_name
+    while name do
+        if seen[name] then
+            error("Circular template inheritance detected involving '" .. name .. "'")
         end
-        local pos = 1
-        while pos <= #current_str do
-            local block_start = current_str:find("{% block ", pos, true)
-            if not block_start then
-                break
-            end
-
-            local name_start = block_start + #"{% block "
-            local name_end = current_str:find("%%}", name_start)
-            if not name_end then
-                break
-            end
-
-            local block_name =
-                current_str:sub(name_start, name_end - 1):gsub("%s*$", "")
-            local content_start = name_end + 2
-
-            -- Find matching endblock
-            local search_pos = content_start
-            local depth = 0
-            local endblock_pos = nil
-            while search_pos <= #current_str do
-                local next_block_start = current_str:find("{% block ", search_pos, true)
-                local next_endblock =
-                    current_str:find("{% endblock %}", search_pos, true)
-
-                if
-                    next_block_start
-                    and (not next_endblock or next_block_start < next_endblock)
-                then
-                    depth = depth + 1
-                    search_pos = next_block_start + #"{% block "
-                elseif next_endblock then
-                    depth = depth - 1
-                    if depth < 0 then
-                        endblock_pos = next_endblock
-                        break
-                    end
-                    search_pos = next_endblock + #"{% endblock %}"
-                else
-                    break
-                end
-            end
-            if not endblock_pos then
-                break
-            end
-
-            local content = current_str:sub(content_start, endblock_pos - 1)
-            local original =
-                current_str:sub(block_start, endblock_pos + #"{% endblock %}" - 1)
-            all_blocks[block_name] = { original = original, content = content } -- Current template blocks override all others
-            -- Track block order
-            local already_in_order = false
-            for _, existing in ipairs(block_order) do
-                if existing == block_name then
-                    already_in_order = true
-                    break
-                end
-            end
-            if not already_in_order then
-                table.insert(block_order, block_name)
-            end
-
-            pos = endblock_pos + #"{% endblock %}"
+        seen[name] = true
+        local template_str = lookup_template(name)
+        if not template_str then
+            error("Template '" .. name .. "' not found")
         end
+        local entry = parsed_template(name, template_str)
+        chain[#chain + 1] = entry
+        name = entry.parent
     end
 
-    -- Start with the root template and replace all blocks
-    local result = template_registry[chain[1]]:gsub('^{%s*extends%s+"[^"]+"%s*%}', "")
-
-    -- Function to recursively replace block tags with their content
-    local function process_blocks(content)
-        local result_content = content
-        local pos = 1
-        while pos <= #result_content do
-            local block_start = result_content:find("{% block ", pos, true)
-            if not block_start then
-                break
+    -- Block tables are built from the root down and kept on each entry
+    -- until an ancestor's table is rebuilt. The root merges onto the same
+    -- empty table every time, so an unchanged chain rebuilds nothing.
+    local merged = EMPTY_BLOCKS
+    for index = #chain, 1, -1 do
+        local entry = chain[index]
+        if entry.base ~= merged then
+            local blocks = {}
+            for block_name, contents in pairs(merged) do
+                blocks[block_name] = contents
             end
-
-            local name_start = block_start + #"{% block "
-            local name_end = result_content:find("%}", name_start)
-            if not name_end then
-                break
+            for block_name, contents in pairs(entry.blocks) do
+                blocks[block_name] = contents
             end
-
-            local block_name =
-                result_content:sub(name_start, name_end - 2):gsub("%s*$", "")
-            local content_start = name_end + 1
-
-            -- Find matching endblock
-            local search_pos = content_start
-            local depth = 0
-            local endblock_pos = nil
-            while search_pos <= #result_content do
-                local next_block_start =
-                    result_content:find("{% block ", search_pos, true)
-                local next_endblock =
-                    result_content:find("{% endblock %}", search_pos, true)
-
-                if
-                    next_block_start
-                    and (not next_endblock or next_block_start < next_endblock)
-                then
-                    depth = depth + 1
-                    search_pos = next_block_start + #"{% block "
-                elseif next_endblock then
-                    depth = depth - 1
-                    if depth < 0 then
-                        endblock_pos = next_endblock
-                        break
-                    end
-                    search_pos = next_endblock + #"{% endblock %}"
-                else
-                    break
-                end
-            end
-            if not endblock_pos then
-                break
-            end
-
-            -- Get the block content
-            local block_content = result_content:sub(content_start, endblock_pos - 1)
-
-            -- Replace with the defined content for this block, or recursively process if no override
-            local replacement
-            if all_blocks[block_name] then
-                replacement = all_blocks[block_name].content
-                -- Recursively process nested blocks in the replacement
-                replacement = process_blocks(replacement)
-            else
-                -- No override, recursively process the existing content
-                replacement = process_blocks(block_content)
-            end
-
-            -- Replace the block
-            local before = result_content:sub(1, block_start - 1)
-            local after = result_content:sub(endblock_pos + #"{% endblock %}")
-            result_content = before .. replacement .. after
-
-            -- Continue from the end of the replacement
-            pos = block_start + #replacement
+            entry.base = merged
+            entry.merged = blocks
         end
-        return result_content
+        merged = entry.merged
     end
 
-    -- Process all blocks in the root template
-    result = process_blocks(result)
+    local _, _, child_blocks = parse_blocks(child_tokens)
+    local blocks = setmetatable(child_blocks, { __index = merged })
+    local tokens = {}
+    expand_blocks(chain[#chain].body, blocks, tokens, {})
+    return tokens
+end
 
+--- Wrap a compiled template chunk in a Template instance.
+---@param chunk function The loaded template chunk, which returns the render function
+---@param code string The generated Lua code for debugging
+---@return Template
+local function make_template(chunk, code)
+    local render = chunk(Template.fragments, html.escape)
+    local result = {
+        render = function(context, sink)
+            -- Wrap context in a table if not already
+            local ctx = type(context) == "table" and context or {}
+            return render(ctx, filter_registry, function_registry, sink)
+        end,
+        code = code,
+    }
+    -- Make it a proper Template instance
+    setmetatable(result, Template_mt)
     return result
 end
 
+--- Compile a template string into a renderable template object.
+---@param template_str string Template string to compile
+---@return Template template
+---@return function chunk The loaded template function
 local function compile(template_str)
     local tokens = Tokenizer.tokenize(template_str)
     local parser = { tokens = tokens, pos = 1 }
-    local body_parts = {} -- Build the function body directly
+    local scope = new_scope() -- Build the function body directly
     local conditional_stack = {} -- Stack to track nested conditionals
 
     -- Check for template inheritance
@@ -1116,45 +1061,14 @@ local function compile(template_str)
 
     -- If this is an inheritance template, resolve complete inheritance chain
     if parent_template_name then
-        if processing_templates[parent_template_name] then
-            -- Circular dependency detected
-            processing_templates[parent_template_name] = nil
-            error(
-                "Circular template inheritance detected involving '"
-                    .. parent_template_name
-                    .. "'"
-            )
-        end
-
-        processing_templates[parent_template_name] = true
-
-        -- Resolve the complete inheritance chain
-        local resolved_str =
-            resolve_inheritance_chain(parent_template_name, template_str)
-        tokens = Tokenizer.tokenize(resolved_str)
-
+        tokens = resolve_inheritance(parent_template_name, tokens)
         parser = { tokens = tokens, pos = 1 }
-
-        processing_templates[parent_template_name] = nil
     end
 
-    -- Start building the function body
-    table.insert(body_parts, "local context, filter_registry, function_registry = ...")
-    table.insert(body_parts, "local parts = {}")
-    table.insert(body_parts, "local function is_truthy(val)")
-    table.insert(
-        body_parts,
-        "  return val ~= false and val ~= nil and val ~= 0 and val ~= '' and (type(val) ~= 'table' or next(val) ~= nil)"
-    )
-    table.insert(body_parts, "end")
-
     while parser.pos <= #tokens do
         local token = tokens[parser.pos]
         if token.type == "TEXT" then
-            table.insert(
-                body_parts,
-                "table.insert(parts, " .. escape_lua_string(token.value) .. ")"
-            )
+            emit_output(scope, { text = token.value })
             parser.pos = parser.pos + 1
         elseif token.type == "EXPR_START" then
             parser.pos = parser.pos + 1
@@ -1171,233 +1085,7 @@ local function compile(template_str)
             end
             parser.pos = parser.pos + 1
 
-            -- Check if this expression contains filter pipelines
-            local has_filters = false
-            for _, token in ipairs(expr_tokens) do
-                if token.type == "OPERATOR" and token.value == "|>" then
-                    has_filters = true
-                    break
-                end
-            end
-
-            if has_filters then
-                -- Handle filter pipeline expressions
-                local filter_code = parse_filter_pipeline(expr_tokens)
-                table.insert(
-                    body_parts,
-                    string.format(
-                        'table.insert(parts, tostring((function(c, fr) return %s end)(context, filter_registry) or ""))',
-                        filter_code
-                    )
-                )
-            elseif
-                #expr_tokens >= 3
-                and expr_tokens[1].type == "IDENTIFIER"
-                and expr_tokens[2].type == "PUNCTUATION"
-                and expr_tokens[2].value == "("
-            then
-                -- Check if this is a function call
-                local func_name = expr_tokens[1].value
-                if function_registry[func_name] then
-                    -- Parse function arguments
-                    local args = {}
-                    local i = 3 -- Skip function name and opening paren
-                    local current_arg = {}
-                    local paren_depth = 1
-
-                    while i <= #expr_tokens and paren_depth > 0 do
-                        local token = expr_tokens[i]
-                        if token.type == "PUNCTUATION" and token.value == "(" then
-                            paren_depth = paren_depth + 1
-                            table.insert(current_arg, token.value)
-                        elseif token.type == "PUNCTUATION" and token.value == ")" then
-                            paren_depth = paren_depth - 1
-                            if paren_depth > 0 then
-                                table.insert(current_arg, token.value)
-                            end
-                        elseif
-                            token.type == "PUNCTUATION"
-                            and token.value == ","
-                            and paren_depth == 1
-                        then
-                            -- End of current argument
-                            if #current_arg > 0 then
-                                table.insert(args, table.concat(current_arg))
-                                current_arg = {}
-                            end
-                        else
-                            -- Collect tokens for this argument and parse as expression
-                            local arg_tokens = {}
-                            local j = i
-                            local arg_paren_depth = 0
-                            while j <= #expr_tokens do
-                                local arg_token = expr_tokens[j]
-                                if
-                                    arg_token.type == "PUNCTUATION"
-                                    and arg_token.value == "("
-                                then
-                                    arg_paren_depth = arg_paren_depth + 1
-                                elseif
-                                    arg_token.type == "PUNCTUATION"
-                                    and arg_token.value == ")"
-                                then
-                                    arg_paren_depth = arg_paren_depth - 1
-                                    if arg_paren_depth < 0 then
-                                        break
-                                    end
-                                elseif
-                                    arg_token.type == "PUNCTUATION"
-                                    and arg_token.value == ","
-                                    and arg_paren_depth == 0
-                                then
-                                    break
-                                end
-                                table.insert(arg_tokens, arg_token)
-                                j = j + 1
-                            end
-
-                            -- Parse the argument tokens as an expression
-                            local arg_expr_parts = {}
-                            local arg_prev_token = nil
-                            for _, arg_token in ipairs(arg_tokens) do
-                                if
-                                    #arg_expr_parts > 0
-                                    and not (arg_token.type == "PUNCTUATION" and arg_token.value == ".")
-                                    and not (
-                                        arg_prev_token
-                                        and arg_prev_token.type == "PUNCTUATION"
-                                        and arg_prev_token.value == "."
-                                    )
-                                then
-                                    arg_expr_parts[#arg_expr_parts] = arg_expr_parts[#arg_expr_parts]
-                                        .. " "
-                                end
-
-                                if arg_token.type == "IDENTIFIER" then
-                                    -- Don't add "context." prefix if this identifier follows a dot
-                                    if
-                                        arg_prev_token
-                                        and arg_prev_token.type == "PUNCTUATION"
-                                        and arg_prev_token.value == "."
-                                    then
-                                        table.insert(arg_expr_parts, arg_token.value)
-                                    else
-                                        table.insert(
-                                            arg_expr_parts,
-                                            "context." .. arg_token.value
-                                        )
-                                    end
-                                elseif arg_token.type == "LITERAL" then
-                                    if type(arg_token.value) == "string" then
-                                        table.insert(
-                                            arg_expr_parts,
-                                            string.format("%q", arg_token.value)
-                                        )
-                                    else
-                                        table.insert(
-                                            arg_expr_parts,
-                                            tostring(arg_token.value)
-                                        )
-                                    end
-                                else
-                                    table.insert(arg_expr_parts, arg_token.value or "")
-                                end
-                                arg_prev_token = arg_token
-                            end
-
-                            table.insert(args, table.concat(arg_expr_parts))
-                            i = j - 1 -- Skip the tokens we already processed
-                        end
-                        i = i + 1
-                    end
-
-                    -- Add the last argument if any
-                    if #current_arg > 0 then
-                        table.insert(args, table.concat(current_arg))
-                    end
-
-                    -- Generate function call code
-                    local args_str = #args > 0 and ", " .. table.concat(args, ", ")
-                        or ""
-                    local func_call = string.format(
-                        "function_registry[%q](context%s)",
-                        func_name,
-                        args_str
-                    )
-                    table.insert(
-                        body_parts,
-                        string.format(
-                            'table.insert(parts, tostring(%s or ""))',
-                            func_call
-                        )
-                    )
-                else
-                    -- Not a registered function, this is an error
-                    error("Unknown function '" .. func_name .. "'")
-                end
-            elseif #expr_tokens == 1 and expr_tokens[1].type == "IDENTIFIER" then
-                -- Handle simple expressions (backward compatibility)
-                local var_name = expr_tokens[1].value
-                table.insert(
-                    body_parts,
-                    string.format(
-                        'table.insert(parts, tostring(context[%q] or ""))',
-                        var_name
-                    )
-                )
-            else
-                -- Handle complex expressions
-                local expr_parts = {}
-                local prev_token = nil
-                for _, token in ipairs(expr_tokens) do
-                    -- Add space between tokens unless this token is a dot or follows a dot
-                    if
-                        #expr_parts > 0
-                        and not (token.type == "PUNCTUATION" and token.value == ".")
-                        and not (
-                            prev_token
-                            and prev_token.type == "PUNCTUATION"
-                            and prev_token.value == "."
-                        )
-                    then
-                        expr_parts[#expr_parts] = expr_parts[#expr_parts] .. " "
-                    end
-
-                    if token.type == "IDENTIFIER" then
-                        -- Don't add "c." prefix if this identifier follows a dot (property access)
-                        if
-                            prev_token
-                            and prev_token.type == "PUNCTUATION"
-                            and prev_token.value == "."
-                        then
-                            table.insert(expr_parts, token.value)
-                        else
-                            table.insert(expr_parts, "c." .. token.value)
-                        end
-                    elseif token.type == "LITERAL" then
-                        if type(token.value) == "string" then
-                            table.insert(expr_parts, string.format("%q", token.value))
-                        else
-                            table.insert(expr_parts, tostring(token.value))
-                        end
-                    elseif token.type == "OPERATOR" then
-                        table.insert(expr_parts, token.value)
-                    elseif token.type == "KEYWORD" then
-                        table.insert(expr_parts, token.value)
-                    else
-                        table.insert(expr_parts, token.value or "")
-                    end
-                    prev_token = token
-                end
-                local expr_str = table.concat(expr_parts)
-                table.insert(
-                    body_parts,
-                    string.format(
-                        'table.insert(parts, tostring((function(c) return %s end)(context) or ""))',
-                        expr_str
-                    )
-                )
-            end
+            emit_output(scope, output_chunk(expr_tokens, scope))
         elseif token.type == "COMPONENT_START" then
             -- Parse component usage: <ComponentName attr="value" />
             parser.pos = parser.pos + 1
@@ -1408,11 +1096,11 @@ local function compile(template_str)
             parser.pos = parser.pos + 1
 
             -- Check if component is registered
-            local component_template = component_registry[component_name]
+            local component_template = lookup_component(component_name)
             if not component_template then
                 -- Generate code that will error during rendering
-                table.insert(
-                    body_parts,
+                emit(
+                    scope,
                     string.format(
                         "error(\"Component '%s' is not registered\")",
                         component_name
@@ -1457,14 +1145,8 @@ local function compile(template_str)
                                 attributes[attr_name] = attr_info.value
                             elseif attr_info.type == "expression" then
                                 -- Expressions are stored as Lua code with a special marker
-                                local parts = {}
-                                for part in attr_info.value:gmatch("[^.]+") do
-                                    table.insert(parts, string.format("[%q]", part))
-                                end
-                                attributes[attr_name] = "__CODE__"
-                                    .. "tostring(context"
-                                    .. table.concat(parts)
-                                    .. ' or "")'
+                                attributes[attr_name] =
+                                    attribute_expression_code(attr_info.value, scope)
                             end
                         end
                     end
@@ -1486,7 +1168,7 @@ local function compile(template_str)
 
                 if has_malformed_attrs then
                     -- Generate error for malformed attributes
-                    table.insert(body_parts, 'error("malformed attribute")')
+                    emit(scope, 'error("malformed attribute")')
                     -- Skip component closure tokens to prevent cascading errors
                     if
                         parser.pos <= #tokens
@@ -1504,18 +1186,18 @@ local function compile(template_str)
                     -- Inline the component template with attributes as context
                     -- Attributes are already evaluated during parsing
                     local component_chunks =
-                        compile_component(component_template, attributes)
+                        compile_component(component_template, attributes, scope)
                     for _, chunk in ipairs(component_chunks) do
-                        table.insert(body_parts, "table.insert(parts, " .. chunk .. ")")
+                        emit_output(scope, chunk)
                     end
                 else
                     -- Components must be self-closing - generate runtime error
-                    table.insert(body_parts, 'error("malformed component tag")')
+                    emit(scope, 'error("malformed component tag")')
                 end
             end
         elseif token.type == "COMPONENT_CLOSE" then
             -- Handle orphaned component close tags (from malformed component parsing)
-            table.insert(body_parts, 'error("mismatched component tags")')
+            emit(scope, 'error("mismatched component tags")')
             parser.pos = parser.pos + 1
             if
                 parser.pos <= #tokens
@@ -1588,54 +1270,7 @@ local function compile(template_str)
                 end
 
                 -- Generate condition expression
-                local condition_parts = {}
-                local prev_token = nil
-                for _, token in ipairs(condition_tokens) do
-                    -- Add space between tokens unless this token is a dot or follows a dot
-                    if
-                        #condition_parts > 0
-                        and not (token.type == "PUNCTUATION" and token.value == ".")
-                        and not (
-                            prev_token
-                            and prev_token.type == "PUNCTUATION"
-                            and prev_token.value == "."
-                        )
-                    then
-                        condition_parts[#condition_parts] = condition_parts[#condition_parts]
-                            .. " "
-                    end
-
-                    if token.type == "IDENTIFIER" then
-                        -- Don't add "c." prefix if this identifier follows a dot (property access)
-                        if
-                            prev_token
-                            and prev_token.type == "PUNCTUATION"
-                            and prev_token.value == "."
-                        then
-                            table.insert(condition_parts, token.value)
-                        else
-                            table.insert(condition_parts, "c." .. token.value)
-                        end
-                    elseif token.type == "LITERAL" then
-                        if type(token.value) == "string" then
-                            table.insert(
-                                condition_parts,
-                                string.format("%q", token.value)
-                            )
-                        else
-                            table.insert(condition_parts, tostring(token.value))
-                        end
-                    elseif token.type == "OPERATOR" then
-                        table.insert(condition_parts, token.value)
-                    elseif token.type == "PUNCTUATION" then
-                        table.insert(condition_parts, token.value)
-                    else
-                        table.insert(condition_parts, token.value or "")
-                    end
-                    prev_token = token
-                end
-
-                local condition_expr = table.concat(condition_parts, " ")
+                local condition_expr = expression_code(condition_tokens, scope)
                 if condition_expr == "" then
                     error(
                         "Empty if condition: {% if %} requires a condition expression"
@@ -1643,13 +1278,7 @@ local function compile(template_str)
                 end
 
                 -- Start conditional block with template-language truthiness
-                table.insert(
-                    body_parts,
-                    string.format(
-                        "if is_truthy((function(c) return %s end)(context)) then",
-                        condition_expr
-                    )
-                )
+                emit(scope, string.format("if is_truthy(%s) then", condition_expr))
                 table.insert(conditional_stack, true)
             elseif stmt_token.type == "IF_END" then
                 -- End conditional block
@@ -1657,7 +1286,7 @@ local function compile(template_str)
                     error("Unexpected endif without matching if")
                 end
                 table.remove(conditional_stack)
-                table.insert(body_parts, "end")
+                emit(scope, "end")
                 parser.pos = parser.pos + 1
 
                 if parser.pos > #tokens or tokens[parser.pos].type ~= "STMT_END" then
@@ -1757,115 +1386,44 @@ local function compile(template_str)
                 end
 
                 -- Generate collection expression
-                local collection_parts = {}
-                local prev_token = nil
-                for _, token in ipairs(inner_collection_tokens) do
-                    -- Add space between tokens unless this token is a dot or follows a dot
-                    if
-                        #collection_parts > 0
-                        and not (token.type == "PUNCTUATION" and token.value == ".")
-                        and not (
-                            prev_token
-                            and prev_token.type == "PUNCTUATION"
-                            and prev_token.value == "."
-                        )
-                    then
-                        collection_parts[#collection_parts] = collection_parts[#collection_parts]
-                            .. " "
-                    end
-
-                    if token.type == "IDENTIFIER" then
-                        -- Don't add "c." prefix if this identifier follows a dot (property access)
-                        if
-                            prev_token
-                            and prev_token.type == "PUNCTUATION"
-                            and prev_token.value == "."
-                        then
-                            table.insert(collection_parts, token.value)
-                        else
-                            table.insert(collection_parts, "c." .. token.value)
-                        end
-                    elseif token.type == "LITERAL" then
-                        if type(token.value) == "string" then
-                            table.insert(
-                                collection_parts,
-                                string.format("%q", token.value)
-                            )
-                        else
-                            table.insert(collection_parts, tostring(token.value))
-                        end
-                    elseif token.type == "OPERATOR" then
-                        table.insert(collection_parts, token.value)
-                    elseif token.type == "PUNCTUATION" then
-                        table.insert(collection_parts, token.value)
-                    else
-                        table.insert(collection_parts, token.value or "")
-                    end
-                    prev_token = token
-                end
-
-                local collection_expr = table.concat(collection_parts, " ")
+                local collection_expr = expression_code(inner_collection_tokens, scope)
                 if collection_expr == "" then
                     error(
                         "Empty for collection: {% for var in %} requires a collection expression"
                     )
                 end
 
-                -- Generate for loop code
+                -- Generate for loop code. Loop variables are locals named after
+                -- the template's variables so expressions in the body read them
+                -- directly.
+                local loop = { variables = { [loop_var1] = true } }
                 if is_key_value then
-                    if use_pairs then
-                        -- Key-value iteration: for key, value in pairs(collection)
-                        table.insert(
-                            body_parts,
-                            string.format(
-                                "for %s, %s in pairs((function(c) return %s end)(context) or {}) do",
-                                loop_var1,
-                                loop_var2,
-                                collection_expr
-                            )
-                        )
-                    else
-                        -- Indexed array iteration: for index, item in ipairs(collection)
-                        table.insert(
-                            body_parts,
-                            string.format(
-                                "for %s, %s in ipairs((function(c) return %s end)(context) or {}) do",
-                                loop_var1,
-                                loop_var2,
-                                collection_expr
-                            )
-                        )
-                    end
-                    table.insert(
-                        body_parts,
+                    loop.variables[loop_var2] = true
+                    emit(
+                        scope,
                         string.format(
-                            "local loop_context = setmetatable({%s = %s, %s = %s}, {__index = context})",
-                            loop_var1,
+                            "for l_%s, l_%s in %s((%s) or EMPTY) do",
                             loop_var1,
                             loop_var2,
-                            loop_var2
+                            use_pairs and "pairs" or "ipairs",
+                            collection_expr
                         )
                     )
                 else
                     -- Array iteration: for _, item in ipairs(collection)
-                    table.insert(
-                        body_parts,
+                    emit(
+                        scope,
                         string.format(
-                            "for _, %s in ipairs((function(c) return %s end)(context) or {}) do",
+                            "for _, l_%s in ipairs((%s) or EMPTY) do",
                             loop_var1,
                             collection_expr
                         )
                     )
-                    table.insert(
-                        body_parts,
-                        string.format(
-                            "local loop_context = setmetatable({%s = %s}, {__index = context})",
-                            loop_var1,
-                            loop_var1
-                        )
-                    )
                 end
-                table.insert(body_parts, "context = loop_context")
+                -- Filled in at endfor if a function call needs the loop's context
+                emit(scope, "")
+                loop.context_line = #scope.body
+                table.insert(scope.loops, loop)
                 table.insert(conditional_stack, "for") -- Track for loops
             elseif stmt_token.type == "FOR_END" then
                 -- End for loop block
@@ -1876,8 +1434,31 @@ local function compile(template_str)
                     error("Unexpected endfor without matching for")
                 end
                 table.remove(conditional_stack)
-                table.insert(body_parts, "context = getmetatable(context).__index") -- Restore original context
-                table.insert(body_parts, "end")
+                local loop = table.remove(scope.loops)
+                if loop.needs_context then
+                    local fields = {}
+                    for name in pairs(loop.variables) do
+                        table.insert(fields, string.format("[%q] = l_%s", name, name))
+                    end
+                    table.sort(fields)
+                    scope.body[loop.context_line] = string.format(
+                        "local context = setmetatable({ %s }, { __index = context })",
+                        table.concat(fields, ", ")
+                    )
+                else
+                    table.remove(scope.body, loop.context_line)
+                end
+                -- Loops are where output grows with the data, so a streaming
+                -- render hands its buffer to the sink once per iteration
+                -- when it holds STREAM_BYTES or more. Inside a cache tag the
+                -- buffer has to stay whole until the fragment is stored.
+                if #scope.caches == 0 then
+                    emit(scope, "if sink and size >= STREAM_BYTES then")
+                    emit(scope, "sink(concat(parts, \"\", 1, n))")
+                    emit(scope, "n, size = 0, 0")
+                    emit(scope, "end")
+                end
+                emit(scope, "end")
                 parser.pos = parser.pos + 1
 
                 if parser.pos > #tokens or tokens[parser.pos].type ~= "STMT_END" then
@@ -1891,6 +1472,107 @@ local function compile(template_str)
             elseif stmt_token.type == "BLOCK_END" then
                 -- Skip block end statements (shouldn't be here in final tokens)
                 parser.pos = parser.pos + 1
+            elseif stmt_token.type == "CACHE_START" then
+                -- {% cache "name" [ttl] [expression, ...] %} renders its body
+                -- once for each set of values and reuses the output.
+                parser.pos = parser.pos + 1
+                local name_token = tokens[parser.pos]
+                if
+                    not name_token
+                    or name_token.type ~= "LITERAL"
+                    or type(name_token.value) ~= "string"
+                then
+                    error("Expected quoted fragment name after cache")
+                end
+                parser.pos = parser.pos + 1
+
+                local ttl = "nil"
+                local ttl_token = tokens[parser.pos]
+                if
+                    ttl_token
+                    and ttl_token.type == "LITERAL"
+                    and type(ttl_token.value) == "number"
+                then
+                    ttl = tostring(ttl_token.value)
+                    parser.pos = parser.pos + 1
+                end
+
+                -- The rest are the values the output depends on, separated by
+                -- commas outside of parentheses.
+                local key_parts = { escape_lua_string(name_token.value) }
+                local value_tokens = {}
+                local depth = 0
+                local function add_value()
+                    local value_code = expression_code(value_tokens, scope)
+                    if value_code == "" then
+                        error("Empty value in cache statement")
+                    end
+                    table.insert(key_parts, "tostring(" .. value_code .. ")")
+                    value_tokens = {}
+                end
+                while parser.pos <= #tokens and tokens[parser.pos].type ~= "STMT_END" do
+                    local value_token = tokens[parser.pos]
+                    if
+                        value_token.type == "PUNCTUATION"
+                        and value_token.value == ","
+                        and depth == 0
+                    then
+                        add_value()
+                    else
+                        if value_token.value == "(" then
+                            depth = depth + 1
+                        elseif value_token.value == ")" then
+                            depth = depth - 1
+                        end
+                        table.insert(value_tokens, value_token)
+                    end
+                    parser.pos = parser.pos + 1
+                end
+                if #value_tokens > 0 or #key_parts > 1 then
+                    add_value()
+                end
+
+                if parser.pos > #tokens then
+                    error("Unclosed cache statement")
+                end
+
+                emit(scope, "do")
+                emit(
+                    scope,
+                    string.format(
+                        'local fragment_key = concat({ %s }, "\\0")',
+                        table.concat(key_parts, ", ")
+                    )
+                )
+                emit(scope, "local fragment = fragments:get(fragment_key)")
+                emit(scope, "if fragment then")
+                emit(scope, "n = n + 1")
+                emit(scope, "parts[n] = fragment")
+                emit(scope, "size = size + #fragment")
+                emit(scope, "else")
+                emit(scope, "local fragment_start = n")
+                table.insert(scope.caches, ttl)
+                table.insert(conditional_stack, "cache")
+            elseif stmt_token.type == "CACHE_END" then
+                if
+                    #conditional_stack == 0
+                    or conditional_stack[#conditional_stack] ~= "cache"
+                then
+                    error("Unexpected endcache without matching cache")
+                end
+                table.remove(conditional_stack)
+                local ttl = table.remove(scope.caches)
+                emit(scope, 'fragment = concat(parts, "", fragment_start + 1, n)')
+                emit(scope, "n = fragment_start + 1")
+                emit(scope, "parts[n] = fragment")
+                emit(scope, "fragments:set(fragment_key, fragment, " .. ttl .. ")")
+                emit(scope, "end")
+                emit(scope, "end")
+                parser.pos = parser.pos + 1
+
+                if parser.pos > #tokens or tokens[parser.pos].type ~= "STMT_END" then
+                    error("Unclosed endcache statement")
+                end
             else
                 error("Unknown statement type: " .. stmt_token.type)
             end
@@ -1907,38 +1589,210 @@ local function compile(template_str)
         local unclosed_type = conditional_stack[#conditional_stack]
         if unclosed_type == "for" then
             error("Unclosed for statement(s)")
+        elseif unclosed_type == "cache" then
+            error("Unclosed cache statement(s)")
         else
             error("Unclosed if statement(s)")
         end
     end
 
     -- Finish the function body
-    table.insert(body_parts, "return table.concat(parts)")
+    emit(scope, "return concat(parts, \"\", 1, n)")
+
+    -- The chunk builds the render function once. Everything a render needs
+    -- from outside is an upvalue or read into a local before the output starts.
+    local lines = {
+        "local tostring, setmetatable, pairs, ipairs = tostring, setmetatable, pairs, ipairs",
+        "local type, next, concat = type, next, table.concat",
+        "local EMPTY = {}",
+        "local STREAM_BYTES = " .. STREAM_BYTES,
+        "local fragments, escape = ...",
+        "local function is_truthy(val)",
+        "  return val ~= false and val ~= nil and val ~= 0 and val ~= '' and (type(val) ~= 'table' or next(val) ~= nil)",
+        "end",
+        "return function(context, filter_registry, function_registry, sink)",
+    }
+    table.move(scope.lookups, 1, #scope.lookups, #lines + 1, lines)
+    table.insert(lines, "local parts, n, size = {}, 0, 0")
+    table.move(scope.body, 1, #scope.body, #lines + 1, lines)
+    table.insert(lines, "end")
 
-    -- Build the complete function body
-    local body = table.concat(body_parts, "\n")
+    local body = table.concat(lines, "\n")
     local chunk, load_err = load(body)
     if not chunk then
         error("Failed to compile template: " .. load_err)
     end
 
-    -- Note: filter_registry is passed as parameter to compiled functions
+    return make_template(chunk, body), chunk
+end
 
-    -- Format the body for pretty printing
-    local formatted_body = table.concat(body_parts, "\n")
+-- Compiled templates are cached as bytecode files that start with this line,
+-- followed by one line per dependency, a blank line, the length of the
+-- generated code, the code, and the bytecode.
+local CACHE_HEADER = "nibiru-template-cache 1\n"
+
+--- Counts of cache lookups since startup
+Template.cache_stats = { hits = 0, misses = 0 }
+
+--- Hash of the compiler itself so a new nibiru version ignores old entries
+---@type string|nil
+local compiler_hash = nil
+
+--- Get the hash that every cache key starts from.
+--- It covers the Lua version, the build of nibiru_core, which tokenizer
+--- compiles run with and the source of the Lua compiler itself.
+---@return string
+local function get_compiler_hash()
+    if not compiler_hash then
+        local sources = {
+            _VERSION,
+            core.build,
+            Tokenizer.native and "native" or "lua",
+        }
+        local template_source = debug.getinfo(1, "S").source
+        local tokenizer_source = package.searchpath("nibiru.tokenizer", package.path)
+        for _, source_path in ipairs({
+            template_source:sub(1, 1) == "@" and template_source:sub(2),
+            tokenizer_source,
+        }) do
+            local file = source_path and io.open(source_path, "rb")
+            if file then
+                table.insert(sources, file:read("a"))
+                file:close()
+            end
+        end
+        compiler_hash = core.hash(table.concat(sources, "\0"))
+    end
+    return compiler_hash
+end
 
-    -- Return a Template instance
-    local result = {
-        render = function(context)
-            -- Wrap context in a table if not already
-            local ctx = type(context) == "table" and context or {}
-            return chunk(ctx, filter_registry, function_registry)
-        end,
-        code = formatted_body,
-    }
-    -- Make it a proper Template instance
-    setmetatable(result, Template_mt)
-    return result
+--- Hash the current content of a template or component a cache entry used.
+---@param kind string "template" or "component"
+---@param name string
+---@return string hash The content hash, or "-" if it is not registered
+local function dependency_hash(kind, name)
+    local content
+    if kind == "template" then
+        content = template_registry[name]
+    else
+        content = component_registry[name]
+    end
+    return content and core.hash(content) or "-"
+end
+
+--- Load a cached template if its dependencies are unchanged.
+---@param file_path string
+---@return Template|nil
+local function load_cached(file_path)
+    local file = io.open(file_path, "rb")
+    if not file then
+        return nil
+    end
+    local data = file:read("a")
+    file:close()
+    if not data or data:sub(1, #CACHE_HEADER) ~= CACHE_HEADER then
+        return nil
+    end
+
+    local position = #CACHE_HEADER + 1
+    while data:sub(position, position) ~= "\n" do
+        local kind, hash, name, next_position =
+            data:match("^(%a+) (%S+) ([^\n]*)\n()", position)
+        if not kind or dependency_hash(kind, name) ~= hash then
+            return nil
+        end
+        position = next_position
+    end
+
+    local code_length, code_start = data:match("^(%d+)\n()", position + 1)
+    if not code_length then
+        return nil
+    end
+    local code_end = code_start + tonumber(code_length)
+    local chunk = load(data:sub(code_end), "=template", "b")
+    if not chunk then
+        -- Bytecode from another Lua build is rejected and compiled again.
+        return nil
+    end
+    return make_template(chunk, data:sub(code_start, code_end - 1))
+end
+
+--- Write a compiled template to the cache.
+---
+--- The entry is written to a temporary file and renamed into place so that
+--- workers starting at the same time never read a partial entry.
+---@param file_path string
+---@param dependencies table<string, table<string, boolean>>
+---@param code string
+---@param chunk function
+local function store_cached(file_path, dependencies, code, chunk)
+    local lines = { CACHE_HEADER }
+    for _, kind in ipairs({ "template", "component" }) do
+        local names = {}
+        for name in pairs(dependencies[kind]) do
+            table.insert(names, name)
+        end
+        table.sort(names)
+        for _, name in ipairs(names) do
+            local hash = dependency_hash(kind, name)
+            table.insert(lines, kind .. " " .. hash .. " " .. name .. "\n")
+        end
+    end
+    table.insert(lines, "\n" .. #code .. "\n")
+    table.insert(lines, code)
+    table.insert(lines, string.dump(chunk, true))
+
+    local temporary_path =
+        string.format("%s.%d.tmp", file_path, math.random(1, 1000000000))
+    local file = io.open(temporary_path, "wb")
+    if not file then
+        -- An unwritable cache only costs the next start a compile.
+        return
+    end
+    local ok = file:write(table.concat(lines))
+    file:close()
+    if not ok or not os.rename(temporary_path, file_path) then
+        os.remove(temporary_path)
+    end
+end
+
+--- Compile a template, reusing cached bytecode when nothing it depends on has
+--- changed.
+---@param template_str string
+---@return Template
+local function compile_cached(template_str)
+    local key = core.hash(get_compiler_hash() .. template_str)
+    local file_path = cache_directory .. "/" .. key .. ".luac"
+    local template = load_cached(file_path)
+    if template then
+        Template.cache_stats.hits = Template.cache_stats.hits + 1
+        return template
+    end
+    Template.cache_stats.misses = Template.cache_stats.misses + 1
+
+    compile_dependencies = { template = {}, component = {} }
+    local ok, compiled, chunk = pcall(compile, template_str)
+    local dependencies = compile_dependencies
+    compile_dependencies = nil
+    if not ok then
+        error(compiled, 0)
+    end
+    store_cached(file_path, dependencies, compiled.code, chunk)
+    return compiled
+end
+
+--- Cache compiled templates as bytecode in a directory.
+---
+--- The directory is created if its parent exists. Entries are keyed by a hash
+--- of the template content and checked against the content of every template
+--- and component the compile read, so stale entries are never used.
+---@param directory string|nil The cache directory, or nil to turn caching off
+function Template.set_cache_directory(directory)
+    if directory then
+        core = core or require("nibiru_core")
+        core.make_directory(directory)
+    end
+    cache_directory = directory
 end
 
 --- Register a named template for inheritance.
@@ -1953,13 +1807,58 @@ function Template.register(name, template_string)
     end
     template_registry[name] = template_string
     -- Pre-compile the template for fast rendering
-    compiled_registry[name] = compile(template_string)
+    if cache_directory then
+        compiled_registry[name] = compile_cached(template_string)
+    else
+        compiled_registry[name] = compile(template_string)
+    end
+end
+
+--- Replace the content of templates and recompile them with their dependents.
+---
+--- New names are registered. Every template in names is compiled against the
+--- new content before any compiled template is swapped, so a broken edit
+--- leaves the previous templates rendering and raises the compile error.
+---@param names string[] Templates to recompile, including every one that extends a changed template
+---@param contents table<string, string> New content for the templates that changed
+function Template.replace(names, contents)
+    local previous = {}
+    for name, template_string in pairs(contents) do
+        previous[name] = template_registry[name] or false
+        template_registry[name] = template_string
+    end
+
+    local compiled = {}
+    local ok, err = pcall(function()
+        for _, name in ipairs(names) do
+            local template_string = template_registry[name]
+            if cache_directory then
+                compiled[name] = compile_cached(template_string)
+            else
+                compiled[name] = compile(template_string)
+            end
+        end
+    end)
+    if not ok then
+        for name, template_string in pairs(previous) do
+            template_registry[name] = template_string or nil
+        end
+        error(err, 0)
+    end
+
+    for name, template in pairs(compiled) do
+        compiled_registry[name] = template
+    end
+    -- Cached fragments may hold output of the old templates.
+    Template.fragments:clear()
 end
 
 --- Clear all registered templates (for testing).
 function Template.clear_templates()
     template_registry = {}
     compiled_registry = {}
+    parsed_templates = {}
+    Template.fragments:clear()
 end
 
 -- Load built-in filters automatically
@@ -1,6 +1,13 @@
 -- nibiru/tokenizer.lua
 local Tokenizer = {}
 
+-- The C tokenizer is used when the core library provides one.
+local has_core, core = pcall(require, "nibiru_core")
+local native_tokenize = has_core and core.tokenize
+
+--- Whether tokenize uses the C tokenizer by default
+Tokenizer.native = native_tokenize and true or false
+
 --- Check if character is alphabetic.
 ---@param c string Single character to check
 ---@return boolean True if alphabetic
@@ -74,6 +81,10 @@ local function tokenize_stmt(input)
                 table.insert(tokens, { type = "BLOCK_START" })
             elseif word == "endblock" then
                 table.insert(tokens, { type = "BLOCK_END" })
+            elseif word == "cache" then
+                table.insert(tokens, { type = "CACHE_START" })
+            elseif word == "endcache" then
+                table.insert(tokens, { type = "CACHE_END" })
             elseif
                 word == "or"
                 or word == "and"
@@ -281,9 +292,17 @@ end
 
 --- Tokenize a template string into tokens for parsing.
 --- Supports: TEXT, EXPR_START/EXPR_END, STMT_START/STMT_END, COMPONENT_* tokens
+---
+--- Unless native is false, the C tokenizer does the work in a single pass
+--- and returns the same tokens.
 ---@param template_str string Template string to tokenize
+---@param native boolean? Whether to tokenize in C when it is available
 ---@return table Array of token objects with type and optional value fields
-function Tokenizer.tokenize(template_str)
+function Tokenizer.tokenize(template_str, native)
+    if native_tokenize and native ~= false then
+        return native_tokenize(template_str)
+    end
+
     local tokens = {}
     local pos = 1
     local len = #template_str
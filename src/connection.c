@@ -0,0 +1,440 @@
+// connection.c - Buffered client connections for the worker loop
+
+#include "connection.h"
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// Receive buffers of RECEIVE_BUFFER_SIZE waiting for reuse
+// Each worker process has its own pool.
+static char *buffer_pool[RECEIVE_BUFFER_POOL_SIZE];
+static int buffer_pool_count = 0;
+
+// Give a connection's receive buffer back to the pool
+static void release_input(struct Connection *connection) {
+    if (connection->input_capacity == RECEIVE_BUFFER_SIZE &&
+        buffer_pool_count < RECEIVE_BUFFER_POOL_SIZE) {
+        buffer_pool[buffer_pool_count++] = connection->input;
+    } else {
+        // Grown buffers are not pooled so one large request doesn't keep
+        // its memory around.
+        free(connection->input);
+    }
+    connection->input = NULL;
+    connection->input_capacity = 0;
+}
+
+// Make room for more input, growing the buffer up to limit bytes
+// Returns: 0 on success, -1 if the buffer is at its limit or memory could
+// not be allocated
+static int reserve_input(struct Connection *connection, size_t limit) {
+    if (!connection->input) {
+        if (buffer_pool_count > 0) {
+            connection->input = buffer_pool[--buffer_pool_count];
+        } else {
+            connection->input = malloc(RECEIVE_BUFFER_SIZE);
+            if (!connection->input) {
+                return -1;
+            }
+        }
+        connection->input_capacity = RECEIVE_BUFFER_SIZE;
+    }
+    if (connection->input_length < connection->input_capacity) {
+        return 0;
+    }
+    if (connection->input_capacity >= limit) {
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    size_t capacity = connection->input_capacity * 2;
+    if (capacity > limit) {
+        capacity = limit;
+    }
+    char *input = realloc(connection->input, capacity);
+    if (!input) {
+        return -1;
+    }
+    connection->input = input;
+    connection->input_capacity = capacity;
+    return 0;
+}
+
+// Create a connection for an accepted client socket
+struct Connection *connection_create(int fd) {
+    struct Connection *connection = malloc(sizeof(struct Connection));
+    if (!connection) {
+        return NULL;
+    }
+    connection->fd = fd;
+    connection->input = NULL;
+    connection->input_length = 0;
+    connection->input_capacity = 0;
+    connection->output = NULL;
+    connection->output_length = 0;
+    connection->output_capacity = 0;
+    connection->output_sent = 0;
+    connection->file = NULL;
+    connection->file_fd = -1;
+    connection->file_ranges = NULL;
+    connection->file_range_count = 0;
+    connection->file_range_capacity = 0;
+    connection->file_ranges_sent = 0;
+    connection->requests_served = 0;
+    connection->closing = 0;
+    connection->paused = NULL;
+    connection->last_active = time(NULL);
+    connection->prev = NULL;
+    connection->next = NULL;
+    return connection;
+}
+
+// Close the client socket and release the connection
+void connection_destroy(struct Connection *connection) {
+    close(connection->fd);
+    if (connection->input) {
+        release_input(connection);
+    }
+    free(connection->output);
+    if (connection->file) {
+        static_file_release(connection->file);
+    }
+    free(connection->file_ranges);
+    free(connection);
+}
+
+// Read available data from the socket into the input buffer
+ssize_t connection_receive(struct Connection *connection, size_t limit) {
+    if (reserve_input(connection, limit) == -1) {
+        return -1;
+    }
+
+    ssize_t bytes_received =
+        recv(connection->fd, connection->input + connection->input_length,
+             connection->input_capacity - connection->input_length, 0);
+    if (bytes_received > 0) {
+        connection->input_length += bytes_received;
+    } else if (connection->input_length == 0) {
+        release_input(connection);
+    }
+    return bytes_received;
+}
+
+// Drop handled bytes from the front of the input buffer
+void connection_consume(struct Connection *connection, size_t length) {
+    connection->input_length -= length;
+    if (connection->input_length == 0) {
+        release_input(connection);
+        return;
+    }
+    memmove(connection->input, connection->input + length,
+            connection->input_length);
+}
+
+// Append data to the output queue
+static int queue_output(struct Connection *connection, const char *data,
+                        size_t length) {
+    size_t needed = connection->output_length + length;
+    if (needed > connection->output_capacity && connection->output_sent > 0 &&
+        connection->file_range_count == 0) {
+        // Drop the sent bytes before growing, so a queue that is drained
+        // while more is streamed behind it doesn't keep growing.
+        connection->output_length -= connection->output_sent;
+        memmove(connection->output,
+                connection->output + connection->output_sent,
+                connection->output_length);
+        connection->output_sent = 0;
+        needed = connection->output_length + length;
+    }
+    if (needed > connection->output_capacity) {
+        size_t capacity = connection->output_capacity == 0
+                              ? 4096
+                              : connection->output_capacity;
+        while (capacity < needed) {
+            capacity *= 2;
+        }
+        char *output = realloc(connection->output, capacity);
+        if (!output) {
+            return -1;
+        }
+        connection->output = output;
+        connection->output_capacity = capacity;
+    }
+    memcpy(connection->output + connection->output_length, data, length);
+    connection->output_length = needed;
+    return 0;
+}
+
+// Send data to the client, queueing whatever the socket can't take yet
+int connection_write(struct Connection *connection, const char *data,
+                     size_t length) {
+    // Keep responses in order behind anything already queued.
+    if (connection_has_output(connection)) {
+        return queue_output(connection, data, length);
+    }
+
+    while (length > 0) {
+        ssize_t sent = send(connection->fd, data, length, 0);
+        if (sent == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return queue_output(connection, data, length);
+            }
+            return -1;
+        }
+        data += sent;
+        length -= sent;
+    }
+    return 0;
+}
+
+// Send several pieces of data to the client with one system call
+int connection_writev(struct Connection *connection, const struct iovec *iov,
+                      int count) {
+    int index = 0;
+    size_t skip = 0; // Bytes of iov[index] already sent
+    while (index < count && !connection_has_output(connection)) {
+        struct iovec pending[CONNECTION_MAX_IOV];
+        int pending_count = 0;
+        for (int i = index; i < count && pending_count < CONNECTION_MAX_IOV;
+             i++) {
+            pending[pending_count] = iov[i];
+            if (i == index) {
+                pending[0].iov_base = (char *)iov[i].iov_base + skip;
+                pending[0].iov_len -= skip;
+            }
+            pending_count++;
+        }
+
+        ssize_t sent = writev(connection->fd, pending, pending_count);
+        if (sent == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            return -1;
+        }
+        // Advance past everything the socket took.
+        size_t remaining = sent + skip;
+        while (index < count && remaining >= iov[index].iov_len) {
+            remaining -= iov[index].iov_len;
+            index++;
+        }
+        skip = remaining;
+    }
+
+    // Queue whatever is left behind the output already waiting.
+    for (; index < count; index++) {
+        if (queue_output(connection, (const char *)iov[index].iov_base + skip,
+                         iov[index].iov_len - skip) == -1) {
+            return -1;
+        }
+        skip = 0;
+    }
+    return 0;
+}
+
+// Send part of a static file (fd) to the client after any queued output
+int connection_send_file(struct Connection *connection,
+                         struct StaticFile *file, int fd, off_t offset,
+                         off_t length) {
+    if (connection->file_range_count == connection->file_range_capacity) {
+        int capacity = connection->file_range_capacity == 0
+                           ? 1
+                           : connection->file_range_capacity * 2;
+        struct FileRange *ranges = realloc(
+            connection->file_ranges, capacity * sizeof(struct FileRange));
+        if (!ranges) {
+            return -1;
+        }
+        connection->file_ranges = ranges;
+        connection->file_range_capacity = capacity;
+    }
+
+    if (!connection->file) {
+        static_file_retain(file);
+        connection->file = file;
+        connection->file_fd = fd;
+    }
+    struct FileRange *range =
+        &connection->file_ranges[connection->file_range_count++];
+    range->position = connection->output_length;
+    range->offset = offset;
+    range->end = offset + length;
+    return connection_flush(connection) == -1 ? -1 : 0;
+}
+
+// Send queued output bytes up to position
+// Returns: 1 if they are sent, 0 if some are still pending, -1 on error
+static int flush_output(struct Connection *connection, size_t position) {
+    while (connection->output_sent < position) {
+        ssize_t sent =
+            send(connection->fd, connection->output + connection->output_sent,
+                 position - connection->output_sent, 0);
+        if (sent == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
+            }
+            return -1;
+        }
+        connection->output_sent += sent;
+    }
+    return 1;
+}
+
+// Send a queued file range
+// Returns: 1 if it is sent, 0 if some is still pending, -1 on error
+static int flush_file_range(struct Connection *connection,
+                            struct FileRange *range) {
+    while (range->offset < range->end) {
+        ssize_t sent = send_static_file(connection->fd, connection->file_fd,
+                                        &range->offset,
+                                        range->end - range->offset);
+        if (sent == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
+            }
+            return -1;
+        }
+        if (sent == 0) {
+            // The file shrank so the promised length can't be sent.
+            return -1;
+        }
+    }
+    return 1;
+}
+
+// Send queued output
+int connection_flush(struct Connection *connection) {
+    while (connection->file_ranges_sent < connection->file_range_count) {
+        struct FileRange *range =
+            &connection->file_ranges[connection->file_ranges_sent];
+        int result = flush_output(connection, range->position);
+        if (result == 1) {
+            result = flush_file_range(connection, range);
+        }
+        if (result != 1) {
+            return result;
+        }
+        connection->file_ranges_sent++;
+    }
+
+    int result = flush_output(connection, connection->output_length);
+    if (result != 1) {
+        return result;
+    }
+    connection->output_length = 0;
+    connection->output_sent = 0;
+    if (connection->file) {
+        static_file_release(connection->file);
+        connection->file = NULL;
+        connection->file_range_count = 0;
+        connection->file_ranges_sent = 0;
+    }
+    return 1;
+}
+
+// Get the milliseconds on a clock that only moves forward
+static long long monotonic_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+// Block until at most high_water bytes of output are queued
+int connection_drain(struct Connection *connection, size_t high_water,
+                     int timeout_ms) {
+    // The deadline is fixed up front so a client that reads a few bytes at
+    // a time can't extend the wait forever.
+    long long deadline = monotonic_ms() + timeout_ms;
+    while (connection_queued(connection) > high_water) {
+        long long remaining = deadline - monotonic_ms();
+        if (remaining <= 0) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+        struct pollfd poll_fd = {.fd = connection->fd, .events = POLLOUT};
+        int ready = poll(&poll_fd, 1, (int)remaining);
+        if (ready == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (ready == 0) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+        if (connection_flush(connection) == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Count the queued output bytes not sent yet
+size_t connection_queued(const struct Connection *connection) {
+    return connection->output_length - connection->output_sent;
+}
+
+// Check if the connection has queued output
+int connection_has_output(const struct Connection *connection) {
+    return connection->output_sent < connection->output_length ||
+           connection->file != NULL;
+}
+
+// Add a connection to the tail (most recently active end) of the list
+void connection_list_append(struct ConnectionList *list,
+                            struct Connection *connection) {
+    connection->prev = list->tail;
+    connection->next = NULL;
+    if (list->tail) {
+        list->tail->next = connection;
+    } else {
+        list->head = connection;
+    }
+    list->tail = connection;
+    list->count++;
+}
+
+// Remove a connection from the list
+void connection_list_remove(struct ConnectionList *list,
+                            struct Connection *connection) {
+    if (connection->prev) {
+        connection->prev->next = connection->next;
+    } else {
+        list->head = connection->next;
+    }
+    if (connection->next) {
+        connection->next->prev = connection->prev;
+    } else {
+        list->tail = connection->prev;
+    }
+    connection->prev = NULL;
+    connection->next = NULL;
+    list->count--;
+}
+
+// Mark a connection as active and move it to the tail of the list
+void connection_list_touch(struct ConnectionList *list,
+                           struct Connection *connection, time_t now) {
+    connection->last_active = now;
+    if (list->tail != connection) {
+        connection_list_remove(list, connection);
+        connection_list_append(list, connection);
+    }
+}
@@ -0,0 +1,147 @@
+// connection.h - Buffered client connections for the worker loop
+
+#ifndef CONNECTION_H
+#define CONNECTION_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <time.h>
+
+#include "static.h"
+
+// Initial size of a connection's receive buffer
+// Buffers of this size are pooled and reused across connections. Larger
+// requests grow the buffer up to the limit given to connection_receive.
+#define RECEIVE_BUFFER_SIZE 4096
+
+// Receive buffers a worker keeps for reuse
+#define RECEIVE_BUFFER_POOL_SIZE 64
+
+// Pieces of data connection_writev hands to one writev call
+#define CONNECTION_MAX_IOV 64
+
+// Queued output a streamed response may leave behind before the writer
+// waits for the client to read some of it
+#define CONNECTION_OUTPUT_HIGH_WATER 65536
+
+// A range of a file to send once the output before it is sent
+struct FileRange {
+    // Output bytes that go out before the range
+    size_t position;
+    // Next byte of the file to send and the end of the range
+    off_t offset;
+    off_t end;
+};
+
+struct Connection {
+    int fd;
+    // Bytes received from the client that are not handled yet
+    // The buffer is only held while there is unhandled input so idle
+    // connections don't pin memory.
+    char *input;
+    size_t input_length;
+    size_t input_capacity;
+    // Response bytes waiting for the socket to become writable
+    char *output;
+    size_t output_length;
+    size_t output_capacity;
+    size_t output_sent;
+    // File ranges sent between the queued output bytes. Every range comes
+    // from the same static file; fd is the file itself or one of its
+    // precompressed siblings.
+    struct StaticFile *file;
+    int file_fd;
+    struct FileRange *file_ranges;
+    int file_range_count;
+    int file_range_capacity;
+    int file_ranges_sent;
+    // Requests handled on this connection
+    int requests_served;
+    // Set once the connection should close after its output drains
+    int closing;
+    // A response waiting for the client to read more of its output before
+    // it continues. The worker owns it.
+    struct PausedResponse *paused;
+    // Last time the client sent data or the socket accepted output
+    time_t last_active;
+    // Links in the idle list, ordered from least to most recently active
+    struct Connection *prev;
+    struct Connection *next;
+};
+
+// Connections ordered by activity so idle ones can be expired from the head
+struct ConnectionList {
+    struct Connection *head;
+    struct Connection *tail;
+    int count;
+};
+
+// Create a connection for an accepted client socket
+// Returns NULL if memory could not be allocated.
+struct Connection *connection_create(int fd);
+
+// Close the client socket and release the connection
+void connection_destroy(struct Connection *connection);
+
+// Read available data from the socket into the input buffer
+// The buffer grows as needed up to limit bytes.
+// Returns: the number of bytes read, 0 if the client closed the connection,
+// or -1 on error. errno is EAGAIN when no data was ready (or a receive
+// timeout expired) and ENOBUFS when the input buffer is at its limit.
+ssize_t connection_receive(struct Connection *connection, size_t limit);
+
+// Drop handled bytes from the front of the input buffer
+void connection_consume(struct Connection *connection, size_t length);
+
+// Send data to the client, queueing whatever the socket can't take yet
+// Returns: 0 on success, -1 on error
+int connection_write(struct Connection *connection, const char *data,
+                     size_t length);
+
+// Send several pieces of data to the client with one system call
+// The pieces go out in order after any queued output. At most
+// CONNECTION_MAX_IOV are handed to the kernel at a time.
+// Returns: 0 on success, -1 on error
+int connection_writev(struct Connection *connection, const struct iovec *iov,
+                      int count);
+
+// Send part of a static file (fd) to the client after any queued output
+// The file is retained until it is sent or the connection is destroyed.
+// Every range queued before the output drains must come from the same file
+// and fd. Later writes are queued behind the range.
+// Returns: 0 on success, -1 on error
+int connection_send_file(struct Connection *connection,
+                         struct StaticFile *file, int fd, off_t offset,
+                         off_t length);
+
+// Send queued output
+// Returns: 1 if all output is sent, 0 if output is still pending, -1 on error
+int connection_flush(struct Connection *connection);
+
+// Block until at most high_water bytes of output are queued
+// Waits for the socket to become writable and sends queued output. Gives
+// up once timeout_ms has passed in total, however much the socket took.
+// Returns: 0 on success, -1 on error or timeout (errno is ETIMEDOUT)
+int connection_drain(struct Connection *connection, size_t high_water,
+                     int timeout_ms);
+
+// Count the queued output bytes not sent yet, leaving out file ranges
+size_t connection_queued(const struct Connection *connection);
+
+// Check if the connection has queued output or a file to send
+int connection_has_output(const struct Connection *connection);
+
+// Add a connection to the tail (most recently active end) of the list
+void connection_list_append(struct ConnectionList *list,
+                            struct Connection *connection);
+
+// Remove a connection from the list
+void connection_list_remove(struct ConnectionList *list,
+                            struct Connection *connection);
+
+// Mark a connection as active and move it to the tail of the list
+void connection_list_touch(struct ConnectionList *list,
+                           struct Connection *connection, time_t now);
+
+#endif // CONNECTION_H
@@ -1,13 +1,30 @@
+#include <ctype.h>
 #include <dirent.h>
+#include <errno.h>
 #include <lauxlib.h>
 #include <limits.h>
 #include <lua.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Identifies this build of the library, so anything cached from its output
+// can tell when the library changed. Packagers may define their own.
+#ifndef NIBIRU_BUILD
+#define NIBIRU_BUILD __DATE__ " " __TIME__
+#endif
+
 // Dynamic array to collect file paths
 typedef struct {
     char **paths;
@@ -130,12 +147,1607 @@ static int nibiru_files_from(lua_State *L) {
     return 1;
 }
 
+// hash(data) - 64-bit FNV-1a hash of a string as 16 hex digits.
+// This keys caches by content; it is not meant to resist collisions on
+// purpose.
+static int nibiru_hash(lua_State *L) {
+    size_t len;
+    const unsigned char *data =
+        (const unsigned char *)luaL_checklstring(L, 1, &len);
+    unsigned long long hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= data[i];
+        hash *= 0x100000001b3ULL;
+    }
+    char hex[17];
+    snprintf(hex, sizeof(hex), "%016llx", hash);
+    lua_pushlstring(L, hex, 16);
+    return 1;
+}
+
+// make_directory(path) - create a directory if it doesn't already exist.
+// Returns true, or nil and an error message.
+static int nibiru_make_directory(lua_State *L) {
+    const char *path = luaL_checkstring(L, 1);
+    if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+        lua_pushnil(L);
+        lua_pushstring(L, strerror(errno));
+        return 2;
+    }
+    lua_pushboolean(L, 1);
+    return 1;
+}
+
+// modified(path) - when a file was last modified, in seconds with a
+// fraction, and its size in bytes. Returns nil and an error message if the
+// file can't be read.
+static int nibiru_modified(lua_State *L) {
+    const char *path = luaL_checkstring(L, 1);
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        lua_pushnil(L);
+        lua_pushstring(L, strerror(errno));
+        return 2;
+    }
+#if defined(__APPLE__)
+    struct timespec mtime = st.st_mtimespec;
+#else
+    struct timespec mtime = st.st_mtim;
+#endif
+    lua_pushnumber(L, (lua_Number)mtime.tv_sec + mtime.tv_nsec / 1e9);
+    lua_pushinteger(L, (lua_Integer)st.st_size);
+    return 2;
+}
+
+// Route matching
+//
+// The Lua router compiles routes into a tree of path segments. router_new
+// flattens that tree into arrays so a match walks integer indexes instead of
+// Lua tables, and converts parameters while it matches.
+
+#define ROUTER_METATABLE "nibiru.router"
+// Most distinct methods across all routes, one bit each in a node's mask
+#define ROUTER_MAX_METHODS 32
+// Most parameters in a single route
+#define ROUTER_MAX_PARAMETERS 32
+
+#ifndef LUA_MAXINTEGER
+#define LUA_MAXINTEGER LLONG_MAX
+#endif
+
+enum { CONVERTER_STRING, CONVERTER_INTEGER, CONVERTER_LITERAL };
+
+// A static edge from a node, labeled with one whole segment
+typedef struct {
+    size_t label;
+    size_t label_len;
+    int child;
+} RouteEdge;
+
+// A literal run or a parameter in a segment that mixes the two
+typedef struct {
+    int converter;
+    size_t text;
+    size_t text_len;
+} RoutePiece;
+
+// An edge for a mixed segment, matched piece by piece
+typedef struct {
+    int first_piece;
+    int piece_count;
+    int child;
+} RoutePattern;
+
+typedef struct {
+    // Static edges sorted by label length and then bytes
+    int first_edge;
+    int edge_count;
+    int first_pattern;
+    int pattern_count;
+    int integer_child;
+    int string_child;
+    // Bit i is set when the route for method i ends at this node.
+    unsigned int allowed;
+    // The route reported as not allowed, or -1 when no route ends here
+    int first_route;
+    // Index into Router.slots of method_count route indexes
+    int slots;
+} RouteNode;
+
+typedef struct {
+    // Segment labels, literal pieces, and method names
+    char *text;
+    size_t text_len;
+    size_t text_capacity;
+    RouteNode *nodes;
+    int node_count;
+    int node_capacity;
+    RouteEdge *edges;
+    int edge_count;
+    int edge_capacity;
+    RoutePattern *patterns;
+    int pattern_count;
+    int pattern_capacity;
+    RoutePiece *pieces;
+    int piece_count;
+    int piece_capacity;
+    int *slots;
+    int slot_count;
+    int slot_capacity;
+    size_t methods[ROUTER_MAX_METHODS];
+    size_t method_lens[ROUTER_MAX_METHODS];
+    int method_count;
+} Router;
+
+// A parameter captured from the path, converted once the match succeeds
+typedef struct {
+    const char *start;
+    size_t len;
+    int converter;
+} RouteCapture;
+
+// Grow an array to hold one more item, raising a Lua error if out of memory
+static void *router_grow(lua_State *L, void *items, int *capacity, int count,
+                         size_t size) {
+    if (count < *capacity) {
+        return items;
+    }
+    int new_capacity = *capacity == 0 ? 16 : *capacity * 2;
+    void *grown = realloc(items, new_capacity * size);
+    if (!grown) {
+        luaL_error(L, "out of memory building router");
+    }
+    *capacity = new_capacity;
+    return grown;
+}
+
+// Copy text into the router and return its offset
+static size_t router_add_text(lua_State *L, Router *router, const char *text,
+                              size_t len) {
+    if (router->text_len + len > router->text_capacity) {
+        size_t capacity = router->text_capacity ? router->text_capacity : 256;
+        while (router->text_len + len > capacity) {
+            capacity *= 2;
+        }
+        char *grown = realloc(router->text, capacity);
+        if (!grown) {
+            luaL_error(L, "out of memory building router");
+        }
+        router->text = grown;
+        router->text_capacity = capacity;
+    }
+    size_t offset = router->text_len;
+    memcpy(router->text + offset, text, len);
+    router->text_len += len;
+    return offset;
+}
+
+// Find the id of a method, or -1 if no route uses it
+static int router_method_id(const Router *router, const char *method,
+                            size_t len) {
+    for (int i = 0; i < router->method_count; i++) {
+        if (router->method_lens[i] == len &&
+            memcmp(router->text + router->methods[i], method, len) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Order static edges by label length and then bytes for binary search
+static int compare_labels(const char *text, size_t a, size_t a_len, size_t b,
+                          size_t b_len) {
+    if (a_len != b_len) {
+        return a_len < b_len ? -1 : 1;
+    }
+    return memcmp(text + a, text + b, a_len);
+}
+
+// Insertion sort a node's edges; nodes rarely have many static children.
+static void sort_edges(Router *router, int first, int count) {
+    RouteEdge *edges = router->edges + first;
+    for (int i = 1; i < count; i++) {
+        RouteEdge edge = edges[i];
+        int j = i - 1;
+        while (j >= 0 && compare_labels(router->text, edges[j].label,
+                                        edges[j].label_len, edge.label,
+                                        edge.label_len) > 0) {
+            edges[j + 1] = edges[j];
+            j--;
+        }
+        edges[j + 1] = edge;
+    }
+}
+
+// Split a mixed segment like `{name:string}.txt` into pieces
+static void add_pieces(lua_State *L, Router *router, const char *text,
+                       size_t len) {
+    size_t index = 0;
+    while (index < len) {
+        const char *open = memchr(text + index, '{', len - index);
+        const char *close =
+            open ? memchr(open, '}', len - (open - text)) : NULL;
+        const char *colon = close ? memchr(open, ':', close - open) : NULL;
+        size_t literal_end = colon ? (size_t)(open - text) : len;
+        if (literal_end > index) {
+            router->pieces =
+                router_grow(L, router->pieces, &router->piece_capacity,
+                            router->piece_count, sizeof(RoutePiece));
+            RoutePiece *piece = &router->pieces[router->piece_count++];
+            piece->converter = CONVERTER_LITERAL;
+            piece->text =
+                router_add_text(L, router, text + index, literal_end - index);
+            piece->text_len = literal_end - index;
+        }
+        if (!colon) {
+            break;
+        }
+        size_t type_len = close - colon - 1;
+        router->pieces = router_grow(L, router->pieces, &router->piece_capacity,
+                                     router->piece_count, sizeof(RoutePiece));
+        RoutePiece *piece = &router->pieces[router->piece_count++];
+        if (type_len == 7 && memcmp(colon + 1, "integer", 7) == 0) {
+            piece->converter = CONVERTER_INTEGER;
+        } else {
+            piece->converter = CONVERTER_STRING;
+        }
+        piece->text = 0;
+        piece->text_len = 0;
+        index = close - text + 1;
+    }
+}
+
+// Take the next unused node and return its id
+static int add_node(lua_State *L, Router *router) {
+    router->nodes = router_grow(L, router->nodes, &router->node_capacity,
+                                router->node_count, sizeof(RouteNode));
+    int id = router->node_count++;
+    RouteNode *node = &router->nodes[id];
+    node->first_edge = 0;
+    node->edge_count = 0;
+    node->first_pattern = 0;
+    node->pattern_count = 0;
+    node->integer_child = -1;
+    node->string_child = -1;
+    node->allowed = 0;
+    node->first_route = -1;
+    node->slots = router->slot_count;
+    for (int i = 0; i < router->method_count; i++) {
+        router->slots = router_grow(L, router->slots, &router->slot_capacity,
+                                    router->slot_count, sizeof(int));
+        router->slots[router->slot_count++] = -1;
+    }
+    return id;
+}
+
+// Flatten the Lua node at the top of the stack and return its id.
+// The table at index `indexes` maps each route to its position.
+static int flatten_node(lua_State *L, Router *router, int indexes) {
+    luaL_checkstack(L, 8, "router too deep");
+    int node_table = lua_gettop(L);
+    int id = add_node(L, router);
+
+    // Reserve every static edge first so they stay contiguous.
+    lua_getfield(L, node_table, "static");
+    int static_table = lua_gettop(L);
+    int first_edge = router->edge_count;
+    lua_pushnil(L);
+    while (lua_next(L, static_table)) {
+        lua_pop(L, 1);
+        size_t len;
+        const char *label = lua_tolstring(L, -1, &len);
+        router->edges = router_grow(L, router->edges, &router->edge_capacity,
+                                    router->edge_count, sizeof(RouteEdge));
+        RouteEdge *edge = &router->edges[router->edge_count++];
+        edge->label = router_add_text(L, router, label, len);
+        edge->label_len = len;
+        edge->child = -1;
+    }
+    int edge_count = router->edge_count - first_edge;
+    sort_edges(router, first_edge, edge_count);
+    router->nodes[id].first_edge = first_edge;
+    router->nodes[id].edge_count = edge_count;
+    for (int i = first_edge; i < first_edge + edge_count; i++) {
+        lua_pushlstring(L, router->text + router->edges[i].label,
+                        router->edges[i].label_len);
+        lua_rawget(L, static_table);
+        int child = flatten_node(L, router, indexes);
+        router->edges[i].child = child;
+        lua_pop(L, 1);
+    }
+    lua_pop(L, 1);
+
+    lua_getfield(L, node_table, "patterns");
+    int pattern_list = lua_gettop(L);
+    int pattern_count = (int)lua_rawlen(L, pattern_list);
+    int first_pattern = router->pattern_count;
+    for (int i = 0; i < pattern_count; i++) {
+        router->patterns =
+            router_grow(L, router->patterns, &router->pattern_capacity,
+                        router->pattern_count, sizeof(RoutePattern));
+        router->pattern_count++;
+    }
+    router->nodes[id].first_pattern = first_pattern;
+    router->nodes[id].pattern_count = pattern_count;
+    for (int i = 0; i < pattern_count; i++) {
+        lua_rawgeti(L, pattern_list, i + 1);
+        size_t len;
+        lua_getfield(L, -1, "text");
+        const char *text = lua_tolstring(L, -1, &len);
+        int first_piece = router->piece_count;
+        add_pieces(L, router, text, len);
+        lua_pop(L, 1);
+        RoutePattern *pattern = &router->patterns[first_pattern + i];
+        pattern->first_piece = first_piece;
+        pattern->piece_count = router->piece_count - first_piece;
+        lua_getfield(L, -1, "node");
+        int child = flatten_node(L, router, indexes);
+        router->patterns[first_pattern + i].child = child;
+        lua_pop(L, 2);
+    }
+    lua_pop(L, 1);
+
+    lua_getfield(L, node_table, "parameters");
+    lua_getfield(L, -1, "integer");
+    if (lua_istable(L, -1)) {
+        int child = flatten_node(L, router, indexes);
+        router->nodes[id].integer_child = child;
+    }
+    lua_pop(L, 1);
+    lua_getfield(L, -1, "string");
+    if (lua_istable(L, -1)) {
+        int child = flatten_node(L, router, indexes);
+        router->nodes[id].string_child = child;
+    }
+    lua_pop(L, 2);
+
+    lua_getfield(L, node_table, "routes");
+    if (lua_istable(L, -1)) {
+        lua_pushnil(L);
+        while (lua_next(L, -2)) {
+            size_t len;
+            const char *method = lua_tolstring(L, -2, &len);
+            int method_id = router_method_id(router, method, len);
+            lua_rawget(L, indexes);
+            router->slots[router->nodes[id].slots + method_id] =
+                (int)lua_tointeger(L, -1);
+            router->nodes[id].allowed |= 1u << method_id;
+            lua_pop(L, 1);
+        }
+        lua_getfield(L, node_table, "first_route");
+        lua_rawget(L, indexes);
+        router->nodes[id].first_route = (int)lua_tointeger(L, -1);
+        lua_pop(L, 1);
+    }
+    lua_pop(L, 1);
+
+    return id;
+}
+
+// Match pieces of a mixed segment, preferring the longest parameter first
+// like a greedy Lua pattern. Returns the capture count or -1.
+static int match_pieces(const Router *router, const RoutePiece *pieces,
+                        int piece_count, const char *segment, size_t len,
+                        RouteCapture *captures, int count) {
+    if (piece_count == 0) {
+        return len == 0 ? count : -1;
+    }
+    const RoutePiece *piece = &pieces[0];
+    if (piece->converter == CONVERTER_LITERAL) {
+        if (len < piece->text_len ||
+            memcmp(segment, router->text + piece->text, piece->text_len) !=
+                0) {
+            return -1;
+        }
+        return match_pieces(router, pieces + 1, piece_count - 1,
+                            segment + piece->text_len, len - piece->text_len,
+                            captures, count);
+    }
+    if (count == ROUTER_MAX_PARAMETERS) {
+        return -1;
+    }
+    size_t longest = len;
+    if (piece->converter == CONVERTER_INTEGER) {
+        longest = 0;
+        while (longest < len && segment[longest] >= '0' &&
+               segment[longest] <= '9') {
+            longest++;
+        }
+    }
+    for (size_t take = longest; take > 0; take--) {
+        captures[count].start = segment;
+        captures[count].len = take;
+        captures[count].converter = piece->converter;
+        int total =
+            match_pieces(router, pieces + 1, piece_count - 1, segment + take,
+                         len - take, captures, count + 1);
+        if (total >= 0) {
+            return total;
+        }
+    }
+    return -1;
+}
+
+// Find the static edge for a segment by binary search
+static int find_edge(const Router *router, const RouteNode *node,
+                     const char *segment, size_t len) {
+    int low = node->first_edge;
+    int high = node->first_edge + node->edge_count - 1;
+    while (low <= high) {
+        int middle = low + (high - low) / 2;
+        const RouteEdge *edge = &router->edges[middle];
+        int order;
+        if (edge->label_len != len) {
+            order = edge->label_len < len ? -1 : 1;
+        } else {
+            order = memcmp(router->text + edge->label, segment, len);
+        }
+        if (order == 0) {
+            return edge->child;
+        } else if (order < 0) {
+            low = middle + 1;
+        } else {
+            high = middle - 1;
+        }
+    }
+    return -1;
+}
+
+// Per match state shared across the walk
+typedef struct {
+    const Router *router;
+    int method_id;
+    const char *path;
+    size_t path_len;
+    RouteCapture captures[ROUTER_MAX_PARAMETERS];
+    int count;
+    // The first route that matched the path but not the method
+    int refused;
+} RouteSearch;
+
+// Walk the tree for the rest of the path. A position past the end of the
+// path means every segment has been consumed. Returns a route index or -1.
+static int search_node(RouteSearch *search, int node_id, size_t position,
+                       int count) {
+    const Router *router = search->router;
+    const RouteNode *node = &router->nodes[node_id];
+    if (position > search->path_len) {
+        if (node->first_route < 0) {
+            return -1;
+        }
+        if (search->method_id >= 0 &&
+            node->allowed & (1u << search->method_id)) {
+            search->count = count;
+            return router->slots[node->slots + search->method_id];
+        }
+        if (search->refused < 0) {
+            search->refused = node->first_route;
+        }
+        return -1;
+    }
+
+    const char *segment = search->path + position;
+    const char *slash = memchr(segment, '/', search->path_len - position);
+    size_t len =
+        slash ? (size_t)(slash - segment) : search->path_len - position;
+    // Step past the slash, or past the end when this is the last segment.
+    size_t next = position + len + 1;
+
+    int route;
+    int child = find_edge(router, node, segment, len);
+    if (child >= 0 && (route = search_node(search, child, next, count)) >= 0) {
+        return route;
+    }
+
+    if (len > 0 && count < ROUTER_MAX_PARAMETERS) {
+        if (node->integer_child >= 0) {
+            size_t digits = 0;
+            while (digits < len && segment[digits] >= '0' &&
+                   segment[digits] <= '9') {
+                digits++;
+            }
+            if (digits == len) {
+                search->captures[count].start = segment;
+                search->captures[count].len = len;
+                search->captures[count].converter = CONVERTER_INTEGER;
+                route = search_node(search, node->integer_child, next,
+                                    count + 1);
+                if (route >= 0) {
+                    return route;
+                }
+            }
+        }
+        if (node->string_child >= 0) {
+            search->captures[count].start = segment;
+            search->captures[count].len = len;
+            search->captures[count].converter = CONVERTER_STRING;
+            route = search_node(search, node->string_child, next, count + 1);
+            if (route >= 0) {
+                return route;
+            }
+        }
+    }
+
+    for (int i = 0; i < node->pattern_count; i++) {
+        const RoutePattern *pattern =
+            &router->patterns[node->first_pattern + i];
+        int total = match_pieces(router, &router->pieces[pattern->first_piece],
+                                 pattern->piece_count, segment, len,
+                                 search->captures, count);
+        if (total >= 0 &&
+            (route = search_node(search, pattern->child, next, total)) >= 0) {
+            return route;
+        }
+    }
+
+    return -1;
+}
+
+// Push a captured parameter, converting integers like math.tointeger
+static void push_capture(lua_State *L, const RouteCapture *capture) {
+    if (capture->converter == CONVERTER_STRING) {
+        lua_pushlstring(L, capture->start, capture->len);
+        return;
+    }
+    lua_Integer value = 0;
+    for (size_t i = 0; i < capture->len; i++) {
+        int digit = capture->start[i] - '0';
+        if (value > (LUA_MAXINTEGER - digit) / 10) {
+            // Too large for an integer, so there's no conversion.
+            lua_pushnil(L);
+            return;
+        }
+        value = value * 10 + digit;
+    }
+    lua_pushinteger(L, value);
+}
+
+// router_new(root, routes) - flatten a Lua route tree into a Router.
+// routes lists every Route in the tree so each can be reported by index.
+static int nibiru_router_new(lua_State *L) {
+    luaL_checktype(L, 1, LUA_TTABLE);
+    luaL_checktype(L, 2, LUA_TTABLE);
+
+    Router *router = lua_newuserdata(L, sizeof(Router));
+    memset(router, 0, sizeof(Router));
+    luaL_setmetatable(L, ROUTER_METATABLE);
+    int router_index = lua_gettop(L);
+
+    // Map each route to its index and collect every method.
+    lua_newtable(L);
+    int indexes = lua_gettop(L);
+    lua_Integer route_count = luaL_len(L, 2);
+    for (lua_Integer i = 1; i <= route_count; i++) {
+        lua_rawgeti(L, 2, i);
+        lua_pushvalue(L, -1);
+        lua_pushinteger(L, i);
+        lua_rawset(L, indexes);
+        lua_getfield(L, -1, "methods");
+        lua_pushnil(L);
+        while (lua_next(L, -2)) {
+            lua_pop(L, 1);
+            size_t len;
+            const char *method = lua_tolstring(L, -1, &len);
+            if (router_method_id(router, method, len) < 0) {
+                if (router->method_count == ROUTER_MAX_METHODS) {
+                    return luaL_error(L, "too many route methods");
+                }
+                int id = router->method_count++;
+                router->methods[id] = router_add_text(L, router, method, len);
+                router->method_lens[id] = len;
+            }
+        }
+        lua_pop(L, 2);
+    }
+
+    lua_pushvalue(L, 1);
+    flatten_node(L, router, indexes);
+    lua_settop(L, router_index);
+    return 1;
+}
+
+// router:match(method, path, parameters) - find the route for a request.
+// Fills parameters with the converted path parameters and returns the match
+// status, the route index, and the parameter count.
+static int nibiru_router_match(lua_State *L) {
+    Router *router = luaL_checkudata(L, 1, ROUTER_METATABLE);
+    size_t method_len;
+    const char *method = luaL_checklstring(L, 2, &method_len);
+    RouteSearch search;
+    search.path = luaL_checklstring(L, 3, &search.path_len);
+    luaL_checktype(L, 4, LUA_TTABLE);
+
+    if (search.path_len == 0 || search.path[0] != '/') {
+        lua_pushinteger(L, 0);
+        return 1;
+    }
+
+    search.router = router;
+    search.method_id = router_method_id(router, method, method_len);
+    search.count = 0;
+    search.refused = -1;
+    int route = search_node(&search, 0, 1, 0);
+    if (route < 0) {
+        if (search.refused < 0) {
+            lua_pushinteger(L, 0);
+            return 1;
+        }
+        lua_pushinteger(L, 2);
+        lua_pushinteger(L, search.refused);
+        return 2;
+    }
+
+    for (int i = 0; i < search.count; i++) {
+        push_capture(L, &search.captures[i]);
+        lua_rawseti(L, 4, i + 1);
+    }
+    lua_pushinteger(L, 1);
+    lua_pushinteger(L, route);
+    lua_pushinteger(L, search.count);
+    return 3;
+}
+
+static int nibiru_router_gc(lua_State *L) {
+    Router *router = luaL_checkudata(L, 1, ROUTER_METATABLE);
+    free(router->text);
+    free(router->nodes);
+    free(router->edges);
+    free(router->patterns);
+    free(router->pieces);
+    free(router->slots);
+    memset(router, 0, sizeof(Router));
+    return 0;
+}
+
+static const luaL_Reg router_methods[] = {{"match", nibiru_router_match},
+                                          {NULL, NULL}};
+
+// Directory watching
+//
+// A watcher reports files written under a directory so templates can be
+// reloaded while the server runs. On Linux it is backed by inotify, with
+// one watch per directory since inotify isn't recursive. Each process must
+// create its own watcher: processes sharing one would split its events.
+
+#define WATCHER_METATABLE "nibiru.watcher"
+
+typedef struct {
+    int fd;
+    char *root;
+    // Directory paths relative to the root, indexed by watch descriptor
+    char **directories;
+    int directory_capacity;
+} Watcher;
+
+#ifdef __linux__
+// Start watching a directory under the root and every directory below it.
+// Returns -1 if out of memory, leaving the directories watched so far.
+static int watch_directory(Watcher *watcher, const char *relative_path) {
+    char full_path[PATH_MAX];
+    if (relative_path[0] == '\0') {
+        snprintf(full_path, PATH_MAX, "%s", watcher->root);
+    } else {
+        snprintf(full_path, PATH_MAX, "%s/%s", watcher->root, relative_path);
+    }
+
+    int wd = inotify_add_watch(watcher->fd, full_path,
+                               IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE |
+                                   IN_ONLYDIR);
+    if (wd < 0) {
+        return 0; // Skip inaccessible directories
+    }
+    if (wd >= watcher->directory_capacity) {
+        int capacity = watcher->directory_capacity * 2;
+        if (capacity <= wd) {
+            capacity = wd + 16;
+        }
+        char **grown =
+            realloc(watcher->directories, capacity * sizeof(char *));
+        if (!grown) {
+            return -1;
+        }
+        memset(grown + watcher->directory_capacity, 0,
+               (capacity - watcher->directory_capacity) * sizeof(char *));
+        watcher->directories = grown;
+        watcher->directory_capacity = capacity;
+    }
+    char *copy = strdup(relative_path);
+    if (!copy) {
+        return -1;
+    }
+    free(watcher->directories[wd]);
+    watcher->directories[wd] = copy;
+
+    DIR *dir = opendir(full_path);
+    if (!dir) {
+        return 0;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 ||
+            strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        char child_relative[PATH_MAX];
+        if (relative_path[0] == '\0') {
+            snprintf(child_relative, PATH_MAX, "%s", entry->d_name);
+        } else {
+            snprintf(child_relative, PATH_MAX, "%s/%s", relative_path,
+                     entry->d_name);
+        }
+        char child_full[PATH_MAX];
+        snprintf(child_full, PATH_MAX, "%s/%s", watcher->root,
+                 child_relative);
+        struct stat st;
+        if (stat(child_full, &st) == 0 && S_ISDIR(st.st_mode) &&
+            watch_directory(watcher, child_relative) < 0) {
+            closedir(dir);
+            return -1;
+        }
+    }
+    closedir(dir);
+    return 0;
+}
+#endif
+
+// watch(directory) - watch a directory tree for written files.
+// Returns a watcher, or nil and an error message.
+static int nibiru_watch(lua_State *L) {
+    const char *path = luaL_checkstring(L, 1);
+#ifdef __linux__
+    struct stat st;
+    if (stat(path, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Path does not exist or is not a directory");
+        return 2;
+    }
+
+    Watcher *watcher = lua_newuserdata(L, sizeof(Watcher));
+    memset(watcher, 0, sizeof(Watcher));
+    watcher->fd = -1;
+    luaL_setmetatable(L, WATCHER_METATABLE);
+
+    watcher->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watcher->fd < 0) {
+        lua_pushnil(L);
+        lua_pushstring(L, strerror(errno));
+        return 2;
+    }
+    watcher->root = strdup(path);
+    if (!watcher->root || watch_directory(watcher, "") < 0) {
+        return luaL_error(L, "out of memory watching %s", path);
+    }
+    return 1;
+#else
+    (void)path;
+    lua_pushnil(L);
+    lua_pushstring(L, "Watching directories is only supported on Linux");
+    return 2;
+#endif
+}
+
+// watcher:changes() - list the files written since the last call.
+// Returns a sorted array of paths relative to the watched directory, or nil
+// when there are none, and true when events were dropped so any file may
+// have changed. Never blocks, so it can be checked before every request.
+static int nibiru_watcher_changes(lua_State *L) {
+    Watcher *watcher = luaL_checkudata(L, 1, WATCHER_METATABLE);
+    FileList list;
+    file_list_init(&list);
+    int overflow = 0;
+
+#ifdef __linux__
+    char buffer[4096]
+        __attribute__((aligned(__alignof__(struct inotify_event))));
+    while (watcher->fd >= 0) {
+        ssize_t length = read(watcher->fd, buffer, sizeof(buffer));
+        if (length <= 0) {
+            break; // Nothing left to read
+        }
+        const struct inotify_event *event;
+        for (char *p = buffer; p < buffer + length;
+             p += sizeof(struct inotify_event) + event->len) {
+            event = (const struct inotify_event *)p;
+            if (event->mask & IN_Q_OVERFLOW) {
+                overflow = 1;
+                continue;
+            }
+            if (event->wd < 0 || event->wd >= watcher->directory_capacity ||
+                !watcher->directories[event->wd]) {
+                continue;
+            }
+            if (event->mask & IN_IGNORED) {
+                // The directory was removed
+                free(watcher->directories[event->wd]);
+                watcher->directories[event->wd] = NULL;
+                continue;
+            }
+            if (event->len == 0) {
+                continue;
+            }
+
+            const char *directory = watcher->directories[event->wd];
+            char relative[PATH_MAX];
+            if (directory[0] == '\0') {
+                snprintf(relative, PATH_MAX, "%s", event->name);
+            } else {
+                snprintf(relative, PATH_MAX, "%s/%s", directory, event->name);
+            }
+
+            if (event->mask & IN_ISDIR) {
+                // Files may land in a new directory before it is watched
+                if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+                    if (watch_directory(watcher, relative) < 0) {
+                        file_list_free(&list);
+                        return luaL_error(L, "out of memory watching %s",
+                                          watcher->root);
+                    }
+                    collect_files_recursive(watcher->root, relative, &list);
+                }
+            } else if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+                file_list_add(&list, relative);
+            }
+        }
+    }
+#endif
+
+    if (list.count == 0) {
+        lua_pushnil(L);
+        lua_pushboolean(L, overflow);
+        return 2;
+    }
+    if (list.count > 1) {
+        qsort(list.paths, list.count, sizeof(char *), compare_paths);
+    }
+    // An editor's save can write a file more than once
+    lua_newtable(L);
+    int count = 0;
+    for (size_t i = 0; i < list.count; i++) {
+        if (i > 0 && strcmp(list.paths[i], list.paths[i - 1]) == 0) {
+            continue;
+        }
+        lua_pushstring(L, list.paths[i]);
+        lua_rawseti(L, -2, ++count);
+    }
+    file_list_free(&list);
+    lua_pushboolean(L, overflow);
+    return 2;
+}
+
+// watcher:close() - stop watching. Also done when the watcher is collected.
+static int nibiru_watcher_close(lua_State *L) {
+    Watcher *watcher = luaL_checkudata(L, 1, WATCHER_METATABLE);
+    if (watcher->fd >= 0) {
+        close(watcher->fd);
+        watcher->fd = -1;
+    }
+    for (int i = 0; i < watcher->directory_capacity; i++) {
+        free(watcher->directories[i]);
+    }
+    free(watcher->directories);
+    free(watcher->root);
+    watcher->directories = NULL;
+    watcher->directory_capacity = 0;
+    watcher->root = NULL;
+    return 0;
+}
+
+static const luaL_Reg watcher_methods[] = {
+    {"changes", nibiru_watcher_changes},
+    {"close", nibiru_watcher_close},
+    {NULL, NULL}};
+
+// Template tokenizing
+//
+// tokenize(template) produces the same tokens as nibiru.tokenizer in one
+// left-to-right pass. memchr jumps between the '{' and '<' bytes that can
+// start a tag, instead of searching the rest of the template for every kind
+// of delimiter after each tag.
+
+// The token list being filled, at a fixed stack index
+typedef struct {
+    lua_State *L;
+    int list;
+    lua_Integer count;
+} TokenList;
+
+// Append {type = type}.
+static void token_add(TokenList *tokens, const char *type) {
+    lua_State *L = tokens->L;
+    lua_createtable(L, 0, 1);
+    lua_pushstring(L, type);
+    lua_setfield(L, -2, "type");
+    lua_rawseti(L, tokens->list, ++tokens->count);
+}
+
+// Append {type = type, value = v}, popping v from the top of the stack.
+static void token_add_value(TokenList *tokens, const char *type) {
+    lua_State *L = tokens->L;
+    lua_createtable(L, 0, 2);
+    lua_insert(L, -2);
+    lua_setfield(L, -2, "value");
+    lua_pushstring(L, type);
+    lua_setfield(L, -2, "type");
+    lua_rawseti(L, tokens->list, ++tokens->count);
+}
+
+// Append a token whose value is a piece of the template.
+static void token_add_text(TokenList *tokens, const char *type,
+                           const char *text, size_t len) {
+    lua_pushlstring(tokens->L, text, len);
+    token_add_value(tokens, type);
+}
+
+// Push a number literal converted like tonumber, or the text itself when it
+// isn't a valid number.
+static void push_number(lua_State *L, const char *text, size_t len) {
+    lua_pushlstring(L, text, len);
+    if (lua_stringtonumber(L, lua_tostring(L, -1)) != 0) {
+        lua_remove(L, -2);
+    }
+}
+
+static int is_word_char(unsigned char c) { return isalnum(c) || c == '_'; }
+
+static int is_word(const char *text, size_t len, const char *word) {
+    return strlen(word) == len && memcmp(text, word, len) == 0;
+}
+
+static int is_keyword(const char *text, size_t len) {
+    return is_word(text, len, "or") || is_word(text, len, "and") ||
+           is_word(text, len, "not") || is_word(text, len, "true") ||
+           is_word(text, len, "false") || is_word(text, len, "nil");
+}
+
+// Index of the first c at or after from, or len if there is none
+static size_t find_byte(const char *text, size_t len, size_t from, char c) {
+    const char *found = from < len ? memchr(text + from, c, len - from) : NULL;
+    return found ? (size_t)(found - text) : len;
+}
+
+// Index of the first two-byte sequence ab at or after from, or len
+static size_t find_pair(const char *text, size_t len, size_t from, char a,
+                        char b) {
+    for (size_t i = find_byte(text, len, from, a); i + 1 < len;
+         i = find_byte(text, len, i + 1, a)) {
+        if (text[i + 1] == b) {
+            return i;
+        }
+    }
+    return len;
+}
+
+// Tokenize the inside of {{ }}.
+static void tokenize_expression(TokenList *tokens, const char *input,
+                                size_t len) {
+    lua_State *L = tokens->L;
+    size_t pos = 0;
+    while (pos < len) {
+        unsigned char c = input[pos];
+        if (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+            pos++;
+        } else if (isalpha(c)) {
+            size_t start = pos;
+            while (pos < len && is_word_char(input[pos])) {
+                pos++;
+            }
+            token_add_text(tokens,
+                           is_keyword(input + start, pos - start)
+                               ? "KEYWORD"
+                               : "IDENTIFIER",
+                           input + start, pos - start);
+        } else if (isdigit(c)) {
+            size_t start = pos;
+            while (pos < len && (isdigit((unsigned char)input[pos]) ||
+                                 input[pos] == '.')) {
+                pos++;
+            }
+            push_number(L, input + start, pos - start);
+            token_add_value(tokens, "LITERAL");
+        } else if (c == '"' || c == '\'') {
+            size_t start = ++pos;
+            while (pos < len && input[pos] != c) {
+                pos += input[pos] == '\\' ? 2 : 1;
+            }
+            if (pos >= len) {
+                luaL_error(L, "Unclosed string literal");
+            }
+            token_add_text(tokens, "LITERAL", input + start, pos - start);
+            pos++;
+        } else if (c == '|') {
+            if (pos + 1 >= len || input[pos + 1] != '>') {
+                luaL_error(L,
+                           "Invalid character '|' in expression at "
+                           "position %I",
+                           (lua_Integer)(pos + 1));
+            }
+            token_add_text(tokens, "OPERATOR", "|>", 2);
+            pos += 2;
+        } else if (c != '\0' && strchr("+-*/=><!", c) != NULL) {
+            size_t start = pos++;
+            if (pos < len && input[pos] == '=') {
+                pos++;
+            }
+            token_add_text(tokens, "OPERATOR", input + start, pos - start);
+        } else if (c == '(' || c == ')' || c == ',' || c == '.') {
+            token_add_text(tokens, "PUNCTUATION", input + pos, 1);
+            pos++;
+        } else {
+            luaL_error(L,
+                       "Unexpected character in expression: %c at position "
+                       "%I",
+                       c, (lua_Integer)(pos + 1));
+        }
+    }
+}
+
+// Types of the statement words that have no value
+static const char *const statement_words[][2] = {
+    {"if", "IF_START"},        {"endif", "IF_END"},
+    {"for", "FOR_START"},      {"endfor", "FOR_END"},
+    {"extends", "EXTENDS"},    {"block", "BLOCK_START"},
+    {"endblock", "BLOCK_END"}, {"cache", "CACHE_START"},
+    {"endcache", "CACHE_END"}, {NULL, NULL}};
+
+// Tokenize the inside of {% %}.
+static void tokenize_statement(TokenList *tokens, const char *input,
+                               size_t len) {
+    lua_State *L = tokens->L;
+    size_t pos = 0;
+    while (pos < len) {
+        unsigned char c = input[pos];
+        char next = pos + 1 < len ? input[pos + 1] : '\0';
+        if (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+            pos++;
+        } else if (isalpha(c)) {
+            size_t start = pos;
+            while (pos < len && is_word_char(input[pos])) {
+                pos++;
+            }
+            const char *word = input + start;
+            size_t word_len = pos - start;
+            const char *type = NULL;
+            for (int i = 0; statement_words[i][0] != NULL; i++) {
+                if (is_word(word, word_len, statement_words[i][0])) {
+                    type = statement_words[i][1];
+                    break;
+                }
+            }
+            if (type != NULL) {
+                token_add(tokens, type);
+            } else if (is_keyword(word, word_len) ||
+                       is_word(word, word_len, "in") ||
+                       is_word(word, word_len, "pairs") ||
+                       is_word(word, word_len, "ipairs")) {
+                token_add_text(tokens, "KEYWORD", word, word_len);
+            } else {
+                token_add_text(tokens, "IDENTIFIER", word, word_len);
+            }
+        } else if (c == '"' || c == '\'') {
+            // Unlike expressions, an unclosed string runs to the end.
+            size_t start = ++pos;
+            while (pos < len && input[pos] != c) {
+                pos += input[pos] == '\\' ? 2 : 1;
+            }
+            token_add_text(tokens, "LITERAL", input + start,
+                           (pos < len ? pos : len) - start);
+            pos++;
+        } else if (c == '.') {
+            if (next == '.') {
+                token_add_text(tokens, "OPERATOR", "..", 2);
+                pos += 2;
+            } else {
+                token_add_text(tokens, "PUNCTUATION", ".", 1);
+                pos++;
+            }
+        } else if (c == '~') {
+            if (next != '=') {
+                luaL_error(L,
+                           "Invalid character '~' in statement at position "
+                           "%I",
+                           (lua_Integer)(pos + 1));
+            }
+            token_add_text(tokens, "OPERATOR", "~=", 2);
+            pos += 2;
+        } else if (c == '=' || c == '>' || c == '<') {
+            size_t start = pos++;
+            if (next == '=') {
+                pos++;
+            }
+            token_add_text(tokens, "OPERATOR", input + start, pos - start);
+        } else if (c == '+' || c == '-' || c == '*' || c == '/') {
+            token_add_text(tokens, "OPERATOR", input + pos, 1);
+            pos++;
+        } else if (c == '(' || c == ')' || c == ',') {
+            token_add_text(tokens, "PUNCTUATION", input + pos, 1);
+            pos++;
+        } else if (isdigit(c)) {
+            size_t start = pos;
+            while (pos < len && isdigit((unsigned char)input[pos])) {
+                pos++;
+            }
+            push_number(L, input + start, pos - start);
+            token_add_value(tokens, "LITERAL");
+        } else {
+            luaL_error(L, "Invalid character '%c' in statement at position %I",
+                       c, (lua_Integer)(pos + 1));
+        }
+    }
+}
+
+// Length of a component name ([A-Z][A-Za-z0-9_]*) at the start of text
+static size_t component_name_length(const char *text, size_t len) {
+    size_t i = 1;
+    while (i < len && (isalnum((unsigned char)text[i]) || text[i] == '_')) {
+        i++;
+    }
+    return i;
+}
+
+// Add an attribute's {type, value} entry to the values table, also
+// recording it in the malformed table when an unquoted value holds
+// characters that belong to the surrounding markup.
+static void add_attribute(lua_State *L, int values, int malformed_values,
+                          const char *name, size_t name_len, const char *value,
+                          size_t value_len, int quoted) {
+    int malformed = 0;
+    for (size_t i = 0; !quoted && i < value_len; i++) {
+        if (value[i] != '\0' && strchr(">\"'{}", value[i]) != NULL) {
+            malformed = 1;
+            break;
+        }
+    }
+
+    lua_pushlstring(L, name, name_len);
+    lua_createtable(L, 0, malformed ? 4 : 2);
+    lua_pushstring(L, quoted ? "string" : "expression");
+    lua_setfield(L, -2, "type");
+    lua_pushlstring(L, value, value_len);
+    lua_setfield(L, -2, "value");
+    if (malformed) {
+        lua_pushboolean(L, 1);
+        lua_setfield(L, -2, "malformed");
+        lua_pushstring(L, "malformed attribute: contains invalid character");
+        lua_setfield(L, -2, "error");
+        lua_pushlstring(L, name, name_len);
+        lua_getfield(L, -2, "error");
+        lua_rawset(L, malformed_values);
+    }
+    lua_rawset(L, values);
+}
+
+// Append a COMPONENT_ATTRS token for the text between a component's name
+// and the end of its tag, if there is any.
+static void tokenize_attributes(TokenList *tokens, const char *text,
+                                size_t len) {
+    lua_State *L = tokens->L;
+    while (len > 0 && isspace((unsigned char)text[0])) {
+        text++;
+        len--;
+    }
+    while (len > 0 && isspace((unsigned char)text[len - 1])) {
+        len--;
+    }
+    if (len == 0) {
+        return;
+    }
+
+    lua_createtable(L, 0, 3);
+    lua_newtable(L);
+    int malformed = lua_gettop(L);
+    lua_newtable(L);
+    int values = lua_gettop(L);
+    size_t pos = 0;
+    while (pos < len) {
+        while (pos < len && isspace((unsigned char)text[pos])) {
+            pos++;
+        }
+        size_t equal = find_byte(text, len, pos, '=');
+        if (pos >= len || equal >= len) {
+            break;
+        }
+
+        size_t name = pos;
+        size_t name_end = equal;
+        while (name < name_end && isspace((unsigned char)text[name])) {
+            name++;
+        }
+        while (name_end > name && isspace((unsigned char)text[name_end - 1])) {
+            name_end--;
+        }
+        pos = equal + 1;
+
+        if (pos < len && (text[pos] == '"' || text[pos] == '\'')) {
+            char quote = text[pos++];
+            size_t start = pos;
+            while (pos < len && text[pos] != quote) {
+                pos += text[pos] == '\\' ? 2 : 1;
+            }
+            add_attribute(L, values, malformed, text + name, name_end - name,
+                          text + start, (pos < len ? pos : len) - start, 1);
+            pos++;
+        } else {
+            size_t start = pos;
+            while (pos < len && text[pos] != ' ') {
+                pos++;
+            }
+            add_attribute(L, values, malformed, text + name, name_end - name,
+                          text + start, pos - start, 0);
+        }
+    }
+    lua_setfield(L, -3, "value");
+    lua_setfield(L, -2, "malformed");
+    lua_pushstring(L, "COMPONENT_ATTRS");
+    lua_setfield(L, -2, "type");
+    lua_rawseti(L, tokens->list, ++tokens->count);
+}
+
+// Index of the next tag at or after pos, or len. brace and angle cache the
+// next '{' and '<' so each byte is searched once.
+static size_t find_tag(const char *text, size_t len, size_t pos, size_t *brace,
+                       size_t *angle) {
+    for (;;) {
+        if (*brace < pos) {
+            *brace = find_byte(text, len, pos, '{');
+        }
+        if (*angle < pos) {
+            *angle = find_byte(text, len, pos, '<');
+        }
+        size_t at = *brace < *angle ? *brace : *angle;
+        if (at + 1 >= len) {
+            return len;
+        }
+        char next = text[at + 1];
+        if (text[at] == '{') {
+            if (next == '{' || next == '%') {
+                return at;
+            }
+        } else if ((next >= 'A' && next <= 'Z') ||
+                   (next == '/' && at + 2 < len && text[at + 2] >= 'A' &&
+                    text[at + 2] <= 'Z')) {
+            return at;
+        }
+        pos = at + 1;
+    }
+}
+
+// tokenize(template) - split a template into the token tables that
+// nibiru.tokenizer returns.
+static int nibiru_tokenize(lua_State *L) {
+    size_t len;
+    const char *text = luaL_checklstring(L, 1, &len);
+    lua_newtable(L);
+    TokenList tokens = {L, lua_gettop(L), 0};
+
+    size_t pos = 0;
+    size_t brace = find_byte(text, len, 0, '{');
+    size_t angle = find_byte(text, len, 0, '<');
+    while (pos < len) {
+        size_t at = find_tag(text, len, pos, &brace, &angle);
+        if (at > pos) {
+            token_add_text(&tokens, "TEXT", text + pos, at - pos);
+        }
+        if (at >= len) {
+            break;
+        }
+
+        if (text[at] == '{') {
+            int expression = text[at + 1] == '{';
+            size_t end = find_pair(text, len, at + 2, expression ? '}' : '%',
+                                   '}');
+            if (end >= len) {
+                return luaL_error(L, "Unclosed %s starting at position %I",
+                                  expression ? "expression" : "statement",
+                                  (lua_Integer)(at + 1));
+            }
+            token_add(&tokens, expression ? "EXPR_START" : "STMT_START");
+            if (expression) {
+                tokenize_expression(&tokens, text + at + 2, end - at - 2);
+            } else {
+                tokenize_statement(&tokens, text + at + 2, end - at - 2);
+            }
+            token_add(&tokens, expression ? "EXPR_END" : "STMT_END");
+            pos = end + 2;
+        } else if (text[at + 1] == '/') {
+            token_add(&tokens, "COMPONENT_CLOSE");
+            size_t end = find_byte(text, len, at + 2, '>');
+            if (end >= len) {
+                return luaL_error(
+                    L, "Unclosed component closing tag at position %I",
+                    (lua_Integer)(at + 1));
+            }
+            token_add_text(&tokens, "COMPONENT_NAME", text + at + 2,
+                           component_name_length(text + at + 2,
+                                                 end - at - 2));
+            pos = end + 1;
+        } else {
+            token_add(&tokens, "COMPONENT_START");
+            size_t slash = find_byte(text, len, at + 1, '/');
+            size_t end = find_byte(text, slash, at + 1, '>');
+            if (end >= len) {
+                return luaL_error(L,
+                                  "Unclosed component tag starting at "
+                                  "position %I",
+                                  (lua_Integer)(at + 1));
+            }
+            const char *content = text + at + 1;
+            size_t content_len = end - at - 1;
+            size_t name_len = component_name_length(content, content_len);
+            token_add_text(&tokens, "COMPONENT_NAME", content, name_len);
+            tokenize_attributes(&tokens, content + name_len,
+                                content_len - name_len);
+            if (text[end] == '/') {
+                token_add(&tokens, "COMPONENT_SELF_CLOSE");
+                pos = end + 2;
+            } else {
+                token_add(&tokens, "COMPONENT_OPEN");
+                pos = end + 1;
+            }
+        }
+    }
+    return 1;
+}
+
+// HTML escaping and filters
+//
+// Template output is escaped by escape_html, which is called for every
+// interpolation. Most values have nothing to escape, so it finds the first
+// special byte 16 at a time and returns the value itself when there is none.
+// safe() marks a value as HTML that escape_html passes through as is.
+
+#define SAFE_METATABLE "nibiru.safe"
+
+// Replacement for each byte that has one
+static const char *const html_escapes[256] = {
+    ['&'] = "&amp;", ['<'] = "&lt;",   ['>'] = "&gt;",
+    ['"'] = "&quot;", ['\''] = "&#39;"};
+
+// Index of the first byte at or after from that needs escaping, or len
+static size_t find_html_special(const char *text, size_t len, size_t from) {
+    size_t i = from;
+#if defined(__SSE2__)
+    const __m128i amp = _mm_set1_epi8('&');
+    const __m128i lt = _mm_set1_epi8('<');
+    const __m128i gt = _mm_set1_epi8('>');
+    const __m128i quot = _mm_set1_epi8('"');
+    const __m128i apos = _mm_set1_epi8('\'');
+    for (; i + 16 <= len; i += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)(text + i));
+        __m128i hits = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(chunk, amp), _mm_cmpeq_epi8(chunk, lt)),
+            _mm_or_si128(_mm_cmpeq_epi8(chunk, gt),
+                         _mm_or_si128(_mm_cmpeq_epi8(chunk, quot),
+                                      _mm_cmpeq_epi8(chunk, apos))));
+        int mask = _mm_movemask_epi8(hits);
+        if (mask != 0) {
+            return i + (size_t)__builtin_ctz((unsigned int)mask);
+        }
+    }
+#endif
+    for (; i < len; i++) {
+        if (html_escapes[(unsigned char)text[i]] != NULL) {
+            return i;
+        }
+    }
+    return len;
+}
+
+// Whether the value at index is marked by safe()
+static int is_safe(lua_State *L, int index) {
+    if (!lua_getmetatable(L, index)) {
+        return 0;
+    }
+    luaL_getmetatable(L, SAFE_METATABLE);
+    int safe = lua_rawequal(L, -1, -2);
+    lua_pop(L, 2);
+    return safe;
+}
+
+// escape_html(value) - the text of a value for HTML output.
+// nil and false are empty, safe values are returned as they are, and
+// everything else is converted like tostring and escaped.
+static int nibiru_escape_html(lua_State *L) {
+    switch (lua_type(L, 1)) {
+    case LUA_TSTRING:
+        break;
+    case LUA_TNONE:
+    case LUA_TNIL:
+        lua_pushliteral(L, "");
+        return 1;
+    case LUA_TBOOLEAN:
+        lua_pushstring(L, lua_toboolean(L, 1) ? "true" : "");
+        return 1;
+    case LUA_TNUMBER:
+        // Numbers never contain a special byte.
+        luaL_tolstring(L, 1, NULL);
+        return 1;
+    default:
+        if (is_safe(L, 1)) {
+            lua_rawgeti(L, 1, 1);
+            return 1;
+        }
+        luaL_tolstring(L, 1, NULL);
+        lua_replace(L, 1);
+    }
+
+    size_t len;
+    const char *text = lua_tolstring(L, 1, &len);
+    size_t special = find_html_special(text, len, 0);
+    if (special == len) {
+        lua_settop(L, 1);
+        return 1;
+    }
+
+    luaL_Buffer buffer;
+    luaL_buffinit(L, &buffer);
+    size_t start = 0;
+    while (special < len) {
+        luaL_addlstring(&buffer, text + start, special - start);
+        luaL_addstring(&buffer, html_escapes[(unsigned char)text[special]]);
+        start = special + 1;
+        special = find_html_special(text, len, start);
+    }
+    luaL_addlstring(&buffer, text + start, len - start);
+    luaL_pushresult(&buffer);
+    return 1;
+}
+
+// safe(value) - mark a value as HTML so escape_html leaves it alone.
+// The value is converted like tostring, with nil and false as empty.
+static int nibiru_safe(lua_State *L) {
+    if (is_safe(L, 1)) {
+        lua_settop(L, 1);
+        return 1;
+    }
+    lua_createtable(L, 1, 0);
+    if (lua_toboolean(L, 1)) {
+        luaL_tolstring(L, 1, NULL);
+    } else {
+        lua_pushliteral(L, "");
+    }
+    lua_rawseti(L, -2, 1);
+    luaL_setmetatable(L, SAFE_METATABLE);
+    return 1;
+}
+
+static int nibiru_safe_tostring(lua_State *L) {
+    lua_rawgeti(L, 1, 1);
+    return 1;
+}
+
+// Check that a filter's value is a string, like the Lua filters do.
+static const char *check_filter_string(lua_State *L, const char *filter,
+                                       size_t *len) {
+    if (lua_type(L, 1) != LUA_TSTRING) {
+        luaL_error(L, "%s filter expects a string, got %s", filter,
+                   luaL_typename(L, 1));
+    }
+    return lua_tolstring(L, 1, len);
+}
+
+// Push text with every byte passed through convert, or the value at index
+// 1 itself when that changes nothing.
+static int push_converted(lua_State *L, const char *text, size_t len,
+                          int (*convert)(int)) {
+    size_t i = 0;
+    while (i < len && convert((unsigned char)text[i]) == (unsigned char)text[i]) {
+        i++;
+    }
+    if (i == len) {
+        lua_settop(L, 1);
+        return 1;
+    }
+    luaL_Buffer buffer;
+    char *out = luaL_buffinitsize(L, &buffer, len);
+    memcpy(out, text, i);
+    for (; i < len; i++) {
+        out[i] = (char)convert((unsigned char)text[i]);
+    }
+    luaL_pushresultsize(&buffer, len);
+    return 1;
+}
+
+// filters.uppercase(value)
+static int nibiru_filter_uppercase(lua_State *L) {
+    size_t len;
+    const char *text = check_filter_string(L, "uppercase", &len);
+    return push_converted(L, text, len, toupper);
+}
+
+// filters.lowercase(value)
+static int nibiru_filter_lowercase(lua_State *L) {
+    size_t len;
+    const char *text = check_filter_string(L, "lowercase", &len);
+    return push_converted(L, text, len, tolower);
+}
+
+// filters.capitalize(value) - upper case the first letter or digit of each
+// run of letters and digits and lower case the rest.
+static int nibiru_filter_capitalize(lua_State *L) {
+    size_t len;
+    const char *text = check_filter_string(L, "capitalize", &len);
+    luaL_Buffer buffer;
+    char *out = luaL_buffinitsize(L, &buffer, len);
+    int in_word = 0;
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = text[i];
+        if (isalnum(c)) {
+            out[i] = (char)(in_word ? tolower(c) : toupper(c));
+            in_word = 1;
+        } else {
+            out[i] = (char)c;
+            in_word = 0;
+        }
+    }
+    luaL_pushresultsize(&buffer, len);
+    return 1;
+}
+
+// filters.truncate(value, length) - the first length bytes of a string.
+static int nibiru_filter_truncate(lua_State *L) {
+    size_t len;
+    const char *text = check_filter_string(L, "truncate", &len);
+    lua_Number length = lua_tonumber(L, 2);
+    if (lua_type(L, 2) != LUA_TNUMBER || length < 0 ||
+        length != floor(length)) {
+        luaL_tolstring(L, 2, NULL);
+        return luaL_error(
+            L, "truncate filter expects a positive integer length, got %s",
+            lua_tostring(L, -1));
+    }
+    if ((lua_Number)len <= length) {
+        lua_settop(L, 1);
+        return 1;
+    }
+    lua_pushlstring(L, text, (size_t)length);
+    return 1;
+}
+
+static const luaL_Reg filter_functions[] = {
+    {"capitalize", nibiru_filter_capitalize},
+    {"lowercase", nibiru_filter_lowercase},
+    {"truncate", nibiru_filter_truncate},
+    {"uppercase", nibiru_filter_uppercase},
+    {NULL, NULL}};
+
 // Library function table
-static const luaL_Reg nibiru_functions[] = {{"files_from", nibiru_files_from},
-                                            {NULL, NULL}};
+static const luaL_Reg nibiru_functions[] = {
+    {"escape_html", nibiru_escape_html},
+    {"files_from", nibiru_files_from},
+    {"hash", nibiru_hash},
+    {"make_directory", nibiru_make_directory},
+    {"modified", nibiru_modified},
+    {"router_new", nibiru_router_new},
+    {"safe", nibiru_safe},
+    {"tokenize", nibiru_tokenize},
+    {"watch", nibiru_watch},
+    {NULL, NULL}};
 
 // Library open function
 int luaopen_nibiru_core(lua_State *L) {
+    luaL_newmetatable(L, ROUTER_METATABLE);
+    lua_pushcfunction(L, nibiru_router_gc);
+    lua_setfield(L, -2, "__gc");
+    luaL_newlib(L, router_methods);
+    lua_setfield(L, -2, "__index");
+    lua_pop(L, 1);
+
+    luaL_newmetatable(L, WATCHER_METATABLE);
+    lua_pushcfunction(L, nibiru_watcher_close);
+    lua_setfield(L, -2, "__gc");
+    luaL_newlib(L, watcher_methods);
+    lua_setfield(L, -2, "__index");
+    lua_pop(L, 1);
+
+    luaL_newmetatable(L, SAFE_METATABLE);
+    lua_pushcfunction(L, nibiru_safe_tostring);
+    lua_setfield(L, -2, "__tostring");
+    lua_pop(L, 1);
+
     luaL_newlib(L, nibiru_functions);
+    luaL_newlib(L, filter_functions);
+    lua_setfield(L, -2, "filters");
+    lua_pushliteral(L, NIBIRU_BUILD);
+    lua_setfield(L, -2, "build");
     return 1;
 }
\ No newline at end of file
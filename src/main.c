@@ -1,3 +1,7 @@
+// For memmem function
+#define _GNU_SOURCE
+
+#include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <lauxlib.h>
@@ -9,18 +13,22 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <sys/socket.h>
-#include <sys/un.h>
+#include <sys/time.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
-// For memmem function
-#define _GNU_SOURCE
-#include <string.h>
-
+#include "connection.h"
 #include "parse.h"
 #include "static.h"
 
+#ifdef __linux__
+#include <sched.h>
+#include <sys/epoll.h>
+#define USE_EPOLL 1
+#endif
+
 // Feature detection for accept4 (Linux-specific with _GNU_SOURCE)
 #if defined(__linux__) && defined(_GNU_SOURCE)
 #define HAVE_ACCEPT4 1
@@ -31,13 +39,86 @@ int accept4(int sockfd, struct sockaddr *addr, socklen_t *addrlen, int flags);
 char *static_dir = "static";
 char *static_url = "/static";
 
+// Port reported to applications as SERVER_PORT
+char *server_port = "8080";
+
+// Keep-alive configuration
+// Seconds a persistent connection may sit idle before the worker closes it.
+// A value of 0 disables keep-alive.
+int keepalive_timeout = 5;
+// Requests served on one connection before the worker closes it
+int keepalive_requests = 100;
+// Seconds a connection that is waiting for the rest of a request, or for
+// the client to read its response, may go without progress before the
+// worker closes it. Unlike keep-alive, this is always on.
+int request_timeout = 30;
+
+// Open connections a single worker multiplexes at once
+int worker_connections = 1024;
+
+// Request size limits
+// Larger request lines and headers get a 431 response.
+int max_header_size = 8192;
+// Larger bodies get a 413 response.
+int max_body_size = 1048576;
+
+// Boot the application once in the master and fork workers from it
+int preload = 0;
+
+// Lua garbage collector configuration
+// Use the generational collector instead of the incremental one (Lua 5.4)
+int gc_generational = 0;
+// Incremental collector pause and step multiplier, 0 for Lua's defaults
+int gc_pause = 0;
+int gc_step_multiplier = 0;
+// Generational collector minor multiplier, 0 for Lua's default
+int gc_minor_multiplier = 0;
+
+// Listening socket configuration
+// Pending connections the kernel queues for each listening socket
+int backlog = 128;
+// Give each worker its own SO_REUSEPORT socket instead of sharing one
+int reuse_port = 0;
+// Pin each worker to its own CPU
+int cpu_affinity = 0;
+
 struct WorkerState {
     // The local Lua interpreter
     lua_State *lua_state;
     // The WSGI application callable
     int application_reference;
-    // The connection handler within nibiru's Lua code
-    int handle_connection_reference;
+    // The request handler within nibiru's Lua code
+    int handle_environ_reference;
+    // The environ table reused for every request, and its wsgi.version
+    int environ_reference;
+    int wsgi_version_reference;
+    // The respond and write callables handed to the request handler
+    int respond_reference;
+    int write_reference;
+    // The connection the current response is written to
+    struct Connection *connection;
+    int keep_alive;
+    // Reusable buffer the response head is serialized into
+    char *head;
+    size_t head_length;
+    size_t head_capacity;
+    // Whether any of the response was written, and whether a write failed
+    int response_started;
+    int write_failed;
+    // The coroutine the current response runs in, and whether a write
+    // paused it
+    lua_State *response_thread;
+    int write_paused;
+    // A finished coroutine kept for the next response, and its reference
+    lua_State *spare_thread;
+    int spare_thread_reference;
+};
+
+// A response paused in its coroutine until the client reads more output
+struct PausedResponse {
+    lua_State *thread;
+    int thread_reference;
+    int keep_alive;
 };
 
 #define MAX_WORKERS 64
@@ -64,126 +145,1385 @@ void worker_signal_handler(int signum) {
 int send_completion_to_parent(int unix_socket);
 int receive_completion_from_worker(int unix_socket);
 
-struct WorkerPool {
-    int num_workers;
-    pid_t worker_pids[MAX_WORKERS];
-};
+struct WorkerPool {
+    int num_workers;
+    pid_t worker_pids[MAX_WORKERS];
+    // One shared socket, or one per worker with --reuseport
+    int num_listen_sockets;
+    int listen_socket_fds[MAX_WORKERS];
+};
+
+/**
+ * Send the head and body pieces of a response with one writev.
+ *
+ * Whatever the socket can't take is queued. Once more than
+ * CONNECTION_OUTPUT_HIGH_WATER bytes are queued, the response waits for the
+ * client to read, so a streamed response to a slow client isn't held in
+ * memory whole. In the event loop the response's coroutine yields and the
+ * worker serves other connections meanwhile. Otherwise the write blocks,
+ * and fails if the client hasn't caught up within request_timeout.
+ * @param first The stack index of the first body piece
+ * @return true while the connection is healthy, false once a write failed
+ */
+int send_pieces(lua_State *lua_state, struct WorkerState *worker,
+                const char *head, size_t head_length, int first) {
+    int count = lua_gettop(lua_state) - first + 1 + (head ? 1 : 0);
+    if (count > CONNECTION_MAX_IOV) {
+        return luaL_error(lua_state, "at most %d pieces can be sent at once",
+                          CONNECTION_MAX_IOV);
+    }
+
+    struct iovec iov[CONNECTION_MAX_IOV];
+    int index = 0;
+    if (head) {
+        iov[index].iov_base = (char *)head;
+        iov[index++].iov_len = head_length;
+    }
+    for (int i = first; i <= lua_gettop(lua_state); i++) {
+        size_t length;
+        iov[index].iov_base = (char *)luaL_checklstring(lua_state, i, &length);
+        iov[index++].iov_len = length;
+    }
+    worker->response_started = 1;
+    if (!worker->write_failed &&
+        connection_writev(worker->connection, iov, index) == -1) {
+        worker->write_failed = 1;
+    }
+    if (!worker->write_failed &&
+        connection_queued(worker->connection) > CONNECTION_OUTPUT_HIGH_WATER) {
+#if defined(USE_EPOLL) && LUA_VERSION_NUM >= 503
+        // The event loop resumes the response with the write's result. A
+        // write from some other coroutine, or across a C call, can't yield
+        // the response and blocks instead.
+        if (lua_state == worker->response_thread &&
+            lua_isyieldable(lua_state)) {
+            worker->write_paused = 1;
+            return lua_yield(lua_state, 0);
+        }
+#endif
+        if (connection_drain(worker->connection, CONNECTION_OUTPUT_HIGH_WATER,
+                             request_timeout * 1000) == -1) {
+            worker->write_failed = 1;
+        }
+    }
+    lua_pushboolean(lua_state, !worker->write_failed);
+    return 1;
+}
+
+/**
+ * Lua callable that writes its string arguments to the current connection.
+ * The pieces go out together with one writev so a chunk and its framing
+ * cost a single system call.
+ * @return true while the connection is healthy, false once a write failed
+ */
+int write_response(lua_State *lua_state) {
+    struct WorkerState *worker =
+        lua_touserdata(lua_state, lua_upvalueindex(1));
+    return send_pieces(lua_state, worker, NULL, 0, 1);
+}
+
+// The Date header for the second it was built in
+static time_t date_header_time = -1;
+static char date_header[64];
+static size_t date_header_length;
+
+/**
+ * Get the Date header line, rebuilding it at most once per second.
+ */
+const char *current_date_header(size_t *length) {
+    time_t now = time(NULL);
+    if (now != date_header_time) {
+        struct tm tm;
+        gmtime_r(&now, &tm);
+        date_header_length = strftime(date_header, sizeof(date_header),
+                                      "Date: %a, %d %b %Y %H:%M:%S GMT\r\n",
+                                      &tm);
+        date_header_time = now;
+    }
+    *length = date_header_length;
+    return date_header;
+}
+
+/**
+ * Append bytes to the worker's response head buffer.
+ * @return 0 on success, -1 if the buffer could not grow
+ */
+int append_head(struct WorkerState *worker, const char *data, size_t length) {
+    size_t needed = worker->head_length + length;
+    if (needed > worker->head_capacity) {
+        size_t capacity = worker->head_capacity ? worker->head_capacity : 512;
+        while (capacity < needed) {
+            capacity *= 2;
+        }
+        char *head = realloc(worker->head, capacity);
+        if (!head) {
+            return -1;
+        }
+        worker->head = head;
+        worker->head_capacity = capacity;
+    }
+    memcpy(worker->head + worker->head_length, data, length);
+    worker->head_length = needed;
+    return 0;
+}
+
+/**
+ * Check that a header field name is a token and its value has no line
+ * breaks, so an application can't split the response.
+ * @return 1 if the field is safe to send, else 0
+ */
+int is_safe_header(const char *name, size_t name_length, const char *value,
+                   size_t value_length) {
+    if (name_length == 0) {
+        return 0;
+    }
+    for (size_t i = 0; i < name_length; i++) {
+        unsigned char c = name[i];
+        if (c <= ' ' || c >= 127 || c == ':') {
+            return 0;
+        }
+    }
+    return !memchr(value, '\r', value_length) &&
+           !memchr(value, '\n', value_length);
+}
+
+/**
+ * Check if a header field is one the server sets to frame the response.
+ */
+int is_framing_header(const char *name, size_t name_length) {
+    return (name_length == 14 &&
+            strncasecmp(name, "Content-Length", 14) == 0) ||
+           (name_length == 17 &&
+            strncasecmp(name, "Transfer-Encoding", 17) == 0) ||
+           (name_length == 10 && strncasecmp(name, "Connection", 10) == 0);
+}
+
+/**
+ * Append one header field line to the response head.
+ * @return 0 on success, -1 if the field is unsafe or memory ran out
+ */
+int append_header(struct WorkerState *worker, const char *name,
+                  size_t name_length, lua_State *lua_state, int value_index) {
+    size_t value_length;
+    const char *value = lua_tolstring(lua_state, value_index, &value_length);
+    if (!value || !is_safe_header(name, name_length, value, value_length)) {
+        return -1;
+    }
+    if (append_head(worker, name, name_length) == -1 ||
+        append_head(worker, ": ", 2) == -1 ||
+        append_head(worker, value, value_length) == -1 ||
+        append_head(worker, "\r\n", 2) == -1) {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Lua callable that serializes a response head and sends it together with
+ * any body pieces: respond(status, headers, content_length, ...).
+ * headers maps names to a value or a list of values. A nil content_length
+ * frames the body with chunked transfer encoding.
+ * @return true while the connection is healthy, false once a write failed
+ */
+int respond(lua_State *lua_state) {
+    struct WorkerState *worker =
+        lua_touserdata(lua_state, lua_upvalueindex(1));
+    size_t status_length;
+    const char *status = luaL_checklstring(lua_state, 1, &status_length);
+    luaL_checktype(lua_state, 2, LUA_TTABLE);
+    if (memchr(status, '\r', status_length) ||
+        memchr(status, '\n', status_length)) {
+        return luaL_error(lua_state, "invalid response status");
+    }
+
+    worker->head_length = 0;
+    int failed = append_head(worker, "HTTP/1.1 ", 9) == -1 ||
+                 append_head(worker, status, status_length) == -1 ||
+                 append_head(worker, "\r\n", 2) == -1;
+
+    lua_pushnil(lua_state);
+    while (!failed && lua_next(lua_state, 2)) {
+        if (lua_type(lua_state, -2) != LUA_TSTRING) {
+            return luaL_error(lua_state, "header names must be strings");
+        }
+        size_t name_length;
+        const char *name = lua_tolstring(lua_state, -2, &name_length);
+        if (!is_framing_header(name, name_length)) {
+            if (lua_istable(lua_state, -1)) {
+                // Repeated fields like Set-Cookie go on separate lines.
+                int count = (int)lua_rawlen(lua_state, -1);
+                for (int i = 1; i <= count && !failed; i++) {
+                    lua_rawgeti(lua_state, -1, i);
+                    failed = append_header(worker, name, name_length,
+                                           lua_state, -1) == -1;
+                    lua_pop(lua_state, 1);
+                }
+            } else {
+                failed = append_header(worker, name, name_length, lua_state,
+                                       -1) == -1;
+            }
+            if (failed) {
+                return luaL_error(lua_state, "invalid response header: %s",
+                                  name);
+            }
+        }
+        lua_pop(lua_state, 1);
+    }
+
+    if (lua_isnoneornil(lua_state, 3)) {
+        failed = failed ||
+                 append_head(worker, "Transfer-Encoding: chunked\r\n", 28) ==
+                     -1;
+    } else {
+        char content_length[48];
+        int length = snprintf(content_length, sizeof(content_length),
+                              "Content-Length: %lld\r\n",
+                              (long long)luaL_checkinteger(lua_state, 3));
+        failed = failed || append_head(worker, content_length, length) == -1;
+    }
+    size_t date_length;
+    const char *date = current_date_header(&date_length);
+    failed = failed || append_head(worker, date, date_length) == -1;
+    if (!worker->keep_alive) {
+        failed = failed ||
+                 append_head(worker, "Connection: close\r\n", 19) == -1;
+    }
+    failed = failed || append_head(worker, "\r\n", 2) == -1;
+    if (failed) {
+        return luaL_error(lua_state, "out of memory for the response head");
+    }
+
+    return send_pieces(lua_state, worker, worker->head, worker->head_length,
+                       4);
+}
+
+/**
+ * Load a Lua module and store a specified module function into the Lua
+ * registry.
+ * @param lua_state The Lua state object
+ * @param module_name The Lua module to load
+ * @param function_name The function within the module
+ * @return The function's reference in the Lua registry or -1 on failure.
+ */
+int nibiru_load_registered_lua_function(lua_State *lua_state,
+                                        const char *module_name,
+                                        const char *function_name) {
+    lua_getglobal(lua_state, "require");
+    lua_pushstring(lua_state, module_name);
+    int status = lua_pcall(lua_state, 1, 1, 0);
+    if (status != LUA_OK) {
+        printf("Error: %s\n", lua_tostring(lua_state, -1));
+        return -1;
+    }
+
+    int lua_type = lua_getfield(lua_state, -1, function_name);
+    if (lua_type != LUA_TFUNCTION) {
+        printf("Unexpected type: %s is not a function.", function_name);
+        return -1;
+    }
+
+    int function_reference = luaL_ref(lua_state, LUA_REGISTRYINDEX);
+
+    // Take the module off the stack to clean up.
+    lua_pop(lua_state, 1);
+
+    return function_reference;
+}
+
+/**
+ * Check that the value at the top of the Lua stack is callable.
+ * @param lua_state The Lua state object
+ * @return 1 if callable else 0
+ */
+int is_callable(lua_State *lua_state) {
+    int status = lua_isfunction(lua_state, -1);
+    if (status == 1) {
+        return 1;
+    }
+
+    if (lua_istable(lua_state, -1) || lua_isuserdata(lua_state, -1)) {
+        if (lua_getmetatable(lua_state, -1)) {
+            lua_pushstring(lua_state, "__call");
+            lua_rawget(lua_state, -2);
+
+            // Check if the __call field is a function
+            int is_callable = lua_isfunction(lua_state, -1);
+
+            // Pop the __call field and the metatable from the stack
+            lua_pop(lua_state, 2);
+
+            return is_callable;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Apply the --gc settings to a worker's Lua state.
+ * Zero settings keep Lua's own defaults.
+ */
+void configure_gc(lua_State *lua_state) {
+#if LUA_VERSION_NUM >= 504
+    if (gc_generational) {
+        lua_gc(lua_state, LUA_GCGEN, gc_minor_multiplier, 0);
+    } else {
+        lua_gc(lua_state, LUA_GCINC, gc_pause, gc_step_multiplier, 0);
+    }
+#else
+    // Older Lua versions only have the incremental collector.
+    if (gc_pause) {
+        lua_gc(lua_state, LUA_GCSETPAUSE, gc_pause);
+    }
+    if (gc_step_multiplier) {
+        lua_gc(lua_state, LUA_GCSETSTEPMUL, gc_step_multiplier);
+    }
+#endif
+}
+
+int initialize_worker(struct WorkerState *worker, const char *app_module,
+                      const char *app_name) {
+    worker->lua_state = NULL;
+    worker->application_reference = 0;
+    worker->handle_environ_reference = 0;
+    worker->environ_reference = 0;
+    worker->wsgi_version_reference = 0;
+    worker->respond_reference = 0;
+    worker->write_reference = 0;
+    worker->connection = NULL;
+    worker->head = NULL;
+    worker->head_capacity = 0;
+    worker->response_thread = NULL;
+    worker->spare_thread = NULL;
+    worker->spare_thread_reference = LUA_NOREF;
+
+    int status;
+
+    worker->lua_state = luaL_newstate();
+    luaL_openlibs(worker->lua_state);
+    configure_gc(worker->lua_state);
+
+    // Load the bootstrap module to get the WSGI callable.
+    int bootstrap_reference = nibiru_load_registered_lua_function(
+        worker->lua_state, "nibiru.server.boot", "bootstrap");
+    if (bootstrap_reference == -1) {
+        return 1;
+    }
+
+    lua_rawgeti(worker->lua_state, LUA_REGISTRYINDEX, bootstrap_reference);
+    lua_pushstring(worker->lua_state, app_module);
+    lua_pushstring(worker->lua_state, app_name);
+    status = lua_pcall(worker->lua_state, 2, 1, 0);
+    if (status != LUA_OK) {
+        printf("Error: %s\n", lua_tostring(worker->lua_state, -1));
+        return 1;
+    }
+    status = is_callable(worker->lua_state);
+    if (status == 0) {
+        printf("`%s` is not a valid callable.\n", app_name);
+        return 1;
+    }
+    worker->application_reference =
+        luaL_ref(worker->lua_state, LUA_REGISTRYINDEX);
+
+    // Load the request handler.
+    int handle_environ_reference = nibiru_load_registered_lua_function(
+        worker->lua_state, "nibiru.server.connector", "handle_environ");
+    if (handle_environ_reference == -1) {
+        return 1;
+    }
+    worker->handle_environ_reference = handle_environ_reference;
+
+    // Create the response callables once rather than closures per request.
+    lua_pushlightuserdata(worker->lua_state, worker);
+    lua_pushcclosure(worker->lua_state, respond, 1);
+    worker->respond_reference = luaL_ref(worker->lua_state, LUA_REGISTRYINDEX);
+    lua_pushlightuserdata(worker->lua_state, worker);
+    lua_pushcclosure(worker->lua_state, write_response, 1);
+    worker->write_reference = luaL_ref(worker->lua_state, LUA_REGISTRYINDEX);
+
+    // Requests refill one environ table instead of allocating a new one.
+    lua_createtable(worker->lua_state, 0, 32);
+    worker->environ_reference = luaL_ref(worker->lua_state, LUA_REGISTRYINDEX);
+    lua_createtable(worker->lua_state, 2, 0);
+    lua_pushinteger(worker->lua_state, 1);
+    lua_rawseti(worker->lua_state, -2, 1);
+    lua_pushinteger(worker->lua_state, 0);
+    lua_rawseti(worker->lua_state, -2, 2);
+    worker->wsgi_version_reference =
+        luaL_ref(worker->lua_state, LUA_REGISTRYINDEX);
+
+    return 0;
+}
+
+void free_worker(struct WorkerState *worker) {
+    if (worker->lua_state != NULL) {
+        lua_close(worker->lua_state);
+    }
+    free(worker->head);
+}
+
+/**
+ * Queue a canned error response and mark the connection for closing.
+ */
+void send_error_response(struct Connection *connection, const char *response) {
+    connection_write(connection, response, strlen(response));
+    connection->closing = 1;
+}
+
+/**
+ * Serve a file from the static directory.
+ *
+ * The file is sent straight from the page cache to the client socket. If the
+ * socket can't take all of it, the rest goes out as the socket drains.
+ * @return 1 if the connection can serve another request, 0 if it must close
+ */
+int serve_static_request(struct Connection *connection, const char *method,
+                         int method_len, const char *target, int target_len,
+                         const char *headers, size_t headers_length,
+                         int keep_alive) {
+    struct StaticFile *file =
+        find_static_file(target, target_len, static_dir, static_url);
+    if (!file) {
+        const char *response = STATIC_NOT_FOUND_RESPONSE;
+        return connection_write(connection, response, strlen(response)) != -1 &&
+               keep_alive;
+    }
+
+    // Send a precompressed sibling if the client accepts its encoding.
+    const char *accept_encoding = NULL;
+    int accept_encoding_len = 0;
+    find_header_value(headers, headers_length, "Accept-Encoding",
+                      &accept_encoding, &accept_encoding_len);
+    int encoding =
+        choose_static_encoding(file, accept_encoding, accept_encoding_len);
+    int fd = encoding == -1 ? file->fd : file->variants[encoding].fd;
+    off_t size = encoding == -1 ? file->st.st_size
+                                : file->variants[encoding].st.st_size;
+    int is_head = method_len == 4 && memcmp(method, "HEAD", 4) == 0;
+    char response_headers[1024];
+    int response_headers_length;
+
+    // Answer conditional requests from the cached stat data alone.
+    const char *if_none_match = NULL, *if_modified_since = NULL;
+    int if_none_match_len = 0, if_modified_since_len = 0;
+    find_header_value(headers, headers_length, "If-None-Match",
+                      &if_none_match, &if_none_match_len);
+    find_header_value(headers, headers_length, "If-Modified-Since",
+                      &if_modified_since, &if_modified_since_len);
+    if (static_file_not_modified(file, encoding, if_none_match,
+                                 if_none_match_len, if_modified_since,
+                                 if_modified_since_len)) {
+        response_headers_length = format_static_not_modified(
+            response_headers, sizeof(response_headers), file, encoding,
+            keep_alive);
+        return connection_write(connection, response_headers,
+                                response_headers_length) != -1 &&
+               keep_alive;
+    }
+
+    // Ranges apply to GET only, and only while If-Range still matches.
+    struct ByteRange ranges[MAX_BYTE_RANGES];
+    int range_count = -1;
+    const char *range = NULL, *if_range = NULL;
+    int range_len = 0, if_range_len = 0;
+    find_header_value(headers, headers_length, "If-Range", &if_range,
+                      &if_range_len);
+    if (!is_head &&
+        find_header_value(headers, headers_length, "Range", &range,
+                          &range_len) &&
+        static_file_range_applies(file, encoding, if_range, if_range_len)) {
+        range_count = parse_byte_ranges(range, range_len, size, ranges);
+    }
+
+    if (range_count == 0) {
+        response_headers_length = format_static_unsatisfiable(
+            response_headers, sizeof(response_headers), file, encoding,
+            keep_alive);
+        return connection_write(connection, response_headers,
+                                response_headers_length) != -1 &&
+               keep_alive;
+    }
+
+    if (range_count > 1) {
+        off_t content_length =
+            static_multipart_length(file, encoding, ranges, range_count);
+        response_headers_length = format_static_multipart_headers(
+            response_headers, sizeof(response_headers), file, encoding,
+            content_length, keep_alive);
+        if (connection_write(connection, response_headers,
+                             response_headers_length) == -1) {
+            return 0;
+        }
+        // Part headers are queued between the file ranges they introduce.
+        for (int i = 0; i < range_count; i++) {
+            response_headers_length = format_static_part_header(
+                response_headers, sizeof(response_headers), file, &ranges[i],
+                size);
+            if (connection_write(connection, response_headers,
+                                 response_headers_length) == -1 ||
+                connection_send_file(connection, file, fd, ranges[i].first,
+                                     ranges[i].last - ranges[i].first + 1) ==
+                    -1) {
+                return 0;
+            }
+        }
+        return connection_write(connection, STATIC_MULTIPART_END,
+                                strlen(STATIC_MULTIPART_END)) != -1 &&
+               keep_alive;
+    }
+
+    const struct ByteRange *single = range_count == 1 ? &ranges[0] : NULL;
+    response_headers_length =
+        format_static_headers(response_headers, sizeof(response_headers),
+                              file, encoding, single, keep_alive);
+    if (connection_write(connection, response_headers,
+                         response_headers_length) == -1) {
+        return 0;
+    }
+    // HEAD responses only carry the headers.
+    if (is_head) {
+        return keep_alive;
+    }
+    off_t offset = single ? single->first : 0;
+    off_t length = single ? single->last - single->first + 1 : size;
+    if (connection_send_file(connection, file, fd, offset, length) == -1) {
+        return 0;
+    }
+    return keep_alive;
+}
+
+// Environ keys for common header names, so the usual headers skip building
+// their key byte by byte
+static const struct {
+    const char *name;
+    int name_len;
+    const char *key;
+} common_headers[] = {
+    {"Host", 4, "HTTP_HOST"},
+    {"User-Agent", 10, "HTTP_USER_AGENT"},
+    {"Accept", 6, "HTTP_ACCEPT"},
+    {"Accept-Encoding", 15, "HTTP_ACCEPT_ENCODING"},
+    {"Accept-Language", 15, "HTTP_ACCEPT_LANGUAGE"},
+    {"Connection", 10, "HTTP_CONNECTION"},
+    {"Cookie", 6, "HTTP_COOKIE"},
+    {"Referer", 7, "HTTP_REFERER"},
+    {"Cache-Control", 13, "HTTP_CACHE_CONTROL"},
+    {"Authorization", 13, "HTTP_AUTHORIZATION"},
+    {"Origin", 6, "HTTP_ORIGIN"},
+    {"If-None-Match", 13, "HTTP_IF_NONE_MATCH"},
+    {"If-Modified-Since", 17, "HTTP_IF_MODIFIED_SINCE"},
+    {"Upgrade-Insecure-Requests", 25, "HTTP_UPGRADE_INSECURE_REQUESTS"},
+    {"Content-Type", 12, "CONTENT_TYPE"},
+    {"Content-Length", 14, "CONTENT_LENGTH"},
+    {"Transfer-Encoding", 17, "HTTP_TRANSFER_ENCODING"},
+};
+
+#define NUM_COMMON_HEADERS                                                     \
+    (int)(sizeof(common_headers) / sizeof(common_headers[0]))
+
+/**
+ * Push the environ key for a header field onto the Lua stack.
+ * Content-Type and Content-Length keep their CGI names; every other field
+ * becomes HTTP_ plus the upper-cased name with dashes turned to underscores.
+ * @return 0 on success, -1 if the field must be left out of the environ
+ */
+int push_environ_key(lua_State *lua_state, const struct HeaderField *field) {
+    for (int i = 0; i < NUM_COMMON_HEADERS; i++) {
+        if (common_headers[i].name_len == field->name_len &&
+            strncasecmp(common_headers[i].name, field->name,
+                        field->name_len) == 0) {
+            lua_pushstring(lua_state, common_headers[i].key);
+            return 0;
+        }
+    }
+
+    // Underscores would let a client spoof a dashed header's key.
+    if (memchr(field->name, '_', field->name_len)) {
+        return -1;
+    }
+    char stack_key[128];
+    size_t key_len = 5 + field->name_len;
+    char *key = key_len <= sizeof(stack_key) ? stack_key : malloc(key_len);
+    if (!key) {
+        return -1;
+    }
+    memcpy(key, "HTTP_", 5);
+    for (int i = 0; i < field->name_len; i++) {
+        char c = field->name[i];
+        key[5 + i] = c == '-' ? '_' : toupper((unsigned char)c);
+    }
+    lua_pushlstring(lua_state, key, key_len);
+    if (key != stack_key) {
+        free(key);
+    }
+    return 0;
+}
+
+/**
+ * Build the WSGI environ for a request and push it onto the Lua stack.
+ * The worker's environ table is cleared and refilled so its hash part is
+ * reused rather than allocated per request.
+ * The target is split into PATH_INFO and QUERY_STRING. Repeated header
+ * fields are joined with commas.
+ * @param fields The request's header fields from parse_headers
+ * @param body_length The length of a framed body to report as
+ * CONTENT_LENGTH, or -1 to take it from the Content-Length field
+ */
+void push_environ(struct WorkerState *worker, const char *method,
+                  int method_len, const char *target, int target_len,
+                  const char *version, int version_len,
+                  const struct HeaderField *fields, int field_count,
+                  long long body_length) {
+    lua_State *lua_state = worker->lua_state;
+    lua_rawgeti(lua_state, LUA_REGISTRYINDEX, worker->environ_reference);
+    // Clearing fields while traversing the table is allowed in Lua.
+    lua_pushnil(lua_state);
+    while (lua_next(lua_state, -2)) {
+        lua_pop(lua_state, 1);
+        lua_pushvalue(lua_state, -1);
+        lua_pushnil(lua_state);
+        lua_rawset(lua_state, -4);
+    }
+
+    lua_pushlstring(lua_state, method, method_len);
+    lua_setfield(lua_state, -2, "REQUEST_METHOD");
+    // nibiru assumes it is mounted at the root rather than some sub-path.
+    lua_pushliteral(lua_state, "");
+    lua_setfield(lua_state, -2, "SCRIPT_NAME");
+    const char *query = memchr(target, '?', target_len);
+    int path_len = query ? query - target : target_len;
+    lua_pushlstring(lua_state, target, path_len);
+    lua_setfield(lua_state, -2, "PATH_INFO");
+    if (query) {
+        lua_pushlstring(lua_state, query + 1, target_len - path_len - 1);
+    } else {
+        lua_pushliteral(lua_state, "");
+    }
+    lua_setfield(lua_state, -2, "QUERY_STRING");
+    lua_pushliteral(lua_state, "localhost");
+    lua_setfield(lua_state, -2, "SERVER_NAME");
+    lua_pushstring(lua_state, server_port);
+    lua_setfield(lua_state, -2, "SERVER_PORT");
+    lua_pushlstring(lua_state, version, version_len);
+    lua_setfield(lua_state, -2, "SERVER_PROTOCOL");
+
+    lua_rawgeti(lua_state, LUA_REGISTRYINDEX, worker->wsgi_version_reference);
+    lua_setfield(lua_state, -2, "wsgi.version");
+    lua_pushliteral(lua_state, "http");
+    lua_setfield(lua_state, -2, "wsgi.url_scheme");
+    lua_pushboolean(lua_state, 0);
+    lua_setfield(lua_state, -2, "wsgi.multithread");
+    lua_pushboolean(lua_state, 1);
+    lua_setfield(lua_state, -2, "wsgi.multiprocess");
+    lua_pushboolean(lua_state, 0);
+    lua_setfield(lua_state, -2, "wsgi.run_once");
+
+    for (int i = 0; i < field_count; i++) {
+        if (push_environ_key(lua_state, &fields[i]) != 0) {
+            continue;
+        }
+        lua_pushvalue(lua_state, -1);
+        lua_rawget(lua_state, -3);
+        if (lua_isnil(lua_state, -1)) {
+            lua_pop(lua_state, 1);
+            lua_pushlstring(lua_state, fields[i].value, fields[i].value_len);
+        } else {
+            lua_pushliteral(lua_state, ",");
+            lua_pushlstring(lua_state, fields[i].value, fields[i].value_len);
+            lua_concat(lua_state, 3);
+        }
+        lua_rawset(lua_state, -3);
+    }
+
+    // A decoded chunked body has no Content-Length field of its own, and a
+    // repeated one would otherwise be joined into a list.
+    if (body_length >= 0) {
+        char content_length[32];
+        snprintf(content_length, sizeof(content_length), "%lld", body_length);
+        lua_pushstring(lua_state, content_length);
+        lua_setfield(lua_state, -2, "CONTENT_LENGTH");
+    }
+}
+
+/**
+ * Resume a response's coroutine, hiding the lua_resume differences between
+ * Lua versions.
+ */
+int resume_thread(lua_State *thread, lua_State *from, int argument_count) {
+#if LUA_VERSION_NUM >= 504
+    int result_count;
+    return lua_resume(thread, from, argument_count, &result_count);
+#else
+    return lua_resume(thread, from, argument_count);
+#endif
+}
+
+/**
+ * Run a response's coroutine until it finishes or a write pauses it.
+ *
+ * A coroutine that finishes cleanly is kept for the next response. One
+ * that pauses is handed to the connection along with the environ it holds,
+ * so the worker starts a new environ for later requests.
+ * @param thread The coroutine, with the arguments to resume it on its stack
+ * @param reference The coroutine's registry reference
+ * @return 1 if the connection can serve another request, 0 if it must close
+ */
+int run_response(struct WorkerState *worker, int worker_id,
+                 struct Connection *connection, lua_State *thread,
+                 int reference, int argument_count) {
+    lua_State *lua_state = worker->lua_state;
+    worker->response_thread = thread;
+    worker->write_paused = 0;
+    int status = resume_thread(thread, lua_state, argument_count);
+    worker->response_thread = NULL;
+
+    if (status == LUA_YIELD && worker->write_paused) {
+        struct PausedResponse *paused = malloc(sizeof(struct PausedResponse));
+        if (paused) {
+            paused->thread = thread;
+            paused->thread_reference = reference;
+            paused->keep_alive = worker->keep_alive;
+            connection->paused = paused;
+            luaL_unref(lua_state, LUA_REGISTRYINDEX,
+                       worker->environ_reference);
+            lua_createtable(lua_state, 0, 32);
+            worker->environ_reference =
+                luaL_ref(lua_state, LUA_REGISTRYINDEX);
+            return 1;
+        }
+        lua_pushliteral(thread, "out of memory pausing the response");
+    } else if (status == LUA_YIELD) {
+        lua_pushliteral(thread, "attempt to yield from outside a coroutine");
+    }
+
+    if (status != LUA_OK) {
+        printf("Worker %d: Lua error: %s\n", worker_id,
+               lua_tostring(thread, -1));
+        // The coroutine can't run another response, so drop it.
+        luaL_unref(lua_state, LUA_REGISTRYINDEX, reference);
+        // A response that already started can only be cut off.
+        if (!worker->response_started) {
+            send_error_response(connection,
+                                "HTTP/1.1 500 Internal Server Error\r\n"
+                                "Connection: close\r\n\r\n");
+        }
+        return 0;
+    }
+
+    lua_settop(thread, 0);
+    if (worker->spare_thread) {
+        luaL_unref(lua_state, LUA_REGISTRYINDEX, reference);
+    } else {
+        worker->spare_thread = thread;
+        worker->spare_thread_reference = reference;
+    }
+    if (worker->write_failed) {
+        perror("Worker: send failed");
+        return 0;
+    }
+    return worker->keep_alive;
+}
+
+/**
+ * Handle a single buffered HTTP request on a client connection.
+ * @param request The complete request (request line, headers, and body)
+ * @param request_length The number of bytes in the request
+ * @param keep_alive Whether the connection stays open after the response
+ * @return 1 if the connection can serve another request or the response
+ * paused, 0 if it must close
+ */
+int handle_request(struct WorkerState *worker, int worker_id,
+                   struct Connection *connection, char *request,
+                   size_t request_length, int keep_alive) {
+    // Parse the HTTP request line
+    const char *method, *target, *version;
+    int method_len, target_len, version_len;
+    int parse_result =
+        parse_request_line(request, request_length, &method, &target, &version,
+                           &method_len, &target_len, &version_len);
+
+    // Handle parsing errors
+    if (parse_result == -1 || parse_result == -3) {
+        // Malformed request: no CRLF found (-1) or leading whitespace (-3)
+        send_error_response(connection, "HTTP/1.1 400 Bad Request\r\n"
+                                        "Connection: close\r\n\r\n");
+        return 0;
+    } else if (parse_result == -2) {
+        // Method or version not supported
+        if (!is_supported_method(method, method_len)) {
+            send_error_response(connection, "HTTP/1.1 501 Not Implemented\r\n"
+                                            "Connection: close\r\n\r\n");
+        } else {
+            send_error_response(connection,
+                                "HTTP/1.1 505 HTTP Version Not Supported\r\n"
+                                "Connection: close\r\n\r\n");
+        }
+        return 0;
+    }
+
+    // Find the start of remaining data (after \r\n)
+    const char *remaining_data = memmem(request, request_length, "\r\n", 2);
+    size_t remaining_length = 0;
+    if (remaining_data) {
+        remaining_data += 2; // Skip \r\n
+        remaining_length = request_length - (remaining_data - request);
+    } else {
+        remaining_data = ""; // Should not happen if parsing succeeded
+    }
+
+    // Check for static file requests
+    if (is_static_request(target, static_url)) {
+        return serve_static_request(connection, method, method_len, target,
+                                    target_len, remaining_data,
+                                    remaining_length, keep_alive);
+    }
+
+    // Split out the header fields for the environ.
+    char *body = memmem(request, request_length, "\r\n\r\n", 4) + 4;
+    size_t body_length = request_length - (body - request);
+    struct HeaderField fields[MAX_HEADER_FIELDS];
+    int field_count = parse_headers(remaining_data, body - remaining_data,
+                                    fields, MAX_HEADER_FIELDS);
+    if (field_count == -1) {
+        send_error_response(connection, "HTTP/1.1 400 Bad Request\r\n"
+                                        "Connection: close\r\n\r\n");
+        return 0;
+    }
+
+    // Hand the application a chunked body as plain data, and a repeated
+    // Content-Length as the one length the body was framed by.
+    long long decoded_length = -1;
+    const char *coding;
+    int coding_len;
+    if (find_header_value(remaining_data, remaining_length,
+                          "Transfer-Encoding", &coding, &coding_len)) {
+        if (decode_chunked_body(body, body_length, &body_length) == -1) {
+            send_error_response(connection, "HTTP/1.1 400 Bad Request\r\n"
+                                            "Connection: close\r\n\r\n");
+            return 0;
+        }
+        decoded_length = body_length;
+    } else if (find_header_value(remaining_data, remaining_length,
+                                 "Content-Length", &coding, &coding_len)) {
+        decoded_length = body_length;
+    }
+
+    // Process the request with Lua in a coroutine. The handler writes the
+    // response as the application produces it.
+    lua_State *thread = worker->spare_thread;
+    int reference = worker->spare_thread_reference;
+    worker->spare_thread = NULL;
+    if (!thread) {
+        thread = lua_newthread(worker->lua_state);
+        reference = luaL_ref(worker->lua_state, LUA_REGISTRYINDEX);
+    }
+    worker->connection = connection;
+    worker->keep_alive = keep_alive;
+    worker->response_started = 0;
+    worker->write_failed = 0;
+    lua_rawgeti(worker->lua_state, LUA_REGISTRYINDEX,
+                worker->handle_environ_reference);
+    lua_rawgeti(worker->lua_state, LUA_REGISTRYINDEX,
+                worker->application_reference);
+    push_environ(worker, method, method_len, target, target_len, version,
+                 version_len, fields, field_count, decoded_length);
+    lua_pushlstring(worker->lua_state, body, body_length);
+    lua_pushboolean(worker->lua_state, keep_alive);
+    lua_rawgeti(worker->lua_state, LUA_REGISTRYINDEX,
+                worker->respond_reference);
+    lua_rawgeti(worker->lua_state, LUA_REGISTRYINDEX, worker->write_reference);
+    lua_xmove(worker->lua_state, thread, 7);
+
+    return run_response(worker, worker_id, connection, thread, reference, 6);
+}
+
+// Responses for find_request_length errors, indexed by -result - 1
+static const char *framing_errors[] = {
+    "HTTP/1.1 400 Bad Request\r\nConnection: close\r\n\r\n",
+    "HTTP/1.1 431 Request Header Fields Too Large\r\n"
+    "Connection: close\r\n\r\n",
+    "HTTP/1.1 413 Content Too Large\r\nConnection: close\r\n\r\n",
+    "HTTP/1.1 501 Not Implemented\r\nConnection: close\r\n\r\n",
+};
+
+/**
+ * Size the receive buffer may grow to.
+ *
+ * This fits the largest request the limits allow. Chunk framing and trailers
+ * may add up to another max_header_size bytes to a chunked body.
+ */
+size_t receive_limit() {
+    return 2 * (size_t)max_header_size + (size_t)max_body_size;
+}
+
+/**
+ * Handle every complete request buffered on a connection.
+ *
+ * Pipelined requests are answered in order. Processing pauses while a
+ * response is still queued so a client that doesn't read can't make the
+ * worker buffer unbounded output.
+ */
+void process_connection(struct WorkerState *worker, int worker_id,
+                        struct Connection *connection) {
+    while (!connection->closing && !connection_has_output(connection)) {
+        if (connection->input_length == 0) {
+            return;
+        }
+
+        size_t request_length = 0;
+        int framing = find_request_length(
+            connection->input, connection->input_length,
+            (size_t)max_header_size, (size_t)max_body_size, &request_length);
+        if (framing == 0) {
+            return; // Wait for more data
+        }
+        if (framing != 1) {
+            send_error_response(connection, framing_errors[-framing - 1]);
+            return;
+        }
+
+        connection->requests_served++;
+        int keep_alive =
+            keepalive_timeout > 0 &&
+            connection->requests_served < keepalive_requests &&
+            request_wants_keep_alive(connection->input, request_length);
+
+        keep_alive =
+            handle_request(worker, worker_id, connection, connection->input,
+                           request_length, keep_alive);
+        connection_consume(connection, request_length);
+        if (!keep_alive) {
+            connection->closing = 1;
+        }
+    }
+}
+
+#ifdef USE_EPOLL
+/**
+ * Update which readiness events the worker waits for on a connection.
+ *
+ * A connection with queued output waits to become writable. Otherwise, it
+ * waits for more request data.
+ */
+int watch_connection(int epoll_fd, int operation,
+                     struct Connection *connection) {
+    struct epoll_event event;
+    event.events = connection_has_output(connection) ? EPOLLOUT : EPOLLIN;
+    event.data.ptr = connection;
+    return epoll_ctl(epoll_fd, operation, connection->fd, &event);
+}
+
+/**
+ * Start or stop waiting on the listening socket.
+ */
+void watch_listener(int epoll_fd, int listen_socket_fd, int watch) {
+    if (!watch) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, listen_socket_fd, NULL);
+        return;
+    }
+    struct epoll_event event;
+    event.events = EPOLLIN;
+#ifdef EPOLLEXCLUSIVE
+    // Wake one worker per new connection instead of all of them.
+    event.events |= EPOLLEXCLUSIVE;
+#endif
+    // The listening socket is the only event without a connection.
+    event.data.ptr = NULL;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_socket_fd, &event);
+}
+
+/**
+ * Accept every pending connection on the non-blocking listening socket.
+ * @return 1 if the worker can't take more connections for now, else 0
+ */
+int accept_connections(int epoll_fd, int listen_socket_fd,
+                       struct ConnectionList *connections) {
+    while (connections->count < worker_connections) {
+        int client_fd = accept4(listen_socket_fd, NULL, NULL,
+                                SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client_fd == -1) {
+            if (errno == EMFILE || errno == ENFILE) {
+                // Out of descriptors. The listener is level-triggered, so
+                // keep it unwatched until a connection closes.
+                perror("Worker: accept failed");
+                return connections->count > 0;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR &&
+                errno != ECONNABORTED) {
+                perror("Worker: accept failed");
+            }
+            return 0;
+        }
+
+        struct Connection *connection = connection_create(client_fd);
+        if (!connection) {
+            close(client_fd);
+            continue;
+        }
+        if (watch_connection(epoll_fd, EPOLL_CTL_ADD, connection) == -1) {
+            perror("Worker: epoll_ctl failed");
+            connection_destroy(connection);
+            continue;
+        }
+        connection_list_append(connections, connection);
+    }
+    return 1;
+}
+
+/**
+ * Get the seconds a connection may go without activity before it expires.
+ *
+ * A connection between requests waits for keepalive_timeout. One that has
+ * part of a request buffered or output queued, or hasn't sent its first
+ * request yet, waits for request_timeout.
+ */
+int connection_timeout(const struct Connection *connection) {
+    if (keepalive_timeout > 0 && connection->requests_served > 0 &&
+        connection->input_length == 0 && !connection_has_output(connection)) {
+        return keepalive_timeout;
+    }
+    return request_timeout;
+}
+
+/**
+ * Continue a paused response once the client has read enough of its output.
+ * @param healthy Whether the write that paused it succeeded, which is what
+ * the write returns to the application
+ */
+void resume_response(struct WorkerState *worker, int worker_id,
+                     struct Connection *connection, int healthy) {
+    struct PausedResponse *paused = connection->paused;
+    connection->paused = NULL;
+    worker->connection = connection;
+    worker->keep_alive = paused->keep_alive;
+    worker->response_started = 1;
+    worker->write_failed = !healthy;
+    lua_pushboolean(paused->thread, healthy);
+    if (!run_response(worker, worker_id, connection, paused->thread,
+                      paused->thread_reference, 1)) {
+        connection->closing = 1;
+    }
+    free(paused);
+}
+
+/**
+ * Remove a connection from the worker and close it.
+ *
+ * A response still paused on the connection is told its write failed so
+ * the application can finish up.
+ */
+void close_connection(struct WorkerState *worker, int worker_id,
+                      struct ConnectionList *connections,
+                      struct Connection *connection) {
+    if (connection->paused) {
+        resume_response(worker, worker_id, connection, 0);
+    }
+    connection_list_remove(connections, connection);
+    // Closing the socket also removes it from the epoll set.
+    connection_destroy(connection);
+}
+
+/**
+ * Multiplex many non-blocking connections in a single worker.
+ *
+ * The worker reads whatever each ready connection sends and only calls into
+ * Lua once a complete request is buffered, so slow or idle clients don't
+ * hold up the rest.
+ */
+int run_event_loop(struct WorkerState *worker, int worker_id,
+                   int listen_socket_fd) {
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd == -1) {
+        perror("Worker: epoll_create1 failed");
+        return 1;
+    }
+
+    // O_NONBLOCK lives on the open file description, which every worker
+    // shares unless it has its own SO_REUSEPORT socket. Every worker
+    // accepts the same way, so setting the flag again is harmless.
+    int flags = fcntl(listen_socket_fd, F_GETFL, 0);
+    fcntl(listen_socket_fd, F_SETFL, flags | O_NONBLOCK);
+    watch_listener(epoll_fd, listen_socket_fd, 1);
+    int listening = 1;
+    // The connection count at which the listener was paused.
+    int paused_count = 0;
+
+    struct ConnectionList connections = {NULL, NULL, 0};
+    struct epoll_event events[64];
+
+    while (!worker_shutdown_requested) {
+        // Wake at least once a second to expire idle connections.
+        int ready = epoll_wait(epoll_fd, events, 64, 1000);
+        if (ready == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Worker: epoll_wait failed");
+            break;
+        }
+
+        time_t now = time(NULL);
+        for (int i = 0; i < ready; i++) {
+            struct Connection *connection = events[i].data.ptr;
+            if (connection == NULL) {
+                if (accept_connections(epoll_fd, listen_socket_fd,
+                                       &connections)) {
+                    // Leave new clients in the backlog until a slot frees.
+                    watch_listener(epoll_fd, listen_socket_fd, 0);
+                    listening = 0;
+                    paused_count = connections.count;
+                }
+                continue;
+            }
+
+            int open = 1;
+            if (events[i].events & EPOLLOUT) {
+                open = connection_flush(connection) != -1;
+                if (open && connection->paused &&
+                    connection_queued(connection) <=
+                        CONNECTION_OUTPUT_HIGH_WATER) {
+                    resume_response(worker, worker_id, connection, 1);
+                }
+            } else if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                ssize_t received = connection_receive(connection,
+                                                      receive_limit());
+                open = received > 0 ||
+                       (received == -1 && (errno == EAGAIN ||
+                                           errno == EWOULDBLOCK ||
+                                           errno == EINTR));
+            }
+
+            if (open) {
+                connection_list_touch(&connections, connection, now);
+                if (!connection->paused && !connection_has_output(connection)) {
+                    process_connection(worker, worker_id, connection);
+                }
+            }
+
+            if (!open ||
+                (connection->closing && !connection_has_output(connection))) {
+                close_connection(worker, worker_id, &connections, connection);
+            } else {
+                watch_connection(epoll_fd, EPOLL_CTL_MOD, connection);
+            }
+        }
+
+        // The list is ordered by activity so expired connections are at the
+        // head. Past the first one younger than the shortest timeout, none
+        // can have expired.
+        int shortest_timeout = request_timeout;
+        if (keepalive_timeout > 0 && keepalive_timeout < shortest_timeout) {
+            shortest_timeout = keepalive_timeout;
+        }
+        struct Connection *oldest = connections.head;
+        while (oldest && now - oldest->last_active >= shortest_timeout) {
+            struct Connection *next = oldest->next;
+            if (now - oldest->last_active >= connection_timeout(oldest)) {
+                close_connection(worker, worker_id, &connections, oldest);
+            }
+            oldest = next;
+        }
+
+        if (!listening && connections.count < paused_count) {
+            watch_listener(epoll_fd, listen_socket_fd, 1);
+            listening = 1;
+        }
+    }
+
+    while (connections.head) {
+        close_connection(worker, worker_id, &connections, connections.head);
+    }
+    close(epoll_fd);
+    return 0;
+}
+#else
+/**
+ * Serve requests on a blocking client connection until it closes.
+ *
+ * The connection stays open for more requests (HTTP/1.1 keep-alive) until
+ * the client asks to close it, it sits idle for longer than
+ * keepalive_timeout, or it has served keepalive_requests requests.
+ */
+void handle_client(struct WorkerState *worker, int worker_id,
+                   struct Connection *connection) {
+    // Bound how long a connection can pin this worker while idle, sending a
+    // request slowly, or not reading its response.
+    struct timeval timeout = {.tv_sec = keepalive_timeout > 0
+                                            ? keepalive_timeout
+                                            : request_timeout,
+                              .tv_usec = 0};
+    setsockopt(connection->fd, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+               sizeof(timeout));
+    timeout.tv_sec = request_timeout;
+    setsockopt(connection->fd, SOL_SOCKET, SO_SNDTIMEO, &timeout,
+               sizeof(timeout));
+
+    while (!worker_shutdown_requested) {
+        process_connection(worker, worker_id, connection);
+        if (connection->closing || connection_has_output(connection)) {
+            // Blocking sends never leave output queued unless they failed.
+            return;
+        }
+
+        ssize_t received =
+            connection_receive(connection, receive_limit());
+        if (received == -1 && errno == EINTR && !worker_shutdown_requested) {
+            continue;
+        }
+        if (received <= 0) {
+            // Connection closed by client, idle timeout, or shutdown
+            return;
+        }
+    }
+}
+#endif
+
+/**
+ * Create a socket listening on the given port.
+ * @param reuse_port Allow other sockets to bind the same port so the kernel
+ * can balance connections between them
+ * @return The listening socket or -1 on failure.
+ */
+int create_listen_socket(const char *port, int backlog, int reuse_port) {
+    struct addrinfo hints;
+    struct addrinfo *server_info;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_flags = AI_PASSIVE;
+    hints.ai_family = AF_UNSPEC; // IPv4 or IPv6
+    hints.ai_socktype = SOCK_STREAM;
+
+    int addr_status = getaddrinfo(NULL, port, &hints, &server_info);
+    if (addr_status != 0) {
+        fprintf(stderr, "Failed to get server information: %s\n",
+                gai_strerror(addr_status));
+        return -1;
+    }
+
+    struct addrinfo *current_server_info;
+    int listen_socket_fd;
+    for (current_server_info = server_info; current_server_info != NULL;
+         current_server_info = current_server_info->ai_next) {
+        listen_socket_fd = socket(current_server_info->ai_family,
+                                  current_server_info->ai_socktype,
+                                  current_server_info->ai_protocol);
+        if (listen_socket_fd == -1) {
+            continue;
+        }
+
+        int opt = 1;
+        setsockopt(listen_socket_fd, SOL_SOCKET, SO_REUSEADDR, &opt,
+                   sizeof(opt));
+#ifdef SO_REUSEPORT
+        if (reuse_port) {
+            setsockopt(listen_socket_fd, SOL_SOCKET, SO_REUSEPORT, &opt,
+                       sizeof(opt));
+        }
+#endif
+
+        int bind_status = bind(listen_socket_fd, current_server_info->ai_addr,
+                               current_server_info->ai_addrlen);
+        if (bind_status == -1) {
+            close(listen_socket_fd);
+            continue;
+        }
+
+        break;
+    }
+
+    freeaddrinfo(server_info);
 
-/**
- * Load a Lua module and store a specified module function into the Lua
- * registry.
- * @param lua_state The Lua state object
- * @param module_name The Lua module to load
- * @param function_name The function within the module
- * @return The function's reference in the Lua registry or -1 on failure.
- */
-int nibiru_load_registered_lua_function(lua_State *lua_state,
-                                        const char *module_name,
-                                        const char *function_name) {
-    lua_getglobal(lua_state, "require");
-    lua_pushstring(lua_state, module_name);
-    int status = lua_pcall(lua_state, 1, 1, 0);
-    if (status != LUA_OK) {
-        printf("Error: %s\n", lua_tostring(lua_state, -1));
+    if (current_server_info == NULL) {
+        perror("Failed to bind socket");
         return -1;
     }
 
-    int lua_type = lua_getfield(lua_state, -1, function_name);
-    if (lua_type != LUA_TFUNCTION) {
-        printf("Unexpected type: %s is not a function.", function_name);
+    int listen_status = listen(listen_socket_fd, backlog);
+    if (listen_status == -1) {
+        perror("Failed to listen");
+        close(listen_socket_fd);
         return -1;
     }
 
-    int function_reference = luaL_ref(lua_state, LUA_REGISTRYINDEX);
-
-    // Take the module off the stack to clean up.
-    lua_pop(lua_state, 1);
-
-    return function_reference;
+    return listen_socket_fd;
 }
 
 /**
- * Check that the value at the top of the Lua stack is callable.
- * @param lua_state The Lua state object
- * @return 1 if callable else 0
+ * Close the pool's listening sockets in the range [first, last).
  */
-int is_callable(lua_State *lua_state) {
-    int status = lua_isfunction(lua_state, -1);
-    if (status == 1) {
-        return 1;
-    }
-
-    if (lua_istable(lua_state, -1) || lua_isuserdata(lua_state, -1)) {
-        if (lua_getmetatable(lua_state, -1)) {
-            lua_pushstring(lua_state, "__call");
-            lua_rawget(lua_state, -2);
-
-            // Check if the __call field is a function
-            int is_callable = lua_isfunction(lua_state, -1);
-
-            // Pop the __call field and the metatable from the stack
-            lua_pop(lua_state, 2);
-
-            return is_callable;
-        }
+void close_listen_sockets(struct WorkerPool *pool, int first, int last) {
+    for (int i = first; i < last; i++) {
+        close(pool->listen_socket_fds[i]);
     }
-
-    return 0;
 }
 
-int initialize_worker(struct WorkerState *worker, const char *app_module,
-                      const char *app_name) {
-    worker->lua_state = NULL;
-    worker->application_reference = 0;
-    worker->handle_connection_reference = 0;
-
-    int status;
-
-    worker->lua_state = luaL_newstate();
-    luaL_openlibs(worker->lua_state);
-
-    // Load the bootstrap module to get the WSGI callable.
-    int bootstrap_reference = nibiru_load_registered_lua_function(
-        worker->lua_state, "nibiru.server.boot", "bootstrap");
-    if (bootstrap_reference == -1) {
-        return 1;
+/**
+ * Pin the calling worker to one of the CPUs the server may run on.
+ *
+ * Workers are spread round-robin over the allowed CPUs. With a per-worker
+ * SO_REUSEPORT socket, SO_INCOMING_CPU also asks the kernel to hand the
+ * socket connections that arrive on that CPU so a request stays on one core.
+ */
+void pin_worker_to_cpu(int worker_id, int listen_socket_fd, int reuse_port) {
+#ifdef __linux__
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == -1) {
+        perror("Worker: sched_getaffinity failed");
+        return;
     }
 
-    lua_rawgeti(worker->lua_state, LUA_REGISTRYINDEX, bootstrap_reference);
-    lua_pushstring(worker->lua_state, app_module);
-    lua_pushstring(worker->lua_state, app_name);
-    status = lua_pcall(worker->lua_state, 2, 1, 0);
-    if (status != LUA_OK) {
-        printf("Error: %s\n", lua_tostring(worker->lua_state, -1));
-        return 1;
-    }
-    status = is_callable(worker->lua_state);
-    if (status == 0) {
-        printf("`%s` is not a valid callable.\n", app_name);
-        return 1;
+    int index = worker_id % CPU_COUNT(&allowed);
+    int cpu = 0;
+    for (; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &allowed) && index-- == 0) {
+            break;
+        }
     }
-    worker->application_reference =
-        luaL_ref(worker->lua_state, LUA_REGISTRYINDEX);
 
-    // Load the connection handler.
-    int handle_connection_reference = nibiru_load_registered_lua_function(
-        worker->lua_state, "nibiru.server.connector", "handle_connection");
-    if (handle_connection_reference == -1) {
-        return 1;
+    cpu_set_t pinned;
+    CPU_ZERO(&pinned);
+    CPU_SET(cpu, &pinned);
+    if (sched_setaffinity(0, sizeof(pinned), &pinned) == -1) {
+        perror("Worker: sched_setaffinity failed");
+        return;
     }
-    worker->handle_connection_reference = handle_connection_reference;
 
-    return 0;
+#ifdef SO_INCOMING_CPU
+    if (reuse_port) {
+        setsockopt(listen_socket_fd, SOL_SOCKET, SO_INCOMING_CPU, &cpu,
+                   sizeof(cpu));
+    }
+#endif
+#else
+    (void)worker_id;
+    (void)listen_socket_fd;
+    (void)reuse_port;
+#endif
 }
 
-void free_worker(struct WorkerState *worker) {
-    if (worker->lua_state != NULL) {
-        lua_close(worker->lua_state);
+/**
+ * Give a worker that inherited the master's Lua state its own random
+ * sequence, since every child of the fork starts from the same seed.
+ */
+void reseed_random(lua_State *lua_state) {
+    lua_getglobal(lua_state, "math");
+    lua_getfield(lua_state, -1, "randomseed");
+    lua_pushinteger(lua_state,
+                    (lua_Integer)time(NULL) ^ ((lua_Integer)getpid() << 16));
+    if (lua_pcall(lua_state, 1, 0, 0) != LUA_OK) {
+        lua_pop(lua_state, 1);
     }
+    lua_pop(lua_state, 1);
 }
 
-int run_worker(int worker_id, int listen_socket_fd, pid_t main_pid,
-               const char *app_module, const char *app_name) {
+/**
+ * Run a worker process until shutdown.
+ * @param preloaded The master's booted worker state with --preload, or NULL
+ * to boot the application in this worker
+ */
+int run_worker(int worker_id, int listen_socket_fd, const char *app_module,
+               const char *app_name, struct WorkerState *preloaded) {
     // Set up signal handler for graceful shutdown
     struct sigaction sa;
     sa.sa_handler = worker_signal_handler;
@@ -195,16 +1535,32 @@ int run_worker(int worker_id, int listen_socket_fd, pid_t main_pid,
     sa.sa_handler = SIG_IGN;
     sigaction(SIGPIPE, &sa, NULL);
 
-    // Initialize worker state
-    struct WorkerState worker;
-    int status = initialize_worker(&worker, app_module, app_name);
-    if (status != 0) {
-        free_worker(&worker);
-        return 1;
+    if (cpu_affinity) {
+        pin_worker_to_cpu(worker_id, listen_socket_fd, reuse_port);
+    }
+
+    // Initialize worker state, or take over the copy inherited from the
+    // master. The response callables point at the master's WorkerState,
+    // which lives on in this process at the same address.
+    struct WorkerState local_worker;
+    struct WorkerState *worker = preloaded;
+    int status;
+    if (preloaded) {
+        reseed_random(worker->lua_state);
+    } else {
+        worker = &local_worker;
+        status = initialize_worker(worker, app_module, app_name);
+        if (status != 0) {
+            free_worker(worker);
+            return 1;
+        }
     }
 
+#ifdef USE_EPOLL
+    status = run_event_loop(worker, worker_id, listen_socket_fd);
+#else
     // Worker main loop - accept connections and handle requests
-    while (1) {
+    while (!worker_shutdown_requested) {
         // Accept new connection
         struct sockaddr_storage client_addr;
         socklen_t addr_size = sizeof(client_addr);
@@ -227,134 +1583,18 @@ int run_worker(int worker_id, int listen_socket_fd, pid_t main_pid,
             break;
         }
 
-        // Processing HTTP request
-
-        // TODO: This should probably be much larger and configurable.
-        int receive_buffer_size = 10000;
-        char receive_buffer[receive_buffer_size];
-
-        // Handle the HTTP request
-        int bytes_received =
-            recv(client_fd, receive_buffer, receive_buffer_size, 0);
-        if (bytes_received > 0) {
-            // Add null to terminate the C string from Lua's point of view.
-            receive_buffer[bytes_received] = '\0';
-
-            // Parse the HTTP request line
-            const char *method, *target, *version;
-            int method_len, target_len, version_len;
-            int parse_result = parse_request_line(
-                receive_buffer, bytes_received, &method, &target, &version,
-                &method_len, &target_len, &version_len);
-
-            // Handle parsing errors
-            if (parse_result == -1 || parse_result == -3) {
-                // Malformed request: no CRLF found (-1) or leading whitespace
-                // (-3)
-                const char *error_response = "HTTP/1.1 400 Bad Request\r\n\r\n";
-                send(client_fd, error_response, strlen(error_response), 0);
-                close(client_fd);
-                continue;
-            } else if (parse_result == -2) {
-                // Method or version not supported
-                const char *error_response;
-                if (!is_supported_method(method, method_len)) {
-                    error_response = "HTTP/1.1 501 Not Implemented\r\n\r\n";
-                } else {
-                    error_response =
-                        "HTTP/1.1 505 HTTP Version Not Supported\r\n\r\n";
-                }
-                send(client_fd, error_response, strlen(error_response), 0);
-                close(client_fd);
-                continue;
-            }
-
-            // Check for static file requests
-            if (is_static_request(target, static_url)) {
-                // Connect to delegation socket
-                int delegation_sock = socket(AF_UNIX, SOCK_STREAM, 0);
-                if (delegation_sock != -1) {
-                    struct sockaddr_un addr;
-                    memset(&addr, 0, sizeof(addr));
-                    addr.sun_family = AF_UNIX;
-                    snprintf(addr.sun_path, sizeof(addr.sun_path),
-                             "/tmp/nibiru_static_%d.sock", main_pid);
-                    if (connect(delegation_sock, (struct sockaddr *)&addr,
-                                sizeof(addr)) == 0) {
-                        delegate_static_request(delegation_sock, method,
-                                                method_len, target, target_len,
-                                                client_fd);
-                        // Read response from delegation_sock and send to
-                        // client_fd
-                        char response_buf[8192];
-                        ssize_t n;
-                        while ((n = read(delegation_sock, response_buf,
-                                         sizeof(response_buf))) > 0) {
-                            send(client_fd, response_buf, n, 0);
-                        }
-                        close(delegation_sock);
-                        close(client_fd);
-                        continue;
-                    } else {
-                        perror("Failed to connect to delegation socket");
-                    }
-                    close(delegation_sock);
-                } else {
-                    perror("Failed to create delegation socket");
-                }
-                // Fallback: close connection
-                close(client_fd);
-                continue;
-            }
-
-            // Find the start of remaining data (after \r\n)
-            const char *remaining_data =
-                memmem(receive_buffer, bytes_received, "\r\n", 2);
-            if (remaining_data) {
-                remaining_data += 2; // Skip \r\n
-            } else {
-                remaining_data = ""; // Should not happen if parsing succeeded
-            }
-
-            // Process the request with Lua
-            lua_rawgeti(worker.lua_state, LUA_REGISTRYINDEX,
-                        worker.handle_connection_reference);
-            lua_rawgeti(worker.lua_state, LUA_REGISTRYINDEX,
-                        worker.application_reference);
-            lua_pushlstring(worker.lua_state, method, method_len);
-            lua_pushlstring(worker.lua_state, target, target_len);
-            lua_pushlstring(worker.lua_state, version, version_len);
-            lua_pushstring(worker.lua_state, remaining_data);
-
-            status = lua_pcall(worker.lua_state, 5, 1, 0);
-            if (status != LUA_OK) {
-                printf("Worker %d: Lua error: %s\n", worker_id,
-                       lua_tostring(worker.lua_state, -1));
-                // Send a basic error response
-                const char *error_response =
-                    "HTTP/1.1 500 Internal Server Error\r\n\r\n";
-                send(client_fd, error_response, strlen(error_response), 0);
-            } else {
-                size_t response_length;
-                const char *response =
-                    lua_tolstring(worker.lua_state, -1, &response_length);
-                int bytes_sent = send(client_fd, response, response_length, 0);
-                if (bytes_sent == -1) {
-                    perror("Worker: send failed");
-                }
-                lua_pop(worker.lua_state, 1);
-            }
-        } else if (bytes_received == 0) {
-            // Connection closed by client
-        } else {
-            perror("Worker: recv failed");
+        struct Connection *connection = connection_create(client_fd);
+        if (!connection) {
+            close(client_fd);
+            continue;
         }
-
-        close(client_fd);
+        handle_client(worker, worker_id, connection);
+        connection_destroy(connection);
     }
+#endif
 
-    free_worker(&worker);
-    return 0;
+    free_worker(worker);
+    return status;
 }
 
 int initialize_worker_pool(struct WorkerPool *pool, int num_workers) {
@@ -494,6 +1734,104 @@ void setup_rocks_paths() {
     setenv("LUA_CPATH", new_lua_cpath, 1);
 }
 
+void print_usage() {
+    printf("Usage: nibiru run [--workers N] [--static DIR] [--static-url URL] "
+           "[--static-max-age SECONDS] [--keepalive-timeout SECONDS] "
+           "[--keepalive-requests N] [--request-timeout SECONDS] "
+           "[--worker-connections N] [--backlog N] [--reuseport] "
+           "[--cpu-affinity] [--max-header-size BYTES] "
+           "[--max-body-size BYTES] [--gc incremental|generational] "
+           "[--gc-pause PERCENT] [--gc-stepmul N] [--gc-minor PERCENT] "
+           "[--preload] <app> [port]\n");
+    printf("  <app> is in format of: module.path:app\n");
+    printf("  --workers N: number of worker processes (default: 2)\n");
+    printf("  --static DIR: directory for static files (default: static)\n");
+    printf("  --static-url URL: URL prefix for static files (default: "
+           "/static)\n");
+    printf("  --static-max-age SECONDS: Cache-Control max-age sent with "
+           "static files (default: none)\n");
+    printf("  --keepalive-timeout SECONDS: idle time before a persistent "
+           "connection is closed, 0 disables keep-alive (default: 5)\n");
+    printf("  --keepalive-requests N: requests served per connection "
+           "(default: 100)\n");
+    printf("  --request-timeout SECONDS: time a partial request or unread "
+           "response may stall before the connection is closed "
+           "(default: 30)\n");
+    printf("  --worker-connections N: open connections per worker "
+           "(default: 1024)\n");
+    printf("  --backlog N: pending connections queued per listening socket "
+           "(default: 128)\n");
+    printf("  --reuseport: give each worker its own SO_REUSEPORT socket\n");
+    printf("  --cpu-affinity: pin each worker to its own CPU\n");
+    printf("  --max-header-size BYTES: largest request line and headers "
+           "(default: 8192)\n");
+    printf("  --max-body-size BYTES: largest request body "
+           "(default: 1048576)\n");
+    printf("  --gc MODE: Lua garbage collector mode, incremental or "
+           "generational (default: incremental)\n");
+    printf("  --gc-pause PERCENT: incremental collector pause "
+           "(default: Lua's)\n");
+    printf("  --gc-stepmul N: incremental collector step multiplier "
+           "(default: Lua's)\n");
+    printf("  --gc-minor PERCENT: generational collector minor multiplier "
+           "(default: Lua's)\n");
+    printf("  --preload: load the application in the master and share it "
+           "with workers through fork\n");
+}
+
+/**
+ * Match a command line option in either `--name=value` or `--name value` form.
+ * @param index The current argument index, advanced past the option on match
+ * @param value Set to the option's value on match
+ * @return 1 if the option matched else 0
+ */
+int match_option(int argc, char *argv[], int *index, const char *name,
+                 char **value) {
+    const char *arg = argv[*index];
+    size_t name_len = strlen(name);
+    if (strncmp(arg, name, name_len) != 0) {
+        return 0;
+    }
+    if (arg[name_len] == '=') {
+        *value = argv[*index] + name_len + 1;
+        *index += 1;
+        return 1;
+    }
+    if (arg[name_len] == '\0' && *index + 1 < argc) {
+        *value = argv[*index + 1];
+        *index += 2;
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Match a command line flag that takes no value.
+ * @param index The current argument index, advanced past the flag on match
+ * @return 1 if the flag matched else 0
+ */
+int match_flag(char *argv[], int *index, const char *name) {
+    if (strcmp(argv[*index], name) != 0) {
+        return 0;
+    }
+    *index += 1;
+    return 1;
+}
+
+/**
+ * Parse a positive integer option value.
+ * @return 0 on success or -1 if the value is not a positive integer
+ */
+int parse_positive_int(const char *value, int *result) {
+    char *endptr;
+    long parsed = strtol(value, &endptr, 10);
+    if (*value == '\0' || *endptr != '\0' || parsed <= 0 || parsed > INT_MAX) {
+        return -1;
+    }
+    *result = parsed;
+    return 0;
+}
+
 int main(int argc, char *argv[]) {
     // Set up paths if running from a LuaRocks tree
     setup_rocks_paths();
@@ -502,82 +1840,151 @@ int main(int argc, char *argv[]) {
      * Process arguments.
      */
     if (argc < 2) {
-        printf("Usage: nibiru run [--workers N] [--static DIR] [--static-url "
-               "URL] <app> [port]\n");
-        printf("  <app> is in format of: module.path:app\n");
-        printf("  --workers N: number of worker processes (default: 2)\n");
+        print_usage();
         return 1;
     }
 
     if (strcmp(argv[1], "run") != 0) {
         printf("Unknown subcommand: %s\n", argv[1]);
-        printf("Usage: nibiru run [--workers N] [--static DIR] [--static-url "
-               "URL] <app> [port]\n");
-        printf("  <app> is in format of: module.path:app\n");
-        printf("  --workers N: number of worker processes (default: 2)\n");
+        print_usage();
         return 1;
     }
 
-    // Parse --workers option
     int num_workers = 2; // default
-    int arg_offset = 0;
-
-    if (argc >= 3 && strncmp(argv[2], "--workers=", 10) == 0) {
-        // Parse --workers=N format
-        char *workers_str = argv[2] + 10;
-        char *endptr;
-        num_workers = strtol(workers_str, &endptr, 10);
-        if (*endptr != '\0' || num_workers <= 0) {
-            printf("Error: --workers must be a positive integer\n");
-            printf("Usage: nibiru run [--workers N] [--static DIR] "
-                   "[--static-url URL] <app> [port]\n");
-            return 1;
-        }
-        arg_offset = 1;
-    } else if (argc >= 4 && strcmp(argv[2], "--workers") == 0) {
-        // Parse --workers N format
-        char *endptr;
-        num_workers = strtol(argv[3], &endptr, 10);
-        if (*endptr != '\0' || num_workers <= 0) {
-            printf("Error: --workers must be a positive integer\n");
-            printf("Usage: nibiru run [--workers N] [--static DIR] "
-                   "[--static-url URL] <app> [port]\n");
+    int arg_index = 2;
+    char *value;
+
+    // Options may appear in any order before the positional arguments.
+    while (arg_index < argc && strncmp(argv[arg_index], "--", 2) == 0) {
+        if (match_option(argc, argv, &arg_index, "--workers", &value)) {
+            if (parse_positive_int(value, &num_workers) != 0 ||
+                num_workers > MAX_WORKERS) {
+                printf("Error: --workers must be a positive integer up to "
+                       "%d\n",
+                       MAX_WORKERS);
+                print_usage();
+                return 1;
+            }
+        } else if (match_option(argc, argv, &arg_index, "--static", &value)) {
+            static_dir = value;
+        } else if (match_option(argc, argv, &arg_index, "--static-url",
+                                &value)) {
+            static_url = value;
+        } else if (match_option(argc, argv, &arg_index, "--static-max-age",
+                                &value)) {
+            if (parse_positive_int(value, &static_max_age) != 0) {
+                printf("Error: --static-max-age must be a positive "
+                       "integer\n");
+                print_usage();
+                return 1;
+            }
+        } else if (match_option(argc, argv, &arg_index, "--keepalive-timeout",
+                                &value)) {
+            char *endptr;
+            keepalive_timeout = strtol(value, &endptr, 10);
+            if (*value == '\0' || *endptr != '\0' || keepalive_timeout < 0) {
+                printf("Error: --keepalive-timeout must be a non-negative "
+                       "integer\n");
+                print_usage();
+                return 1;
+            }
+        } else if (match_option(argc, argv, &arg_index, "--keepalive-requests",
+                                &value)) {
+            if (parse_positive_int(value, &keepalive_requests) != 0) {
+                printf("Error: --keepalive-requests must be a positive "
+                       "integer\n");
+                print_usage();
+                return 1;
+            }
+        } else if (match_option(argc, argv, &arg_index, "--request-timeout",
+                                &value)) {
+            // The write path waits in milliseconds.
+            if (parse_positive_int(value, &request_timeout) != 0 ||
+                request_timeout > INT_MAX / 1000) {
+                printf("Error: --request-timeout must be a positive "
+                       "integer\n");
+                print_usage();
+                return 1;
+            }
+        } else if (match_option(argc, argv, &arg_index, "--worker-connections",
+                                &value)) {
+            if (parse_positive_int(value, &worker_connections) != 0) {
+                printf("Error: --worker-connections must be a positive "
+                       "integer\n");
+                print_usage();
+                return 1;
+            }
+        } else if (match_option(argc, argv, &arg_index, "--backlog", &value)) {
+            if (parse_positive_int(value, &backlog) != 0) {
+                printf("Error: --backlog must be a positive integer\n");
+                print_usage();
+                return 1;
+            }
+        } else if (match_option(argc, argv, &arg_index, "--max-header-size",
+                                &value)) {
+            if (parse_positive_int(value, &max_header_size) != 0) {
+                printf("Error: --max-header-size must be a positive "
+                       "integer\n");
+                print_usage();
+                return 1;
+            }
+        } else if (match_option(argc, argv, &arg_index, "--max-body-size",
+                                &value)) {
+            if (parse_positive_int(value, &max_body_size) != 0) {
+                printf("Error: --max-body-size must be a positive integer\n");
+                print_usage();
+                return 1;
+            }
+        } else if (match_option(argc, argv, &arg_index, "--gc", &value)) {
+            if (strcmp(value, "generational") == 0) {
+                gc_generational = 1;
+            } else if (strcmp(value, "incremental") == 0) {
+                gc_generational = 0;
+            } else {
+                printf("Error: --gc must be incremental or generational\n");
+                print_usage();
+                return 1;
+            }
+        } else if (match_option(argc, argv, &arg_index, "--gc-pause",
+                                &value)) {
+            if (parse_positive_int(value, &gc_pause) != 0) {
+                printf("Error: --gc-pause must be a positive integer\n");
+                print_usage();
+                return 1;
+            }
+        } else if (match_option(argc, argv, &arg_index, "--gc-stepmul",
+                                &value)) {
+            if (parse_positive_int(value, &gc_step_multiplier) != 0) {
+                printf("Error: --gc-stepmul must be a positive integer\n");
+                print_usage();
+                return 1;
+            }
+        } else if (match_option(argc, argv, &arg_index, "--gc-minor",
+                                &value)) {
+            if (parse_positive_int(value, &gc_minor_multiplier) != 0) {
+                printf("Error: --gc-minor must be a positive integer\n");
+                print_usage();
+                return 1;
+            }
+        } else if (match_flag(argv, &arg_index, "--reuseport")) {
+            reuse_port = 1;
+        } else if (match_flag(argv, &arg_index, "--cpu-affinity")) {
+            cpu_affinity = 1;
+        } else if (match_flag(argv, &arg_index, "--preload")) {
+            preload = 1;
+        } else {
+            printf("Unknown option: %s\n", argv[arg_index]);
+            print_usage();
             return 1;
         }
-        arg_offset = 2;
-    }
-
-    // Parse --static option
-    if (argc >= 3 + arg_offset &&
-        strncmp(argv[2 + arg_offset], "--static=", 9) == 0) {
-        static_dir = argv[2 + arg_offset] + 9;
-        arg_offset++;
-    } else if (argc >= 4 + arg_offset &&
-               strcmp(argv[2 + arg_offset], "--static") == 0) {
-        static_dir = argv[3 + arg_offset];
-        arg_offset += 2;
-    }
-
-    // Parse --static-url option
-    if (argc >= 3 + arg_offset &&
-        strncmp(argv[2 + arg_offset], "--static-url=", 13) == 0) {
-        static_url = argv[2 + arg_offset] + 13;
-        arg_offset++;
-    } else if (argc >= 4 + arg_offset &&
-               strcmp(argv[2 + arg_offset], "--static-url") == 0) {
-        static_url = argv[3 + arg_offset];
-        arg_offset += 2;
     }
 
-    if (argc < 3 + arg_offset) {
-        printf("Usage: nibiru run [--workers N] [--static DIR] [--static-url "
-               "URL] <app> [port]\n");
-        printf("  <app> is in format of: module.path:app\n");
-        printf("  --workers N: number of worker processes (default: 2)\n");
+    if (arg_index >= argc) {
+        print_usage();
         return 1;
     }
 
-    char *app_specifier = argv[2 + arg_offset];
+    char *app_specifier = argv[arg_index];
     char *app_module = strsep(&app_specifier, ":");
     char *app_name = strsep(&app_specifier, ":");
     // The default callable name is "app".
@@ -586,23 +1993,31 @@ int main(int argc, char *argv[]) {
     }
 
     char *port = "8080";
-    if (argc >= 4 + arg_offset) {
-        port = argv[3 + arg_offset];
+    if (arg_index + 1 < argc) {
+        port = argv[arg_index + 1];
     }
+    server_port = port;
 
     printf("Starting nibiru with %d workers\n", num_workers);
 
     int status;
 
     // Preflight validation - create a temporary worker to validate the
-    // application
+    // application. With --preload it is kept and every worker inherits it.
     struct WorkerState preflight_worker;
     status = initialize_worker(&preflight_worker, app_module, app_name);
     if (status != 0) {
         free_worker(&preflight_worker);
         return 1;
     }
-    free_worker(&preflight_worker); // Clean up preflight worker
+    struct WorkerState *preloaded = NULL;
+    if (preload) {
+        // Collect the boot garbage now so workers share a compact heap.
+        lua_gc(preflight_worker.lua_state, LUA_GCCOLLECT, 0);
+        preloaded = &preflight_worker;
+    } else {
+        free_worker(&preflight_worker); // Clean up preflight worker
+    }
 
     // Set up signal handlers for graceful shutdown
     struct sigaction sa;
@@ -618,121 +2033,70 @@ int main(int argc, char *argv[]) {
     sa.sa_handler = SIG_IGN;
     sigaction(SIGPIPE, &sa, NULL);
 
-    // Set up the listening socket
-    struct addrinfo hints;
-    struct addrinfo *server_info;
-
-    memset(&hints, 0, sizeof(hints));
-    hints.ai_flags = AI_PASSIVE;
-    hints.ai_family = AF_UNSPEC; // IPv4 or IPv6
-    hints.ai_socktype = SOCK_STREAM;
-
-    int addr_status = getaddrinfo(NULL, port, &hints, &server_info);
-    if (addr_status != 0) {
-        fprintf(stderr, "Failed to get server information: %s\n",
-                gai_strerror(addr_status));
+    // Set up the listening sockets. With --reuseport every worker gets its
+    // own socket and the kernel spreads new connections across them.
+    struct WorkerPool worker_pool;
+    status = initialize_worker_pool(&worker_pool, num_workers);
+    if (status != 0) {
+        printf("Failed to initialize worker pool\n");
         return 1;
     }
 
-    struct addrinfo *current_server_info;
-    int listen_socket_fd;
-    for (current_server_info = server_info; current_server_info != NULL;
-         current_server_info = current_server_info->ai_next) {
-        listen_socket_fd = socket(current_server_info->ai_family,
-                                  current_server_info->ai_socktype,
-                                  current_server_info->ai_protocol);
-        if (listen_socket_fd == -1) {
-            continue;
-        }
-
-        int opt = 1;
-        setsockopt(listen_socket_fd, SOL_SOCKET, SO_REUSEADDR, &opt,
-                   sizeof(opt));
-
-        int bind_status = bind(listen_socket_fd, current_server_info->ai_addr,
-                               current_server_info->ai_addrlen);
-        if (bind_status == -1) {
-            close(listen_socket_fd);
-            continue;
+    worker_pool.num_listen_sockets = reuse_port ? num_workers : 1;
+    for (int i = 0; i < worker_pool.num_listen_sockets; i++) {
+        worker_pool.listen_socket_fds[i] =
+            create_listen_socket(port, backlog, reuse_port);
+        if (worker_pool.listen_socket_fds[i] == -1) {
+            close_listen_sockets(&worker_pool, 0, i);
+            return 1;
         }
-
-        break;
-    }
-
-    freeaddrinfo(server_info);
-
-    if (current_server_info == NULL) {
-        perror("Failed to bind socket");
-        return 1;
-    }
-
-    int backlog = 128;
-    int listen_status = listen(listen_socket_fd, backlog);
-    if (listen_status == -1) {
-        perror("Failed to listen");
-        close(listen_socket_fd);
-        return 1;
     }
 
     printf("Server listening on %s...\n", port);
 
-    // Create delegation socket for static files
-    int delegation_socket = create_delegation_socket();
-    if (delegation_socket == -1) {
-        perror("Failed to create delegation socket");
-        close(listen_socket_fd);
-        return 1;
-    }
-
-    // Fork static worker
-    pid_t static_pid = fork();
-    if (static_pid == 0) {
-        // Static worker
-        close(listen_socket_fd); // Not needed
-        run_static_event_loop(delegation_socket, static_dir, static_url);
-        exit(0);
-    } else if (static_pid == -1) {
-        perror("Failed to fork static worker");
-        close(listen_socket_fd);
-        close(delegation_socket);
-        return 1;
-    }
-
-    // Initialize the worker pool
-    struct WorkerPool worker_pool;
-    status = initialize_worker_pool(&worker_pool, num_workers);
-    if (status != 0) {
-        printf("Failed to initialize worker pool\n");
-        free_worker_pool(&worker_pool);
-        return 1;
-    }
-
-    pid_t main_pid = getpid();
     // Fork worker processes
     for (int i = 0; i < num_workers; i++) {
+        // Workers share socket 0 unless each has its own.
+        int socket_index = reuse_port ? i : 0;
         pid_t pid = fork();
         if (pid == -1) {
             perror("Failed to fork worker");
-            close(listen_socket_fd);
+            close_listen_sockets(&worker_pool, socket_index,
+                                 worker_pool.num_listen_sockets);
             free_worker_pool(&worker_pool);
             return 1;
         }
         if (pid == 0) {
             // Child process - become a worker
-            return run_worker(i, listen_socket_fd, main_pid, app_module,
-                              app_name);
+            // Sockets before this worker's were already closed by the parent.
+            close_listen_sockets(&worker_pool, socket_index + 1,
+                                 worker_pool.num_listen_sockets);
+            return run_worker(i, worker_pool.listen_socket_fds[socket_index],
+                              app_module, app_name, preloaded);
         } else {
             // Parent process - record worker PID
             worker_pool.worker_pids[i] = pid;
+            // A per-worker socket belongs to its worker alone so the kernel
+            // stops routing connections to it if the worker exits.
+            if (reuse_port) {
+                close(worker_pool.listen_socket_fds[i]);
+            }
         }
     }
 
+    // The workers have their own copies of the preloaded state now.
+    if (preloaded) {
+        free_worker(preloaded);
+    }
+
     // Main server loop - wait for shutdown signal
     while (!shutdown_requested) {
         pause();
     }
 
-    close(listen_socket_fd);
+    if (!reuse_port) {
+        close_listen_sockets(&worker_pool, 0, worker_pool.num_listen_sockets);
+    }
     free_worker_pool(&worker_pool);
     return 0;
 }
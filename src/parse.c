@@ -1,7 +1,19 @@
 // parse.c - HTTP request parsing implementations
 
+// For memmem function
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include "parse.h"
+#include <stdint.h>
+#include <sys/types.h>
 #include <string.h>
+#include <strings.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 // Supported HTTP methods (same as Lua parser)
 const char *SUPPORTED_METHODS[] = {"GET",     "HEAD",   "POST",
@@ -15,30 +27,67 @@ const int NUM_SUPPORTED_VERSIONS = 1;
 
 // Check if method is supported (method may not be null-terminated)
 int is_supported_method(const char *method, int method_len) {
-    for (int i = 0; i < NUM_SUPPORTED_METHODS; i++) {
-        const char *supported = SUPPORTED_METHODS[i];
-        int supported_len = strlen(supported);
-        if (method_len == supported_len &&
-            strncmp(method, supported, method_len) == 0) {
-            return 1;
-        }
+    // Perfect hash of the supported methods: the first two bytes and the
+    // length pick a slot holding the method's index plus one.
+    static const signed char method_slots[32] = {
+        [1] = 1, [9] = 2, [27] = 3, [6] = 4, [7] = 5,
+        [11] = 6, [24] = 7, [3] = 8, [20] = 9};
+    // Lengths of SUPPORTED_METHODS, checked before comparing any bytes so an
+    // unknown method never reads past a shorter one.
+    static const unsigned char method_lengths[] = {3, 4, 4, 3, 6,
+                                                   7, 7, 5, 5};
+    if (!method || method_len < 3 || method_len > 7) {
+        return 0;
     }
-    return 0;
+    int slot = method_slots[(method[0] ^ method[1] ^ method_len) & 31];
+    if (slot == 0 || method_lengths[slot - 1] != method_len) {
+        return 0;
+    }
+    return memcmp(method, SUPPORTED_METHODS[slot - 1], method_len) == 0;
 }
 
 // Check if version is supported (version may not be null-terminated)
 int is_supported_version(const char *version, int version_len) {
+    // Every supported version is the 8 bytes of HTTP/x.y.
+    if (version_len != 8) {
+        return 0;
+    }
     for (int i = 0; i < NUM_SUPPORTED_VERSIONS; i++) {
-        const char *supported = SUPPORTED_VERSIONS[i];
-        int supported_len = strlen(supported);
-        if (version_len == supported_len &&
-            strncmp(version, supported, version_len) == 0) {
+        if (memcmp(version, SUPPORTED_VERSIONS[i], 8) == 0) {
             return 1;
         }
     }
     return 0;
 }
 
+// Find the first CRLF in a buffer
+// SSE2 is part of the x86-64 baseline so the vector loop needs no runtime
+// check. It compares 16 bytes at a time against CR and only looks at the
+// following byte for the CRs it finds.
+static const char *find_crlf(const char *buffer, size_t buffer_len) {
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i cr = _mm_set1_epi8('\r');
+    for (; i + 16 <= buffer_len; i += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i *)(buffer + i));
+        unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, cr));
+        while (mask) {
+            size_t index = i + __builtin_ctz(mask);
+            if (index + 1 < buffer_len && buffer[index + 1] == '\n') {
+                return buffer + index;
+            }
+            mask &= mask - 1;
+        }
+    }
+#endif
+    for (; i + 1 < buffer_len; i++) {
+        if (buffer[i] == '\r' && buffer[i + 1] == '\n') {
+            return buffer + i;
+        }
+    }
+    return NULL;
+}
+
 // Parse HTTP request line from buffer
 // Returns: 0 on success, negative codes for different errors
 // -1: no CRLF, -2: validation error, -3: leading whitespace,
@@ -49,13 +98,7 @@ int parse_request_line(const char *buffer, size_t buffer_len,
                        const char **version, int *method_len, int *target_len,
                        int *version_len) {
     // Find the end of the request line (\r\n) - HTTP spec requires CRLF
-    const char *line_end = NULL;
-    for (size_t i = 0; i < buffer_len - 1; i++) {
-        if (buffer[i] == '\r' && buffer[i + 1] == '\n') {
-            line_end = &buffer[i];
-            break;
-        }
-    }
+    const char *line_end = find_crlf(buffer, buffer_len);
     if (!line_end || line_end == buffer) {
         return -1; // No \r\n found or empty line
     }
@@ -70,8 +113,9 @@ int parse_request_line(const char *buffer, size_t buffer_len,
 
     // Parse method
     *method = pos;
-    while (pos < end && *pos != ' ')
-        pos++;
+    pos = memchr(pos, ' ', end - pos);
+    if (!pos)
+        pos = end;
     *method_len = pos - *method;
     if (*method_len == 0)
         return -4; // Parse error: empty method
@@ -84,8 +128,9 @@ int parse_request_line(const char *buffer, size_t buffer_len,
 
     // Parse target
     *target = pos;
-    while (pos < end && *pos != ' ')
-        pos++;
+    pos = memchr(pos, ' ', end - pos);
+    if (!pos)
+        pos = end;
     *target_len = pos - *target;
     if (*target_len == 0)
         return -6; // Parse error: empty target
@@ -115,4 +160,608 @@ int parse_request_line(const char *buffer, size_t buffer_len,
         return -2; // Validation error: unsupported version
 
     return 0; // Success
-}
\ No newline at end of file
+}
+// Find the end of the request line so header searches skip it
+static const char *find_headers_start(const char *buffer, size_t buffer_len) {
+    const char *line_end = memmem(buffer, buffer_len, "\r\n", 2);
+    if (!line_end) {
+        return NULL;
+    }
+    return line_end + 2;
+}
+
+// Find the value of a header field (name is matched case-insensitively)
+int find_header_value(const char *headers, size_t headers_len,
+                      const char *name, const char **value, int *value_len) {
+    size_t name_len = strlen(name);
+    const char *pos = headers;
+    const char *end = headers + headers_len;
+
+    while (pos < end) {
+        const char *line_end = memmem(pos, end - pos, "\r\n", 2);
+        if (!line_end || line_end == pos) {
+            // Missing CRLF or the blank line that ends the headers
+            return 0;
+        }
+
+        if ((size_t)(line_end - pos) > name_len && pos[name_len] == ':' &&
+            strncasecmp(pos, name, name_len) == 0) {
+            const char *start = pos + name_len + 1;
+            // Trim optional whitespace around the field value
+            while (start < line_end && (*start == ' ' || *start == '\t'))
+                start++;
+            const char *stop = line_end;
+            while (stop > start && (stop[-1] == ' ' || stop[-1] == '\t'))
+                stop--;
+            *value = start;
+            *value_len = stop - start;
+            return 1;
+        }
+
+        pos = line_end + 2;
+    }
+    return 0;
+}
+
+// Parse the chunk-size line at pos
+// Returns: 1 with size and data set, 0 if the line is incomplete, -1 if it is
+// invalid
+static int parse_chunk_size(const char *pos, const char *end, size_t *size,
+                            const char **data) {
+    const char *line_end = memmem(pos, end - pos, "\r\n", 2);
+    if (!line_end) {
+        return 0;
+    }
+
+    size_t value = 0;
+    const char *digit = pos;
+    for (; digit < line_end; digit++) {
+        int nibble;
+        if (*digit >= '0' && *digit <= '9') {
+            nibble = *digit - '0';
+        } else if (*digit >= 'a' && *digit <= 'f') {
+            nibble = *digit - 'a' + 10;
+        } else if (*digit >= 'A' && *digit <= 'F') {
+            nibble = *digit - 'A' + 10;
+        } else {
+            break;
+        }
+        if (value > (SIZE_MAX >> 4)) {
+            return -1; // Overflow
+        }
+        value = (value << 4) | nibble;
+    }
+    // Chunk extensions after the size are allowed and ignored.
+    if (digit == pos || (digit < line_end && *digit != ';' && *digit != ' ' &&
+                         *digit != '\t')) {
+        return -1;
+    }
+
+    *size = value;
+    *data = line_end + 2;
+    return 1;
+}
+
+// Find the end of a chunked body
+// Returns: 1 if complete, 0 if more data is needed, -1 if invalid,
+// -3 if the decoded body would exceed max_body_size
+static int scan_chunked_body(const char *body, size_t body_len,
+                             size_t max_body_size, size_t *raw_len) {
+    const char *pos = body;
+    const char *end = body + body_len;
+    size_t decoded_len = 0;
+
+    for (;;) {
+        size_t size;
+        const char *data;
+        int result = parse_chunk_size(pos, end, &size, &data);
+        if (result != 1) {
+            return result;
+        }
+        pos = data;
+        if (size == 0) {
+            break; // The last chunk
+        }
+        if (size > max_body_size - decoded_len) {
+            return -3;
+        }
+        decoded_len += size;
+        if ((size_t)(end - data) < size + 2) {
+            return 0;
+        }
+        if (data[size] != '\r' || data[size + 1] != '\n') {
+            return -1;
+        }
+        pos = data + size + 2;
+    }
+
+    // Skip the trailer fields up to the blank line that ends the message.
+    for (;;) {
+        const char *line_end = memmem(pos, end - pos, "\r\n", 2);
+        if (!line_end) {
+            return 0;
+        }
+        if (line_end == pos) {
+            *raw_len = pos + 2 - body;
+            return 1;
+        }
+        pos = line_end + 2;
+    }
+}
+
+// Characters allowed in a header field name (RFC 9110 token)
+static int is_token_char(unsigned char c) {
+    static const char *separators = "\"(),/:;<=>?@[\\]{}";
+    return c > 32 && c < 127 && !strchr(separators, c);
+}
+
+// Split every header field out of the header section
+int parse_headers(const char *headers, size_t headers_len,
+                  struct HeaderField *fields, int max_fields) {
+    const char *pos = headers;
+    const char *end = headers + headers_len;
+    int count = 0;
+
+    while (pos < end) {
+        const char *line_end = memchr(pos, '\n', end - pos);
+        if (!line_end || line_end == pos || line_end[-1] != '\r') {
+            return -1;
+        }
+        const char *value_end = line_end - 1;
+        if (value_end == pos) {
+            return count; // The blank line that ends the headers
+        }
+        if (count == max_fields) {
+            return -1;
+        }
+
+        // No whitespace is allowed before the colon, and obsolete line
+        // folding is rejected rather than unfolded.
+        const char *colon = memchr(pos, ':', value_end - pos);
+        if (!colon || colon == pos) {
+            return -1;
+        }
+        for (const char *c = pos; c < colon; c++) {
+            if (!is_token_char(*c)) {
+                return -1;
+            }
+        }
+
+        const char *value = colon + 1;
+        while (value < value_end && (*value == ' ' || *value == '\t'))
+            value++;
+        while (value_end > value &&
+               (value_end[-1] == ' ' || value_end[-1] == '\t'))
+            value_end--;
+
+        fields[count].name = pos;
+        fields[count].name_len = colon - pos;
+        fields[count].value = value;
+        fields[count].value_len = value_end - value;
+        count++;
+        pos = line_end + 1;
+    }
+    return -1; // Missing the blank line
+}
+
+// Parse the Content-Length of a request from every field that carries one
+// A repeated field or a comma-separated list is accepted only when all of
+// its values agree; otherwise the body's end is ambiguous.
+// Returns: 1 with length set, 0 if there is no Content-Length, -1 if it is
+// invalid
+static int parse_content_length(const char *headers, size_t headers_len,
+                                size_t *length) {
+    const char *pos = headers;
+    const char *end = headers + headers_len;
+    const char *value;
+    int value_len;
+    int found = 0;
+
+    while (pos < end && find_header_value(pos, end - pos, "Content-Length",
+                                          &value, &value_len)) {
+        const char *value_end = value + value_len;
+        const char *item = value;
+        for (;;) {
+            while (item < value_end && (*item == ' ' || *item == '\t'))
+                item++;
+            size_t number = 0;
+            const char *digit = item;
+            for (; digit < value_end && *digit >= '0' && *digit <= '9';
+                 digit++) {
+                size_t next = number * 10 + (*digit - '0');
+                if (next < number) {
+                    return -1; // Overflow
+                }
+                number = next;
+            }
+            if (digit == item || (found && number != *length)) {
+                return -1;
+            }
+            *length = number;
+            found = 1;
+
+            while (digit < value_end && (*digit == ' ' || *digit == '\t'))
+                digit++;
+            if (digit == value_end) {
+                break;
+            }
+            if (*digit != ',') {
+                return -1;
+            }
+            item = digit + 1;
+        }
+
+        // Continue after the line holding this field.
+        const char *line_end = memmem(value_end, end - value_end, "\r\n", 2);
+        if (!line_end) {
+            break;
+        }
+        pos = line_end + 2;
+    }
+    return found;
+}
+
+// Find the length of the first complete request in the buffer
+int find_request_length(const char *buffer, size_t buffer_len,
+                        size_t max_header_size, size_t max_body_size,
+                        size_t *request_len) {
+    const char *headers_end = memmem(buffer, buffer_len, "\r\n\r\n", 4);
+    if (!headers_end) {
+        // Headers are not complete yet
+        return buffer_len > max_header_size ? -2 : 0;
+    }
+    size_t headers_len = headers_end + 4 - buffer;
+    if (headers_len > max_header_size) {
+        return -2;
+    }
+
+    const char *headers = find_headers_start(buffer, headers_len);
+    size_t fields_len = headers ? headers_len - (headers - buffer) : 0;
+    size_t content_length = 0;
+    int has_content_length =
+        headers ? parse_content_length(headers, fields_len, &content_length)
+                : 0;
+
+    const char *coding;
+    int coding_len;
+    if (headers && find_header_value(headers, fields_len, "Transfer-Encoding",
+                                     &coding, &coding_len)) {
+        // A message with both framings is ambiguous, which makes it a
+        // request smuggling vector.
+        if (has_content_length) {
+            return -1;
+        }
+        if (coding_len != 7 || strncasecmp(coding, "chunked", 7) != 0) {
+            return -4;
+        }
+
+        size_t body_len = 0;
+        int result = scan_chunked_body(buffer + headers_len,
+                                       buffer_len - headers_len,
+                                       max_body_size, &body_len);
+        // Chunk framing and trailers may add up to max_header_size bytes on
+        // top of the body itself.
+        if (result == 0 &&
+            buffer_len - headers_len > max_body_size + max_header_size) {
+            return -3;
+        }
+        if (result != 1) {
+            return result;
+        }
+        *request_len = headers_len + body_len;
+        return 1;
+    }
+
+    if (has_content_length == -1) {
+        return -1;
+    }
+    if (content_length > max_body_size) {
+        return -3;
+    }
+
+    if (buffer_len - headers_len < content_length) {
+        return 0; // Body is not complete yet
+    }
+
+    *request_len = headers_len + content_length;
+    return 1;
+}
+
+// Decode a complete chunked body in place
+int decode_chunked_body(char *body, size_t body_len, size_t *decoded_len) {
+    const char *pos = body;
+    const char *end = body + body_len;
+    char *out = body;
+
+    for (;;) {
+        size_t size;
+        const char *data;
+        if (parse_chunk_size(pos, end, &size, &data) != 1 ||
+            (size_t)(end - data) < size) {
+            return -1;
+        }
+        if (size == 0) {
+            break;
+        }
+        memmove(out, data, size);
+        out += size;
+        pos = data + size + 2;
+    }
+
+    *decoded_len = out - body;
+    return 0;
+}
+
+// Check if the client wants the connection to stay open after this request
+int request_wants_keep_alive(const char *buffer, size_t buffer_len) {
+    const char *headers = find_headers_start(buffer, buffer_len);
+    if (!headers) {
+        return 0;
+    }
+
+    const char *value;
+    int value_len;
+    if (!find_header_value(headers, buffer_len - (headers - buffer),
+                           "Connection", &value, &value_len)) {
+        return 1; // Persistent by default in HTTP/1.1
+    }
+
+    // The Connection header is a comma separated list of options.
+    const char *pos = value;
+    const char *end = value + value_len;
+    while (pos < end) {
+        while (pos < end && (*pos == ' ' || *pos == ','))
+            pos++;
+        const char *option = pos;
+        while (pos < end && *pos != ',' && *pos != ' ')
+            pos++;
+        if (pos - option == 5 && strncasecmp(option, "close", 5) == 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Parse a qvalue like "0.8" into thousandths
+static int parse_qvalue(const char *pos, const char *end) {
+    if (pos == end || (*pos != '0' && *pos != '1')) {
+        return -1;
+    }
+    int quality = (*pos++ - '0') * 1000;
+    if (pos < end && *pos == '.') {
+        pos++;
+        int scale = 100;
+        while (scale > 0 && pos < end && *pos >= '0' && *pos <= '9') {
+            quality += (*pos++ - '0') * scale;
+            scale /= 10;
+        }
+    }
+    return quality > 1000 ? 1000 : quality;
+}
+
+// Find the quality a client gives a content coding in an Accept-Encoding value
+int coding_quality(const char *value, int value_len, const char *coding) {
+    size_t coding_len = strlen(coding);
+    const char *pos = value;
+    const char *end = value + value_len;
+    int wildcard = 0;
+
+    while (pos < end) {
+        while (pos < end && (*pos == ' ' || *pos == '\t' || *pos == ','))
+            pos++;
+        const char *name = pos;
+        while (pos < end && *pos != ',' && *pos != ';' && *pos != ' ' &&
+               *pos != '\t')
+            pos++;
+        size_t name_len = pos - name;
+        const char *element_end = memchr(pos, ',', end - pos);
+        if (!element_end) {
+            element_end = end;
+        }
+
+        // Look for a q parameter among the element's parameters.
+        int quality = 1000;
+        const char *param = pos;
+        while ((param = memchr(param, ';', element_end - param))) {
+            param++;
+            while (param < element_end && (*param == ' ' || *param == '\t'))
+                param++;
+            if (element_end - param > 2 && (*param == 'q' || *param == 'Q') &&
+                param[1] == '=') {
+                quality = parse_qvalue(param + 2, element_end);
+                if (quality == -1) {
+                    quality = 0; // Ignore codings with a malformed qvalue
+                }
+            }
+        }
+
+        if (name_len == coding_len &&
+            strncasecmp(name, coding, name_len) == 0) {
+            return quality;
+        }
+        if (name_len == 1 && *name == '*') {
+            wildcard = quality;
+        }
+        pos = element_end;
+    }
+    return wildcard;
+}
+
+// Parse a fixed number of decimal digits
+static int parse_digits(const char *pos, int count) {
+    int value = 0;
+    for (int i = 0; i < count; i++) {
+        if (pos[i] < '0' || pos[i] > '9') {
+            return -1;
+        }
+        value = value * 10 + (pos[i] - '0');
+    }
+    return value;
+}
+
+// Parse an HTTP date in the IMF-fixdate format
+int parse_http_date(const char *value, int value_len, time_t *result) {
+    static const char *months = "JanFebMarAprMayJunJulAugSepOctNovDec";
+    // "Sun, 06 Nov 1994 08:49:37 GMT"
+    if (value_len != 29 || value[3] != ',' || value[4] != ' ' ||
+        value[7] != ' ' || value[11] != ' ' || value[16] != ' ' ||
+        value[19] != ':' || value[22] != ':' ||
+        memcmp(value + 25, " GMT", 4) != 0) {
+        return -1;
+    }
+
+    int day = parse_digits(value + 5, 2);
+    int year = parse_digits(value + 12, 4);
+    int hour = parse_digits(value + 17, 2);
+    int minute = parse_digits(value + 20, 2);
+    int second = parse_digits(value + 23, 2);
+    const char *month_name = NULL;
+    for (int i = 0; i < 12 && !month_name; i++) {
+        if (memcmp(value + 8, months + i * 3, 3) == 0) {
+            month_name = months + i * 3;
+        }
+    }
+    if (day < 1 || day > 31 || year < 1970 || hour < 0 || hour > 23 ||
+        minute < 0 || minute > 59 || second < 0 || second > 60 ||
+        !month_name) {
+        return -1;
+    }
+    int month = (month_name - months) / 3 + 1;
+
+    // Count days since the epoch with the civil calendar algorithm, shifting
+    // the year to start in March so leap days come last.
+    int shifted_year = month <= 2 ? year - 1 : year;
+    int era = shifted_year / 400;
+    int year_of_era = shifted_year - era * 400;
+    int day_of_year = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    int day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 +
+                     day_of_year;
+    long long days = (long long)era * 146097 + day_of_era - 719468;
+
+    *result = (time_t)(days * 86400 + hour * 3600 + minute * 60 + second);
+    return 0;
+}
+
+// Check if an If-None-Match style list of entity tags matches an entity tag
+int etag_list_matches(const char *value, int value_len, const char *etag) {
+    size_t etag_len = strlen(etag);
+    const char *pos = value;
+    const char *end = value + value_len;
+
+    while (pos < end) {
+        while (pos < end && (*pos == ' ' || *pos == '\t' || *pos == ','))
+            pos++;
+        if (pos == end) {
+            break;
+        }
+        if (*pos == '*') {
+            return 1;
+        }
+        if (end - pos > 2 && pos[0] == 'W' && pos[1] == '/') {
+            pos += 2;
+        }
+        const char *tag = pos;
+        if (pos < end && *pos == '"') {
+            const char *close = memchr(pos + 1, '"', end - pos - 1);
+            pos = close ? close + 1 : end;
+        } else {
+            while (pos < end && *pos != ',')
+                pos++;
+        }
+        if ((size_t)(pos - tag) == etag_len &&
+            memcmp(tag, etag, etag_len) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Parse a non-negative decimal number
+// Returns: the position after the digits, or NULL if there are none or the
+// number overflows
+static const char *parse_offset(const char *pos, const char *end,
+                                off_t *result) {
+    const char *start = pos;
+    unsigned long long value = 0;
+    while (pos < end && *pos >= '0' && *pos <= '9') {
+        if (value > (unsigned long long)INT64_MAX / 10) {
+            return NULL;
+        }
+        value = value * 10 + (*pos++ - '0');
+    }
+    if (pos == start || value > (unsigned long long)INT64_MAX) {
+        return NULL;
+    }
+    *result = (off_t)value;
+    return pos;
+}
+
+// Parse a Range header value for a representation of size bytes
+int parse_byte_ranges(const char *value, int value_len, off_t size,
+                      struct ByteRange *ranges) {
+    const char *pos = value;
+    const char *end = value + value_len;
+    if (value_len < 6 || strncasecmp(value, "bytes=", 6) != 0) {
+        return -1;
+    }
+    pos += 6;
+
+    int count = 0;
+    int specs = 0;
+    while (pos < end) {
+        while (pos < end && (*pos == ' ' || *pos == '\t' || *pos == ','))
+            pos++;
+        if (pos == end) {
+            break;
+        }
+        if (++specs > MAX_BYTE_RANGES) {
+            return -1;
+        }
+
+        off_t first, last;
+        if (*pos == '-') {
+            // A suffix range: the last N bytes
+            off_t suffix;
+            pos = parse_offset(pos + 1, end, &suffix);
+            if (!pos) {
+                return -1;
+            }
+            if (suffix == 0) {
+                continue; // Unsatisfiable
+            }
+            first = suffix < size ? size - suffix : 0;
+            last = size - 1;
+        } else {
+            pos = parse_offset(pos, end, &first);
+            if (!pos || pos == end || *pos != '-') {
+                return -1;
+            }
+            pos++;
+            last = size - 1;
+            if (pos < end && *pos >= '0' && *pos <= '9') {
+                pos = parse_offset(pos, end, &last);
+                if (!pos) {
+                    return -1;
+                }
+                if (last < first) {
+                    return -1;
+                }
+                if (last >= size) {
+                    last = size - 1;
+                }
+            }
+        }
+        while (pos < end && (*pos == ' ' || *pos == '\t'))
+            pos++;
+        if (pos < end && *pos != ',') {
+            return -1;
+        }
+
+        if (first < size && size > 0) {
+            ranges[count].first = first;
+            ranges[count].last = last;
+            count++;
+        }
+    }
+    return specs == 0 ? -1 : count;
+}
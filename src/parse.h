@@ -4,6 +4,30 @@
 #define PARSE_H
 
 #include <stddef.h>
+#include <sys/types.h>
+#include <time.h>
+
+// Most ranges honored in one Range header
+// Requests for more get the whole representation instead.
+#define MAX_BYTE_RANGES 16
+
+// An inclusive range of bytes in a representation
+struct ByteRange {
+    off_t first;
+    off_t last;
+};
+
+// Most header fields accepted in one request
+#define MAX_HEADER_FIELDS 100
+
+// A header field as it appears in the request buffer
+struct HeaderField {
+    const char *name;
+    int name_len;
+    // Leading and trailing whitespace is trimmed.
+    const char *value;
+    int value_len;
+};
 
 // Supported HTTP methods
 extern const char *SUPPORTED_METHODS[];
@@ -27,4 +51,63 @@ int parse_request_line(const char *buffer, size_t buffer_len,
                        const char **version, int *method_len, int *target_len,
                        int *version_len);
 
+// Find the value of a header field (name is matched case-insensitively)
+// headers should point at the header section that follows the request line.
+// Returns: 1 if found, 0 if not found
+int find_header_value(const char *headers, size_t headers_len,
+                      const char *name, const char **value, int *value_len);
+
+// Split every header field out of the header section
+// headers should point at the header section that follows the request line
+// and include the blank line that ends it. Lines are found with memchr, which
+// the C library vectorizes, so each byte is only scanned once.
+// Returns: the number of fields stored, or -1 if a field is malformed or
+// there are more than max_fields
+int parse_headers(const char *headers, size_t headers_len,
+                  struct HeaderField *fields, int max_fields);
+
+// Find the length of the first complete request in the buffer
+// The request ends after the blank line that terminates the headers plus any
+// body framed by Content-Length or chunked Transfer-Encoding.
+// Returns: 1 if a full request is buffered, 0 if more data is needed,
+// -1 on invalid framing, -2 if the headers exceed max_header_size,
+// -3 if the body exceeds max_body_size, -4 on an unsupported
+// Transfer-Encoding
+int find_request_length(const char *buffer, size_t buffer_len,
+                        size_t max_header_size, size_t max_body_size,
+                        size_t *request_len);
+
+// Decode a complete chunked body in place
+// Chunk framing and trailers are dropped so only the body data remains.
+// Returns: 0 on success, -1 if the body is not valid chunked data
+int decode_chunked_body(char *body, size_t body_len, size_t *decoded_len);
+
+// Check if the client wants the connection to stay open after this request
+// HTTP/1.1 connections are persistent unless the client sends
+// `Connection: close`.
+int request_wants_keep_alive(const char *buffer, size_t buffer_len);
+
+// Find the quality a client gives a content coding in an Accept-Encoding
+// value (coding is matched case-insensitively)
+// Returns: the qvalue scaled to 0-1000. A coding that isn't listed gets the
+// quality of "*", or 0 if there is no "*".
+int coding_quality(const char *value, int value_len, const char *coding);
+
+// Parse an HTTP date in the IMF-fixdate format
+// like "Sun, 06 Nov 1994 08:49:37 GMT"
+// Returns: 0 on success, -1 if the date is invalid
+int parse_http_date(const char *value, int value_len, time_t *result);
+
+// Check if an If-None-Match style list of entity tags matches an entity tag
+// "*" matches anything. The comparison ignores weak W/ prefixes.
+// Returns: 1 if a tag matches, else 0
+int etag_list_matches(const char *value, int value_len, const char *etag);
+
+// Parse a Range header value for a representation of size bytes
+// Returns: the number of ranges stored in ranges, 0 if none of the ranges
+// can be satisfied, or -1 if the header should be ignored (it isn't a
+// valid bytes range or lists more than MAX_BYTE_RANGES ranges)
+int parse_byte_ranges(const char *value, int value_len, off_t size,
+                      struct ByteRange *ranges);
+
 #endif // PARSE_H
\ No newline at end of file
@@ -7,30 +7,53 @@
 #include <string.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
-#include <sys/un.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "parse.h"
+#include "static.h"
+
 #ifdef __linux__
-#include <sys/epoll.h>
-#define USE_EPOLL 1
+#include <sys/sendfile.h>
 #elif defined(__APPLE__) || defined(__FreeBSD__)
-#define USE_KQUEUE 1
+#include <sys/uio.h>
 #endif
 
+int static_max_age = 0;
+
 // MIME type mapping - simple hardcoded list
 typedef struct {
     const char *ext;
     const char *mime;
+    // Whether precompressed siblings are worth looking for
+    int compressible;
 } mime_type;
 
 static const mime_type mime_types[] = {
-    {".html", "text/html"},        {".htm", "text/html"},
-    {".css", "text/css"},          {".js", "application/javascript"},
-    {".json", "application/json"}, {".png", "image/png"},
-    {".jpg", "image/jpeg"},        {".jpeg", "image/jpeg"},
-    {".gif", "image/gif"},         {".svg", "image/svg+xml"},
-    {".ico", "image/x-icon"},      {".txt", "text/plain"},
-    {".xml", "application/xml"},   {NULL, NULL}};
+    {".html", "text/html", 1},        {".htm", "text/html", 1},
+    {".css", "text/css", 1},          {".js", "application/javascript", 1},
+    {".json", "application/json", 1}, {".png", "image/png", 0},
+    {".jpg", "image/jpeg", 0},        {".jpeg", "image/jpeg", 0},
+    {".gif", "image/gif", 0},         {".svg", "image/svg+xml", 1},
+    {".ico", "image/x-icon", 1},      {".txt", "text/plain", 1},
+    {".xml", "application/xml", 1},   {NULL, NULL, 0}};
+
+// Content-Encoding names and file extensions, indexed by StaticEncoding
+static const char *encoding_names[] = {"br", "zstd", "gzip"};
+static const char *encoding_extensions[] = {".br", ".zst", ".gz"};
+
+// Check if a file type is worth compressing
+static int is_compressible(const char *path) {
+    const char *ext = strrchr(path, '.');
+    if (!ext)
+        return 0;
+    for (const mime_type *mt = mime_types; mt->ext; ++mt) {
+        if (strcmp(ext, mt->ext) == 0) {
+            return mt->compressible;
+        }
+    }
+    return 0;
+}
 
 const char *get_mime_type(const char *path) {
     const char *ext = strrchr(path, '.');
@@ -81,186 +104,490 @@ int sanitize_path(const char *path, char *out, size_t out_size,
     return 0;
 }
 
-// Serve static file
-int serve_static_file(int client_fd, const char *path, const char *static_dir,
-                      const char *static_url) {
-    char full_path[PATH_MAX];
-    if (sanitize_path(path, full_path, sizeof(full_path), static_dir,
-                      static_url) != 0) {
-        // 404 for invalid paths
-        const char *response = "HTTP/1.1 404 Not Found\r\nContent-Type: "
-                               "text/plain\r\n\r\n404 Not Found";
-        send(client_fd, response, strlen(response), 0);
-        return 0;
+// The static file cache
+// Files are found through a hash table keyed on the sanitized path and
+// evicted in least recently used order. Each process has its own cache.
+#define STATIC_CACHE_BUCKETS (STATIC_CACHE_SIZE * 2)
+static struct StaticFile *cache_buckets[STATIC_CACHE_BUCKETS];
+static struct StaticFile *cache_head; // Least recently used
+static struct StaticFile *cache_tail; // Most recently used
+static int cache_count = 0;
+
+// Hash a path with FNV-1a
+static size_t hash_path(const char *path) {
+    size_t hash = 2166136261u;
+    for (const unsigned char *c = (const unsigned char *)path; *c; c++) {
+        hash = (hash ^ *c) * 16777619u;
+    }
+    return hash % STATIC_CACHE_BUCKETS;
+}
+
+static void cache_unlink(struct StaticFile *file) {
+    if (file->prev) {
+        file->prev->next = file->next;
+    } else {
+        cache_head = file->next;
+    }
+    if (file->next) {
+        file->next->prev = file->prev;
+    } else {
+        cache_tail = file->prev;
+    }
+}
+
+static void cache_append(struct StaticFile *file) {
+    file->prev = cache_tail;
+    file->next = NULL;
+    if (cache_tail) {
+        cache_tail->next = file;
+    } else {
+        cache_head = file;
+    }
+    cache_tail = file;
+}
+
+static void free_static_file(struct StaticFile *file) {
+    close(file->fd);
+    for (int i = 0; i < STATIC_ENCODING_COUNT; i++) {
+        if (file->variants[i].fd != -1) {
+            close(file->variants[i].fd);
+        }
+    }
+    free(file);
+}
+
+static void cache_remove(struct StaticFile *file) {
+    struct StaticFile **link = &cache_buckets[hash_path(file->path)];
+    while (*link != file) {
+        link = &(*link)->hash_next;
+    }
+    *link = file->hash_next;
+    cache_unlink(file);
+    cache_count--;
+    file->evicted = 1;
+    if (file->references == 0) {
+        free_static_file(file);
     }
+}
+
+// Check if two stat results describe the same version of a file
+static int same_file(const struct stat *a, const struct stat *b) {
+    return a->st_dev == b->st_dev && a->st_ino == b->st_ino &&
+           a->st_size == b->st_size && a->st_mtime == b->st_mtime;
+}
+
+// Build the path of a precompressed sibling
+static int variant_path(char *out, size_t out_size, const char *path,
+                        int encoding) {
+    return snprintf(out, out_size, "%s%s", path,
+                    encoding_extensions[encoding]) < (int)out_size
+               ? 0
+               : -1;
+}
+
+// Format a strong entity tag from a file's modification time and size
+// Precompressed siblings get a suffix naming their encoding so each
+// representation has its own tag.
+static void format_etag(char *out, size_t out_size, const struct stat *st,
+                        const char *suffix) {
+    snprintf(out, out_size, "\"%llx-%llx%s\"", (long long)st->st_mtime,
+             (long long)st->st_size, suffix);
+}
+
+// Open the precompressed siblings of a compressible file
+static void open_variants(struct StaticFile *file) {
+    for (int i = 0; i < STATIC_ENCODING_COUNT; i++) {
+        struct StaticVariant *variant = &file->variants[i];
+        variant->fd = -1;
 
+        char path[PATH_MAX];
+        if (!is_compressible(file->path) ||
+            variant_path(path, sizeof(path), file->path, i) != 0) {
+            continue;
+        }
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            continue;
+        }
+        // A sibling older than the file was compressed from an old version.
+        if (fstat(fd, &variant->st) != 0 || !S_ISREG(variant->st.st_mode) ||
+            variant->st.st_mtime < file->st.st_mtime) {
+            close(fd);
+            continue;
+        }
+        variant->fd = fd;
+        char suffix[16];
+        snprintf(suffix, sizeof(suffix), "-%s", encoding_names[i]);
+        format_etag(variant->etag, sizeof(variant->etag), &variant->st,
+                    suffix);
+    }
+}
+
+// Check if a cached file and its siblings still match what is on disk
+static int is_current(const struct StaticFile *file) {
     struct stat st;
-    if (stat(full_path, &st) != 0 || !S_ISREG(st.st_mode)) {
-        // 404 for not found or not regular file
-        const char *response = "HTTP/1.1 404 Not Found\r\nContent-Type: "
-                               "text/plain\r\n\r\n404 Not Found";
-        send(client_fd, response, strlen(response), 0);
+    if (stat(file->path, &st) != 0 || !same_file(&file->st, &st)) {
         return 0;
     }
+    if (!is_compressible(file->path)) {
+        return 1;
+    }
 
-    int fd = open(full_path, O_RDONLY);
-    if (fd == -1) {
-        const char *response = "HTTP/1.1 404 Not Found\r\nContent-Type: "
-                               "text/plain\r\n\r\n404 Not Found";
-        send(client_fd, response, strlen(response), 0);
-        return 0;
+    for (int i = 0; i < STATIC_ENCODING_COUNT; i++) {
+        const struct StaticVariant *variant = &file->variants[i];
+        char path[PATH_MAX];
+        if (variant_path(path, sizeof(path), file->path, i) != 0) {
+            continue;
+        }
+        int exists = stat(path, &st) == 0;
+        // A sibling appeared, changed, or went away.
+        if (variant->fd == -1 ? exists
+                              : !exists || !same_file(&variant->st, &st)) {
+            return 0;
+        }
     }
+    return 1;
+}
 
-    const char *mime = get_mime_type(full_path);
-    char header[512];
-    int header_len = snprintf(
-        header, sizeof(header),
-        "HTTP/1.1 200 OK\r\nContent-Type: %s\r\nContent-Length: %ld\r\n\r\n",
-        mime, st.st_size);
-    send(client_fd, header, header_len, 0);
+// Look up an open file in the static file cache, opening it on a miss
+struct StaticFile *static_cache_open(const char *full_path) {
+    time_t now = time(NULL);
+    size_t bucket = hash_path(full_path);
+    struct StaticFile *file = cache_buckets[bucket];
+    while (file && strcmp(file->path, full_path) != 0) {
+        file = file->hash_next;
+    }
 
-    // Send file content
-    char buf[8192];
-    ssize_t n;
-    while ((n = read(fd, buf, sizeof(buf))) > 0) {
-        send(client_fd, buf, n, 0);
+    if (file) {
+        if (now - file->checked < STATIC_CACHE_VALID_SECONDS) {
+            cache_unlink(file);
+            cache_append(file);
+            return file;
+        }
+        if (is_current(file)) {
+            file->checked = now;
+            cache_unlink(file);
+            cache_append(file);
+            return file;
+        }
+        // The file changed or is gone so open it again.
+        cache_remove(file);
     }
-    close(fd);
-    return 0;
+
+    int fd = open(full_path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return NULL;
+    }
+
+    file = malloc(sizeof(struct StaticFile));
+    if (!file) {
+        close(fd);
+        return NULL;
+    }
+    if (cache_count == STATIC_CACHE_SIZE) {
+        cache_remove(cache_head);
+    }
+    snprintf(file->path, sizeof(file->path), "%s", full_path);
+    file->fd = fd;
+    file->st = st;
+    file->mime_type = get_mime_type(full_path);
+    format_etag(file->etag, sizeof(file->etag), &st, "");
+    struct tm modified;
+    gmtime_r(&st.st_mtime, &modified);
+    strftime(file->last_modified, sizeof(file->last_modified),
+             "%a, %d %b %Y %H:%M:%S GMT", &modified);
+    open_variants(file);
+    file->checked = now;
+    file->references = 0;
+    file->evicted = 0;
+    file->hash_next = cache_buckets[bucket];
+    cache_buckets[bucket] = file;
+    cache_append(file);
+    cache_count++;
+    return file;
 }
 
-// Create Unix domain socket for delegation
-int create_delegation_socket() {
-    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
-    if (sock == -1) {
-        perror("socket");
-        return -1;
+// Keep a file open while a response is still sending it
+void static_file_retain(struct StaticFile *file) { file->references++; }
+
+// Release a file kept with static_file_retain
+void static_file_release(struct StaticFile *file) {
+    file->references--;
+    if (file->evicted && file->references == 0) {
+        free_static_file(file);
     }
+}
 
-    struct sockaddr_un addr;
-    memset(&addr, 0, sizeof(addr));
-    addr.sun_family = AF_UNIX;
-    snprintf(addr.sun_path, sizeof(addr.sun_path), "/tmp/nibiru_static_%d.sock",
-             getpid());
+// Close every file in the static file cache
+void static_cache_clear() {
+    while (cache_head) {
+        cache_remove(cache_head);
+    }
+}
 
-    unlink(addr.sun_path); // Remove if exists
-    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
-        perror("bind");
-        close(sock);
+// Send part of a file to a socket without copying it through userspace
+ssize_t send_static_file(int out_fd, int in_fd, off_t *offset, size_t count) {
+#if defined(__linux__)
+    return sendfile(out_fd, in_fd, offset, count);
+#elif defined(__APPLE__)
+    off_t length = count;
+    int result = sendfile(in_fd, out_fd, *offset, &length, NULL, 0);
+    // A partial send still reports how much went out.
+    *offset += length;
+    if (result == -1 && length == 0) {
         return -1;
     }
-
-    if (listen(sock, 10) == -1) {
-        perror("listen");
-        close(sock);
+    return length;
+#elif defined(__FreeBSD__)
+    off_t sent = 0;
+    int result = sendfile(in_fd, out_fd, *offset, count, NULL, &sent, 0);
+    *offset += sent;
+    if (result == -1 && sent == 0) {
         return -1;
     }
+    return sent;
+#else
+    char buf[8192];
+    ssize_t n = pread(in_fd, buf,
+                      count < sizeof(buf) ? count : sizeof(buf), *offset);
+    if (n <= 0) {
+        return n;
+    }
+    ssize_t sent = send(out_fd, buf, n, 0);
+    if (sent > 0) {
+        *offset += sent;
+    }
+    return sent;
+#endif
+}
+
+// Find the file a static request refers to
+struct StaticFile *find_static_file(const char *target, size_t target_len,
+                                    const char *static_dir,
+                                    const char *static_url) {
+    // The query string doesn't name a file.
+    const char *query = memchr(target, '?', target_len);
+    if (query) {
+        target_len = query - target;
+    }
+
+    char path[PATH_MAX];
+    if (target_len >= sizeof(path)) {
+        return NULL;
+    }
+    memcpy(path, target, target_len);
+    path[target_len] = '\0';
 
-    return sock;
+    char full_path[PATH_MAX];
+    if (sanitize_path(path, full_path, sizeof(full_path), static_dir,
+                      static_url) != 0) {
+        return NULL;
+    }
+    return static_cache_open(full_path);
 }
 
-// Serialize request for delegation
-int serialize_request(char *buf, size_t buf_size, const char *method,
-                      size_t method_len, const char *path, size_t path_len,
-                      int client_fd) {
-    // Format: method\0path\0client_fd
-    size_t total = method_len + 1 + path_len + 1 + sizeof(int);
-    if (total > buf_size)
+// Pick the precompressed sibling to send for an Accept-Encoding value
+int choose_static_encoding(const struct StaticFile *file,
+                           const char *accept_encoding,
+                           int accept_encoding_len) {
+    int chosen = -1;
+    int chosen_quality = 0;
+    if (!accept_encoding) {
         return -1;
+    }
+    for (int i = 0; i < STATIC_ENCODING_COUNT; i++) {
+        if (file->variants[i].fd == -1) {
+            continue;
+        }
+        // Ties go to the earlier, better compressed, encoding.
+        int quality = coding_quality(accept_encoding, accept_encoding_len,
+                                     encoding_names[i]);
+        if (quality > chosen_quality) {
+            chosen = i;
+            chosen_quality = quality;
+        }
+    }
+    return chosen;
+}
 
-    memcpy(buf, method, method_len);
-    buf[method_len] = '\0';
-    memcpy(buf + method_len + 1, path, path_len);
-    buf[method_len + 1 + path_len] = '\0';
-    memcpy(buf + method_len + 1 + path_len + 1, &client_fd, sizeof(int));
-    return total;
-}
-
-// Deserialize request
-int deserialize_request(const char *buf, size_t buf_size, char *method,
-                        size_t method_size, char *path, size_t path_size,
-                        int *client_fd) {
-    const char *p = buf;
-    size_t len = strlen(p) + 1;
-    if (len > method_size)
-        return -1;
-    strcpy(method, p);
-    p += len;
+// Check if a file has any precompressed siblings
+static int has_variants(const struct StaticFile *file) {
+    for (int i = 0; i < STATIC_ENCODING_COUNT; i++) {
+        if (file->variants[i].fd != -1) {
+            return 1;
+        }
+    }
+    return 0;
+}
 
-    len = strlen(p) + 1;
-    if (len > path_size)
-        return -1;
-    strcpy(path, p);
-    p += len;
+// Get the entity tag of a representation
+static const char *representation_etag(const struct StaticFile *file,
+                                       int encoding) {
+    return encoding == -1 ? file->etag : file->variants[encoding].etag;
+}
 
-    if ((size_t)(p - buf) + sizeof(int) > buf_size)
-        return -1;
-    memcpy(client_fd, p, sizeof(int));
+// Get the size of a representation
+static off_t representation_size(const struct StaticFile *file,
+                                 int encoding) {
+    return encoding == -1 ? file->st.st_size
+                          : file->variants[encoding].st.st_size;
+}
+
+// Check if a conditional request's validators match the representation
+int static_file_not_modified(const struct StaticFile *file, int encoding,
+                             const char *if_none_match, int if_none_match_len,
+                             const char *if_modified_since,
+                             int if_modified_since_len) {
+    if (if_none_match) {
+        return etag_list_matches(if_none_match, if_none_match_len,
+                                 representation_etag(file, encoding));
+    }
+    time_t since;
+    if (if_modified_since &&
+        parse_http_date(if_modified_since, if_modified_since_len, &since) ==
+            0) {
+        return file->st.st_mtime <= since;
+    }
     return 0;
 }
 
-// Delegate static request
-int delegate_static_request(int delegation_socket, const char *method,
-                            size_t method_len, const char *path,
-                            size_t path_len, int client_fd) {
-    char buf[1024];
-    int len = serialize_request(buf, sizeof(buf), method, method_len, path,
-                                path_len, client_fd);
-    if (len == -1) {
-        return -1;
+// Check if an If-Range validator still matches the representation
+int static_file_range_applies(const struct StaticFile *file, int encoding,
+                              const char *if_range, int if_range_len) {
+    if (!if_range) {
+        return 1;
     }
+    // Entity tags must match strongly so weak tags never do.
+    if (if_range_len > 0 && if_range[0] == '"') {
+        const char *etag = representation_etag(file, encoding);
+        return (size_t)if_range_len == strlen(etag) &&
+               memcmp(if_range, etag, if_range_len) == 0;
+    }
+    time_t date;
+    return parse_http_date(if_range, if_range_len, &date) == 0 &&
+           date == file->st.st_mtime;
+}
 
-    // Send data
-    ssize_t sent = send(delegation_socket, buf, len, 0);
-    if (sent == -1) {
-        perror("send in delegate");
-        return -1;
+// Format the validator and caching headers shared by every response for a
+// representation
+static int format_validators(char *buf, size_t buf_size,
+                             const struct StaticFile *file, int encoding,
+                             int keep_alive) {
+    char cache_control[64] = "";
+    if (static_max_age > 0) {
+        snprintf(cache_control, sizeof(cache_control),
+                 "Cache-Control: public, max-age=%d\r\n", static_max_age);
     }
-    return 0;
+    // Caches must key on Accept-Encoding whenever the response could have
+    // been encoded differently.
+    return snprintf(buf, buf_size, "ETag: %s\r\nLast-Modified: %s\r\n%s%s%s",
+                    representation_etag(file, encoding), file->last_modified,
+                    cache_control,
+                    has_variants(file) ? "Vary: Accept-Encoding\r\n" : "",
+                    keep_alive ? "" : "Connection: close\r\n");
 }
 
-// Receive delegated request
-int receive_delegated_request(int delegation_socket, char *method,
-                              size_t method_size, char *path,
-                              size_t path_size) {
-    char buf[1024];
-    ssize_t received = recv(delegation_socket, buf, sizeof(buf), 0);
-    if (received == -1) {
-        perror("recv in receive");
-        return -1;
+// Format the status line and headers for a static file response
+int format_static_headers(char *buf, size_t buf_size,
+                          const struct StaticFile *file, int encoding,
+                          const struct ByteRange *range, int keep_alive) {
+    off_t size = representation_size(file, encoding);
+    char content_encoding[64] = "";
+    if (encoding != -1) {
+        snprintf(content_encoding, sizeof(content_encoding),
+                 "Content-Encoding: %s\r\n", encoding_names[encoding]);
     }
-    int dummy_fd;
-    int result = deserialize_request(buf, received, method, method_size, path,
-                                     path_size, &dummy_fd);
-    return result;
-}
-
-// Event loop for static worker
-void run_static_event_loop(int delegation_socket, const char *static_dir,
-                           const char *static_url) {
-    while (1) {
-        int delegation_client_fd = accept(delegation_socket, NULL, NULL);
-        if (delegation_client_fd == -1) {
-            if (errno == EINTR)
-                continue;
-            perror("accept in static worker");
-            break;
-        }
-        char method[16];
-        char path[PATH_MAX];
-        if (receive_delegated_request(delegation_client_fd, method,
-                                      sizeof(method), path,
-                                      sizeof(path)) == 0) {
-            serve_static_file(delegation_client_fd, path, static_dir,
-                              static_url);
-        }
-        close(delegation_client_fd);
+    char content_range[96] = "";
+    off_t content_length = size;
+    if (range) {
+        snprintf(content_range, sizeof(content_range),
+                 "Content-Range: bytes %lld-%lld/%lld\r\n",
+                 (long long)range->first, (long long)range->last,
+                 (long long)size);
+        content_length = range->last - range->first + 1;
     }
+    char validators[256];
+    format_validators(validators, sizeof(validators), file, encoding,
+                      keep_alive);
+    return snprintf(buf, buf_size,
+                    "HTTP/1.1 %s\r\nContent-Type: %s\r\n"
+                    "Content-Length: %lld\r\n%s%sAccept-Ranges: bytes\r\n"
+                    "%s\r\n",
+                    range ? "206 Partial Content" : "200 OK",
+                    file->mime_type, (long long)content_length,
+                    content_encoding, content_range, validators);
 }
 
-// Placeholder for kqueue implementation
-#ifdef USE_KQUEUE
-// Implement kqueue version similarly
-#endif
+// Format the headers of a 206 response with several ranges
+int format_static_multipart_headers(char *buf, size_t buf_size,
+                                    const struct StaticFile *file,
+                                    int encoding, off_t content_length,
+                                    int keep_alive) {
+    char content_encoding[64] = "";
+    if (encoding != -1) {
+        snprintf(content_encoding, sizeof(content_encoding),
+                 "Content-Encoding: %s\r\n", encoding_names[encoding]);
+    }
+    char validators[256];
+    format_validators(validators, sizeof(validators), file, encoding,
+                      keep_alive);
+    return snprintf(buf, buf_size,
+                    "HTTP/1.1 206 Partial Content\r\n"
+                    "Content-Type: multipart/byteranges; boundary=%s\r\n"
+                    "Content-Length: %lld\r\n%sAccept-Ranges: bytes\r\n"
+                    "%s\r\n",
+                    STATIC_MULTIPART_BOUNDARY, (long long)content_length,
+                    content_encoding, validators);
+}
 
-// Placeholder for kqueue implementation
+// Format the delimiter and headers that start one part of a multipart body
+int format_static_part_header(char *buf, size_t buf_size,
+                              const struct StaticFile *file,
+                              const struct ByteRange *range, off_t size) {
+    return snprintf(buf, buf_size,
+                    "\r\n--%s\r\nContent-Type: %s\r\n"
+                    "Content-Range: bytes %lld-%lld/%lld\r\n\r\n",
+                    STATIC_MULTIPART_BOUNDARY, file->mime_type,
+                    (long long)range->first, (long long)range->last,
+                    (long long)size);
+}
+
+// Find the length of the multipart body for a list of ranges
+off_t static_multipart_length(const struct StaticFile *file, int encoding,
+                              const struct ByteRange *ranges, int count) {
+    off_t size = representation_size(file, encoding);
+    off_t length = strlen(STATIC_MULTIPART_END);
+    for (int i = 0; i < count; i++) {
+        length += format_static_part_header(NULL, 0, file, &ranges[i], size);
+        length += ranges[i].last - ranges[i].first + 1;
+    }
+    return length;
+}
+
+// Format a 304 Not Modified response
+int format_static_not_modified(char *buf, size_t buf_size,
+                               const struct StaticFile *file, int encoding,
+                               int keep_alive) {
+    char validators[256];
+    format_validators(validators, sizeof(validators), file, encoding,
+                      keep_alive);
+    return snprintf(buf, buf_size, "HTTP/1.1 304 Not Modified\r\n%s\r\n",
+                    validators);
+}
+
+// Format a 416 Range Not Satisfiable response
+int format_static_unsatisfiable(char *buf, size_t buf_size,
+                                const struct StaticFile *file, int encoding,
+                                int keep_alive) {
+    return snprintf(buf, buf_size,
+                    "HTTP/1.1 416 Range Not Satisfiable\r\n"
+                    "Content-Range: bytes */%lld\r\nContent-Length: 0\r\n"
+                    "%s\r\n",
+                    (long long)representation_size(file, encoding),
+                    keep_alive ? "" : "Connection: close\r\n");
+}
@@ -1,21 +1,165 @@
 #ifndef STATIC_H
 #define STATIC_H
 
+#include <limits.h>
 #include <stddef.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "parse.h"
+
+// Open files kept by the static file cache
+#define STATIC_CACHE_SIZE 256
+
+// Seconds a cached file is trusted before it is checked against the disk
+#define STATIC_CACHE_VALID_SECONDS 1
+
+// Multipart boundary separating the parts of a multiple range response
+#define STATIC_MULTIPART_BOUNDARY "nibiru-byteranges-7f3a91c2e4b8"
+
+// Content codings a static file may have a precompressed sibling for, in
+// order of preference. The sibling is named after the file plus the
+// coding's extension, like app.js.br.
+enum StaticEncoding {
+    STATIC_ENCODING_BROTLI,
+    STATIC_ENCODING_ZSTD,
+    STATIC_ENCODING_GZIP,
+    STATIC_ENCODING_COUNT
+};
+
+// A precompressed sibling of a static file
+struct StaticVariant {
+    // -1 if there is no usable sibling
+    int fd;
+    struct stat st;
+    char etag[64];
+};
+
+// An open static file held by the cache
+struct StaticFile {
+    // The sanitized path the file is cached under
+    char path[PATH_MAX];
+    int fd;
+    struct stat st;
+    const char *mime_type;
+    // Validators derived from the stat data when the file is opened
+    char etag[64];
+    char last_modified[32];
+    // Precompressed siblings, looked up for compressible types only
+    struct StaticVariant variants[STATIC_ENCODING_COUNT];
+    // When the file was last checked against the disk
+    time_t checked;
+    // Responses still sending the file. An evicted file is closed once the
+    // last of them finishes.
+    int references;
+    int evicted;
+    // Link in the hash bucket chain
+    struct StaticFile *hash_next;
+    // Links in the LRU list, ordered from least to most recently used
+    struct StaticFile *prev;
+    struct StaticFile *next;
+};
+
+// Seconds clients may cache static files, sent as Cache-Control max-age
+// 0 leaves out the Cache-Control header.
+extern int static_max_age;
 
 // Static file request detection
 int is_static_request(const char *path, const char *static_url);
 
-// Delegation of static requests
-int delegate_static_request(int delegation_socket, const char *method,
-                            size_t method_len, const char *path,
-                            size_t path_len, int client_fd);
+// Look up an open file in the static file cache, opening it on a miss
+// Returns NULL if the path is not a readable regular file. The file stays
+// valid until the next call unless it is retained.
+struct StaticFile *static_cache_open(const char *full_path);
+
+// Close every file in the static file cache
+void static_cache_clear();
+
+// Send part of a file to a socket without copying it through userspace
+// Returns: the number of bytes sent, or -1 on error. offset is advanced past
+// the bytes sent.
+ssize_t send_static_file(int out_fd, int in_fd, off_t *offset, size_t count);
+
+// Pick the precompressed sibling to send for an Accept-Encoding value
+// accept_encoding may be NULL when the request has no Accept-Encoding.
+// Returns: the StaticEncoding to send, or -1 to send the file as is
+int choose_static_encoding(const struct StaticFile *file,
+                           const char *accept_encoding,
+                           int accept_encoding_len);
+
+// Keep a file open while a response is still sending it
+void static_file_retain(struct StaticFile *file);
+
+// Release a file kept with static_file_retain
+void static_file_release(struct StaticFile *file);
+
+// Find the file a static request refers to (target may not be
+// null-terminated)
+// Returns NULL if there is no such file, which is a 404 response.
+struct StaticFile *find_static_file(const char *target, size_t target_len,
+                                    const char *static_dir,
+                                    const char *static_url);
+
+// Check if a conditional request's validators match the representation
+// Either header value may be NULL when the request doesn't have it. A
+// matching If-None-Match wins over If-Modified-Since.
+// Returns: 1 if the response is 304 Not Modified, else 0
+int static_file_not_modified(const struct StaticFile *file, int encoding,
+                             const char *if_none_match, int if_none_match_len,
+                             const char *if_modified_since,
+                             int if_modified_since_len);
+
+// Check if an If-Range validator still matches the representation
+// Returns: 1 if the Range header should be honored, 0 to send it all
+int static_file_range_applies(const struct StaticFile *file, int encoding,
+                              const char *if_range, int if_range_len);
+
+// Format the status line and headers for a static file response
+// encoding is a StaticEncoding or -1 for the file as is. range is NULL for
+// the whole representation or the single range of a 206 response.
+// Returns: the length of the headers, as snprintf does
+int format_static_headers(char *buf, size_t buf_size,
+                          const struct StaticFile *file, int encoding,
+                          const struct ByteRange *range, int keep_alive);
+
+// Format the headers of a 206 response with several ranges
+// content_length is the length of the whole multipart body.
+// Returns: the length of the headers, as snprintf does
+int format_static_multipart_headers(char *buf, size_t buf_size,
+                                    const struct StaticFile *file,
+                                    int encoding, off_t content_length,
+                                    int keep_alive);
+
+// Format the delimiter and headers that start one part of a multipart body
+// size is the size of the whole representation.
+// Returns: the length of the part header, as snprintf does
+int format_static_part_header(char *buf, size_t buf_size,
+                              const struct StaticFile *file,
+                              const struct ByteRange *range, off_t size);
+
+// Find the length of the multipart body for a list of ranges
+off_t static_multipart_length(const struct StaticFile *file, int encoding,
+                              const struct ByteRange *ranges, int count);
+
+// Format a 304 Not Modified response
+// Returns: the length of the response, as snprintf does
+int format_static_not_modified(char *buf, size_t buf_size,
+                               const struct StaticFile *file, int encoding,
+                               int keep_alive);
+
+// Format a 416 Range Not Satisfiable response
+// Returns: the length of the response, as snprintf does
+int format_static_unsatisfiable(char *buf, size_t buf_size,
+                                const struct StaticFile *file, int encoding,
+                                int keep_alive);
 
-// Socket creation for delegation
-int create_delegation_socket();
+// Closing delimiter of a multipart body
+#define STATIC_MULTIPART_END "\r\n--" STATIC_MULTIPART_BOUNDARY "--\r\n"
 
-// Event loop for static file serving
-void run_static_event_loop(int delegation_socket, const char *static_dir,
-                           const char *static_url);
+// Response for a static file that doesn't exist
+#define STATIC_NOT_FOUND_RESPONSE                                              \
+    "HTTP/1.1 404 Not Found\r\nContent-Type: text/plain\r\n"                   \
+    "Content-Length: 13\r\n\r\n404 Not Found"
 
 #endif // STATIC_H
\ No newline at end of file
@@ -0,0 +1,126 @@
+// bench_parse.c - Microbenchmark for request line parsing
+//
+// Compares parse_request_line against the byte-by-byte scanner and the
+// strlen + strncmp method lookup it replaced. Run with `make bench`.
+
+#include "../src/parse.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define ITERATIONS 5000000
+
+// The request line parser before the vectorized scanner
+static int baseline_is_supported(const char *token, int token_len,
+                                 const char **table, int table_len) {
+    for (int i = 0; i < table_len; i++) {
+        int supported_len = strlen(table[i]);
+        if (token_len == supported_len &&
+            strncmp(token, table[i], token_len) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int baseline_parse_request_line(const char *buffer, size_t buffer_len,
+                                       const char **method,
+                                       const char **target,
+                                       const char **version, int *method_len,
+                                       int *target_len, int *version_len) {
+    const char *line_end = NULL;
+    for (size_t i = 0; i < buffer_len - 1; i++) {
+        if (buffer[i] == '\r' && buffer[i + 1] == '\n') {
+            line_end = &buffer[i];
+            break;
+        }
+    }
+    if (!line_end || line_end == buffer)
+        return -1;
+    const char *pos = buffer;
+    const char *end = line_end;
+    if (*pos == ' ')
+        return -3;
+    *method = pos;
+    while (pos < end && *pos != ' ')
+        pos++;
+    *method_len = pos - *method;
+    if (*method_len == 0)
+        return -4;
+    while (pos < end && *pos == ' ')
+        pos++;
+    if (pos >= end)
+        return -5;
+    *target = pos;
+    while (pos < end && *pos != ' ')
+        pos++;
+    *target_len = pos - *target;
+    if (*target_len == 0)
+        return -6;
+    while (pos < end && *pos == ' ')
+        pos++;
+    if (pos >= end)
+        return -7;
+    *version = pos;
+    while (pos < end && *pos != '\r')
+        pos++;
+    *version_len = pos - *version;
+    if (*version_len == 0)
+        return -8;
+    if (pos != end || *(pos + 1) != '\n')
+        return -9;
+    if (!baseline_is_supported(*method, *method_len, SUPPORTED_METHODS,
+                               NUM_SUPPORTED_METHODS))
+        return -2;
+    if (!baseline_is_supported(*version, *version_len, SUPPORTED_VERSIONS,
+                               NUM_SUPPORTED_VERSIONS))
+        return -2;
+    return 0;
+}
+
+typedef int (*parser)(const char *, size_t, const char **, const char **,
+                      const char **, int *, int *, int *);
+
+// Time a parser over a request and return nanoseconds per call
+static double time_parser(parser parse, const char *request) {
+    size_t request_len = strlen(request);
+    const char *method, *target, *version;
+    int method_len, target_len, version_len;
+    volatile int sink = 0;
+    struct timespec start, stop;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < ITERATIONS; i++) {
+        sink += parse(request, request_len, &method, &target, &version,
+                      &method_len, &target_len, &version_len);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    (void)sink;
+
+    double elapsed = (stop.tv_sec - start.tv_sec) * 1e9 +
+                     (stop.tv_nsec - start.tv_nsec);
+    return elapsed / ITERATIONS;
+}
+
+int main(void) {
+    const char *requests[] = {
+        "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n",
+        "PATCH /api/v1/users/42/preferences HTTP/1.1\r\n"
+        "Host: localhost\r\n\r\n",
+        "OPTIONS /static/js/vendor/application.bundle.min.js?v=9c1f3e2a7b "
+        "HTTP/1.1\r\nHost: localhost\r\n\r\n",
+    };
+    int num_requests = sizeof(requests) / sizeof(requests[0]);
+
+    printf("%-12s %12s %12s %8s\n", "line bytes", "baseline ns", "current ns",
+           "speedup");
+    for (int i = 0; i < num_requests; i++) {
+        double baseline =
+            time_parser(baseline_parse_request_line, requests[i]);
+        double current = time_parser(parse_request_line, requests[i]);
+        printf("%-12zu %12.1f %12.1f %7.2fx\n",
+               strstr(requests[i], "\r\n") - requests[i], baseline, current,
+               baseline / current);
+    }
+    return 0;
+}
@@ -48,8 +48,6 @@ stop_server() {
     fi
     # Kill any leftover processes
     kill_leftover_processes >/dev/null 2>&1 || true
-    # Clean up files
-    rm -f /tmp/nibiru_static_*.sock 2>/dev/null || true
     # Keep log file for debugging
     # rm -f "$LOG_FILE" 2>/dev/null || true
 }
@@ -0,0 +1,372 @@
+// test_connection.c - Unit tests for buffered client connections
+
+#include "../src/connection.h"
+#include "unity.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// Create a connection for one end of a non-blocking socket pair
+static struct Connection *create_pair(int *peer_fd) {
+    int fds[2];
+    TEST_ASSERT_EQUAL(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL, 0) | O_NONBLOCK);
+    *peer_fd = fds[1];
+    struct Connection *connection = connection_create(fds[0]);
+    TEST_ASSERT_NOT_NULL(connection);
+    return connection;
+}
+
+void test_connection_receive_and_consume(void) {
+    int peer_fd;
+    struct Connection *connection = create_pair(&peer_fd);
+
+    errno = 0;
+    TEST_ASSERT_EQUAL(-1, connection_receive(connection, RECEIVE_BUFFER_SIZE));
+    TEST_ASSERT_EQUAL(EAGAIN, errno);
+
+    write(peer_fd, "GET / HTTP/1.1\r\n\r\nGET", 21);
+    TEST_ASSERT_EQUAL(21, connection_receive(connection, RECEIVE_BUFFER_SIZE));
+    TEST_ASSERT_EQUAL(21, connection->input_length);
+
+    connection_consume(connection, 18);
+    TEST_ASSERT_EQUAL(3, connection->input_length);
+    TEST_ASSERT_EQUAL_MEMORY("GET", connection->input, 3);
+
+    close(peer_fd);
+    TEST_ASSERT_EQUAL(0, connection_receive(connection, RECEIVE_BUFFER_SIZE));
+    connection_destroy(connection);
+}
+
+void test_connection_write_queues_output(void) {
+    int peer_fd;
+    struct Connection *connection = create_pair(&peer_fd);
+
+    // Write more than the socket buffer holds so the rest gets queued.
+    static char data[1024 * 1024];
+    memset(data, 'x', sizeof(data));
+    TEST_ASSERT_EQUAL(0, connection_write(connection, data, sizeof(data)));
+    TEST_ASSERT_TRUE(connection_has_output(connection));
+    TEST_ASSERT_EQUAL(0, connection_flush(connection));
+
+    // Drain the peer until every byte has arrived.
+    static char received[sizeof(data)];
+    size_t total = 0;
+    while (total < sizeof(data)) {
+        ssize_t n = read(peer_fd, received + total, sizeof(data) - total);
+        TEST_ASSERT_TRUE(n > 0);
+        total += n;
+        if (connection_has_output(connection)) {
+            TEST_ASSERT_NOT_EQUAL(-1, connection_flush(connection));
+        }
+    }
+    TEST_ASSERT_FALSE(connection_has_output(connection));
+    TEST_ASSERT_EQUAL_MEMORY(data, received, sizeof(data));
+
+    close(peer_fd);
+    connection_destroy(connection);
+}
+
+void test_connection_writev_queues_remainder(void) {
+    int peer_fd;
+    struct Connection *connection = create_pair(&peer_fd);
+
+    // The middle piece overflows the socket buffer so the socket takes part
+    // of it and the rest is queued in order.
+    static char data[1024 * 1024];
+    memset(data, 'x', sizeof(data));
+    struct iovec iov[] = {{"[", 1}, {data, sizeof(data)}, {"]", 1}};
+    TEST_ASSERT_EQUAL(0, connection_writev(connection, iov, 3));
+    TEST_ASSERT_TRUE(connection_has_output(connection));
+
+    // Later pieces wait behind the queue.
+    struct iovec more[] = {{"!", 1}};
+    TEST_ASSERT_EQUAL(0, connection_writev(connection, more, 1));
+
+    static char received[sizeof(data) + 3];
+    size_t total = 0;
+    while (total < sizeof(received)) {
+        ssize_t n = read(peer_fd, received + total, sizeof(received) - total);
+        TEST_ASSERT_TRUE(n > 0);
+        total += n;
+        if (connection_has_output(connection)) {
+            TEST_ASSERT_NOT_EQUAL(-1, connection_flush(connection));
+        }
+    }
+    TEST_ASSERT_EQUAL('[', received[0]);
+    TEST_ASSERT_EQUAL_MEMORY(data, received + 1, sizeof(data));
+    TEST_ASSERT_EQUAL_MEMORY("]!", received + 1 + sizeof(data), 2);
+
+    close(peer_fd);
+    connection_destroy(connection);
+}
+
+void test_connection_list_touch_orders_by_activity(void) {
+    struct ConnectionList list = {0};
+    int peer_fds[3];
+    struct Connection *connections[3];
+    for (int i = 0; i < 3; i++) {
+        connections[i] = create_pair(&peer_fds[i]);
+        connection_list_append(&list, connections[i]);
+    }
+    TEST_ASSERT_EQUAL(3, list.count);
+    TEST_ASSERT_EQUAL_PTR(connections[0], list.head);
+
+    connection_list_touch(&list, connections[0], 100);
+    TEST_ASSERT_EQUAL_PTR(connections[1], list.head);
+    TEST_ASSERT_EQUAL_PTR(connections[0], list.tail);
+    TEST_ASSERT_EQUAL(100, connections[0]->last_active);
+
+    connection_list_remove(&list, connections[2]);
+    TEST_ASSERT_EQUAL(2, list.count);
+    TEST_ASSERT_EQUAL_PTR(connections[0], connections[1]->next);
+    TEST_ASSERT_NULL(connections[0]->next);
+
+    for (int i = 0; i < 3; i++) {
+        close(peer_fds[i]);
+        connection_destroy(connections[i]);
+    }
+}
+
+void test_connection_receive_grows_to_limit(void) {
+    int peer_fd;
+    struct Connection *connection = create_pair(&peer_fd);
+    size_t limit = RECEIVE_BUFFER_SIZE * 3;
+
+    static char data[RECEIVE_BUFFER_SIZE * 4];
+    memset(data, 'x', sizeof(data));
+    write(peer_fd, data, sizeof(data));
+
+    // The buffer doubles until the limit caps it.
+    while (connection_receive(connection, limit) > 0) {
+    }
+    TEST_ASSERT_EQUAL(ENOBUFS, errno);
+    TEST_ASSERT_EQUAL(limit, connection->input_capacity);
+    TEST_ASSERT_EQUAL(limit, connection->input_length);
+
+    // Consuming everything hands the buffer back.
+    connection_consume(connection, connection->input_length);
+    TEST_ASSERT_NULL(connection->input);
+    TEST_ASSERT_EQUAL(RECEIVE_BUFFER_SIZE,
+                      connection_receive(connection, limit));
+
+    close(peer_fd);
+    connection_destroy(connection);
+}
+
+void test_connection_reuses_pooled_buffers(void) {
+    int peer_fd;
+    struct Connection *connection = create_pair(&peer_fd);
+
+    write(peer_fd, "GET", 3);
+    TEST_ASSERT_EQUAL(3, connection_receive(connection, RECEIVE_BUFFER_SIZE));
+    char *buffer = connection->input;
+    connection_consume(connection, 3);
+    TEST_ASSERT_NULL(connection->input);
+
+    // An idle connection holds no buffer until data arrives.
+    errno = 0;
+    TEST_ASSERT_EQUAL(-1, connection_receive(connection, RECEIVE_BUFFER_SIZE));
+    TEST_ASSERT_EQUAL(EAGAIN, errno);
+    TEST_ASSERT_NULL(connection->input);
+
+    write(peer_fd, "GET", 3);
+    TEST_ASSERT_EQUAL(3, connection_receive(connection, RECEIVE_BUFFER_SIZE));
+    TEST_ASSERT_EQUAL_PTR(buffer, connection->input);
+
+    close(peer_fd);
+    connection_destroy(connection);
+}
+
+void test_connection_send_file_after_output(void) {
+    const char *path = "/tmp/nibiru_test_connection.txt";
+    static char data[1024 * 1024];
+    memset(data, 'x', sizeof(data));
+    FILE *out = fopen(path, "w");
+    TEST_ASSERT_NOT_NULL(out);
+    fwrite(data, 1, sizeof(data), out);
+    fclose(out);
+
+    int peer_fd;
+    struct Connection *connection = create_pair(&peer_fd);
+    struct StaticFile *file = static_cache_open(path);
+    TEST_ASSERT_NOT_NULL(file);
+
+    TEST_ASSERT_EQUAL(0, connection_write(connection, "head:", 5));
+    TEST_ASSERT_EQUAL(0, connection_send_file(connection, file, file->fd, 0,
+                                              file->st.st_size));
+    // The file is bigger than the socket buffer so some of it waits.
+    TEST_ASSERT_TRUE(connection_has_output(connection));
+    TEST_ASSERT_EQUAL(1, file->references);
+
+    static char received[sizeof(data) + 5];
+    size_t total = 0;
+    while (total < sizeof(received)) {
+        ssize_t n = read(peer_fd, received + total, sizeof(received) - total);
+        TEST_ASSERT_TRUE(n > 0);
+        total += n;
+        if (connection_has_output(connection)) {
+            TEST_ASSERT_NOT_EQUAL(-1, connection_flush(connection));
+        }
+    }
+    TEST_ASSERT_FALSE(connection_has_output(connection));
+    TEST_ASSERT_EQUAL(0, file->references);
+    TEST_ASSERT_EQUAL_MEMORY("head:", received, 5);
+    TEST_ASSERT_EQUAL_MEMORY(data, received + 5, sizeof(data));
+
+    close(peer_fd);
+    connection_destroy(connection);
+    static_cache_clear();
+    unlink(path);
+}
+
+void test_connection_send_file_ranges(void) {
+    const char *path = "/tmp/nibiru_test_connection.txt";
+    FILE *out = fopen(path, "w");
+    TEST_ASSERT_NOT_NULL(out);
+    fputs("0123456789", out);
+    fclose(out);
+
+    int peer_fd;
+    struct Connection *connection = create_pair(&peer_fd);
+    struct StaticFile *file = static_cache_open(path);
+    TEST_ASSERT_NOT_NULL(file);
+
+    // Buffered bytes and file ranges go out in the order they were queued.
+    TEST_ASSERT_EQUAL(0, connection_write(connection, "[", 1));
+    TEST_ASSERT_EQUAL(
+        0, connection_send_file(connection, file, file->fd, 1, 2));
+    TEST_ASSERT_EQUAL(0, connection_write(connection, "|", 1));
+    TEST_ASSERT_EQUAL(
+        0, connection_send_file(connection, file, file->fd, 7, 3));
+    TEST_ASSERT_EQUAL(0, connection_write(connection, "]", 1));
+    TEST_ASSERT_FALSE(connection_has_output(connection));
+    TEST_ASSERT_EQUAL(0, file->references);
+
+    char received[16];
+    ssize_t n = read(peer_fd, received, sizeof(received));
+    TEST_ASSERT_EQUAL(8, n);
+    TEST_ASSERT_EQUAL_MEMORY("[12|789]", received, 8);
+
+    close(peer_fd);
+    connection_destroy(connection);
+    static_cache_clear();
+    unlink(path);
+}
+
+void test_connection_drain_waits_for_reader(void) {
+    int peer_fd;
+    struct Connection *connection = create_pair(&peer_fd);
+
+    // A peer that doesn't read leaves the output queued, and waiting for it
+    // gives up after the timeout instead of hanging.
+    static char data[1024 * 1024];
+    memset(data, 'x', sizeof(data));
+    struct iovec iov[] = {{data, sizeof(data)}};
+    TEST_ASSERT_EQUAL(0, connection_writev(connection, iov, 1));
+    size_t queued = connection->output_length - connection->output_sent;
+    TEST_ASSERT_TRUE(queued > CONNECTION_OUTPUT_HIGH_WATER);
+    errno = 0;
+    TEST_ASSERT_EQUAL(-1, connection_drain(connection,
+                                           CONNECTION_OUTPUT_HIGH_WATER, 50));
+    TEST_ASSERT_EQUAL(ETIMEDOUT, errno);
+
+    // Once the peer reads, the socket takes more and the queue shrinks.
+    static char received[sizeof(data)];
+    ssize_t n = read(peer_fd, received, sizeof(received));
+    TEST_ASSERT_TRUE(n > 0);
+    TEST_ASSERT_EQUAL(0, connection_drain(connection, queued - 1, 50));
+    TEST_ASSERT_TRUE(connection->output_length - connection->output_sent <
+                     queued);
+
+    close(peer_fd);
+    connection_destroy(connection);
+}
+
+void test_connection_drain_deadline_is_total(void) {
+    int peer_fd;
+    struct Connection *connection = create_pair(&peer_fd);
+
+    static char data[4 * 1024 * 1024];
+    memset(data, 'x', sizeof(data));
+    struct iovec iov[] = {{data, sizeof(data)}};
+    TEST_ASSERT_EQUAL(0, connection_writev(connection, iov, 1));
+
+    // A peer that keeps reading a little at a time makes progress before
+    // every poll would time out, but the wait still ends at the deadline.
+    pid_t reader = fork();
+    TEST_ASSERT_TRUE(reader != -1);
+    if (reader == 0) {
+        static char received[262144];
+        for (;;) {
+            if (read(peer_fd, received, sizeof(received)) <= 0) {
+                _exit(0);
+            }
+            usleep(50000);
+        }
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    errno = 0;
+    TEST_ASSERT_EQUAL(-1, connection_drain(connection,
+                                           CONNECTION_OUTPUT_HIGH_WATER, 200));
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    TEST_ASSERT_EQUAL(ETIMEDOUT, errno);
+    long elapsed_ms = (end.tv_sec - start.tv_sec) * 1000 +
+                      (end.tv_nsec - start.tv_nsec) / 1000000;
+    TEST_ASSERT_TRUE(elapsed_ms < 1000);
+
+    kill(reader, SIGKILL);
+    waitpid(reader, NULL, 0);
+    close(peer_fd);
+    connection_destroy(connection);
+}
+
+void test_connection_streamed_output_stays_bounded(void) {
+    int peer_fd;
+    struct Connection *connection = create_pair(&peer_fd);
+
+    // Stream far more than the high-water mark while the peer reads a
+    // little at a time. The queue is compacted as it drains instead of
+    // growing with everything ever written.
+    static char chunk[16384];
+    memset(chunk, 'x', sizeof(chunk));
+    static char received[65536];
+    size_t written = 0;
+    size_t total = 0;
+    for (int i = 0; i < 256; i++) {
+        struct iovec iov[] = {{chunk, sizeof(chunk)}};
+        TEST_ASSERT_EQUAL(0, connection_writev(connection, iov, 1));
+        written += sizeof(chunk);
+        if (connection->output_length - connection->output_sent >
+            CONNECTION_OUTPUT_HIGH_WATER) {
+            ssize_t n = read(peer_fd, received, sizeof(chunk));
+            TEST_ASSERT_TRUE(n > 0);
+            total += n;
+            TEST_ASSERT_NOT_EQUAL(-1, connection_flush(connection));
+        }
+    }
+    TEST_ASSERT_TRUE(connection_has_output(connection));
+    TEST_ASSERT_TRUE(connection->output_capacity <=
+                     4 * CONNECTION_OUTPUT_HIGH_WATER);
+
+    while (total < written) {
+        ssize_t n = read(peer_fd, received, sizeof(received));
+        TEST_ASSERT_TRUE(n > 0);
+        total += n;
+        if (connection_has_output(connection)) {
+            TEST_ASSERT_NOT_EQUAL(-1, connection_flush(connection));
+        }
+    }
+    TEST_ASSERT_FALSE(connection_has_output(connection));
+
+    close(peer_fd);
+    connection_destroy(connection);
+}
@@ -2,20 +2,21 @@
 
 #include "../src/static.h"
 #include "unity.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
 
 // Declarations for internal static functions
 const char *get_mime_type(const char *path);
 int sanitize_path(const char *path, char *out, size_t out_size,
                   const char *static_dir, const char *static_url);
-int serialize_request(char *buf, size_t buf_size, const char *method,
-                      const char *path, int client_fd);
-int deserialize_request(const char *buf, size_t buf_size, char *method,
-                        size_t method_size, char *path, size_t path_size,
-                        int *client_fd);
 
 // Test functions declared in test_parse.c
 void test_is_supported_method_valid(void);
 void test_is_supported_method_invalid(void);
+void test_is_supported_method_longer_than_slot(void);
 void test_is_supported_method_edge_cases(void);
 void test_is_supported_version_valid(void);
 void test_is_supported_version_invalid(void);
@@ -26,6 +27,38 @@ void test_parse_request_line_invalid_version(void);
 void test_parse_request_line_malformed(void);
 void test_parse_request_line_edge_cases(void);
 void test_parse_request_line_complex_target(void);
+void test_find_header_value(void);
+void test_parse_headers(void);
+void test_find_request_length_complete(void);
+void test_find_request_length_incomplete(void);
+void test_find_request_length_with_body(void);
+void test_find_request_length_pipelined(void);
+void test_find_request_length_invalid_content_length(void);
+void test_find_request_length_repeated_content_length(void);
+void test_find_request_length_chunked(void);
+void test_find_request_length_chunked_incomplete(void);
+void test_find_request_length_invalid_chunked(void);
+void test_find_request_length_headers_too_large(void);
+void test_find_request_length_body_too_large(void);
+void test_decode_chunked_body(void);
+void test_request_wants_keep_alive(void);
+void test_coding_quality(void);
+void test_parse_http_date(void);
+void test_etag_list_matches(void);
+void test_parse_byte_ranges(void);
+
+// Test functions declared in test_connection.c
+void test_connection_receive_and_consume(void);
+void test_connection_write_queues_output(void);
+void test_connection_writev_queues_remainder(void);
+void test_connection_list_touch_orders_by_activity(void);
+void test_connection_receive_grows_to_limit(void);
+void test_connection_reuses_pooled_buffers(void);
+void test_connection_send_file_after_output(void);
+void test_connection_send_file_ranges(void);
+void test_connection_drain_waits_for_reader(void);
+void test_connection_drain_deadline_is_total(void);
+void test_connection_streamed_output_stays_bounded(void);
 
 // Static file tests
 void test_is_static_request_valid(void);
@@ -35,6 +68,15 @@ void test_get_mime_type_unknown(void);
 void test_sanitize_path_valid(void);
 void test_sanitize_path_traversal(void);
 void test_sanitize_path_invalid_url(void);
+void test_static_cache_reuses_open_file(void);
+void test_static_cache_detects_changes(void);
+void test_static_cache_missing_file(void);
+void test_send_static_file(void);
+void test_static_cache_keeps_retained_file(void);
+void test_find_static_file(void);
+void test_static_cache_precompressed_variants(void);
+void test_static_conditional_requests(void);
+void test_static_range_headers(void);
 
 // Static file test implementations
 void test_is_static_request_valid(void) {
@@ -83,25 +125,258 @@ void test_sanitize_path_invalid_url(void) {
     TEST_ASSERT_EQUAL(-1, result);
 }
 
-void test_serialize_deserialize_request(void) {
-    char buf[1024];
-    const char *method = "GET";
-    const char *path = "/static/test.txt";
-    int client_fd = 42;
+// Write a temporary file for the static cache tests
+static void write_file(const char *path, const char *content) {
+    FILE *file = fopen(path, "w");
+    TEST_ASSERT_NOT_NULL(file);
+    fputs(content, file);
+    fclose(file);
+}
+
+void test_static_cache_reuses_open_file(void) {
+    const char *path = "/tmp/nibiru_test_cache.txt";
+    write_file(path, "cached");
 
-    int len = serialize_request(buf, sizeof(buf), method, path, client_fd);
-    TEST_ASSERT_GREATER_THAN(0, len);
+    struct StaticFile *file = static_cache_open(path);
+    TEST_ASSERT_NOT_NULL(file);
+    TEST_ASSERT_EQUAL(6, file->st.st_size);
+    TEST_ASSERT_EQUAL_STRING("text/plain", file->mime_type);
+    int fd = file->fd;
 
-    char out_method[16];
-    char out_path[PATH_MAX];
-    int out_client_fd;
-    int result =
-        deserialize_request(buf, len, out_method, sizeof(out_method), out_path,
-                            sizeof(out_path), &out_client_fd);
-    TEST_ASSERT_EQUAL(0, result);
-    TEST_ASSERT_EQUAL_STRING(method, out_method);
-    TEST_ASSERT_EQUAL_STRING(path, out_path);
-    TEST_ASSERT_EQUAL(client_fd, out_client_fd);
+    file = static_cache_open(path);
+    TEST_ASSERT_NOT_NULL(file);
+    TEST_ASSERT_EQUAL(fd, file->fd);
+
+    static_cache_clear();
+    unlink(path);
+}
+
+void test_static_cache_detects_changes(void) {
+    const char *path = "/tmp/nibiru_test_cache.txt";
+    write_file(path, "before");
+    struct StaticFile *file = static_cache_open(path);
+    TEST_ASSERT_NOT_NULL(file);
+
+    // Replace the file and let the cached entry expire.
+    unlink(path);
+    write_file(path, "after the change");
+    file->checked -= STATIC_CACHE_VALID_SECONDS;
+
+    file = static_cache_open(path);
+    TEST_ASSERT_NOT_NULL(file);
+    TEST_ASSERT_EQUAL(16, file->st.st_size);
+
+    // A deleted file is no longer served.
+    unlink(path);
+    file->checked -= STATIC_CACHE_VALID_SECONDS;
+    TEST_ASSERT_NULL(static_cache_open(path));
+
+    static_cache_clear();
+}
+
+void test_static_cache_missing_file(void) {
+    TEST_ASSERT_NULL(static_cache_open("/tmp/nibiru_test_missing.txt"));
+    // Only regular files are served.
+    TEST_ASSERT_NULL(static_cache_open("/tmp"));
+}
+
+void test_send_static_file(void) {
+    const char *path = "/tmp/nibiru_test_cache.txt";
+    write_file(path, "Hello, World!");
+    struct StaticFile *file = static_cache_open(path);
+    TEST_ASSERT_NOT_NULL(file);
+
+    int fds[2];
+    TEST_ASSERT_EQUAL(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    off_t offset = 7;
+    TEST_ASSERT_EQUAL(6, send_static_file(fds[0], file->fd, &offset, 6));
+    TEST_ASSERT_EQUAL(13, offset);
+
+    char received[16];
+    TEST_ASSERT_EQUAL(6, read(fds[1], received, sizeof(received)));
+    TEST_ASSERT_EQUAL_MEMORY("World!", received, 6);
+
+    close(fds[0]);
+    close(fds[1]);
+    static_cache_clear();
+    unlink(path);
+}
+
+void test_static_cache_keeps_retained_file(void) {
+    const char *path = "/tmp/nibiru_test_cache.txt";
+    write_file(path, "retained");
+    struct StaticFile *file = static_cache_open(path);
+    TEST_ASSERT_NOT_NULL(file);
+
+    // An evicted file stays open until its last response releases it.
+    static_file_retain(file);
+    static_cache_clear();
+    TEST_ASSERT_TRUE(file->evicted);
+    TEST_ASSERT_NOT_EQUAL(-1, fcntl(file->fd, F_GETFD));
+    int fd = file->fd;
+    static_file_release(file);
+    TEST_ASSERT_EQUAL(-1, fcntl(fd, F_GETFD));
+
+    unlink(path);
+}
+
+void test_find_static_file(void) {
+    const char *path = "/tmp/nibiru_test_cache.txt";
+    write_file(path, "found");
+
+    const char *target = "/static/nibiru_test_cache.txt?v=2 HTTP/1.1";
+    struct StaticFile *file =
+        find_static_file(target, strlen(target) - strlen(" HTTP/1.1"), "/tmp",
+                         "/static");
+    TEST_ASSERT_NOT_NULL(file);
+    TEST_ASSERT_EQUAL(5, file->st.st_size);
+
+    char headers[512];
+    format_static_headers(headers, sizeof(headers), file, -1, NULL, 0);
+    char expected[512];
+    snprintf(expected, sizeof(expected),
+             "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\n"
+             "Content-Length: 5\r\nAccept-Ranges: bytes\r\n"
+             "ETag: %s\r\nLast-Modified: %s\r\nConnection: close\r\n\r\n",
+             file->etag, file->last_modified);
+    TEST_ASSERT_EQUAL_STRING(expected, headers);
+
+    TEST_ASSERT_NULL(find_static_file("/static/../etc/passwd", 21, "/tmp",
+                                      "/static"));
+
+    static_cache_clear();
+    unlink(path);
+}
+
+void test_static_cache_precompressed_variants(void) {
+    const char *path = "/tmp/nibiru_test_cache.css";
+    write_file(path, "body { color: red; }");
+    write_file("/tmp/nibiru_test_cache.css.gz", "gzipped");
+    write_file("/tmp/nibiru_test_cache.css.br", "brotli");
+
+    struct StaticFile *file = static_cache_open(path);
+    TEST_ASSERT_NOT_NULL(file);
+    TEST_ASSERT_NOT_EQUAL(-1, file->variants[STATIC_ENCODING_BROTLI].fd);
+    TEST_ASSERT_EQUAL(-1, file->variants[STATIC_ENCODING_ZSTD].fd);
+    TEST_ASSERT_NOT_EQUAL(-1, file->variants[STATIC_ENCODING_GZIP].fd);
+
+    // Brotli is preferred unless the client ranks another coding higher.
+    const char *accept = "gzip, deflate, br";
+    TEST_ASSERT_EQUAL(STATIC_ENCODING_BROTLI,
+                      choose_static_encoding(file, accept, strlen(accept)));
+    accept = "gzip;q=1.0, br;q=0.5";
+    TEST_ASSERT_EQUAL(STATIC_ENCODING_GZIP,
+                      choose_static_encoding(file, accept, strlen(accept)));
+    accept = "zstd";
+    TEST_ASSERT_EQUAL(-1, choose_static_encoding(file, accept, strlen(accept)));
+    TEST_ASSERT_EQUAL(-1, choose_static_encoding(file, NULL, 0));
+
+    char headers[512];
+    format_static_headers(headers, sizeof(headers), file,
+                          STATIC_ENCODING_GZIP, NULL, 1);
+    TEST_ASSERT_EQUAL_STRING_LEN("HTTP/1.1 200 OK\r\nContent-Type: text/css\r\n"
+                                 "Content-Length: 7\r\n"
+                                 "Content-Encoding: gzip\r\n",
+                                 headers, 79);
+    TEST_ASSERT_NOT_NULL(strstr(headers, "Vary: Accept-Encoding\r\n"));
+
+    // The identity response varies too.
+    format_static_headers(headers, sizeof(headers), file, -1, NULL, 1);
+    TEST_ASSERT_NOT_NULL(strstr(headers, "Vary: Accept-Encoding\r\n"));
+
+    // Each representation has its own entity tag.
+    TEST_ASSERT_NOT_EQUAL(0, strcmp(file->etag,
+                                    file->variants[STATIC_ENCODING_GZIP].etag));
+    TEST_ASSERT_NOT_NULL(
+        strstr(file->variants[STATIC_ENCODING_GZIP].etag, "-gzip\""));
+
+    static_cache_clear();
+    unlink(path);
+    unlink("/tmp/nibiru_test_cache.css.gz");
+    unlink("/tmp/nibiru_test_cache.css.br");
+}
+
+void test_static_conditional_requests(void) {
+    const char *path = "/tmp/nibiru_test_cache.txt";
+    write_file(path, "conditional");
+    struct StaticFile *file = static_cache_open(path);
+    TEST_ASSERT_NOT_NULL(file);
+
+    char etag[80];
+    snprintf(etag, sizeof(etag), "\"other\", W/%s", file->etag);
+    TEST_ASSERT_TRUE(
+        static_file_not_modified(file, -1, etag, strlen(etag), NULL, 0));
+    TEST_ASSERT_FALSE(
+        static_file_not_modified(file, -1, "\"other\"", 7, NULL, 0));
+    TEST_ASSERT_TRUE(static_file_not_modified(
+        file, -1, NULL, 0, file->last_modified, strlen(file->last_modified)));
+    const char *old = "Sun, 06 Nov 1994 08:49:37 GMT";
+    TEST_ASSERT_FALSE(
+        static_file_not_modified(file, -1, NULL, 0, old, strlen(old)));
+    // If-None-Match wins over If-Modified-Since.
+    TEST_ASSERT_FALSE(static_file_not_modified(
+        file, -1, "\"other\"", 7, file->last_modified,
+        strlen(file->last_modified)));
+
+    // If-Range needs a strong match or the exact modification date.
+    TEST_ASSERT_TRUE(static_file_range_applies(file, -1, NULL, 0));
+    TEST_ASSERT_TRUE(static_file_range_applies(file, -1, file->etag,
+                                               strlen(file->etag)));
+    snprintf(etag, sizeof(etag), "W/%s", file->etag);
+    TEST_ASSERT_FALSE(
+        static_file_range_applies(file, -1, etag, strlen(etag)));
+    TEST_ASSERT_TRUE(static_file_range_applies(
+        file, -1, file->last_modified, strlen(file->last_modified)));
+    TEST_ASSERT_FALSE(static_file_range_applies(file, -1, old, strlen(old)));
+
+    char response[512];
+    format_static_not_modified(response, sizeof(response), file, -1, 1);
+    TEST_ASSERT_EQUAL_STRING_LEN("HTTP/1.1 304 Not Modified\r\nETag: ",
+                                 response, 33);
+    TEST_ASSERT_NULL(strstr(response, "Content-Length"));
+
+    static_cache_clear();
+    unlink(path);
+}
+
+void test_static_range_headers(void) {
+    const char *path = "/tmp/nibiru_test_cache.txt";
+    write_file(path, "0123456789");
+    struct StaticFile *file = static_cache_open(path);
+    TEST_ASSERT_NOT_NULL(file);
+
+    char headers[512];
+    struct ByteRange range = {2, 5};
+    format_static_headers(headers, sizeof(headers), file, -1, &range, 0);
+    TEST_ASSERT_EQUAL_STRING_LEN("HTTP/1.1 206 Partial Content\r\n", headers,
+                                 30);
+    TEST_ASSERT_NOT_NULL(strstr(headers, "Content-Length: 4\r\n"));
+    TEST_ASSERT_NOT_NULL(strstr(headers, "Content-Range: bytes 2-5/10\r\n"));
+    TEST_ASSERT_NOT_NULL(strstr(headers, "Connection: close\r\n"));
+
+    // The multipart length covers every part header and the closing
+    // delimiter.
+    struct ByteRange ranges[] = {{0, 1}, {8, 9}};
+    char part[256];
+    off_t expected =
+        format_static_part_header(part, sizeof(part), file, &ranges[0], 10) +
+        format_static_part_header(part, sizeof(part), file, &ranges[1], 10) +
+        4 + strlen(STATIC_MULTIPART_END);
+    TEST_ASSERT_EQUAL(expected,
+                      static_multipart_length(file, -1, ranges, 2));
+    TEST_ASSERT_EQUAL_STRING("\r\n--" STATIC_MULTIPART_BOUNDARY
+                             "\r\nContent-Type: text/plain\r\n"
+                             "Content-Range: bytes 8-9/10\r\n\r\n",
+                             part);
+
+    format_static_unsatisfiable(headers, sizeof(headers), file, -1, 1);
+    TEST_ASSERT_EQUAL_STRING("HTTP/1.1 416 Range Not Satisfiable\r\n"
+                             "Content-Range: bytes */10\r\n"
+                             "Content-Length: 0\r\n\r\n",
+                             headers);
+
+    static_cache_clear();
+    unlink(path);
 }
 
 int main(void) {
@@ -110,6 +385,7 @@ int main(void) {
     // Run all parsing tests
     RUN_TEST(test_is_supported_method_valid);
     RUN_TEST(test_is_supported_method_invalid);
+    RUN_TEST(test_is_supported_method_longer_than_slot);
     RUN_TEST(test_is_supported_method_edge_cases);
     RUN_TEST(test_is_supported_version_valid);
     RUN_TEST(test_is_supported_version_invalid);
@@ -120,6 +396,38 @@ int main(void) {
     RUN_TEST(test_parse_request_line_malformed);
     RUN_TEST(test_parse_request_line_edge_cases);
     RUN_TEST(test_parse_request_line_complex_target);
+    RUN_TEST(test_find_header_value);
+    RUN_TEST(test_parse_headers);
+    RUN_TEST(test_find_request_length_complete);
+    RUN_TEST(test_find_request_length_incomplete);
+    RUN_TEST(test_find_request_length_with_body);
+    RUN_TEST(test_find_request_length_pipelined);
+    RUN_TEST(test_find_request_length_invalid_content_length);
+    RUN_TEST(test_find_request_length_repeated_content_length);
+    RUN_TEST(test_find_request_length_chunked);
+    RUN_TEST(test_find_request_length_chunked_incomplete);
+    RUN_TEST(test_find_request_length_invalid_chunked);
+    RUN_TEST(test_find_request_length_headers_too_large);
+    RUN_TEST(test_find_request_length_body_too_large);
+    RUN_TEST(test_decode_chunked_body);
+    RUN_TEST(test_request_wants_keep_alive);
+    RUN_TEST(test_coding_quality);
+    RUN_TEST(test_parse_http_date);
+    RUN_TEST(test_etag_list_matches);
+    RUN_TEST(test_parse_byte_ranges);
+
+    // Run connection tests
+    RUN_TEST(test_connection_receive_and_consume);
+    RUN_TEST(test_connection_write_queues_output);
+    RUN_TEST(test_connection_writev_queues_remainder);
+    RUN_TEST(test_connection_list_touch_orders_by_activity);
+    RUN_TEST(test_connection_receive_grows_to_limit);
+    RUN_TEST(test_connection_reuses_pooled_buffers);
+    RUN_TEST(test_connection_send_file_after_output);
+    RUN_TEST(test_connection_send_file_ranges);
+    RUN_TEST(test_connection_drain_waits_for_reader);
+    RUN_TEST(test_connection_drain_deadline_is_total);
+    RUN_TEST(test_connection_streamed_output_stays_bounded);
 
     // Run static file tests
     RUN_TEST(test_is_static_request_valid);
@@ -129,7 +437,15 @@ int main(void) {
     RUN_TEST(test_sanitize_path_valid);
     RUN_TEST(test_sanitize_path_traversal);
     RUN_TEST(test_sanitize_path_invalid_url);
-    RUN_TEST(test_serialize_deserialize_request);
+    RUN_TEST(test_static_cache_reuses_open_file);
+    RUN_TEST(test_static_cache_detects_changes);
+    RUN_TEST(test_static_cache_missing_file);
+    RUN_TEST(test_send_static_file);
+    RUN_TEST(test_static_cache_keeps_retained_file);
+    RUN_TEST(test_find_static_file);
+    RUN_TEST(test_static_cache_precompressed_variants);
+    RUN_TEST(test_static_conditional_requests);
+    RUN_TEST(test_static_range_headers);
 
     return UNITY_END();
 }
\ No newline at end of file
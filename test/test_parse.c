@@ -2,8 +2,17 @@
 
 #include "../src/parse.h"
 #include "unity.h"
+#include <stdio.h>
 #include <string.h>
 
+// Request size limits for the framing tests
+#define MAX_HEADER_SIZE 256
+#define MAX_BODY_SIZE 64
+
+// Request line and headers for a chunked request
+#define CHUNKED_HEADERS                                                        \
+    "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+
 // Test fixtures
 void setUp(void) {
     // Setup code if needed
@@ -33,6 +42,15 @@ void test_is_supported_method_invalid(void) {
     TEST_ASSERT_FALSE(is_supported_method("", 0));     // Empty
 }
 
+// Unknown methods that hash to the slot of a shorter method
+void test_is_supported_method_longer_than_slot(void) {
+    TEST_ASSERT_FALSE(is_supported_method("ACxx", 4));    // PUT's slot
+    TEST_ASSERT_FALSE(is_supported_method("ABxxx", 5));   // PUT's slot
+    TEST_ASSERT_FALSE(is_supported_method("AAxxxx", 6));  // PUT's slot
+    TEST_ASSERT_FALSE(is_supported_method("AAxxxxx", 7)); // DELETE's slot
+    TEST_ASSERT_FALSE(is_supported_method("GAxxxxx", 7)); // GET's slot
+}
+
 void test_is_supported_method_edge_cases(void) {
     TEST_ASSERT_FALSE(is_supported_method(NULL, 0));   // Null pointer
     TEST_ASSERT_FALSE(is_supported_method("GET", 0));  // Zero length
@@ -166,4 +184,344 @@ void test_parse_request_line_complex_target(void) {
     TEST_ASSERT_EQUAL_STRING_LEN("GET", method, ml);
     TEST_ASSERT_EQUAL_STRING_LEN("/api/v1/users?query=test", target, tl);
     TEST_ASSERT_EQUAL_STRING_LEN("HTTP/1.1", version, vl);
-}
\ No newline at end of file
+}
+// Test find_header_value function
+void test_find_header_value(void) {
+    const char *headers =
+        "Host: localhost\r\ncontent-length:  42 \r\nConnection: close\r\n\r\n";
+    const char *value;
+    int value_len;
+
+    TEST_ASSERT_TRUE(find_header_value(headers, strlen(headers),
+                                       "Content-Length", &value, &value_len));
+    TEST_ASSERT_EQUAL_STRING_LEN("42", value, value_len);
+    TEST_ASSERT_EQUAL(2, value_len);
+
+    TEST_ASSERT_TRUE(find_header_value(headers, strlen(headers), "Connection",
+                                       &value, &value_len));
+    TEST_ASSERT_EQUAL_STRING_LEN("close", value, value_len);
+
+    TEST_ASSERT_FALSE(find_header_value(headers, strlen(headers), "Accept",
+                                        &value, &value_len));
+    // A header name prefix is not a match.
+    TEST_ASSERT_FALSE(find_header_value(headers, strlen(headers), "Hos",
+                                        &value, &value_len));
+}
+
+// Frame a request with the test size limits
+static int frame_request(const char *buffer, size_t buffer_len,
+                         size_t *request_len) {
+    return find_request_length(buffer, buffer_len, MAX_HEADER_SIZE,
+                               MAX_BODY_SIZE, request_len);
+}
+
+// Test find_request_length function
+void test_find_request_length_complete(void) {
+    const char *buffer = "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    size_t request_len = 0;
+
+    int result = frame_request(buffer, strlen(buffer), &request_len);
+
+    TEST_ASSERT_EQUAL(1, result);
+    TEST_ASSERT_EQUAL(strlen(buffer), request_len);
+}
+
+void test_find_request_length_incomplete(void) {
+    size_t request_len = 0;
+
+    const char *buffer1 = "GET / HTTP/1.1\r\nHost: local";
+    TEST_ASSERT_EQUAL(0, frame_request(buffer1, strlen(buffer1), &request_len));
+
+    const char *buffer2 = "POST / HTTP/1.1\r\nContent-Length: 10\r\n\r\nabc";
+    TEST_ASSERT_EQUAL(0, frame_request(buffer2, strlen(buffer2), &request_len));
+}
+
+void test_find_request_length_with_body(void) {
+    const char *buffer = "POST / HTTP/1.1\r\nContent-Length: 3\r\n\r\nabc";
+    size_t request_len = 0;
+
+    int result = frame_request(buffer, strlen(buffer), &request_len);
+
+    TEST_ASSERT_EQUAL(1, result);
+    TEST_ASSERT_EQUAL(strlen(buffer), request_len);
+}
+
+void test_find_request_length_pipelined(void) {
+    const char *first = "GET /a HTTP/1.1\r\n\r\n";
+    const char *buffer = "GET /a HTTP/1.1\r\n\r\nGET /b HTTP/1.1\r\n\r\n";
+    size_t request_len = 0;
+
+    int result = frame_request(buffer, strlen(buffer), &request_len);
+
+    TEST_ASSERT_EQUAL(1, result);
+    TEST_ASSERT_EQUAL(strlen(first), request_len);
+
+    result = frame_request(buffer + request_len, strlen(buffer) - request_len,
+                           &request_len);
+    TEST_ASSERT_EQUAL(1, result);
+    TEST_ASSERT_EQUAL(strlen(first), request_len);
+}
+
+void test_find_request_length_invalid_content_length(void) {
+    const char *buffer = "POST / HTTP/1.1\r\nContent-Length: abc\r\n\r\n";
+    size_t request_len = 0;
+
+    TEST_ASSERT_EQUAL(-1, frame_request(buffer, strlen(buffer), &request_len));
+}
+
+void test_find_request_length_repeated_content_length(void) {
+    size_t request_len = 0;
+
+    // Repeated fields and lists that agree frame the body once
+    const char *buffer1 = "POST / HTTP/1.1\r\nContent-Length: 3\r\n"
+                          "Host: localhost\r\nContent-Length: 3\r\n\r\nabc";
+    TEST_ASSERT_EQUAL(1, frame_request(buffer1, strlen(buffer1), &request_len));
+    TEST_ASSERT_EQUAL(strlen(buffer1), request_len);
+
+    const char *buffer2 = "POST / HTTP/1.1\r\nContent-Length: 3 , 3\r\n\r\nabc";
+    TEST_ASSERT_EQUAL(1, frame_request(buffer2, strlen(buffer2), &request_len));
+    TEST_ASSERT_EQUAL(strlen(buffer2), request_len);
+
+    // Values that disagree leave the end of the body ambiguous
+    const char *buffer3 = "POST / HTTP/1.1\r\nContent-Length: 3\r\n"
+                          "Content-Length: 5\r\n\r\nabcde";
+    TEST_ASSERT_EQUAL(-1,
+                      frame_request(buffer3, strlen(buffer3), &request_len));
+
+    const char *buffer4 = "POST / HTTP/1.1\r\nContent-Length: 3, 5\r\n\r\n"
+                          "abcde";
+    TEST_ASSERT_EQUAL(-1,
+                      frame_request(buffer4, strlen(buffer4), &request_len));
+
+    // An empty list item is invalid
+    const char *buffer5 = "POST / HTTP/1.1\r\nContent-Length: 3,\r\n\r\nabc";
+    TEST_ASSERT_EQUAL(-1,
+                      frame_request(buffer5, strlen(buffer5), &request_len));
+}
+
+void test_find_request_length_chunked(void) {
+    const char *buffer = CHUNKED_HEADERS
+                         "5;name=value\r\nHello\r\n7\r\n, World\r\n"
+                         "0\r\nExpires: never\r\n\r\nGET / HTTP/1.1\r\n\r\n";
+    size_t request_len = 0;
+
+    int result = frame_request(buffer, strlen(buffer), &request_len);
+
+    TEST_ASSERT_EQUAL(1, result);
+    TEST_ASSERT_EQUAL(strlen(buffer) - strlen("GET / HTTP/1.1\r\n\r\n"),
+                      request_len);
+}
+
+void test_find_request_length_chunked_incomplete(void) {
+    const char *bodies[] = {"",
+                            "5",
+                            "5\r\nHel",
+                            "5\r\nHello\r\n",
+                            "5\r\nHello\r\n0\r\n",
+                            "5\r\nHello\r\n0\r\nX: y\r\n"};
+    char buffer[256];
+    size_t request_len = 0;
+
+    for (size_t i = 0; i < sizeof(bodies) / sizeof(bodies[0]); i++) {
+        snprintf(buffer, sizeof(buffer), "%s%s", CHUNKED_HEADERS, bodies[i]);
+        TEST_ASSERT_EQUAL(0,
+                          frame_request(buffer, strlen(buffer), &request_len));
+    }
+}
+
+void test_find_request_length_invalid_chunked(void) {
+    size_t request_len = 0;
+
+    // Chunk data that doesn't end with CRLF
+    const char *buffer1 = CHUNKED_HEADERS "3\r\nabcd\r\n0\r\n\r\n";
+    TEST_ASSERT_EQUAL(-1,
+                      frame_request(buffer1, strlen(buffer1), &request_len));
+
+    // A chunk size that isn't hex
+    const char *buffer2 = CHUNKED_HEADERS "xyz\r\n";
+    TEST_ASSERT_EQUAL(-1,
+                      frame_request(buffer2, strlen(buffer2), &request_len));
+
+    // Both framings at once
+    const char *buffer3 = "POST / HTTP/1.1\r\nContent-Length: 5\r\n"
+                          "Transfer-Encoding: chunked\r\n\r\n0\r\n\r\n";
+    TEST_ASSERT_EQUAL(-1,
+                      frame_request(buffer3, strlen(buffer3), &request_len));
+
+    // A transfer coding the server can't decode
+    const char *buffer4 = "POST / HTTP/1.1\r\nTransfer-Encoding: gzip\r\n\r\n";
+    TEST_ASSERT_EQUAL(-4,
+                      frame_request(buffer4, strlen(buffer4), &request_len));
+}
+
+void test_find_request_length_headers_too_large(void) {
+    char buffer[MAX_HEADER_SIZE + 64];
+    size_t request_len = 0;
+
+    // The limit applies before the end of the headers arrives.
+    memset(buffer, 'a', sizeof(buffer));
+    TEST_ASSERT_EQUAL(-2, frame_request(buffer, sizeof(buffer), &request_len));
+
+    snprintf(buffer, sizeof(buffer), "GET / HTTP/1.1\r\nX-Long: %0*d\r\n\r\n",
+             MAX_HEADER_SIZE, 0);
+    TEST_ASSERT_EQUAL(-2, frame_request(buffer, strlen(buffer), &request_len));
+}
+
+void test_find_request_length_body_too_large(void) {
+    char buffer[256];
+    size_t request_len = 0;
+
+    // Content-Length is checked without waiting for the body.
+    snprintf(buffer, sizeof(buffer),
+             "POST / HTTP/1.1\r\nContent-Length: %d\r\n\r\n",
+             MAX_BODY_SIZE + 1);
+    TEST_ASSERT_EQUAL(-3, frame_request(buffer, strlen(buffer), &request_len));
+
+    snprintf(buffer, sizeof(buffer),
+             "POST / HTTP/1.1\r\nContent-Length: %d\r\n\r\n", MAX_BODY_SIZE);
+    TEST_ASSERT_EQUAL(0, frame_request(buffer, strlen(buffer), &request_len));
+
+    snprintf(buffer, sizeof(buffer), CHUNKED_HEADERS "%x\r\n",
+             MAX_BODY_SIZE + 1);
+    TEST_ASSERT_EQUAL(-3, frame_request(buffer, strlen(buffer), &request_len));
+}
+
+// Test decode_chunked_body function
+void test_decode_chunked_body(void) {
+    char body[] = "5\r\nHello\r\n7;ext\r\n, World\r\n0\r\nX: y\r\n\r\n";
+    size_t decoded_len = 0;
+
+    TEST_ASSERT_EQUAL(0, decode_chunked_body(body, strlen(body), &decoded_len));
+    TEST_ASSERT_EQUAL(12, decoded_len);
+    TEST_ASSERT_EQUAL_MEMORY("Hello, World", body, 12);
+}
+
+// Test request_wants_keep_alive function
+void test_request_wants_keep_alive(void) {
+    const char *buffer1 = "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    TEST_ASSERT_TRUE(request_wants_keep_alive(buffer1, strlen(buffer1)));
+
+    const char *buffer2 = "GET / HTTP/1.1\r\nConnection: keep-alive\r\n\r\n";
+    TEST_ASSERT_TRUE(request_wants_keep_alive(buffer2, strlen(buffer2)));
+
+    const char *buffer3 = "GET / HTTP/1.1\r\nConnection: Close\r\n\r\n";
+    TEST_ASSERT_FALSE(request_wants_keep_alive(buffer3, strlen(buffer3)));
+
+    const char *buffer4 = "GET / HTTP/1.1\r\nConnection: TE, close\r\n\r\n";
+    TEST_ASSERT_FALSE(request_wants_keep_alive(buffer4, strlen(buffer4)));
+}
+
+// Test coding_quality function
+void test_coding_quality(void) {
+    const char *value = "gzip, br;q=0.8, zstd;q=0, *;q=0.1";
+    int len = strlen(value);
+
+    TEST_ASSERT_EQUAL(1000, coding_quality(value, len, "gzip"));
+    TEST_ASSERT_EQUAL(800, coding_quality(value, len, "br"));
+    TEST_ASSERT_EQUAL(0, coding_quality(value, len, "zstd"));
+    TEST_ASSERT_EQUAL(100, coding_quality(value, len, "compress"));
+    TEST_ASSERT_EQUAL(1000, coding_quality("GZIP", 4, "gzip"));
+    TEST_ASSERT_EQUAL(0, coding_quality("", 0, "gzip"));
+    TEST_ASSERT_EQUAL(0, coding_quality("gzip;q=x", 8, "gzip"));
+    // A coding name that only starts with another doesn't match.
+    TEST_ASSERT_EQUAL(0, coding_quality("gzipx", 5, "gzip"));
+}
+
+void test_parse_http_date(void) {
+    time_t date;
+    const char *value = "Sun, 06 Nov 1994 08:49:37 GMT";
+    TEST_ASSERT_EQUAL(0, parse_http_date(value, strlen(value), &date));
+    TEST_ASSERT_EQUAL(784111777, date);
+    value = "Thu, 29 Feb 2024 00:00:00 GMT";
+    TEST_ASSERT_EQUAL(0, parse_http_date(value, strlen(value), &date));
+    TEST_ASSERT_EQUAL(1709164800, date);
+
+    // Obsolete formats and garbage are ignored.
+    value = "Sunday, 06-Nov-94 08:49:37 GMT";
+    TEST_ASSERT_EQUAL(-1, parse_http_date(value, strlen(value), &date));
+    value = "Sun, 06 Foo 1994 08:49:37 GMT";
+    TEST_ASSERT_EQUAL(-1, parse_http_date(value, strlen(value), &date));
+    value = "Sun, 06 Nov 1994 25:49:37 GMT";
+    TEST_ASSERT_EQUAL(-1, parse_http_date(value, strlen(value), &date));
+}
+
+void test_etag_list_matches(void) {
+    const char *value = "\"a\", W/\"b\" ,\"c\"";
+    int len = strlen(value);
+
+    TEST_ASSERT_TRUE(etag_list_matches(value, len, "\"a\""));
+    TEST_ASSERT_TRUE(etag_list_matches(value, len, "\"b\""));
+    TEST_ASSERT_TRUE(etag_list_matches(value, len, "\"c\""));
+    TEST_ASSERT_FALSE(etag_list_matches(value, len, "\"d\""));
+    TEST_ASSERT_FALSE(etag_list_matches(value, len, "\"ab\""));
+    TEST_ASSERT_TRUE(etag_list_matches("*", 1, "\"x\""));
+    TEST_ASSERT_FALSE(etag_list_matches("", 0, "\"x\""));
+}
+
+void test_parse_byte_ranges(void) {
+    struct ByteRange ranges[MAX_BYTE_RANGES];
+
+    TEST_ASSERT_EQUAL(1, parse_byte_ranges("bytes=0-4", 9, 10, ranges));
+    TEST_ASSERT_EQUAL(0, ranges[0].first);
+    TEST_ASSERT_EQUAL(4, ranges[0].last);
+
+    // Open ended, suffix, and overlong ranges are clamped to the size.
+    const char *value = "bytes=8-, -3, 5-100";
+    TEST_ASSERT_EQUAL(3, parse_byte_ranges(value, strlen(value), 10, ranges));
+    TEST_ASSERT_EQUAL(8, ranges[0].first);
+    TEST_ASSERT_EQUAL(9, ranges[0].last);
+    TEST_ASSERT_EQUAL(7, ranges[1].first);
+    TEST_ASSERT_EQUAL(9, ranges[1].last);
+    TEST_ASSERT_EQUAL(5, ranges[2].first);
+    TEST_ASSERT_EQUAL(9, ranges[2].last);
+    TEST_ASSERT_EQUAL(1, parse_byte_ranges("bytes=-30", 9, 10, ranges));
+    TEST_ASSERT_EQUAL(0, ranges[0].first);
+
+    // Ranges that start past the end can't be satisfied.
+    TEST_ASSERT_EQUAL(0, parse_byte_ranges("bytes=10-", 9, 10, ranges));
+    TEST_ASSERT_EQUAL(0, parse_byte_ranges("bytes=-0", 8, 10, ranges));
+    TEST_ASSERT_EQUAL(1, parse_byte_ranges("bytes=20-30,1-1", 15, 10, ranges));
+
+    // Invalid headers are ignored.
+    TEST_ASSERT_EQUAL(-1, parse_byte_ranges("items=0-4", 9, 10, ranges));
+    TEST_ASSERT_EQUAL(-1, parse_byte_ranges("bytes=5-2", 9, 10, ranges));
+    TEST_ASSERT_EQUAL(-1, parse_byte_ranges("bytes=a-b", 9, 10, ranges));
+    TEST_ASSERT_EQUAL(-1, parse_byte_ranges("bytes=", 6, 10, ranges));
+    value = "bytes=0-0,1-1,2-2,3-3,4-4,5-5,6-6,7-7,8-8,9-9,0-0,1-1,2-2,3-3,"
+            "4-4,5-5,6-6";
+    TEST_ASSERT_EQUAL(-1, parse_byte_ranges(value, strlen(value), 10, ranges));
+}
+
+void test_parse_headers(void) {
+    struct HeaderField fields[4];
+    const char *headers = "Host: example.com\r\nX-Empty:\r\n"
+                          "Accept:\t text/html \t\r\n\r\n";
+    int count = parse_headers(headers, strlen(headers), fields, 4);
+
+    TEST_ASSERT_EQUAL(3, count);
+    TEST_ASSERT_EQUAL(4, fields[0].name_len);
+    TEST_ASSERT_EQUAL_MEMORY("Host", fields[0].name, 4);
+    TEST_ASSERT_EQUAL(11, fields[0].value_len);
+    TEST_ASSERT_EQUAL_MEMORY("example.com", fields[0].value, 11);
+    TEST_ASSERT_EQUAL(0, fields[1].value_len);
+    TEST_ASSERT_EQUAL(9, fields[2].value_len);
+    TEST_ASSERT_EQUAL_MEMORY("text/html", fields[2].value, 9);
+
+    TEST_ASSERT_EQUAL(0, parse_headers("\r\n", 2, fields, 4));
+
+    // Malformed fields are rejected.
+    headers = "Host : example.com\r\n\r\n";
+    TEST_ASSERT_EQUAL(-1, parse_headers(headers, strlen(headers), fields, 4));
+    headers = "Host: a\r\n folded\r\n\r\n";
+    TEST_ASSERT_EQUAL(-1, parse_headers(headers, strlen(headers), fields, 4));
+    headers = "Host: a\n\r\n";
+    TEST_ASSERT_EQUAL(-1, parse_headers(headers, strlen(headers), fields, 4));
+    headers = "NoColon\r\n\r\n";
+    TEST_ASSERT_EQUAL(-1, parse_headers(headers, strlen(headers), fields, 4));
+    headers = "Host: a\r\n";
+    TEST_ASSERT_EQUAL(-1, parse_headers(headers, strlen(headers), fields, 4));
+
+    // So are more fields than fit.
+    headers = "A: 1\r\nB: 2\r\nC: 3\r\n\r\n";
+    TEST_ASSERT_EQUAL(-1, parse_headers(headers, strlen(headers), fields, 2));
+}
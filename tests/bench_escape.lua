@@ -0,0 +1,66 @@
+-- Template output escaping microbenchmark.
+--
+-- Run from the repository root after building nibiru_core:
+--   LUA_PATH='lua/?.lua;;' LUA_CPATH='lua/?.so;;' lua tests/bench_escape.lua
+--
+-- Each template is rendered with output converted by tostring alone, as before
+-- escaping, and with the Lua and C escape functions.
+local html = require("nibiru.html")
+local Template = require("nibiru.template")
+
+local RENDERS = 200
+
+local native_escape = html.escape
+package.loaded.nibiru_core = nil
+package.preload.nibiru_core = function()
+    error("nibiru_core hidden for the benchmark")
+end
+local lua_escape = dofile("lua/nibiru/html.lua").escape
+
+local escapes = {
+    {
+        "tostring",
+        function(value)
+            return tostring(value or "")
+        end,
+    },
+    { "Lua escape", lua_escape },
+    { "C escape", native_escape },
+}
+
+--- Render a template a number of times and return the microseconds per render.
+local function time(source, context)
+    local template = Template(source)
+    local start = os.clock()
+    for _ = 1, RENDERS do
+        template(context)
+    end
+    return (os.clock() - start) / RENDERS * 1e6
+end
+
+local source = string.rep("<li>{{ item }}</li>", 5000)
+local contexts = {
+    { "5000 clean strings", { item = "an ordinary product name" } },
+    { "5000 strings with markup", { item = 'Tom & Jerry <"special">' } },
+    { "5000 numbers", { item = 12345 } },
+}
+
+print("| Values                   | tostring µs | Lua escape µs | C escape µs |")
+print("|--------------------------|-------------|---------------|-------------|")
+for _, case in ipairs(contexts) do
+    local results = {}
+    for index, escape in ipairs(escapes) do
+        html.escape = escape[2]
+        results[index] = time(source, case[2])
+    end
+    print(
+        string.format(
+            "| %-24s | %11.0f | %13.0f | %11.0f |",
+            case[1],
+            results[1],
+            results[2],
+            results[3]
+        )
+    )
+end
+html.escape = native_escape
@@ -0,0 +1,68 @@
+-- Markdown document cache microbenchmark.
+--
+-- Run from the repository root after building nibiru_core:
+--   LUA_PATH='lua/?.lua;;' LUA_CPATH='lua/?.so;;' lua tests/bench_markdown.lua
+--
+-- A docs page is parsed from scratch, from the content cache, and from the
+-- file cache, which checks the file's modification time on every call.
+local markdown = require("nibiru.markdown")
+
+local section = [[
+## Section
+
+Some **bold** and *italic* text with `inline code`, a [link](https://example.com),
+and a footnote[^note].
+
+- First item with _emphasis_
+- Second item with a [reference](/docs/page)
+- Third item
+
+```lua
+local value = compute(42)
+```
+
+> A quote with **strong** words.
+
+| Name | Value |
+|------|-------|
+| a    | 1     |
+
+[^note]: The footnote text.
+
+]]
+local document = "---\ntitle: Guide\ntags: [lua, docs]\n---\n# Guide\n\n"
+    .. string.rep(section, 20)
+
+local file_path = os.tmpname()
+local file = assert(io.open(file_path, "w"))
+file:write(document)
+file:close()
+
+--- Call a parser a number of times and return the microseconds per call.
+local function time(parse, input, repetitions)
+    local start = os.clock()
+    for _ = 1, repetitions do
+        assert(parse(input))
+    end
+    return (os.clock() - start) / repetitions * 1e6
+end
+
+print(string.format("Document of %d bytes", #document))
+print("| Call                   | µs per call |")
+print("|------------------------|-------------|")
+print(string.format("| %-22s | %11.1f |", "markdown.parse", time(markdown.parse, document, 50)))
+print(
+    string.format(
+        "| %-22s | %11.1f |",
+        "markdown.parse_cached",
+        time(markdown.parse_cached, document, 20000)
+    )
+)
+print(
+    string.format(
+        "| %-22s | %11.1f |",
+        "markdown.parse_file",
+        time(markdown.parse_file, file_path, 20000)
+    )
+)
+os.remove(file_path)
@@ -0,0 +1,67 @@
+-- Route dispatch microbenchmark.
+--
+-- Run from the repository root after building nibiru_core:
+--   LUA_PATH='lua/?.lua;;' LUA_CPATH='lua/?.so;;' lua tests/bench_router.lua
+--
+-- Each matcher resolves a route and its converted parameters for the first,
+-- middle, and last route of tables with 10, 100, and 1000 routes.
+local Route = require("nibiru.route")
+local Router = require("nibiru.router")
+
+local LOOKUPS = 200000
+
+--- The matcher from before the router: try every route's pattern in order,
+--- then match again to pull out the parameters.
+local function linear(routes, method, path)
+    for _, route in ipairs(routes) do
+        local match = route:matches(method, path)
+        if match ~= Route.NO_MATCH then
+            local raw = table.pack(string.match(path, route.path_pattern))
+            return match, route, math.tointeger(raw[1])
+        end
+    end
+    return Route.NO_MATCH, nil
+end
+
+--- Time a number of calls and return the nanoseconds per call.
+local function time(call, method, path)
+    local start = os.clock()
+    for _ = 1, LOOKUPS do
+        call(method, path)
+    end
+    return (os.clock() - start) / LOOKUPS * 1e9
+end
+
+print("| Routes | Path                        | Linear ns | Lua tree ns | C ns  |")
+print("|--------|-----------------------------|-----------|-------------|-------|")
+for _, count in ipairs({ 10, 100, 1000 }) do
+    local routes = {}
+    for i = 1, count do
+        routes[i] = Route("/section" .. i .. "/items/{id:integer}", function() end)
+    end
+    local lua_router = Router(routes, false)
+    local native_router = Router(routes)
+
+    for _, section in ipairs({ 1, count // 2, count }) do
+        local path = "/section" .. section .. "/items/42"
+        local linear_ns = time(function(method, target)
+            return linear(routes, method, target)
+        end, "GET", path)
+        local lua_ns = time(function(method, target)
+            return lua_router:match(method, target)
+        end, "GET", path)
+        local native_ns = time(function(method, target)
+            return native_router:match(method, target)
+        end, "GET", path)
+        print(
+            string.format(
+                "| %-6d | %-27s | %9.0f | %11.0f | %5.0f |",
+                count,
+                "`" .. path .. "`",
+                linear_ns,
+                lua_ns,
+                native_ns
+            )
+        )
+    end
+end
@@ -0,0 +1,46 @@
+-- Template tokenizer microbenchmark.
+--
+-- Run from the repository root after building nibiru_core:
+--   LUA_PATH='lua/?.lua;;' LUA_CPATH='lua/?.so;;' lua tests/bench_tokenizer.lua
+--
+-- Each template is tokenized by the Lua tokenizer and by the C one.
+local Tokenizer = require("nibiru.tokenizer")
+
+--- Tokenize a template a number of times and return the milliseconds per call.
+local function time(template, native, repetitions)
+    local start = os.clock()
+    for _ = 1, repetitions do
+        Tokenizer.tokenize(template, native)
+    end
+    return (os.clock() - start) / repetitions * 1000
+end
+
+local row = '<div class="row"><a href="{{ item.url }}">{{ item.name |> upper }}</a>'
+    .. '{% if item.active %}<Badge label="on"/>{% endif %}</div>\n'
+local templates = {
+    { "Page of 200 rows", string.rep(row, 200), 50 },
+    {
+        "5000 expressions, then a statement",
+        string.rep("{{ x }}", 5000) .. "{% if y %}",
+        5,
+    },
+    {
+        "100 KB of markup without tags",
+        string.rep("<p>plain paragraph of markup with no tags at all</p>\n", 2000),
+        50,
+    },
+}
+
+print("| Template                           | Lua ms   | C ms   |")
+print("|------------------------------------|----------|--------|")
+for _, case in ipairs(templates) do
+    local name, template, repetitions = case[1], case[2], case[3]
+    print(
+        string.format(
+            "| %-34s | %8.2f | %6.2f |",
+            name,
+            time(template, false, repetitions),
+            time(template, true, repetitions)
+        )
+    )
+end
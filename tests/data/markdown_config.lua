@@ -0,0 +1,9 @@
+return {
+    templates = {
+        directory = "tests/data/test_templates"
+    },
+    markdown = {
+        directory = "tests/data/markdown",
+        cache_size = 65536
+    }
+}
\ No newline at end of file
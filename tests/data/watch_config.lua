@@ -0,0 +1,6 @@
+return {
+    templates = {
+        directory = "tests/data/test_templates",
+        watch = true
+    }
+}
\ No newline at end of file
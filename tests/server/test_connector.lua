@@ -29,4 +29,191 @@ function tests.test_valid_connection()
     assert.truthy(string.find(response, "Hello, World!"))
 end
 
+-- The response is framed with Content-Length so connections can be reused.
+function tests.test_content_length()
+    local application = function(environ, start_response)
+        start_response("200 OK", {})
+        return ipairs({ "Hello, ", "World!" })
+    end
+
+    local response = connector.handle_connection(application, "GET", "/", "HTTP/1.1", "\r\n", true)
+
+    assert.equal("HTTP/1.1 200 OK\r\nContent-Length: 13\r\n\r\nHello, World!", response)
+end
+
+-- A connection that will close announces it to the client.
+function tests.test_connection_close()
+    local application = function(environ, start_response)
+        start_response("200 OK", {})
+        return ipairs({ "Bye" })
+    end
+
+    local response = connector.handle_connection(application, "GET", "/", "HTTP/1.1", "\r\n", false)
+
+    assert.truthy(string.find(response, "Connection: close\r\n", 1, true))
+end
+
+-- A prebuilt environ gets the body as wsgi.input.
+function tests.test_handle_environ()
+    local application = function(environ, start_response)
+        start_response("200 OK", {})
+        return ipairs({ environ["wsgi.input"]:read() })
+    end
+
+    local environ = { REQUEST_METHOD = "POST", PATH_INFO = "/" }
+    local response = connector.handle_environ(application, environ, "echo", true)
+
+    assert.equal("HTTP/1.1 200 OK\r\nContent-Length: 4\r\n\r\necho", response)
+end
+
+-- Large responses stream with chunked transfer encoding.
+function tests.test_streams_large_response()
+    local big = string.rep("x", 10000)
+    local application = function(environ, start_response)
+        start_response("200 OK", { ["Content-Type"] = "text/plain" })
+        return ipairs({ big, big, "tail" })
+    end
+    local calls = {}
+    local respond = function(status, headers, content_length, ...)
+        table.insert(calls, { status, headers, content_length, { ... } })
+        return true
+    end
+    local write = function(...)
+        table.insert(calls, { ... })
+        return true
+    end
+
+    local environ = { REQUEST_METHOD = "GET", PATH_INFO = "/" }
+    local result =
+        connector.handle_environ(application, environ, "", true, respond, write)
+
+    assert.is_nil(result)
+    assert.equal(2, #calls)
+    -- The chunks reach the server as separate pieces.
+    assert.equal("200 OK", calls[1][1])
+    assert.same({ ["Content-Type"] = "text/plain" }, calls[1][2])
+    assert.is_nil(calls[1][3])
+    assert.same({ "4e20\r\n", big, big, "\r\n" }, calls[1][4])
+    assert.same({ "4\r\n", "tail", "\r\n", "0\r\n\r\n" }, calls[2])
+end
+
+-- A failed write stops pulling chunks from the application.
+function tests.test_stops_after_failed_write()
+    local pulled = 0
+    local application = function(environ, start_response)
+        start_response("200 OK", {})
+        return function()
+            pulled = pulled + 1
+            if pulled <= 5 then
+                return pulled, string.rep("x", 20000)
+            end
+        end
+    end
+    local fail = function()
+        return false
+    end
+
+    local environ = { REQUEST_METHOD = "GET", PATH_INFO = "/" }
+    connector.handle_environ(application, environ, "", true, fail, fail)
+
+    assert.equal(1, pulled)
+end
+
+-- Response headers are serialized ahead of the framing the server adds.
+function tests.test_response_headers()
+    local application = function(environ, start_response)
+        start_response("200 OK", {
+            ["Content-Type"] = "text/html",
+            ["Set-Cookie"] = { "a=1", "b=2" },
+            ["Content-Length"] = "999",
+        })
+        return ipairs({ "Hi" })
+    end
+
+    local response = connector.handle_connection(application, "GET", "/", "HTTP/1.1", "\r\n")
+
+    assert.equal(
+        "HTTP/1.1 200 OK\r\nContent-Type: text/html\r\nSet-Cookie: a=1\r\n"
+            .. "Set-Cookie: b=2\r\nContent-Length: 2\r\n\r\nHi",
+        response
+    )
+end
+
+-- HEAD responses keep their framing headers but drop the body.
+function tests.test_head_has_no_body()
+    local application = function(environ, start_response)
+        start_response("200 OK", {})
+        return ipairs({ "Hello" })
+    end
+
+    local environ = { REQUEST_METHOD = "HEAD", PATH_INFO = "/" }
+    local response = connector.handle_environ(application, environ, "", true)
+
+    assert.equal("HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\n", response)
+end
+
+-- A response paused while a slow client catches up doesn't hold up another
+-- request, and neither one's body or input leaks into the other's.
+function tests.test_paused_response_does_not_block_others()
+    local chunk = string.rep("a", 20000)
+    local slow_application = function(environ, start_response)
+        start_response("200 OK", {})
+        local count = 0
+        return function()
+            count = count + 1
+            if count <= 3 then
+                return count, chunk
+            elseif count == 4 then
+                -- Read after the pause, once the other request has run.
+                return count, environ["wsgi.input"]:read()
+            end
+        end
+    end
+    local fast_application = function(environ, start_response)
+        start_response("201 Created", {})
+        return ipairs({ "hi ", environ["wsgi.input"]:read() })
+    end
+
+    --- Run a request in a coroutine the way the server does. Writes to a
+    --- slow client yield until the test resumes them.
+    local function serve(application, body, slow, output)
+        local write = function(...)
+            for i = 1, select("#", ...) do
+                table.insert(output, (select(i, ...)))
+            end
+            if slow then
+                coroutine.yield()
+            end
+            return true
+        end
+        local respond = function(status, _, _, ...)
+            table.insert(output, status .. "|")
+            return write(...)
+        end
+        return coroutine.create(function()
+            local environ = { REQUEST_METHOD = "GET" }
+            connector.handle_environ(application, environ, body, true, respond, write)
+        end)
+    end
+
+    local slow_output, fast_output = {}, {}
+    local slow = serve(slow_application, "slow body", true, slow_output)
+    assert.is_true(coroutine.resume(slow))
+    assert.equal("suspended", coroutine.status(slow))
+
+    local fast = serve(fast_application, "fast body", false, fast_output)
+    assert.is_true(coroutine.resume(fast))
+    assert.equal("dead", coroutine.status(fast))
+    assert.equal("201 Created|hi fast body", table.concat(fast_output))
+
+    while coroutine.status(slow) ~= "dead" do
+        assert.is_true(coroutine.resume(slow))
+    end
+    local framed = "4e20\r\n" .. chunk .. "\r\n"
+    assert.equal(
+        "200 OK|" .. framed:rep(3) .. "9\r\nslow body\r\n0\r\n\r\n",
+        table.concat(slow_output)
+    )
+end
+
 return tests
@@ -23,6 +23,53 @@ function tests.test_valid_request()
     assert.equal("HTTP/1.1", environ.SERVER_PROTOCOL)
 end
 
+-- Header fields become CGI style environ variables.
+function tests.test_headers()
+    local data = "Host: example.com\r\nContent-Type: text/plain\r\n"
+        .. "Content-Length: 5\r\nX-Forwarded-For:  10.0.0.1 \r\n"
+        .. "Accept: text/html\r\naccept: text/plain\r\nX_Spoofed: 1\r\n\r\nhello"
+
+    local environ = parser.parse("POST", "/submit", "HTTP/1.1", data)
+
+    assert.equal("example.com", environ.HTTP_HOST)
+    assert.equal("text/plain", environ.CONTENT_TYPE)
+    assert.equal("5", environ.CONTENT_LENGTH)
+    assert.equal("10.0.0.1", environ.HTTP_X_FORWARDED_FOR)
+    assert.equal("text/html,text/plain", environ.HTTP_ACCEPT)
+    assert.is_nil(environ.HTTP_X_SPOOFED)
+    assert.equal("hello", environ["wsgi.input"]:read())
+end
+
+-- The query string is split from the path.
+function tests.test_query_string()
+    local environ = parser.parse("GET", "/search?q=lua&page=2", "HTTP/1.1", "\r\n")
+
+    assert.equal("/search", environ.PATH_INFO)
+    assert.equal("q=lua&page=2", environ.QUERY_STRING)
+
+    environ = parser.parse("GET", "/", "HTTP/1.1", "\r\n")
+    assert.equal("", environ.QUERY_STRING)
+end
+
+-- wsgi.input reads the body in pieces.
+function tests.test_input()
+    local input = parser.Input("first\nsecond")
+
+    assert.equal("fi", input:read(2))
+    assert.equal("rst\n", input:readline())
+    assert.equal("second", input:readline())
+    assert.equal("", input:read())
+end
+
+-- wsgi.input resets to a new body for reuse.
+function tests.test_input_reset()
+    local input = parser.Input("first")
+    input:read()
+
+    assert.equal(input, input:reset("second"))
+    assert.equal("second", input:read())
+end
+
 -- Parser now only accepts pre-validated inputs, so error tests are removed
 -- (validation is done in C)
 
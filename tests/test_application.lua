@@ -1,6 +1,8 @@
 local assert = require("luassert")
 local Application = require("nibiru.application")
 local http = require("nibiru.http")
+local markdown = require("nibiru.markdown")
+local TemplateLoader = require("nibiru.loader")
 local Route = require("nibiru.route")
 local Template = require("nibiru.template")
 
@@ -34,7 +36,7 @@ function tests.test_app_is_wsgi_callable()
 
     assert.is_true(start_response_called)
     assert.equal("200 OK", actual_status)
-    assert.same({}, actual_response_headers)
+    assert.same({ ["Content-Type"] = "text/html" }, actual_response_headers)
 end
 
 -- The app finds routes.
@@ -74,6 +76,97 @@ function tests.test_config_and_template_loading()
     assert.equal("tests/data/test_templates", app.config.templates.directory)
 end
 
+-- The app sizes the markdown cache and warms it from the configured directory
+function tests.test_markdown_warming()
+    Template.clear_templates()
+    markdown.cache:clear()
+    local max_bytes = markdown.cache.max_bytes
+    Application(nil, "tests/data/markdown_config.lua")
+
+    assert.equal(65536, markdown.cache.max_bytes)
+    local bytes = markdown.cache.bytes
+    assert.is_true(bytes > 0)
+    local result = markdown.parse_file("tests/data/markdown/index.md")
+    assert.equal("Welcome", result.frontmatter.title)
+    assert.equal(bytes, markdown.cache.bytes)
+
+    markdown.cache:resize(max_bytes)
+    markdown.cache:clear()
+end
+
+--- Replace TemplateLoader.watch with one that fails and count its calls.
+local function with_failing_watch(callback)
+    local watch = TemplateLoader.watch
+    local calls = 0
+    TemplateLoader.watch = function()
+        calls = calls + 1
+        error("Watching directories is only supported on Linux")
+    end
+    local ok, err = pcall(callback, function()
+        return calls
+    end)
+    TemplateLoader.watch = watch
+    if not ok then
+        error(err, 0)
+    end
+end
+
+-- Watching templates where it isn't supported stops the app from starting
+function tests.test_watch_unsupported_fails_startup()
+    Template.clear_templates()
+    with_failing_watch(function()
+        local ok, err = pcall(Application, nil, "tests/data/watch_config.lua")
+        assert.is_false(ok)
+        assert.match("templates.watch is enabled but templates can't be watched", err)
+    end)
+end
+
+-- A worker that can't make its watcher stops trying instead of failing requests
+function tests.test_watch_failure_in_worker_is_not_retried()
+    Template.clear_templates()
+    local app = Application(nil, "tests/data/watch_config.lua")
+    local stderr = io.stderr
+    io.stderr = { write = function() end }
+    local ok, err = pcall(with_failing_watch, function(calls)
+        app:reload_templates()
+        app:reload_templates()
+        assert.equal(1, calls())
+    end)
+    io.stderr = stderr
+    assert.is_true(ok, err)
+end
+
+-- A template edited after startup but before a worker's first request is
+-- picked up by that request.
+function tests.test_watch_catches_up_on_first_request()
+    Template.clear_templates()
+    local directory = os.tmpname()
+    os.remove(directory)
+    os.execute("mkdir -p " .. directory)
+    local file = assert(io.open(directory .. "/page.html", "w"))
+    file:write("Old")
+    file:close()
+    local config_path = directory .. "_config.lua"
+    file = assert(io.open(config_path, "w"))
+    file:write(string.format(
+        "return { templates = { directory = %q, watch = true } }",
+        directory
+    ))
+    file:close()
+
+    local app = Application(nil, config_path)
+    file = assert(io.open(directory .. "/page.html", "w"))
+    file:write("New")
+    file:close()
+    app:reload_templates()
+
+    assert.equal("New", Template.render("page.html").content)
+    app.template_watcher:close()
+    os.execute("rm -rf " .. directory)
+    os.remove(config_path)
+    Template.clear_templates()
+end
+
 -- The app maintains a lookup table of routes by name.
 function tests.test_route_name_lookup()
     Template.clear_templates()
@@ -188,4 +281,55 @@ function tests.test_url_for_multiple_parameters()
     assert.equal("/blog/2024/12/my-article", app:url_for("blog_post", 2024, 12, "my-article"))
 end
 
+-- The app reuses one request and headers table across calls.
+function tests.test_app_reuses_request()
+    Template.clear_templates()
+    local requests = {}
+    local headers = {}
+    local start_response = function(_, response_headers)
+        table.insert(headers, response_headers)
+    end
+    local app = Application({ Route("/", function(request)
+        table.insert(requests, request)
+        return http.ok("hello")
+    end, nil, { "GET", "POST" }) }, "tests/data/config.lua")
+
+    local iterator, state, initial =
+        app({ REQUEST_METHOD = "GET", PATH_INFO = "/" }, start_response)
+    app({ REQUEST_METHOD = "POST", PATH_INFO = "/" }, start_response)
+
+    assert.equal(requests[1], requests[2])
+    assert.equal("POST", requests[2].method)
+    assert.equal(headers[1], headers[2])
+    local chunks = {}
+    for _, chunk in iterator, state, initial do
+        table.insert(chunks, chunk)
+    end
+    assert.same({ "hello" }, chunks)
+end
+
+-- A streamed response's chunks are the body the app returns.
+function tests.test_app_returns_stream()
+    Template.clear_templates()
+    local app = Application({ Route("/", function()
+        local chunks = { "one", "two" }
+        local index = 0
+        local response = http.ok()
+        response.stream = function()
+            index = index + 1
+            if chunks[index] then
+                return index, chunks[index]
+            end
+        end
+        return response
+    end) }, "tests/data/config.lua")
+
+    local chunks = {}
+    for _, chunk in app({ REQUEST_METHOD = "GET", PATH_INFO = "/" }, function() end) do
+        table.insert(chunks, chunk)
+    end
+
+    assert.same({ "one", "two" }, chunks)
+end
+
 return tests
@@ -166,6 +166,149 @@ return {
     os.remove(temp_file)
 end
 
+-- Test config validation - templates.cache_directory must be a string
+function tests.test_config_validation_invalid_cache_directory()
+    local temp_file = "/tmp/test_config_cache_dir_"
+        .. tostring(os.time())
+        .. "_"
+        .. tostring(math.random(10000))
+        .. ".lua"
+    local file = io.open(temp_file, "w")
+    assert(file, "Failed to create temp file")
+    file:write([[
+return {
+    templates = {
+        cache_directory = 123  -- Should be a string
+    }
+}
+]])
+    file:close()
+
+    local success, err = pcall(function()
+        return Config.load(temp_file)
+    end)
+
+    assert.is_false(success, "Config with invalid cache directory should fail validation")
+    assert.is_not_nil(string.find(err, "templates.cache_directory must be a non-empty string", 1, true))
+
+    os.remove(temp_file)
+end
+
+-- Test config validation - templates.watch must be a boolean
+function tests.test_config_validation_invalid_watch()
+    local temp_file = "/tmp/test_config_watch_"
+        .. tostring(os.time())
+        .. "_"
+        .. tostring(math.random(10000))
+        .. ".lua"
+    local file = io.open(temp_file, "w")
+    assert(file, "Failed to create temp file")
+    file:write([[
+return {
+    templates = {
+        watch = "yes"  -- Should be a boolean
+    }
+}
+]])
+    file:close()
+
+    local success, err = pcall(function()
+        return Config.load(temp_file)
+    end)
+
+    assert.is_false(success, "Config with invalid watch setting should fail validation")
+    assert.is_not_nil(string.find(err, "templates.watch must be a boolean", 1, true))
+
+    os.remove(temp_file)
+end
+
+-- Test config validation - templates.fragment_cache_size must be a positive integer
+function tests.test_config_validation_invalid_fragment_cache_size()
+    local temp_file = "/tmp/test_config_fragments_"
+        .. tostring(os.time())
+        .. "_"
+        .. tostring(math.random(10000))
+        .. ".lua"
+    local file = io.open(temp_file, "w")
+    assert(file, "Failed to create temp file")
+    file:write([[
+return {
+    templates = {
+        fragment_cache_size = 0  -- Should be positive
+    }
+}
+]])
+    file:close()
+
+    local success, err = pcall(function()
+        return Config.load(temp_file)
+    end)
+
+    assert.is_false(success, "Config with invalid fragment cache size should fail validation")
+    assert.is_not_nil(
+        string.find(err, "templates.fragment_cache_size must be a positive integer", 1, true)
+    )
+
+    os.remove(temp_file)
+end
+
+-- Test config validation - markdown.cache_size must be a positive integer
+function tests.test_config_validation_invalid_markdown_cache_size()
+    local temp_file = "/tmp/test_config_markdown_"
+        .. tostring(os.time())
+        .. "_"
+        .. tostring(math.random(10000))
+        .. ".lua"
+    local file = io.open(temp_file, "w")
+    assert(file, "Failed to create temp file")
+    file:write([[
+return {
+    markdown = {
+        cache_size = 1.5  -- Should be an integer
+    }
+}
+]])
+    file:close()
+
+    local success, err = pcall(function()
+        return Config.load(temp_file)
+    end)
+
+    assert.is_false(success, "Config with invalid markdown cache size should fail validation")
+    assert.is_not_nil(string.find(err, "markdown.cache_size must be a positive integer", 1, true))
+
+    os.remove(temp_file)
+end
+
+-- Test config validation - unknown keys in the markdown section fail
+function tests.test_config_validation_unknown_markdown_key()
+    local temp_file = "/tmp/test_config_markdown_key_"
+        .. tostring(os.time())
+        .. "_"
+        .. tostring(math.random(10000))
+        .. ".lua"
+    local file = io.open(temp_file, "w")
+    assert(file, "Failed to create temp file")
+    file:write([[
+return {
+    markdown = {
+        directory = "content",
+        extensions = { ".md" }
+    }
+}
+]])
+    file:close()
+
+    local success, err = pcall(function()
+        return Config.load(temp_file)
+    end)
+
+    assert.is_false(success, "Config with unknown markdown setting should fail validation")
+    assert.is_not_nil(string.find(err, "unknown markdown setting 'extensions'", 1, true))
+
+    os.remove(temp_file)
+end
+
 -- Test loading config with partial settings (should merge with defaults)
 function tests.test_load_partial_config()
     -- Create a config file with only some settings
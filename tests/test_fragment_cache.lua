@@ -0,0 +1,86 @@
+local assert = require("luassert")
+local FragmentCache = require("nibiru.fragment_cache")
+
+local tests = {}
+
+--- A clock that only moves when the test sets it.
+local function fake_clock()
+    local clock = { now = 1000 }
+    function clock.time()
+        return clock.now
+    end
+    return clock
+end
+
+-- Stored fragments are returned until they are replaced
+function tests.test_get_and_set()
+    local cache = FragmentCache(1024)
+
+    assert.is_nil(cache:get("nav"))
+    cache:set("nav", "<nav>1</nav>")
+    assert.equal("<nav>1</nav>", cache:get("nav"))
+    cache:set("nav", "<nav>2</nav>")
+    assert.equal("<nav>2</nav>", cache:get("nav"))
+    assert.equal(#"nav" + #"<nav>2</nav>", cache.bytes)
+end
+
+-- A fragment expires once its time to live has passed
+function tests.test_ttl()
+    local clock = fake_clock()
+    local cache = FragmentCache(1024, clock.time)
+    cache:set("short", "a", 10)
+    cache:set("forever", "b")
+
+    clock.now = 1009
+    assert.equal("a", cache:get("short"))
+    clock.now = 1010
+    assert.is_nil(cache:get("short"))
+    assert.equal(#"forever" + 1, cache.bytes)
+    clock.now = 100000
+    assert.equal("b", cache:get("forever"))
+end
+
+-- The least recently used fragments are dropped to stay within the size
+function tests.test_lru_eviction()
+    local cache = FragmentCache(30)
+    cache:set("a", string.rep("a", 9))
+    cache:set("b", string.rep("b", 9))
+    cache:set("c", string.rep("c", 9))
+
+    -- Reading a makes b the least recently used.
+    assert.is_not_nil(cache:get("a"))
+    cache:set("d", string.rep("d", 9))
+
+    assert.is_nil(cache:get("b"))
+    assert.is_not_nil(cache:get("a"))
+    assert.is_not_nil(cache:get("c"))
+    assert.is_not_nil(cache:get("d"))
+    assert.equal(30, cache.bytes)
+end
+
+-- A fragment larger than the cache isn't stored
+function tests.test_oversized_fragment()
+    local cache = FragmentCache(10)
+    cache:set("small", "x")
+    cache:set("big", string.rep("x", 10))
+
+    assert.is_nil(cache:get("big"))
+    assert.equal("x", cache:get("small"))
+end
+
+-- Shrinking the cache evicts, and clearing it drops everything
+function tests.test_resize_and_clear()
+    local cache = FragmentCache(100)
+    cache:set("a", "1234")
+    cache:set("b", "1234")
+
+    cache:resize(5)
+    assert.is_nil(cache:get("a"))
+    assert.equal("1234", cache:get("b"))
+
+    cache:clear()
+    assert.is_nil(cache:get("b"))
+    assert.equal(0, cache.bytes)
+end
+
+return tests
@@ -0,0 +1,176 @@
+local assert = require("luassert")
+local html = require("nibiru.html")
+local builtin_filters = require("nibiru.builtin_filters")
+local Template = require("nibiru.template")
+
+local tests = {}
+
+--- Load a module from its file with nibiru_core hidden, to get the Lua
+--- versions of its functions.
+local function load_without_core(path)
+    local core = package.loaded.nibiru_core
+    package.loaded.nibiru_core = nil
+    package.preload.nibiru_core = function()
+        error("nibiru_core hidden for the test")
+    end
+    local ok, module = pcall(dofile, path)
+    package.preload.nibiru_core = nil
+    package.loaded.nibiru_core = core
+    assert.is_true(ok)
+    return module
+end
+
+local lua_html = load_without_core("lua/nibiru/html.lua")
+local lua_filters = load_without_core("lua/nibiru/builtin_filters.lua")
+
+local ESCAPE_CASES = {
+    "",
+    "plain text with no specials",
+    "<script>alert('x')</script>",
+    'a "quoted" & <tagged> value',
+    "&&&<<<>>>'''\"\"\"",
+    string.rep("x", 40) .. "<" .. string.rep("y", 40),
+    "embedded\0nul & more",
+}
+
+local ESCAPE_VALUES = { nil, false, true, 0, 42, 3.5, -7 }
+
+-- Escaping
+
+function tests.test_escape_specials()
+    assert.equal(
+        "&lt;a href=&quot;x&quot;&gt;Tom &amp; Jerry&#39;s&lt;/a&gt;",
+        html.escape('<a href="x">Tom & Jerry\'s</a>')
+    )
+end
+
+function tests.test_escape_empty_values()
+    assert.equal("", html.escape(nil))
+    assert.equal("", html.escape(false))
+    assert.equal("", html.escape(""))
+end
+
+function tests.test_escape_converts_values()
+    assert.equal("true", html.escape(true))
+    assert.equal("42", html.escape(42))
+    assert.equal("3.5", html.escape(3.5))
+end
+
+function tests.test_escape_uses_tostring()
+    local value = setmetatable({}, {
+        __tostring = function()
+            return "<b>"
+        end,
+    })
+    assert.equal("&lt;b&gt;", html.escape(value))
+end
+
+function tests.test_escape_leaves_safe_strings()
+    assert.equal("<b>bold</b>", html.escape(html.safe("<b>bold</b>")))
+end
+
+function tests.test_safe_tostring()
+    local value = html.safe("<i>")
+    assert.equal("<i>", tostring(value))
+    assert.equal(value, html.safe(value))
+    assert.equal("", tostring(html.safe(nil)))
+end
+
+function tests.test_lua_and_native_escape_agree()
+    for _, text in ipairs(ESCAPE_CASES) do
+        assert.equal(lua_html.escape(text), html.escape(text))
+    end
+    for i = 1, #ESCAPE_VALUES + 1 do
+        local value = ESCAPE_VALUES[i]
+        assert.equal(lua_html.escape(value), html.escape(value))
+    end
+end
+
+-- String filters
+
+function tests.test_lua_and_native_filters_agree()
+    local texts = {
+        "",
+        "hello world",
+        "HeLLo WoRlD",
+        "it's a multi-word_title 2nd edition",
+        "  leading and trailing  ",
+    }
+    for _, name in ipairs({ "uppercase", "lowercase", "capitalize" }) do
+        for _, text in ipairs(texts) do
+            assert.equal(lua_filters[name](text), builtin_filters[name](text))
+        end
+    end
+    for _, length in ipairs({ 0, 3, 5, 100, 4.0 }) do
+        assert.equal(
+            lua_filters.truncate("hello world", length),
+            builtin_filters.truncate("hello world", length)
+        )
+    end
+end
+
+function tests.test_lua_and_native_filter_errors_agree()
+    local cases = {
+        { "uppercase", 42 },
+        { "lowercase", {} },
+        { "capitalize", nil },
+        { "truncate", true, 3 },
+        { "truncate", "text", -1 },
+        { "truncate", "text", 1.5 },
+        { "truncate", "text", "3" },
+    }
+    for _, case in ipairs(cases) do
+        local name = case[1]
+        local lua_ok, lua_err = pcall(lua_filters[name], case[2], case[3])
+        local ok, err = pcall(builtin_filters[name], case[2], case[3])
+        assert.is_false(lua_ok)
+        assert.is_false(ok)
+        assert.equal(lua_err:gsub("^.-:%d+: ", ""), err:gsub("^.-:%d+: ", ""))
+    end
+end
+
+-- Template output
+
+function tests.test_template_escapes_output()
+    local template = Template("<p>{{ text }}</p>")
+    assert.equal("<p>&lt;em&gt;hi&lt;/em&gt;</p>", template({ text = "<em>hi</em>" }))
+end
+
+function tests.test_template_escapes_filter_output()
+    local template = Template("{{ text |> uppercase }}")
+    assert.equal("&lt;EM&gt;", template({ text = "<em>" }))
+end
+
+function tests.test_template_escapes_attributes()
+    Template.component("Link", [[<a title="{{ title }}">x</a>]])
+    local template = Template([[<Link title=page.title />]])
+    assert.equal(
+        '<a title="&quot;quoted&quot;">x</a>',
+        template({ page = { title = '"quoted"' } })
+    )
+    Template.clear_components()
+end
+
+function tests.test_template_safe_filter()
+    local template = Template("<div>{{ body |> safe }}</div>")
+    assert.equal("<div><p>hi</p></div>", template({ body = "<p>hi</p>" }))
+end
+
+function tests.test_template_safe_values()
+    local template = Template("<div>{{ body }}</div>")
+    assert.equal("<div><p>hi</p></div>", template({ body = html.safe("<p>hi</p>") }))
+end
+
+function tests.test_template_safe_survives_clear_filters()
+    Template.clear_filters()
+    local template = Template("{{ body |> safe }}")
+    assert.equal("<br>", template({ body = "<br>" }))
+    Template.clear_filters()
+    for name, filter_func in pairs(builtin_filters) do
+        if name ~= "safe" then
+            Template.register_filter(name, filter_func)
+        end
+    end
+end
+
+return tests
@@ -19,6 +19,19 @@ function tests.test_request_with_arguments()
     assert.equal("/users", request.path)
 end
 
+-- A request resets in place for reuse.
+function tests.test_request_reset()
+    local request = http.Request("POST", "/users")
+    request.user = "matt"
+
+    local reset = request:reset("GET", "/other")
+
+    assert.equal(request, reset)
+    assert.equal("GET", request.method)
+    assert.equal("/other", request.path)
+    assert.is_nil(request.user)
+end
+
 -- get is a shortcut to create a GET request.
 function tests.test_get()
     local request = http.get("/users")
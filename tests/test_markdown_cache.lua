@@ -0,0 +1,124 @@
+local assert = require("luassert")
+local markdown = require("nibiru.markdown")
+
+local tests = {}
+
+--- Make an empty temporary directory.
+local function temp_directory()
+    local directory = "/tmp/nibiru_markdown_"
+        .. tostring(os.time())
+        .. "_"
+        .. tostring(math.random(100000))
+    os.execute("mkdir -p " .. directory)
+    return directory
+end
+
+--- Write a file, replacing its content.
+local function write(file_path, content)
+    local file = assert(io.open(file_path, "w"))
+    file:write(content)
+    file:close()
+end
+
+function tests.test_parse_cached_reuses_result()
+    markdown.cache:clear()
+    local first = markdown.parse_cached("# Title\n\nBody")
+    local second = markdown.parse_cached("# Title\n\nBody")
+    assert.equal(first, second)
+    assert.equal("<h1>Title</h1>\n<p>Body</p>", first.html)
+end
+
+function tests.test_parse_cached_keys_by_content()
+    markdown.cache:clear()
+    local first = markdown.parse_cached("# One")
+    local second = markdown.parse_cached("# Two")
+    assert.is_true(first ~= second)
+    assert.equal("<h1>Two</h1>", second.html)
+end
+
+function tests.test_parse_cached_errors_are_not_cached()
+    markdown.cache:clear()
+    local result, err = markdown.parse_cached("---\ntitle: x\n")
+    assert.is_nil(result)
+    assert.equal("missing closing", err)
+    assert.equal(0, markdown.cache.bytes)
+
+    result, err = markdown.parse_cached(42)
+    assert.is_nil(result)
+    assert.equal("expected string", err)
+end
+
+function tests.test_parse_file_reuses_until_changed()
+    markdown.cache:clear()
+    local directory = temp_directory()
+    local file_path = directory .. "/page.md"
+    write(file_path, "---\ntitle: First\n---\n# First")
+
+    local first = markdown.parse_file(file_path)
+    assert.equal("First", first.frontmatter.title)
+    assert.equal(first, markdown.parse_file(file_path))
+
+    -- A different size is a change even within the same clock tick.
+    write(file_path, "---\ntitle: Second\n---\n# Second")
+    local second = markdown.parse_file(file_path)
+    assert.equal("Second", second.frontmatter.title)
+    assert.equal("<h1>Second</h1>", second.html)
+
+    os.execute("rm -rf " .. directory)
+end
+
+function tests.test_parse_file_missing()
+    local result, err = markdown.parse_file("/tmp/nonexistent_markdown_12345.md")
+    assert.is_nil(result)
+    assert.is_not_nil(err)
+end
+
+function tests.test_cache_size_is_bounded()
+    markdown.cache:clear()
+    local max_bytes = markdown.cache.max_bytes
+    markdown.cache:resize(1024)
+    for i = 1, 50 do
+        markdown.parse_cached("# Document " .. i .. "\n\n" .. string.rep("text ", 20))
+    end
+    assert.is_true(markdown.cache.bytes <= 1024)
+    markdown.cache:resize(max_bytes)
+    markdown.cache:clear()
+end
+
+function tests.test_warm_parses_markdown_files()
+    markdown.cache:clear()
+    local directory = temp_directory()
+    os.execute("mkdir -p " .. directory .. "/guides")
+    write(directory .. "/index.md", "# Home")
+    write(directory .. "/guides/setup.markdown", "# Setup")
+    write(directory .. "/notes.txt", "not markdown")
+
+    assert.equal(2, markdown.warm(directory))
+    local entries = markdown.cache.bytes
+    assert.is_true(entries > 0)
+
+    -- Later calls with the same paths are hits.
+    local result = markdown.parse_file(directory .. "/guides/setup.markdown")
+    assert.equal("<h1>Setup</h1>", result.html)
+    assert.equal(entries, markdown.cache.bytes)
+
+    os.execute("rm -rf " .. directory)
+    markdown.cache:clear()
+end
+
+function tests.test_warm_reports_bad_files()
+    local directory = temp_directory()
+    write(directory .. "/broken.md", "---\ntitle: x\n")
+
+    local count, err = markdown.warm(directory)
+    assert.is_nil(count)
+    assert.match("broken%.md: missing closing", err)
+
+    count, err = markdown.warm(directory .. "/missing")
+    assert.is_nil(count)
+    assert.is_not_nil(err)
+
+    os.execute("rm -rf " .. directory)
+end
+
+return tests
@@ -87,5 +87,28 @@ function tests.test_files_from_nonexistent_dir()
     )
 end
 
+function tests.test_modified()
+    local temp_file = "/tmp/nibiru_test_modified_"
+        .. tostring(os.time())
+        .. "_"
+        .. tostring(math.random(10000))
+    local f = assert(io.open(temp_file, "w"))
+    f:write("test content")
+    f:close()
+
+    local mtime, size = path.modified(temp_file)
+    assert(type(mtime) == "number", "Should return the modification time")
+    assert(math.abs(mtime - os.time()) < 60, "Modification time should be recent")
+    assert(size == 12, "Should return the size in bytes")
+
+    os.remove(temp_file)
+end
+
+function tests.test_modified_nonexistent_file()
+    local mtime, err = path.modified("/tmp/nonexistent_file_12345")
+    assert(mtime == nil, "Should return nil for a missing file")
+    assert(type(err) == "string", "Should give an error message")
+end
+
 return tests
 
@@ -0,0 +1,134 @@
+local assert = require("luassert")
+local Route = require("nibiru.route")
+local Router = require("nibiru.router")
+
+local tests = {}
+
+local function responder() end
+
+-- A route splits its path into segments for the router.
+function tests.test_route_segments()
+    local route = Route("/users/{id:integer}/file-{name:string}.txt/", responder)
+
+    assert.same({
+        { kind = "static", text = "users" },
+        { kind = "parameter", converter = "integer" },
+        {
+            kind = "pattern",
+            text = "file-{name:string}.txt",
+            pattern = "^file%-([^/]+)%.txt$",
+            converters = { "string" },
+        },
+        { kind = "static", text = "" },
+    }, route.segments)
+    assert.same({ { kind = "static", text = "" } }, Route("/", responder).segments)
+end
+
+-- Static paths match exactly.
+local function test_static(native)
+    local root = Route("/", responder)
+    local users = Route("/users", responder)
+    local router = Router({ root, users }, native)
+
+    local match, route = router:match("GET", "/")
+    assert.equal(Route.MATCH, match)
+    assert.equal(root, route)
+    assert.equal(users, select(2, router:match("GET", "/users")))
+    assert.equal(Route.NO_MATCH, router:match("GET", "/users/"))
+    assert.equal(Route.NO_MATCH, router:match("GET", "/other"))
+    assert.equal(Route.NO_MATCH, router:match("GET", ""))
+end
+
+-- Parameters are captured and converted.
+local function test_parameters(native)
+    local route = Route("/users/{name:string}/posts/{id:integer}", responder)
+    local router = Router({ route }, native)
+
+    local match, actual_route, parameters = router:match("GET", "/users/matt/posts/42")
+
+    assert.equal(Route.MATCH, match)
+    assert.equal(route, actual_route)
+    assert.equal("matt", parameters[1])
+    assert.equal(42, parameters[2])
+    assert.equal(Route.NO_MATCH, router:match("GET", "/users/matt/posts/other"))
+    assert.equal(Route.NO_MATCH, router:match("GET", "/users//posts/42"))
+end
+
+-- A segment mixing text and parameters matches by pattern.
+local function test_mixed_segment(native)
+    local route = Route("/files/{name:string}.{ext:string}", responder)
+    local router = Router({ route }, native)
+
+    local match, _, parameters = router:match("GET", "/files/notes.tar.gz")
+
+    assert.equal(Route.MATCH, match)
+    assert.equal("notes.tar", parameters[1])
+    assert.equal("gz", parameters[2])
+    assert.equal(Route.NO_MATCH, router:match("GET", "/files/notes"))
+end
+
+-- Static segments win over parameters, and integers over strings.
+local function test_priority(native)
+    local by_name = Route("/users/{name:string}", responder)
+    local by_id = Route("/users/{id:integer}", responder)
+    local new = Route("/users/new", responder)
+    local router = Router({ by_name, by_id, new }, native)
+
+    assert.equal(new, select(2, router:match("GET", "/users/new")))
+    assert.equal(by_id, select(2, router:match("GET", "/users/42")))
+    assert.equal(by_name, select(2, router:match("GET", "/users/matt")))
+end
+
+-- A branch that can't finish the path falls back to the next one.
+local function test_backtracking(native)
+    local static = Route("/users/new", responder)
+    local edit = Route("/users/{name:string}/edit", responder)
+    local router = Router({ static, edit }, native)
+
+    local match, route, parameters = router:match("GET", "/users/new/edit")
+
+    assert.equal(Route.MATCH, match)
+    assert.equal(edit, route)
+    assert.equal("new", parameters[1])
+end
+
+-- Routes on one path can each handle different methods.
+local function test_methods(native)
+    local show = Route("/users/{id:integer}", responder)
+    local update = Route("/users/{id:integer}", responder, nil, { "PUT" })
+    local router = Router({ show, update }, native)
+
+    assert.equal(show, select(2, router:match("GET", "/users/1")))
+    assert.equal(update, select(2, router:match("PUT", "/users/1")))
+    assert.same({ Route.NOT_ALLOWED, show }, { router:match("DELETE", "/users/1") })
+end
+
+-- The first route listed keeps a method that routes share.
+local function test_first_route_wins(native)
+    local first = Route("/users", responder)
+    local second = Route("/users", responder, nil, { "GET", "POST" })
+    local router = Router({ first, second }, native)
+
+    assert.equal(first, select(2, router:match("GET", "/users")))
+    assert.equal(second, select(2, router:match("POST", "/users")))
+end
+
+-- Every matcher test runs against both the Lua walk and the C automaton.
+for name, test in pairs({
+    static = test_static,
+    parameters = test_parameters,
+    mixed_segment = test_mixed_segment,
+    priority = test_priority,
+    backtracking = test_backtracking,
+    methods = test_methods,
+    first_route_wins = test_first_route_wins,
+}) do
+    tests["test_lua_" .. name] = function()
+        test(false)
+    end
+    tests["test_native_" .. name] = function()
+        test(true)
+    end
+end
+
+return tests
@@ -331,6 +331,75 @@ function tests.test_render_empty_context()
     assert.equal("text/html", response.content_type)
 end
 
+-- Stream: The body renders in chunks as it is iterated
+function tests.test_stream_chunks()
+    Template.clear_templates()
+    Template.clear_components()
+    Template.component("Item", "<li>{{ label }}</li>")
+    Template.register("base.html", "<ul>{% block items %}{% endblock %}</ul>")
+    Template.register(
+        "list.html",
+        '{% extends "base.html" %}{% block items %}'
+            .. "{% for item in items %}<Item label=item />{% endfor %}"
+            .. "{% endblock %}"
+    )
+    local items = {}
+    for i = 1, 5000 do
+        items[i] = i
+    end
+
+    local response = Template.stream("list.html", { items = items }, "text/plain", 201)
+    local chunks = {}
+    for index, chunk in response.stream do
+        assert.equal(#chunks + 1, index)
+        table.insert(chunks, chunk)
+    end
+
+    assert.equal(201, response.status_code)
+    assert.equal("text/plain", response.content_type)
+    assert.equal("", response.content)
+    assert.is_true(#chunks > 1)
+    local expected = Template.render("list.html", { items = items }).content
+    assert.equal(expected, table.concat(chunks))
+    Template.clear_components()
+end
+
+-- Stream: Output is flushed by bytes, so large pieces don't pile up
+function tests.test_stream_flushes_by_bytes()
+    Template.clear_templates()
+    Template.register("posts.html", "{% for post in posts %}{{ post |> safe }}{% endfor %}")
+    local post = string.rep("p", 6000)
+    local posts = {}
+    for i = 1, 20 do
+        posts[i] = post
+    end
+
+    local chunks = {}
+    for _, chunk in Template.stream("posts.html", { posts = posts }).stream do
+        table.insert(chunks, chunk)
+    end
+
+    -- Each chunk is flushed once it reaches 16 KiB, after three posts.
+    assert.equal(7, #chunks)
+    for i = 1, 6 do
+        assert.equal(3 * #post, #chunks[i])
+    end
+    assert.equal(2 * #post, #chunks[7])
+end
+
+-- Stream: A small template is a single chunk
+function tests.test_stream_single_chunk()
+    Template.clear_templates()
+    Template.register("test.html", "Hello {{name}}!")
+
+    local chunks = {}
+    for _, chunk in Template.stream("test.html", { name = "World" }).stream do
+        table.insert(chunks, chunk)
+    end
+
+    assert.same({ "Hello World!" }, chunks)
+end
+
 -- Render: Error when template not found
 function tests.test_render_template_not_found()
     Template.clear_templates()
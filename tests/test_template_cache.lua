@@ -0,0 +1,151 @@
+local assert = require("luassert")
+local core = require("nibiru_core")
+local Template = require("nibiru.template")
+
+local tests = {}
+
+--- Make an empty cache directory for one test.
+local function make_cache_directory()
+    local directory = os.tmpname()
+    os.remove(directory)
+    assert(core.make_directory(directory))
+    return directory
+end
+
+--- Remove a cache directory and its entries.
+local function remove_cache_directory(directory)
+    for _, name in ipairs(core.files_from(directory) or {}) do
+        os.remove(directory .. "/" .. name)
+    end
+    os.remove(directory)
+end
+
+--- Register templates with the cache on, starting from empty registries.
+local function register(directory, templates)
+    Template.clear_templates()
+    Template.clear_components()
+    Template.set_cache_directory(directory)
+    Template.cache_stats.hits = 0
+    Template.cache_stats.misses = 0
+    for _, template in ipairs(templates) do
+        Template.register(template[1], template[2])
+    end
+    Template.set_cache_directory(nil)
+end
+
+-- hash is stable and depends on the content.
+function tests.test_hash()
+    assert.equal("cbf29ce484222325", core.hash(""))
+    assert.equal(core.hash("abc"), core.hash("abc"))
+    assert.are_not.equal(core.hash("abc"), core.hash("abd"))
+end
+
+-- A second start loads the compiled template from the cache.
+function tests.test_cache_hit()
+    local directory = make_cache_directory()
+    local templates = { { "page.html", "Hello {{ name }}!" } }
+
+    register(directory, templates)
+    assert.equal(1, Template.cache_stats.misses)
+    assert.equal(1, #core.files_from(directory))
+
+    register(directory, templates)
+    assert.equal(1, Template.cache_stats.hits)
+    assert.equal(0, Template.cache_stats.misses)
+    local response = Template.render("page.html", { name = "World" })
+    assert.equal("Hello World!", response.content)
+
+    Template.clear_templates()
+    remove_cache_directory(directory)
+end
+
+-- Changing a parent template invalidates the children compiled from it.
+function tests.test_cache_tracks_inheritance()
+    local directory = make_cache_directory()
+    local child = '{% extends "base.html" %}{% block body %}child{% endblock %}'
+
+    register(directory, {
+        { "base.html", "<main>{% block body %}{% endblock %}</main>" },
+        { "child.html", child },
+    })
+    register(directory, {
+        { "base.html", "<div>{% block body %}{% endblock %}</div>" },
+        { "child.html", child },
+    })
+
+    assert.equal(0, Template.cache_stats.hits)
+    assert.equal("<div>child</div>", Template.render("child.html").content)
+
+    Template.clear_templates()
+    remove_cache_directory(directory)
+end
+
+-- Changing a component invalidates the templates that use it.
+function tests.test_cache_tracks_components()
+    local directory = make_cache_directory()
+    local page = { "page.html", "<Badge />" }
+
+    Template.clear_components()
+    Template.component("Badge", "<b>old</b>")
+    Template.set_cache_directory(directory)
+    Template.register(page[1], page[2])
+    Template.clear_templates()
+    Template.clear_components()
+    Template.component("Badge", "<b>new</b>")
+    Template.register(page[1], page[2])
+    Template.set_cache_directory(nil)
+
+    assert.equal("<b>new</b>", Template.render("page.html").content)
+
+    Template.clear_templates()
+    Template.clear_components()
+    remove_cache_directory(directory)
+end
+
+-- A corrupt entry is compiled again rather than loaded.
+function tests.test_corrupt_entry()
+    local directory = make_cache_directory()
+    local templates = { { "page.html", "Hi" } }
+
+    register(directory, templates)
+    local entry = directory .. "/" .. core.files_from(directory)[1]
+    local file = assert(io.open(entry, "wb"))
+    file:write("garbage")
+    file:close()
+    register(directory, templates)
+
+    assert.equal(1, Template.cache_stats.misses)
+    assert.equal("Hi", Template.render("page.html").content)
+
+    Template.clear_templates()
+    remove_cache_directory(directory)
+end
+
+-- Entries compiled with another tokenizer or core build are not shared.
+function tests.test_cache_keyed_by_compiler()
+    local directory = make_cache_directory()
+    local Tokenizer = require("nibiru.tokenizer")
+
+    --- Compile a template with a fresh copy of the module, whose compiler
+    --- hash is taken with the given tokenizer and core build.
+    local function compile_with(native, build)
+        local saved_native, saved_build = Tokenizer.native, core.build
+        Tokenizer.native, core.build = native, build
+        local fresh = dofile("lua/nibiru/template.lua")
+        fresh.set_cache_directory(directory)
+        fresh.register("page.html", "Hi {{ name }}")
+        fresh.set_cache_directory(nil)
+        Tokenizer.native, core.build = saved_native, saved_build
+        return fresh.cache_stats.misses
+    end
+
+    assert.equal(1, compile_with(Tokenizer.native, core.build))
+    assert.equal(0, compile_with(Tokenizer.native, core.build))
+    assert.equal(1, compile_with(not Tokenizer.native, core.build))
+    assert.equal(1, compile_with(Tokenizer.native, core.build .. " other"))
+    assert.equal(3, #core.files_from(directory))
+
+    remove_cache_directory(directory)
+end
+
+return tests
@@ -317,4 +317,24 @@ function tests.test_for_endfor_non_iterable()
     assert.is_true(success)
 end
 
+function tests.test_for_endfor_loop_variables_are_locals()
+    local template = Template(
+        "{% for item in items %}{{ item }}{% if item == 2 %}!{% endif %}{% endfor %}"
+    )
+    assert.equal("12!3", template({ items = { 1, 2, 3 } }))
+    -- Expressions read loop variables directly rather than through closures
+    assert.is_nil(string.find(template.code, "function(c)", 1, true))
+    assert.is_nil(string.find(template.code, "setmetatable({", 1, true))
+end
+
+function tests.test_for_endfor_function_sees_loop_context()
+    Template.register_function("describe", function(context, suffix)
+        return context.item .. "/" .. context.title .. suffix
+    end)
+    local template = Template("{% for item in items %}{{ describe(\"!\") }} {% endfor %}")
+    local result = template({ items = { "a", "b" }, title = "t" })
+    Template.clear_functions()
+    assert.equal("a/t! b/t! ", result)
+end
+
 return tests
@@ -0,0 +1,165 @@
+local assert = require("luassert")
+local Template = require("nibiru.template")
+
+local tests = {}
+
+-- Fragment caching: {% cache %} tags
+
+--- Count the calls of a template function, so tests can tell whether a
+--- fragment was rendered again.
+local function counting_function(name)
+    local counter = { calls = 0 }
+    Template.register_function(name, function()
+        counter.calls = counter.calls + 1
+        return counter.calls
+    end)
+    return counter
+end
+
+-- A cached fragment renders once and is reused
+function tests.test_cache_reuses_output()
+    Template.clear_functions()
+    Template.fragments:clear()
+    local counter = counting_function("nav_count")
+    local template = Template(
+        '<header>{% cache "nav" %}<nav>{{ nav_count() }}</nav>{% endcache %}</header>'
+    )
+
+    assert.equal("<header><nav>1</nav></header>", template({}))
+    assert.equal("<header><nav>1</nav></header>", template({}))
+    assert.equal(1, counter.calls)
+end
+
+-- The listed values key the fragment, other values don't
+function tests.test_cache_keyed_by_values()
+    Template.clear_functions()
+    Template.fragments:clear()
+    local template = Template(
+        '{% cache "greeting" user.name, lang %}'
+            .. "{{ lang }}: {{ user.name }} {{ page }}{% endcache %}"
+    )
+    local ada = { name = "Ada" }
+
+    assert.equal("en: Ada 1", template({ user = ada, lang = "en", page = 1 }))
+    assert.equal("en: Ada 1", template({ user = ada, lang = "en", page = 2 }))
+    assert.equal("fr: Ada 3", template({ user = ada, lang = "fr", page = 3 }))
+    local bob = { name = "Bob" }
+    assert.equal("en: Bob 4", template({ user = bob, lang = "en", page = 4 }))
+end
+
+-- A fragment with a time to live renders again once it expires
+function tests.test_cache_ttl()
+    Template.clear_functions()
+    Template.fragments:clear()
+    local clock = Template.fragments.clock
+    local now = 1000
+    Template.fragments.clock = function()
+        return now
+    end
+    local counter = counting_function("footer_count")
+    local template =
+        Template('{% cache "footer" 60 %}{{ footer_count() }}{% endcache %}')
+
+    local ok, err = pcall(function()
+        assert.equal("1", template({}))
+        now = 1059
+        assert.equal("1", template({}))
+        now = 1060
+        assert.equal("2", template({}))
+    end)
+    Template.fragments.clock = clock
+    assert(ok, err)
+end
+
+-- Fragments inside a loop can be keyed by the loop variable, and the text
+-- around them isn't part of the fragment
+function tests.test_cache_in_loop()
+    Template.clear_functions()
+    Template.fragments:clear()
+    local template = Template(
+        '{% for item in items %}[{% cache "item" item.id %}'
+            .. "{{ item.name }}{% endcache %}]{% endfor %}"
+    )
+
+    assert.equal(
+        "[a][b]",
+        template({ items = { { id = 1, name = "a" }, { id = 2, name = "b" } } })
+    )
+    assert.equal(
+        "[a][b][c]",
+        template({
+            items = {
+                { id = 1, name = "changed" },
+                { id = 2, name = "changed" },
+                { id = 3, name = "c" },
+            },
+        })
+    )
+end
+
+-- Fragments wrap components and stay whole when the render streams
+function tests.test_cache_with_component_and_stream()
+    Template.clear_components()
+    Template.clear_functions()
+    Template.fragments:clear()
+    Template.component("Link", '<a href="{{ href }}">{{ href }}</a>')
+    local template = Template(
+        '{% cache "links" %}{% for href in links %}<Link href=href/>{% endfor %}'
+            .. "{% endcache %}<p>end</p>"
+    )
+    local links = {}
+    for i = 1, 1000 do
+        links[i] = "/" .. i
+    end
+    local expected = template({ links = links })
+
+    local chunks = {}
+    for _, chunk in template:chunks({ links = {} }) do
+        table.insert(chunks, chunk)
+    end
+    assert.equal(expected, table.concat(chunks))
+
+    Template.fragments:clear()
+    chunks = {}
+    for _, chunk in template:chunks({ links = links }) do
+        table.insert(chunks, chunk)
+    end
+    assert.equal(expected, table.concat(chunks))
+    assert.equal(expected, template({ links = {} }))
+end
+
+-- Replacing templates drops fragments rendered by the old ones
+function tests.test_replace_clears_fragments()
+    Template.clear_functions()
+    Template.clear_templates()
+    Template.register("fragment_page.html", '{% cache "body" %}old{% endcache %}')
+    assert.equal("old", Template.render("fragment_page.html").content)
+
+    Template.replace({ "fragment_page.html" }, {
+        ["fragment_page.html"] = '{% cache "body" %}new{% endcache %}',
+    })
+
+    assert.equal("new", Template.render("fragment_page.html").content)
+end
+
+-- Malformed cache tags fail to compile
+function tests.test_cache_errors()
+    local cases = {
+        { "{% cache %}x{% endcache %}", "Expected quoted fragment name" },
+        { "{% cache nav %}x{% endcache %}", "Expected quoted fragment name" },
+        { '{% cache "nav" a, %}x{% endcache %}', "Empty value in cache statement" },
+        { '{% cache "nav" %}x', "Unclosed cache statement" },
+        { "x{% endcache %}", "Unexpected endcache without matching cache" },
+        {
+            '{% for i in items %}{% cache "nav" %}{% endfor %}{% endcache %}',
+            "Unexpected endfor without matching for",
+        },
+    }
+    for _, case in ipairs(cases) do
+        local ok, err = pcall(Template, case[1])
+        assert.is_false(ok, case[1])
+        assert.match(case[2], err)
+    end
+end
+
+return tests
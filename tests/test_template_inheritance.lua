@@ -154,7 +154,7 @@ function tests.test_nested_block_content()
 
 {% block content %}
 <div class="content">
-    {{ article.body }}
+    {{ article.body |> safe }}
     {% if article.tags %}
     <div class="tags">
         {% for tag in article.tags %}
@@ -465,4 +465,100 @@ function tests.test_inheritance_merging_bug()
     assert(result == expected, "Template inheritance merging should work without BLOCK_START tokens")
 end
 
+-- A cycle further up the chain is reported instead of looping
+function tests.test_circular_inheritance_chain()
+    Template.replace({}, {
+        ["cycle_a.html"] = '{% extends "cycle_b.html" %}'
+            .. "{% block content %}A{% endblock %}",
+        ["cycle_b.html"] = '{% extends "cycle_a.html" %}'
+            .. "{% block content %}B{% endblock %}",
+    })
+
+    local success, err = pcall(Template, '{% extends "cycle_a.html" %}')
+
+    assert.is_false(success)
+    assert.match("Circular template inheritance detected involving 'cycle_a.html'", err)
+end
+
+-- Each level overrides the blocks of the levels above it
+function tests.test_deep_inheritance_chain()
+    Template.register(
+        "deep_0.html",
+        "<{% block title %}root{% endblock %}|{% block body %}body{% endblock %}>"
+    )
+    for level = 1, 50 do
+        Template.register(
+            "deep_" .. level .. ".html",
+            '{% extends "deep_'
+                .. (level - 1)
+                .. '.html" %}{% block body %}'
+                .. level
+                .. "{% block inner %}{% endblock %}{% endblock %}"
+        )
+    end
+
+    local template = Template(
+        '{% extends "deep_50.html" %}{% block inner %}-{{ name }}{% endblock %}'
+    )
+
+    assert.equal("<root|50-leaf>", template({ name = "leaf" }))
+    assert.equal("<root|50>", Template.render("deep_50.html").content)
+end
+
+--- Get the module's parsed templates, keyed by name.
+local function parsed_templates()
+    local index = 1
+    while true do
+        local name, value = debug.getupvalue(Template.clear_templates, index)
+        if name == "parsed_templates" or not name then
+            return value
+        end
+        index = index + 1
+    end
+end
+
+-- Compiling another child reuses the merged blocks of its ancestors
+function tests.test_merged_blocks_are_reused()
+    Template.clear_templates()
+    Template.register(
+        "reuse_base.html",
+        "<{% block a %}{% endblock %}{% block b %}{% endblock %}>"
+    )
+    Template.register(
+        "reuse_mid.html",
+        '{% extends "reuse_base.html" %}{% block a %}mid{% endblock %}'
+    )
+    Template.register(
+        "reuse_one.html",
+        '{% extends "reuse_mid.html" %}{% block b %}1{% endblock %}'
+    )
+    local parsed = parsed_templates()
+    local base_merged = parsed["reuse_base.html"].merged
+    local mid_merged = parsed["reuse_mid.html"].merged
+    assert.is_not_nil(base_merged)
+    assert.is_not_nil(mid_merged)
+
+    Template.register(
+        "reuse_two.html",
+        '{% extends "reuse_mid.html" %}{% block b %}2{% endblock %}'
+    )
+
+    assert.equal(base_merged, parsed["reuse_base.html"].merged)
+    assert.equal(mid_merged, parsed["reuse_mid.html"].merged)
+    assert.equal("<mid2>", Template.render("reuse_two.html").content)
+end
+
+-- A replaced parent is parsed again for the children compiled after it
+function tests.test_replaced_parent()
+    Template.register("replaced_base.html", "<old>{% block content %}{% endblock %}")
+    local child = '{% extends "replaced_base.html" %}{% block content %}x{% endblock %}'
+    assert.equal("<old>x", Template(child)({}))
+
+    Template.replace({}, {
+        ["replaced_base.html"] = "<new>{% block content %}{% endblock %}",
+    })
+
+    assert.equal("<new>x", Template(child)({}))
+end
+
 return tests
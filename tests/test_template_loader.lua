@@ -1,3 +1,4 @@
+local assert = require("luassert")
 local TemplateLoader = require("nibiru.loader")
 local Template = require("nibiru.template")
 
@@ -526,5 +527,104 @@ function tests.test_dependency_analysis_self_reference()
     assert(err:match("Circular dependency detected"), "Should mention circular dependency in error")
 end
 
+--- Write a file in a test directory.
+local function write_file(file_path, content)
+    local file = assert(io.open(file_path, "w"))
+    file:write(content)
+    file:close()
+end
+
+-- Reloading recompiles a changed layout and only the templates below it.
+function tests.test_reload_recompiles_dependents()
+    Template.clear_templates()
+    local temp_dir = "/tmp/nibiru_test_reload_"
+        .. tostring(os.time())
+        .. "_"
+        .. tostring(math.random(10000))
+    os.execute("mkdir -p " .. temp_dir)
+    write_file(temp_dir .. "/base.html", "<main>{% block body %}{% endblock %}</main>")
+    write_file(
+        temp_dir .. "/page.html",
+        '{% extends "base.html" %}{% block body %}Page{% endblock %}'
+    )
+    write_file(
+        temp_dir .. "/deep.html",
+        '{% extends "page.html" %}{% block body %}Deep{% endblock %}'
+    )
+    write_file(temp_dir .. "/other.html", "Other")
+    TemplateLoader.from_directory(temp_dir)
+
+    write_file(temp_dir .. "/base.html", "<body>{% block body %}{% endblock %}</body>")
+    local names = TemplateLoader.reload({ "base.html", "other.html" })
+
+    assert.same({ "base.html", "page.html", "deep.html" }, names)
+    assert.equal("<body>Page</body>", Template.render("page.html").content)
+    assert.equal("<body>Deep</body>", Template.render("deep.html").content)
+    assert.equal("Other", Template.render("other.html").content)
+
+    -- A template can move to another parent
+    write_file(temp_dir .. "/deep.html", '{% extends "other.html" %}')
+    assert.same({ "deep.html" }, TemplateLoader.reload({ "deep.html" }))
+    write_file(temp_dir .. "/base.html", "<div>{% block body %}{% endblock %}</div>")
+    assert.same({ "base.html", "page.html" }, TemplateLoader.reload({ "base.html" }))
+
+    os.execute("rm -rf " .. temp_dir)
+end
+
+-- A broken edit leaves every template rendering its previous version.
+function tests.test_reload_failure_keeps_templates()
+    Template.clear_templates()
+    local temp_dir = "/tmp/nibiru_test_reload_error_"
+        .. tostring(os.time())
+        .. "_"
+        .. tostring(math.random(10000))
+    os.execute("mkdir -p " .. temp_dir)
+    write_file(temp_dir .. "/base.html", "<main>{% block body %}{% endblock %}</main>")
+    write_file(
+        temp_dir .. "/page.html",
+        '{% extends "base.html" %}{% block body %}Page{% endblock %}'
+    )
+    TemplateLoader.from_directory(temp_dir)
+
+    write_file(temp_dir .. "/base.html", "<main>{% block body %}{% endblock %}{% if %}</main>")
+    local success = pcall(TemplateLoader.reload, { "base.html" })
+    assert.is_false(success)
+    assert.equal("<main>Page</main>", Template.render("page.html").content)
+
+    write_file(temp_dir .. "/base.html", '{% extends "page.html" %}')
+    success = pcall(TemplateLoader.reload, { "base.html" })
+    assert.is_false(success)
+    assert.equal("<main>Page</main>", Template.render("page.html").content)
+
+    os.execute("rm -rf " .. temp_dir)
+end
+
+-- The watcher reports files written in the directory and new subdirectories.
+function tests.test_watch_reports_written_files()
+    Template.clear_templates()
+    local temp_dir = "/tmp/nibiru_test_watch_"
+        .. tostring(os.time())
+        .. "_"
+        .. tostring(math.random(10000))
+    os.execute("mkdir -p " .. temp_dir .. "/pages")
+    write_file(temp_dir .. "/index.html", "Index")
+    TemplateLoader.from_directory(temp_dir)
+    local watcher = TemplateLoader.watch()
+
+    assert.is_nil((watcher:changes()))
+    write_file(temp_dir .. "/index.html", "New index")
+    write_file(temp_dir .. "/pages/about.html", "About")
+    write_file(temp_dir .. "/index.html", "Newer index")
+    os.execute("mkdir -p " .. temp_dir .. "/more")
+    local changed = watcher:changes()
+    write_file(temp_dir .. "/more/extra.html", "Extra")
+    local more = watcher:changes()
+    watcher:close()
+
+    assert.same({ "index.html", "pages/about.html" }, changed)
+    assert.same({ "more/extra.html" }, more)
+    os.execute("rm -rf " .. temp_dir)
+end
+
 return tests
 
@@ -245,4 +245,47 @@ function tests.test_attribute_validation()
     assert.equal(tokens[3].malformed.text, "malformed attribute: contains invalid character")
 end
 
+--- Tokenize with one implementation, returning the tokens or the error
+--- message without its location.
+local function tokenize_with(template, native)
+    local ok, result = pcall(Tokenizer.tokenize, template, native)
+    if not ok then
+        return ok, (tostring(result):gsub("^[^:]*:%d+: ", ""))
+    end
+    return ok, result
+end
+
+-- The C tokenizer returns the same tokens and errors as the Lua one
+function tests.test_native_matches_lua()
+    local templates = {
+        "",
+        "plain <p>text</p> with < and { alone {",
+        '{{ user.name |> upper }} {{ 1.5 }} {{ 1.2.3 }} {{ a >= b != c }}',
+        '{{ "esc \\" q" }} {{ \'single\' }} {{ f(a, b).c }}',
+        '{% for k, v in pairs(items) %}{{ k }}{% endfor %}',
+        '{% if a.b == "x" and not c ~= 2 %}..{% endif %}',
+        '{% extends "base.html" %}{% block content %}{% endblock %}',
+        '{% cache "nav" 60 user.id, f(a, b) %}{% endcache %}{% cached %}',
+        "{% if x .. 'y' <= 10 %}{% endif %}",
+        '<Card title="A / B" body=text/><Card>{{ x }}</Card>',
+        '<Button text=Save"> <Button  a = "1"  b=\'2\'  c=d e=f{g} />',
+        "<Item/></Item>{{{ x }}}{%% if %}",
+        "{{ unclosed",
+        "{% unclosed",
+        "<Unclosed",
+        "</Unclosed",
+        '{{ "unclosed }}',
+        "{{ a | b }}",
+        "{{ _private }}",
+        "{% a ~ b %}",
+        "{% a ! b %}",
+    }
+    for _, template in ipairs(templates) do
+        local lua_ok, lua_result = tokenize_with(template, false)
+        local native_ok, native_result = tokenize_with(template, true)
+        assert.equal(lua_ok, native_ok, template)
+        assert.same(lua_result, native_result, template)
+    end
+end
+
 return tests
\ No newline at end of file